@@ -0,0 +1,200 @@
+/**
+ * @brief xstring 微基准
+ * @file xstring_bench.c
+ * @author Oswin
+ * @date 2026-02-08
+ * @details Times the xstring scans against the byte-at-a-time code they
+ *          replaced (strpbrk, strstr, isspace/toupper loops, per-call KMP
+ *          tables), on strings of a few lengths. "charset-view" is the
+ *          length-bounded scan xstr_view uses, which strpbrk() can not do.
+ *
+ *          cmake -B build -DXSTRING_BUILD_BENCH=ON && cmake --build build
+ *          ./build/xstring_bench [iterations]
+ *
+ * @copyright (c) 2026 Intretech Software Development Department. All Rights Reserved.
+ */
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "xstring.h"
+#include "xstring_simd.h"
+
+static volatile size_t g_sink;
+
+/* hides the input from the optimizer, so pure calls are not hoisted out of the loop */
+static inline char* opaque(char* p) {
+  __asm__ volatile("" : "+r"(p) : : "memory");
+  return p;
+}
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the replaced implementations */
+
+static size_t old_find_charset(const char* s) {
+  const char* p = strpbrk(s, ",;|");
+  return p ? (size_t)(p - s) : 0;
+}
+
+static size_t old_find_substr(const char* s) {
+  const char* p = strstr(s, "needle/");
+  return p ? (size_t)(p - s) : 0;
+}
+
+static size_t old_trim(char* s, size_t len) {
+  const char* start = s;
+  while (*start && isspace((unsigned char)*start)) start++;
+  const char* end = s + len - 1;
+  while (end > start && isspace((unsigned char)*end)) end--;
+  return (size_t)(end - start + 1);
+}
+
+static size_t old_upper(char* s) {
+  char* q = s;
+  while (*q) *q = toupper((unsigned char)*q), q++;
+  return (size_t)(q - s);
+}
+
+static size_t old_kmp_count(const char* s, size_t n, const char* pat) {
+  int m = (int)strlen(pat);
+  int* lps = malloc(sizeof(int) * m);
+  int* matches = malloc(sizeof(int) * n);
+  int len = 0, i = 1;
+  lps[0] = 0;
+  while (i < m) {
+    if (pat[i] == pat[len])
+      lps[i++] = ++len;
+    else if (len)
+      len = lps[len - 1];
+    else
+      lps[i++] = 0;
+  }
+
+  int j = 0, count = 0;
+  i = 0;
+  while (i < (int)n) {
+    if (pat[j] == s[i]) i++, j++;
+    if (j == m) {
+      matches[count++] = i - j;
+      j = lps[j - 1];
+    } else if (i < (int)n && pat[j] != s[i]) {
+      if (j)
+        j = lps[j - 1];
+      else
+        i++;
+    }
+  }
+
+  free(lps);
+  free(matches);
+  return (size_t)count;
+}
+
+/* the new ones */
+
+static size_t new_find_charset(const char* s, size_t len) {
+  const char* p = xstr_find_charset_z(s, len, ",;|");
+  return p ? (size_t)(p - s) : 0;
+}
+
+/* views are not terminated, strpbrk() could not be used on them */
+static size_t new_find_charset_view(const char* s, size_t len) {
+  const char* p = xstr_find_charset(s, len, ",;|", xFALSE);
+  return p ? (size_t)(p - s) : 0;
+}
+
+static size_t new_find_substr(const char* s, size_t len) {
+  const char* p = xstr_find_substr(s, len, "needle/", 7);
+  return p ? (size_t)(p - s) : 0;
+}
+
+static size_t new_trim(char* s, size_t len) {
+  const char* start = xstr_skip_charset(s, len, XSTR_SPACES);
+  return (size_t)(xstr_rskip_charset(start, len - (start - s), XSTR_SPACES) - start);
+}
+
+static size_t new_upper(char* s, size_t len) {
+  xstr_upper(s, len);
+  return len;
+}
+
+static size_t new_count(const char* s, size_t len, const char* pat) {
+  size_t count = 0, m = strlen(pat);
+  for (const char* p = s; (p = xstr_find_substr(p, s + len - p, pat, m)); p += m) count++;
+  return count;
+}
+
+/* a path-like string, the interesting byte at the very end */
+static char* make_input(size_t len, char tail) {
+  char* s = malloc(len + 1);
+  for (size_t i = 0; i < len; ++i) s[i] = "usr/lib/firmware/module-"[i % 24];
+  s[len - 1] = tail;
+  s[len] = '\0';
+  return s;
+}
+
+/* best of a few rounds, the board is rarely idle */
+#define ROUNDS 5
+#define TIME_LOOP(best, iters, expr)                                       \
+  do {                                                                     \
+    best = 1e9;                                                            \
+    for (int r = 0; r < ROUNDS; ++r) {                                     \
+      double t0 = now_sec();                                               \
+      for (int it = 0; it < (iters); ++it) s = opaque(s), g_sink += (expr); \
+      double t = now_sec() - t0;                                           \
+      if (t < best) best = t;                                              \
+    }                                                                      \
+  } while (0)
+
+#define BENCH(name, len, iters, old_expr, new_expr)                        \
+  do {                                                                     \
+    double t_old, t_new;                                                   \
+    TIME_LOOP(t_old, iters, old_expr);                                     \
+    TIME_LOOP(t_new, iters, new_expr);                                     \
+    double mb = (double)(len) * (iters) / (1024.0 * 1024.0);               \
+    printf("%-14s %8zu %10.1f %10.1f %8.2fx\n", name, (size_t)(len),      \
+           mb / t_old, mb / t_new, t_old / t_new);                         \
+  } while (0)
+
+int main(int argc, char** argv) {
+  long budget = argc > 1 ? atol(argv[1]) : 200000;
+  const size_t lens[] = {64, 1024, 16384, 262144};
+
+  printf("xstring scans, %s implementation\n", xstr_simd_name());
+  printf("%-14s %8s %10s %10s %9s\n", "op", "bytes", "old MB/s", "new MB/s", "speedup");
+
+  for (size_t k = 0; k < sizeof(lens) / sizeof(lens[0]); ++k) {
+    size_t len = lens[k];
+    int iters = (int)(budget * 64 / len) + 1;
+
+    char* s = make_input(len, ';');
+    BENCH("charset", len, iters, old_find_charset(s), new_find_charset(s, len));
+    BENCH("charset-view", len, iters, old_find_charset(s), new_find_charset_view(s, len));
+    free(s);
+
+    s = make_input(len, '/');
+    memcpy(s + len - 7, "needle/", 7);
+    BENCH("substr", len, iters, old_find_substr(s), new_find_substr(s, len));
+    BENCH("replace-scan", len, iters, old_kmp_count(s, len, "needle/"), new_count(s, len, "needle/"));
+    free(s);
+
+    s = make_input(len, ' ');
+    memset(s, ' ', len / 4);
+    memset(s + len - len / 4, '\t', len / 4);
+    BENCH("trim", len, iters, old_trim(s, len), new_trim(s, len));
+    free(s);
+
+    s = make_input(len, 'x');
+    BENCH("upper", len, iters, old_upper(s), new_upper(s, len));
+    free(s);
+  }
+
+  return 0;
+}
@@ -3,8 +3,17 @@
 #include "os_file.h"
 #include "xlog.h"
 #include "exec.h"
+#include "kexec.h"
+#include "ubootenv.h"
+#include "events.h"
+#include <errno.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#ifndef __APPLE__
+#include <mntent.h>
+#include <sys/mount.h>
+#endif /* __APPLE__ */
 
 typedef struct {
     xoption this_option;
@@ -13,6 +22,10 @@ typedef struct {
         xbool_t force;
         xbool_t need_reboot;
         int reboot_delay_second;
+        int script_timeout_second;
+        xbool_t kexec;
+        char *kexec_record;
+        int events_fd;
     } flags;
 } checkout_context_t;
 
@@ -23,6 +36,10 @@ static checkout_context_t g_checkout_ctx = {
         .force = xFALSE,
         .need_reboot = xFALSE,
         .reboot_delay_second = 3,
+        .script_timeout_second = 0,
+        .kexec = xFALSE,
+        .kexec_record = NULL,
+        .events_fd = -1,
     },
 };
 
@@ -41,6 +58,9 @@ err_t checkout_usage_init(xoption root) {
     xoption_add_string(checkout, 'x', "script", "<script.sh>",
                        "Custom shell script to run after the partition switch",
                        &g_checkout_ctx.flags.specified_script, xFALSE);
+    xoption_add_number(checkout, '\0', "script-timeout", "<seconds>",
+                       "Time allowed for the script before it is killed, 0 waits forever",
+                       &g_checkout_ctx.flags.script_timeout_second, xFALSE);
     xoption_add_boolean(checkout, '\0', "reboot",
                         "Automatically restart the system after a successful checkout",
                         &g_checkout_ctx.flags.need_reboot); 
@@ -50,23 +70,52 @@ err_t checkout_usage_init(xoption root) {
     xoption_add_boolean(checkout, 'f', "force",
                         "Force the checkout even if the target partition is already active",
                         &g_checkout_ctx.flags.force);
+    xoption_add_boolean(checkout, '\0', "kexec",
+                        "Reboot into the new partition via kexec, skipping firmware and bootloader (implies --reboot)",
+                        &g_checkout_ctx.flags.kexec);
+    xoption_add_string(checkout, '\0', "kexec-record", "<file>",
+                       "Record the kexec request to a file instead of executing it (implies --kexec)",
+                       &g_checkout_ctx.flags.kexec_record, xFALSE);
+    xoption_add_number(checkout, '\0', "events-fd", "<fd>",
+                       "Write newline-delimited JSON events to this open file descriptor",
+                       &g_checkout_ctx.flags.events_fd, xFALSE);
 
     g_checkout_ctx.this_option = checkout;
 
     return X_RET_OK;
 }
 
-void assert_requirements() {
+static err_t require_command(const char *cmd) {
+    if (exec_find_program(cmd))
+        return X_RET_OK;
+
+    XLOG_E("%s not found in PATH", cmd);
+    return X_RET_NOTSUP;
+}
+
+/* Unlike assert_command() this reports instead of exiting, the daemon must survive it. */
+static err_t check_requirements(checkout_context_t *ctx) {
     XLOG_D("Checking requirements for checkout feature...");
 
-    assert_command("fw_setenv");
-    assert_command("fw_printenv");
-    assert_command("reboot");
+    // The environment tools are only needed without native env access
+    if (!ubootenv_is_native()) {
+        if (require_command("fw_setenv") != X_RET_OK || require_command("fw_printenv") != X_RET_OK)
+            return X_RET_NOTSUP;
+    }
+
+    if (ctx->flags.need_reboot && !ctx->flags.kexec_record)
+        return require_command("reboot");
+
+    return X_RET_OK;
 }
 
-static void run_script_with_check(const char *script) {
+static err_t find_mount_source(const char *mount_point, char *buf, size_t len);
+static err_t mount_partition(const char *part);
+
+/* Starts the script in the background, it runs while we wait to reboot. */
+static exec_proc start_script_with_check(const char *script) {
     if (script == NULL)
-        return;
+        return NULL;
 
     XLOG_I("Running checkout script: %s", script);
 
@@ -74,28 +123,99 @@ static void run_script_with_check(const char *script) {
 
     if (script == NULL || strlen(script) == 0) {
         XLOG_W("No script or empty provided to run.");
-        return;
+        return NULL;
     }
 
     if (!os_file_exist(script)) {
         XLOG_W("The script file does not exist: %s, skipping it.", script);
+        return NULL;
+    }
+
+    char *const argv[] = {"/bin/bash", (char *)script, NULL};
+    exec_proc proc = exec_spawn(argv);
+    if (proc == NULL) {
+        XLOG_W("Failed to start the script: %s", script);
+    }
+
+    return proc;
+}
+
+static void wait_script_with_check(checkout_context_t *ctx, exec_proc script, time_t started,
+                                   events_stage_t stage) {
+    if (script == NULL)
+        return;
+
+    // The timeout counts from the script start, the reboot delay included
+    int timeout = ctx->flags.script_timeout_second;
+    int left_ms = 0;
+    if (timeout > 0) {
+        time_t left = started + timeout - time(NULL);
+        left_ms = left > 0 ? (int)left * 1000 : 1;
+    }
+
+    exec_t r;
+    if (exec_wait(script, left_ms, &r) == X_RET_TIMEOUT) {
+        XLOG_W("The script did not finish within %d seconds, killing it.", timeout);
+        exec_kill(script);
+        events_stage_end("script", stage, X_RET_TIMEOUT);
         return;
     }
 
-    xstring cmd = xstring_init_format("/bin/bash %s", script);
-    exec_t r = exec_command(xstring_to_string(&cmd));
+    XLOG_D("Script output: %s", exec_output(r));
     if (!exec_success(r)) {
-        XLOG_W("The script execution failed. return code: %d", r.code);
+        XLOG_W("The script execution failed. return code: %d, stderr: %s", exec_code(r), exec_error(r));
+    } else {
+        XLOG_I("Script executed: %s", ctx->flags.specified_script);
     }
+    events_stage_end("script", stage, exec_success(r) ? X_RET_OK : X_RET_ERROR);
     exec_free(r);
-    xstring_free(&cmd);
+}
+
+/* Loads the kernel of `part` for a kexec reboot, NULL if it can not be used. */
+static const kexec_ops_t *kexec_prepare(checkout_context_t *ctx, const char *part) {
+    if (!ctx->flags.kexec)
+        return NULL;
+
+    const kexec_ops_t *ops = ctx->flags.kexec_record ? kexec_record_ops(ctx->flags.kexec_record)
+                                                     : kexec_native_ops();
 
-    XLOG_I("Script executed: %s", script);
+    char root_source[32];
+    char current[256];
+    snprintf(root_source, sizeof(root_source), "ubi0:%s", part);
+
+    // A forced checkout to the running slot finds its kernel at "/"
+    err_t err;
+    if (find_mount_source("/", current, sizeof(current)) == X_RET_OK && !strcmp(current, root_source)) {
+        err = kexec_load_slot(ops, "/", root_source);
+    } else {
+        err = mount_partition(part);
+        if (err == X_RET_OK) {
+            err = kexec_load_slot(ops, INACTIVE_PARTITION_MOUNT_POINT, root_source);
+            unmount_inactive_partition();
+        } else if (err != X_RET_EXIST) {
+            unmount_inactive_partition();
+        }
+    }
+
+    if (err != X_RET_OK) {
+        XLOG_W("Cannot kexec into partition '%s' (%s), falling back to a normal reboot.", part, err_str(err));
+        return NULL;
+    }
+
+    XLOG_I("Loaded kernel of partition '%s' for kexec (%s backend)", part, ops->name);
+    return ops;
 }
 
-static void reboot_with_check(checkout_context_t *ctx) {
-    if (!ctx->flags.need_reboot) 
+static void reboot_with_check(checkout_context_t *ctx, const char *part, exec_proc script, time_t started,
+                              events_stage_t script_stage) {
+    if (!ctx->flags.need_reboot) {
+        wait_script_with_check(ctx, script, started, script_stage);
         return;
+    }
+
+    // Ends only when the reboot did not happen
+    events_stage_t stage = events_stage_begin("reboot");
+    const kexec_ops_t *kexec = kexec_prepare(ctx, part);
 
     int delay = ctx->flags.reboot_delay_second;
     if (delay <= 0) {
@@ -105,66 +225,154 @@ static void reboot_with_check(checkout_context_t *ctx) {
         sleep(delay);
     }
 
+    wait_script_with_check(ctx, script, started, script_stage);
+
+    // The slot kexec_prepare() mounted, or an upgrade left behind, goes first
+    if (kexec && !ctx->flags.kexec_record)
+        unmount_inactive_partition();
+
+    // On success the init system is shutting down, or the request was just recorded
+    if (kexec && kexec->exec() == X_RET_OK) {
+        events_stage_end("reboot", stage, X_RET_OK);
+        return;
+    }
+
+    if (ctx->flags.kexec_record) {
+        XLOG_W("Not rebooting while only recording kexec requests.");
+        events_stage_end("reboot", stage, X_RET_OK);
+        return;
+    }
+
     exec_t r = exec_command("reboot");
     if (!exec_success(r)) {
         XLOG_E("Failed to reboot the system. return code: %d", r.code);
+        // Still better than staying on the old slot
+        if (kexec)
+            kexec_exec_immediately();
+        events_stage_end("reboot", stage, X_RET_ERROR);
     }
 
     exec_free(r);
 }
 
-err_t checkout_with_reboot(checkout_context_t *ctx, const char *part) {
-    xstring cmd = xstring_init_format("fw_setenv %s %s", UBOOTENV_VAR_ROOTFS_PART, part);
-    exec_t r = exec_command(xstring_to_string(&cmd));
-    xstring_free(&cmd);
+/**
+ * Finds the source of the filesystem mounted on `mount_point`, e.g. "ubi0:a"
+ * for "/". Reads /proc/self/mounts directly instead of spawning a pipeline.
+ */
+static err_t find_mount_source(const char *mount_point, char *buf, size_t len) {
+#ifdef __APPLE__
+    XLOG_T("Simulating mount source lookup of '%s' on macOS.", mount_point);
+    snprintf(buf, len, "ubi0:a");
+    return X_RET_OK;
+#else
+    FILE *fp = setmntent("/proc/self/mounts", "r");
+    if (fp == NULL) {
+        XLOG_E("Failed to open /proc/self/mounts: %s", strerror(errno));
+        return X_RET_ERROR;
+    }
 
-    if (!exec_success(r)) {
+    err_t err = X_RET_NOTENT;
+    struct mntent ent;
+    char line[1024];
+    // The last matching entry is the one visible at that path
+    while (getmntent_r(fp, &ent, line, sizeof(line)) != NULL) {
+        if (!strcmp(ent.mnt_dir, mount_point)) {
+            snprintf(buf, len, "%s", ent.mnt_fsname);
+            err = X_RET_OK;
+        }
+    }
+
+    endmntent(fp);
+    return err;
+#endif /* __APPLE__ */
+}
+
+err_t checkout_with_reboot(checkout_context_t *ctx, const char *part) {
+    events_stage_t stage = events_stage_begin("switch");
+    if (ubootenv_set(UBOOTENV_VAR_ROOTFS_PART, part) != X_RET_OK ||
+        ubootenv_commit() != X_RET_OK) {
         XLOG_E("Failed to set rootfs_root to '%s'", part);
-        exec_free(r);
+        events_stage_end("switch", stage, X_RET_ERROR);
         return X_RET_ERROR;
     }
-
-    exec_free(r);
+    events_stage_end("switch", stage, X_RET_OK);
 
     XLOG_D("Checked out to partition: '%s'", part);
 
     XLOG_I("Partition switching successful");
 
-    run_script_with_check(ctx->flags.specified_script);
+    time_t started = time(NULL);
+    exec_proc script = start_script_with_check(ctx->flags.specified_script);
+    stage = script ? events_stage_begin("script") : 0;
 
-    reboot_with_check(ctx);
+    reboot_with_check(ctx, part, script, started, stage);
 
     return X_RET_OK;
 }
 
-err_t checkout_feature_entry(xoption self) {
-    assert_requirements();
+static err_t checkout_execute(checkout_context_t *ctx);
 
+err_t checkout_feature_entry(xoption self) {
     checkout_context_t *ctx = xoption_get_context(self);
     if (ctx == NULL) {
         XLOG_E("Invalid checkout context.");
         return X_RET_INVAL;
     }
 
-    // Get current rootfs partition from rootfs mount
-    exec_t current_rootfs_part = exec_command("awk '$2==\"/\" {print $1}' /proc/self/mounts");
-    if (!exec_success(current_rootfs_part)) {
-        XLOG_D("mount output: %s", exec_output(current_rootfs_part));
-        XLOG_E("Failed to get current rootfs mount info.");
-        return X_RET_ERROR;
+    if (ctx->flags.events_fd >= 0) {
+        err_t err = register_events_notify_operators(ctx->flags.events_fd);
+        if (err != X_RET_OK)
+            return err;
     }
 
+    err_t err = checkout_execute(ctx);
+    events_result("checkout", err);
+    return err;
+}
+
+err_t checkout_perform(const checkout_request_t *req) {
+    if (req == NULL)
+        return X_RET_INVAL;
+
+    checkout_context_t *ctx = &g_checkout_ctx;
+    ctx->flags.specified_script = NULL;
+    ctx->flags.force = req->force;
+    ctx->flags.need_reboot = req->reboot;
+    ctx->flags.reboot_delay_second = req->delay_second;
+    ctx->flags.kexec = req->kexec;
+    ctx->flags.kexec_record = NULL;
+
+    return checkout_execute(ctx);
+}
+
+static err_t checkout_execute(checkout_context_t *ctx) {
+    if (ctx->flags.kexec_record)
+        ctx->flags.kexec = xTRUE;
+    if (ctx->flags.kexec)
+        ctx->flags.need_reboot = xTRUE;
+
     // Get current boot partition from U-Boot env
-    exec_t current_env_part = exec_command("fw_printenv -n " UBOOTENV_VAR_ROOTFS_PART);
-    if (!exec_success(current_env_part)) {
-        XLOG_E("Failed to get current rootfs_root. output: %s", exec_output(current_env_part));
+    if (ubootenv_load() != X_RET_OK) {
+        XLOG_E("Failed to read U-Boot environment.");
+        return X_RET_ERROR;
+    }
+
+    if (check_requirements(ctx) != X_RET_OK)
+        return X_RET_NOTSUP;
+
+    // Get current rootfs partition from rootfs mount
+    char rootfs_part[256];
+    if (find_mount_source("/", rootfs_part, sizeof(rootfs_part)) != X_RET_OK) {
+        XLOG_E("Failed to get current rootfs mount info.");
         return X_RET_ERROR;
     }
 
-    // Remove whitespace and breaklines
-    const char *env_part = xstring_trim(&current_env_part.output);
-    const char *rootfs_part = xstring_trim(&current_rootfs_part.output);
+    const char *env_part = ubootenv_get(UBOOTENV_VAR_ROOTFS_PART);
     const char *checkout_part = NULL;
+    if (env_part == NULL) {
+        XLOG_E("Failed to get current rootfs_root.");
+        return X_RET_ERROR;
+    }
 
     XLOG_D("Current rootfs source: '%s' and env partition: '%s'", rootfs_part, env_part);
 
@@ -175,7 +383,6 @@ err_t checkout_feature_entry(xoption self) {
         checkout_part = "a";
     } else {
         XLOG_E("Invalid current rootfs_part: %s", env_part);
-        exec_free(current_env_part);
         return -1;
     }
 
@@ -199,87 +406,62 @@ err_t checkout_feature_entry(xoption self) {
     return code;
 }
 
-xstring get_inactive_partition(void) {
-    // Get current rootfs_part
-    exec_t current_part = exec_command("fw_printenv -n " UBOOTENV_VAR_ROOTFS_PART);
-    if (!exec_success(current_part)) {
-        XLOG_E("Failed to get current rootfs_root. output: %s", exec_output(current_part));
-        exec_free(current_part);
-        return xstring_init_empty();
-    }
+xstr_view get_inactive_partition(void) {
+    xstr_view current_part = get_active_partition();
+    if (xstr_view_empty(current_part))
+        return current_part;
 
-    // Remove whitespace and breaklines
-    const char *p = xstring_trim(&current_part.output);
-    if (!p || strlen(p) == 0) {
-        XLOG_E("Current rootfs_part is empty (No expect).");
-        exec_free(current_part);
-        return xstring_init_empty();
-    }
+    if (xstr_view_equal(current_part, XSTR_VIEW_LIT("a"), X_CASE))
+        return XSTR_VIEW_LIT("b");
+    if (xstr_view_equal(current_part, XSTR_VIEW_LIT("b"), X_CASE))
+        return XSTR_VIEW_LIT("a");
 
-    if (!strcmp(p, "a")) {
-        return xstring_init_iter("b");
-    } else if (!strcmp(p, "b")) {
-        return xstring_init_iter("a");
-    } else {
-        XLOG_E("Invalid current rootfs_part: %s", p);
-        exec_free(current_part);
-        return xstring_init_empty();
-    }
+    XLOG_E("Invalid current rootfs_part: " XSTR_VIEW_FMT, XSTR_VIEW_ARG(current_part));
+    return xstr_view_n(NULL, 0);
 }
 
-xstring get_active_partition(void) {
-    // Get current rootfs_part
-    exec_t current_part = exec_command("fw_printenv -n " UBOOTENV_VAR_ROOTFS_PART);
-    if (!exec_success(current_part)) {
-        XLOG_E("Failed to get current rootfs_root. output: %s", exec_output(current_part));
-        exec_free(current_part);
-        return xstring_init_empty();
-    }
-
-    // Remove whitespace and breaklines
-    const char *p = xstring_trim(&current_part.output);
-    if (!p || strlen(p) == 0) {
+xstr_view get_active_partition(void) {
+    // Get current rootfs_part, the environment is read once per process
+    xstr_view p = xstr_view_of(ubootenv_get(UBOOTENV_VAR_ROOTFS_PART));
+    if (xstr_view_empty(p))
         XLOG_E("Current rootfs_part is empty (No expect).");
-        exec_free(current_part);
-        return xstring_init_empty();
-    }
 
-    return xstring_init_iter(p);
+    return p;
 }
 
 static xbool_t checkout_mount_already(const char *part) {
     if (part == NULL)
         return xFALSE;
 
-    xstring cmd = xstring_init_format("mount | grep '%s'",
-                                      part);
-    exec_t r = exec_command(xstring_to_string(&cmd));
-    xstring_free(&cmd);
-    if (exec_success(r)) {
-        exec_free(r);
-        return xTRUE;
-    } else {
-        exec_free(r);
+#ifdef __APPLE__
+    XLOG_T("Simulating mount lookup of '%s' on macOS.", part);
+    return xFALSE;
+#else
+    FILE *fp = setmntent("/proc/self/mounts", "r");
+    if (fp == NULL)
         return xFALSE;
-    }
-}
 
-err_t mount_inactive_partition(void) {
-    xstring inactive_part = get_inactive_partition();
-    if (xstring_is_empty(&inactive_part)) {
-        XLOG_E("Cannot get inactive partition.");
-        xstring_free(&inactive_part);
-        return X_RET_ERROR;
+    xbool_t found = xFALSE;
+    struct mntent ent;
+    char line[1024];
+    while (!found && getmntent_r(fp, &ent, line, sizeof(line)) != NULL) {
+        found = strstr(ent.mnt_fsname, part) != NULL;
     }
 
+    endmntent(fp);
+    return found;
+#endif /* __APPLE__ */
+}
+
+/* Mounts the slot `part` on INACTIVE_PARTITION_MOUNT_POINT. */
+static err_t mount_partition(const char *part) {
     const char *ubi_dev = NULL;
-    if (xstring_equal(&inactive_part, "a", X_CASE)) {
+    if (!strcmp(part, "a")) {
         ubi_dev = "/dev/ubi0_0";
-    } else if (xstring_equal(&inactive_part, "b", X_CASE)) {
+    } else if (!strcmp(part, "b")) {
         ubi_dev = "/dev/ubi0_1";
     } else {
-        XLOG_E("Invalid inactive partition: %s", xstring_to_string(&inactive_part));
-        xstring_free(&inactive_part);
+        XLOG_E("Invalid partition: %s", part);
         return X_RET_ERROR;
     }
 
@@ -289,59 +471,56 @@ err_t mount_inactive_partition(void) {
         return X_RET_EXIST;
     }
 
-    xstring cmd = xstring_init_format("mkdir -p %s; mount -t ubifs %s %s",
-                                      INACTIVE_PARTITION_MOUNT_POINT,
-                                      ubi_dev,
-                                      INACTIVE_PARTITION_MOUNT_POINT);
+    if (os_mkdir_p(INACTIVE_PARTITION_MOUNT_POINT, 0755) != X_RET_OK) {
+        XLOG_E("Failed to create mount point %s: %s", INACTIVE_PARTITION_MOUNT_POINT, strerror(errno));
+        return X_RET_ERROR;
+    }
 
-    exec_t r = exec_command(xstring_to_string(&cmd));
-    xstring_free(&cmd);
-    xstring_free(&inactive_part);
-    if (!exec_success(r)) {
-        exec_free(r);
+#ifdef __APPLE__
+    XLOG_T("Simulating mount of %s on %s on macOS.", ubi_dev, INACTIVE_PARTITION_MOUNT_POINT);
+#else
+    if (mount(ubi_dev, INACTIVE_PARTITION_MOUNT_POINT, "ubifs", 0, NULL) != 0) {
+        XLOG_E("Failed to mount %s on %s: %s", ubi_dev, INACTIVE_PARTITION_MOUNT_POINT, strerror(errno));
         return X_RET_ERROR;
     }
+#endif /* __APPLE__ */
 
-    exec_free(r);
+    XLOG_D("Mounted %s on %s", ubi_dev, INACTIVE_PARTITION_MOUNT_POINT);
     return X_RET_OK;
 }
 
-err_t unmount_inactive_partition(void) {
-    xstring inactive_part = get_inactive_partition();
-    if (xstring_is_empty(&inactive_part)) {
+err_t mount_inactive_partition(void) {
+    xstr_view inactive_part = get_inactive_partition();
+    if (xstr_view_empty(inactive_part)) {
         XLOG_E("Cannot get inactive partition.");
-        xstring_free(&inactive_part);
         return X_RET_ERROR;
     }
 
-    const char *ubi_dev = NULL;
-    if (xstring_equal(&inactive_part, "a", X_CASE)) {
-        ubi_dev = "/dev/ubi0_0";
-    } else if (xstring_equal(&inactive_part, "b", X_CASE)) {
-        ubi_dev = "/dev/ubi0_1";
-    } else {
-        XLOG_E("Invalid inactive partition: %s", xstring_to_string(&inactive_part));
-        xstring_free(&inactive_part);
-        return X_RET_ERROR;
-    }
+    // a view of "a" or "b", terminated like any literal
+    return mount_partition(inactive_part.p);
+}
 
-    xstring_free(&inactive_part);
+err_t unmount_inactive_partition(void) {
+    if (!os_file_exist(INACTIVE_PARTITION_MOUNT_POINT))
+        return X_RET_OK;
 
-    xstring cmd = xstring_init_format("test -d %s || exit 0;sync && umount -l %s && rmdir %s",
-                                      INACTIVE_PARTITION_MOUNT_POINT,
-                                      INACTIVE_PARTITION_MOUNT_POINT,
-                                      INACTIVE_PARTITION_MOUNT_POINT);
-    exec_t r = exec_command(xstring_to_string(&cmd));
-    if (!exec_success(r)) {
-        XLOG_E("Failed to unmount inactive partition. command: `%s`, error code: %d",
-               xstring_to_string(&cmd), exec_code(r));
-        xstring_free(&cmd);
-        exec_free(r);
+    sync();
+
+#ifdef __APPLE__
+    XLOG_T("Simulating unmount of %s on macOS.", INACTIVE_PARTITION_MOUNT_POINT);
+#else
+    // EINVAL: nothing is mounted there, only the directory is left over
+    if (umount2(INACTIVE_PARTITION_MOUNT_POINT, MNT_DETACH) != 0 && errno != EINVAL) {
+        XLOG_E("Failed to unmount inactive partition %s: %s",
+               INACTIVE_PARTITION_MOUNT_POINT, strerror(errno));
         return X_RET_ERROR;
     }
+#endif /* __APPLE__ */
 
-    xstring_free(&cmd);
-    exec_free(r);
+    if (rmdir(INACTIVE_PARTITION_MOUNT_POINT) != 0) {
+        XLOG_E("Failed to remove mount point %s: %s", INACTIVE_PARTITION_MOUNT_POINT, strerror(errno));
+        return X_RET_ERROR;
+    }
 
     return X_RET_OK;
 }
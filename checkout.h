@@ -26,10 +26,33 @@ extern "C" {
 #include "xstring.h"
 #include "xoption.h"
 
+typedef struct {
+    xbool_t force;
+    xbool_t reboot;
+    int delay_second;
+    xbool_t kexec;
+} checkout_request_t;
+
 err_t checkout_usage_init(xoption root);
 
-xstring get_inactive_partition(void);
-xstring get_active_partition(void);
+/**
+ * @brief Switches the next boot to the other partition, as `iota-cli checkout`
+ *  does, for callers that are not driven by the command line.
+ */
+err_t checkout_perform(const checkout_request_t *req);
+
+/**
+ * @brief The partition the next upgrade goes to, "a" or "b".
+ * @return A view of a literal, NUL-terminated; empty when unknown.
+ */
+xstr_view get_inactive_partition(void);
+
+/**
+ * @brief The partition rootfs_part currently selects.
+ * @return A view into the cached U-Boot environment, valid until the next
+ *  ubootenv_set() of rootfs_part; empty when unset.
+ */
+xstr_view get_active_partition(void);
 err_t mount_inactive_partition(void);
 err_t unmount_inactive_partition(void);
 
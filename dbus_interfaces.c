@@ -9,28 +9,96 @@
 #include "xlog.h"
 #include "dbus_interfaces.h"
 #include <dbus/dbus.h>
-
-#define DBUS_SERVICE_NAME    "com.iota.status"
-#define DBUS_OBJECT_PATH     "/com/iota/status"
-#define DBUS_INTERFACE_NAME  "com.iota.status.Interface"
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #define SIGNAL_PROGRESS_CHANGED  "ProgressChanged"
 #define SIGNAL_MESSAGE_LOGGED    "MessageLogged"
 #define SIGNAL_ERROR_OCCURRED    "ErrorOccurred"
+#define SIGNAL_JOB_FINISHED      "JobFinished"
+
+/* Signals queued while the sender thread is behind, must be a power of 2. */
+#define SENDER_QUEUE_SIZE        256
+/* How often the sender flushes, progress is sent at most this often. */
+#define SENDER_FLUSH_INTERVAL_MS 100
 
 static DBusConnection *g_dbus_conn = NULL;
+static xbool_t g_dbus_name_owned = xFALSE;
+
+typedef enum {
+    EVENT_PROGRESS,
+    EVENT_MESSAGE,
+    EVENT_ERROR,
+    EVENT_JOB_FINISHED,
+} dbus_event_type_e;
+
+typedef struct {
+    dbus_event_type_e type;
+    int code;               // percent, error code or job result
+    uint64_t total;
+    uint64_t current;
+    uint32_t job_id;
+    char text[256];         // step, message or error text
+} dbus_event_t;
+
+typedef struct {
+    atomic_size_t seq;
+    dbus_event_t event;
+} sender_cell_t;
+
+/*
+ * Signals are emitted by a sender thread so the data path never waits for
+ * the bus. Messages and errors go through a bounded lock-free MPSC queue,
+ * progress through a triple buffer that only keeps the latest value.
+ *
+ * The triple buffer is sent after the queue, so within a step a progress
+ * signal may arrive after a message that was logged later. A step's final
+ * value and a job's last progress go through the queue instead, they keep
+ * their place before the next step's messages and before JobFinished.
+ */
+static struct {
+    pthread_t thread;
+    xbool_t started;
+    atomic_bool stop;
+    sem_t wakeup;
+    sender_cell_t cells[SENDER_QUEUE_SIZE];
+    atomic_size_t enqueue_pos;
+    size_t dequeue_pos;             // sender thread only
+    atomic_uint dropped;
+    dbus_event_t progress[3];
+    atomic_int progress_middle;     // index, PROGRESS_DIRTY once published
+    int progress_back;              // producer only
+    int progress_front;             // sender thread only
+    dbus_event_t progress_last;     // producer only, last published value
+} g_sender;
+
+#define PROGRESS_DIRTY 4
 
 static void init(void);
-static err_t progress_changed(const char *step, int percent, int total, int current);
+static err_t progress_changed(const char *step, int percent, uint64_t total, uint64_t current);
 static err_t message_logged(const char *log_msg);
 static err_t error_occurred(int err_code, const char *err_msg);
+static err_t job_started(void);
 static void fini(void);
+static err_t send_progress_changed(const char *step, int percent, uint64_t total, uint64_t current);
+static err_t send_message_logged(const char *log_msg);
+static err_t send_error_occurred(int err_code, const char *err_msg);
+static err_t send_job_finished(uint32_t job_id, int code, const char *message);
+static void sender_start(void);
+static void sender_stop(void);
 
 void register_dbus_notify_operators() {
     static notify_operators_t dbus_notify_ops = {
         .progress_changed = progress_changed,
         .message_logged = message_logged,
         .error_occurred = error_occurred,
+        .job_started = job_started,
     };
 
     init();
@@ -39,42 +107,72 @@ void register_dbus_notify_operators() {
 }
 
 void init(void)
+{
+    dbus_interfaces_connect(xFALSE, xFALSE);
+}
+
+err_t dbus_interfaces_connect(xbool_t session_bus, xbool_t own_name)
 {
     DBusError err;
     int ret;
 
+    if (g_dbus_conn != NULL) {
+        return X_RET_OK;
+    }
+
+    // Signals may be sent from a worker thread while the daemon dispatches
+    dbus_threads_init_default();
     dbus_error_init(&err);
 
-    g_dbus_conn = dbus_bus_get(DBUS_BUS_SYSTEM, &err);
+    g_dbus_conn = dbus_bus_get(session_bus ? DBUS_BUS_SESSION : DBUS_BUS_SYSTEM, &err);
     if (dbus_error_is_set(&err)) {
         XLOG_E("D-Bus Connection Error: %s", err.message);
         dbus_error_free(&err);
-        return;
+        g_dbus_conn = NULL;
+        return X_RET_ERROR;
     }
 
     if (g_dbus_conn == NULL) {
         XLOG_E("D-Bus Connection is NULL");
-        return;
+        return X_RET_ERROR;
+    }
+
+    if (!own_name) {
+        sender_start();
+        return X_RET_OK;
     }
 
-#if 0
     ret = dbus_bus_request_name(g_dbus_conn,
                                 DBUS_SERVICE_NAME,
-                                DBUS_NAME_FLAG_REPLACE_EXISTING,
+                                DBUS_NAME_FLAG_DO_NOT_QUEUE,
                                 &err);
     if (dbus_error_is_set(&err)) {
         XLOG_E("D-Bus Request Name Error: %s", err.message);
         dbus_error_free(&err);
-        return;
+        fini();
+        return X_RET_ERROR;
     }
 
     if (ret != DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER) {
-        XLOG_W("D-Bus Not Primary Owner (%d)", ret);
-        // return;
+        XLOG_E("D-Bus Not Primary Owner (%d), is another daemon running?", ret);
+        fini();
+        return X_RET_EXIST;
     }
 
+    g_dbus_name_owned = xTRUE;
+    sender_start();
     XLOG_D("D-Bus initialized successfully.  Service:  %s", DBUS_SERVICE_NAME);
-#endif
+    return X_RET_OK;
+}
+
+DBusConnection *dbus_interfaces_connection(void)
+{
+    return g_dbus_conn;
+}
+
+void dbus_interfaces_disconnect(void)
+{
+    fini();
 }
 
 /**
@@ -87,7 +185,7 @@ void init(void)
  * @param total   总大小
  * @param current 已处理大小
  */
-err_t progress_changed(const char *step, int percent, int total, int current)
+static err_t send_progress_changed(const char *step, int percent, uint64_t total, uint64_t current)
 {
     DBusMessage *msg;
     dbus_int32_t d_percent = (dbus_int32_t)percent;
@@ -120,7 +218,6 @@ err_t progress_changed(const char *step, int percent, int total, int current)
         return X_RET_ERROR;
     }
 
-    dbus_connection_flush(g_dbus_conn);
     dbus_message_unref(msg);
     return X_RET_OK;
 }
@@ -132,7 +229,7 @@ err_t progress_changed(const char *step, int percent, int total, int current)
  * 
  * @param msg 无进度的描述性文本/日志
  */
-err_t message_logged(const char *log_msg)
+static err_t send_message_logged(const char *log_msg)
 {
     DBusMessage *msg;
 
@@ -159,7 +256,6 @@ err_t message_logged(const char *log_msg)
         return X_RET_ERROR;
     }
 
-    dbus_connection_flush(g_dbus_conn);
     dbus_message_unref(msg);
 
     return X_RET_OK;
@@ -173,7 +269,7 @@ err_t message_logged(const char *log_msg)
  * @param err_code 错误码
  * @param err_msg  错误详细描述
  */
-err_t error_occurred(int err_code, const char *err_msg)
+static err_t send_error_occurred(int err_code, const char *err_msg)
 {
     DBusMessage *msg;
     dbus_int32_t d_err_code = (dbus_int32_t)err_code;
@@ -202,7 +298,51 @@ err_t error_occurred(int err_code, const char *err_msg)
         return X_RET_ERROR;
     }
 
-    dbus_connection_flush(g_dbus_conn);
+    dbus_message_unref(msg);
+
+    return X_RET_OK;
+}
+
+/**
+ * 发送任务完成信号
+ * Signal:  JobFinished
+ * Signature: uis (uint32, int32, string)
+ *
+ * @param job_id  任务编号
+ * @param code    结果码 (err_t)
+ * @param message 结果描述
+ */
+static err_t send_job_finished(uint32_t job_id, int code, const char *message)
+{
+    DBusMessage *msg;
+    dbus_uint32_t d_job_id = (dbus_uint32_t)job_id;
+    dbus_int32_t d_code = (dbus_int32_t)code;
+
+    if (g_dbus_conn == NULL) {
+        return X_RET_INVAL;
+    }
+
+    msg = dbus_message_new_signal(DBUS_OBJECT_PATH,
+                                  DBUS_INTERFACE_NAME,
+                                  SIGNAL_JOB_FINISHED);
+    if (msg == NULL) {
+        return X_RET_ERROR;
+    }
+
+    if (! dbus_message_append_args(msg,
+                                   DBUS_TYPE_UINT32, &d_job_id,
+                                   DBUS_TYPE_INT32, &d_code,
+                                   DBUS_TYPE_STRING, &message,
+                                   DBUS_TYPE_INVALID)) {
+        dbus_message_unref(msg);
+        return X_RET_ERROR;
+    }
+
+    if (! dbus_connection_send(g_dbus_conn, msg, NULL)) {
+        dbus_message_unref(msg);
+        return X_RET_ERROR;
+    }
+
     dbus_message_unref(msg);
 
     return X_RET_OK;
@@ -210,14 +350,20 @@ err_t error_occurred(int err_code, const char *err_msg)
 
 void fini(void)
 {
+    // Everything queued so far still goes out
+    sender_stop();
+
     if (g_dbus_conn != NULL) {
         DBusError err;
         dbus_error_init(&err);
 
-        dbus_bus_release_name(g_dbus_conn, DBUS_SERVICE_NAME, &err);
-        if (dbus_error_is_set(&err)) {
-            XLOG_E("D-Bus Release Name Error: %s", err.message);
-            dbus_error_free(&err);
+        if (g_dbus_name_owned) {
+            dbus_bus_release_name(g_dbus_conn, DBUS_SERVICE_NAME, &err);
+            if (dbus_error_is_set(&err)) {
+                XLOG_E("D-Bus Release Name Error: %s", err.message);
+                dbus_error_free(&err);
+            }
+            g_dbus_name_owned = xFALSE;
         }
 
         dbus_connection_unref(g_dbus_conn);
@@ -226,3 +372,281 @@ void fini(void)
         XLOG_I("D-Bus connection closed");
     }
 }
+
+static xbool_t sender_push(const dbus_event_t *event)
+{
+    size_t pos = atomic_load_explicit(&g_sender.enqueue_pos, memory_order_relaxed);
+
+    for (;;) {
+        sender_cell_t *cell = &g_sender.cells[pos & (SENDER_QUEUE_SIZE - 1)];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&g_sender.enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                cell->event = *event;
+                atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+                return xTRUE;
+            }
+        } else if (diff < 0) {
+            // Full, the sender is too far behind
+            atomic_fetch_add(&g_sender.dropped, 1);
+            return xFALSE;
+        } else {
+            pos = atomic_load_explicit(&g_sender.enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+static xbool_t sender_pop(dbus_event_t *event)
+{
+    sender_cell_t *cell = &g_sender.cells[g_sender.dequeue_pos & (SENDER_QUEUE_SIZE - 1)];
+    size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+
+    if ((intptr_t)seq - (intptr_t)(g_sender.dequeue_pos + 1) < 0) {
+        return xFALSE;
+    }
+
+    *event = cell->event;
+    atomic_store_explicit(&cell->seq, g_sender.dequeue_pos + SENDER_QUEUE_SIZE, memory_order_release);
+    g_sender.dequeue_pos++;
+    return xTRUE;
+}
+
+static void sender_send(const dbus_event_t *event)
+{
+    switch (event->type) {
+    case EVENT_PROGRESS:
+        send_progress_changed(event->text, event->code, event->total, event->current);
+        break;
+    case EVENT_MESSAGE:
+        send_message_logged(event->text);
+        break;
+    case EVENT_ERROR:
+        send_error_occurred(event->code, event->text);
+        break;
+    case EVENT_JOB_FINISHED:
+        send_job_finished(event->job_id, event->code, event->text);
+        break;
+    }
+}
+
+/* Sends everything pending, returns whether anything was sent. */
+static xbool_t sender_drain(void)
+{
+    xbool_t sent = xFALSE;
+    dbus_event_t event;
+
+    while (sender_pop(&event)) {
+        sender_send(&event);
+        sent = xTRUE;
+    }
+
+    if (atomic_load(&g_sender.progress_middle) & PROGRESS_DIRTY) {
+        int middle = atomic_exchange(&g_sender.progress_middle, g_sender.progress_front);
+        g_sender.progress_front = middle & ~PROGRESS_DIRTY;
+        sender_send(&g_sender.progress[g_sender.progress_front]);
+        sent = xTRUE;
+    }
+
+    unsigned dropped = atomic_exchange(&g_sender.dropped, 0);
+    if (dropped > 0) {
+        char text[64];
+        snprintf(text, sizeof(text), "%u notifications dropped", dropped);
+        send_message_logged(text);
+        sent = xTRUE;
+    }
+
+    return sent;
+}
+
+static void *sender_main(void *arg)
+{
+    for (;;) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += SENDER_FLUSH_INTERVAL_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (sem_timedwait(&g_sender.wakeup, &deadline) != 0 && errno == EINTR) {
+        }
+
+        // Read stop first, so whatever was queued before it is drained
+        xbool_t stop = atomic_load(&g_sender.stop);
+        if (sender_drain()) {
+            dbus_connection_flush(g_dbus_conn);
+        }
+
+        if (stop) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+void sender_start(void)
+{
+    if (g_sender.started) {
+        return;
+    }
+
+    for (size_t i = 0; i < SENDER_QUEUE_SIZE; i++) {
+        atomic_init(&g_sender.cells[i].seq, i);
+    }
+    atomic_init(&g_sender.enqueue_pos, 0);
+    atomic_init(&g_sender.stop, xFALSE);
+    atomic_init(&g_sender.dropped, 0);
+    atomic_init(&g_sender.progress_middle, 2);
+    g_sender.dequeue_pos = 0;
+    g_sender.progress_back = 0;
+    g_sender.progress_front = 1;
+    g_sender.progress_last.text[0] = '\0';
+    sem_init(&g_sender.wakeup, 0, 0);
+
+    if (pthread_create(&g_sender.thread, NULL, sender_main, NULL) != 0) {
+        XLOG_E("Failed to start D-Bus sender thread");
+        sem_destroy(&g_sender.wakeup);
+        return;
+    }
+
+    g_sender.started = xTRUE;
+
+    // A command line run simply returns from main, drain before the exit
+    static xbool_t registered = xFALSE;
+    if (!registered) {
+        atexit(sender_stop);
+        registered = xTRUE;
+    }
+}
+
+void sender_stop(void)
+{
+    if (!g_sender.started) {
+        return;
+    }
+
+    atomic_store(&g_sender.stop, xTRUE);
+    sem_post(&g_sender.wakeup);
+    pthread_join(g_sender.thread, NULL);
+    sem_destroy(&g_sender.wakeup);
+    g_sender.started = xFALSE;
+}
+
+static err_t enqueue(const dbus_event_t *event, xbool_t wakeup)
+{
+    if (!g_sender.started) {
+        // No sender thread, fall back to sending right away
+        sender_send(event);
+        if (g_dbus_conn) {
+            dbus_connection_flush(g_dbus_conn);
+        }
+        return X_RET_OK;
+    }
+
+    if (!sender_push(event)) {
+        return X_RET_FULL;
+    }
+
+    if (wakeup) {
+        sem_post(&g_sender.wakeup);
+    }
+    return X_RET_OK;
+}
+
+/* Called from a single thread, the one running the upgrade. */
+err_t progress_changed(const char *step, int percent, uint64_t total, uint64_t current)
+{
+    if (g_dbus_conn == NULL) {
+        return X_RET_INVAL;
+    }
+
+    dbus_event_t event = {
+        .type = EVENT_PROGRESS,
+        .code = percent,
+        .total = total,
+        .current = current,
+    };
+    snprintf(event.text, sizeof(event.text), "%s", step ? step : "");
+
+    if (!g_sender.started) {
+        return enqueue(&event, xFALSE);
+    }
+
+    // Only the latest value per step is kept, but a step's last value
+    // must not be overwritten by the next step before it was sent.
+    dbus_event_t *last = &g_sender.progress_last;
+    if (last->text[0] != '\0' && strcmp(last->text, event.text) != 0) {
+        enqueue(last, xFALSE);
+    }
+    *last = event;
+
+    g_sender.progress[g_sender.progress_back] = event;
+    int middle = atomic_exchange(&g_sender.progress_middle, g_sender.progress_back | PROGRESS_DIRTY);
+    g_sender.progress_back = middle & ~PROGRESS_DIRTY;
+
+    return X_RET_OK;
+}
+
+/* A new job starts without the previous one's progress. */
+err_t job_started(void)
+{
+    g_sender.progress_last.text[0] = '\0';
+    return X_RET_OK;
+}
+
+/* Moves the job's last progress into the queue, ahead of what follows it. */
+static void progress_settle(void)
+{
+    dbus_event_t *last = &g_sender.progress_last;
+    if (!g_sender.started || last->text[0] == '\0') {
+        return;
+    }
+
+    // Not sent twice, unless the sender already took it
+    int middle = atomic_load(&g_sender.progress_middle);
+    while ((middle & PROGRESS_DIRTY) &&
+           !atomic_compare_exchange_weak(&g_sender.progress_middle, &middle, middle & ~PROGRESS_DIRTY)) {
+    }
+
+    enqueue(last, xFALSE);
+    last->text[0] = '\0';
+}
+
+err_t message_logged(const char *log_msg)
+{
+    if (g_dbus_conn == NULL) {
+        return X_RET_INVAL;
+    }
+
+    dbus_event_t event = {.type = EVENT_MESSAGE};
+    snprintf(event.text, sizeof(event.text), "%s", log_msg ? log_msg : "");
+    return enqueue(&event, xFALSE);
+}
+
+err_t error_occurred(int err_code, const char *err_msg)
+{
+    if (g_dbus_conn == NULL) {
+        return X_RET_INVAL;
+    }
+
+    dbus_event_t event = {.type = EVENT_ERROR, .code = err_code};
+    snprintf(event.text, sizeof(event.text), "%s", err_msg ? err_msg : "");
+    return enqueue(&event, xTRUE);
+}
+
+err_t dbus_emit_job_finished(uint32_t job_id, int code, const char *message)
+{
+    if (g_dbus_conn == NULL) {
+        return X_RET_INVAL;
+    }
+
+    progress_settle();
+
+    dbus_event_t event = {.type = EVENT_JOB_FINISHED, .code = code, .job_id = job_id};
+    snprintf(event.text, sizeof(event.text), "%s", message ? message : "");
+    return enqueue(&event, xTRUE);
+}
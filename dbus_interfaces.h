@@ -4,10 +4,32 @@
 extern "C" {
 #endif /* __cplusplus */
 
+#include <stdint.h>
 #include "notify.h"
 
+#define DBUS_SERVICE_NAME    "com.iota.status"
+#define DBUS_OBJECT_PATH     "/com/iota/status"
+#define DBUS_INTERFACE_NAME  "com.iota.status.Interface"
+
+struct DBusConnection;
+
 void register_dbus_notify_operators();
 
+/**
+ * Connects to the system (or session) bus, optionally owning DBUS_SERVICE_NAME.
+ * Later calls return X_RET_OK as long as the first one succeeded.
+ */
+err_t dbus_interfaces_connect(xbool_t session_bus, xbool_t own_name);
+struct DBusConnection *dbus_interfaces_connection(void);
+void dbus_interfaces_disconnect(void);
+
+/**
+ * Signal: JobFinished
+ * Signature: uis (uint32, int32, string)
+ * Called from the thread that ran the job, after the job's last progress.
+ */
+err_t dbus_emit_job_finished(uint32_t job_id, int code, const char *message);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -0,0 +1,233 @@
+#define XLOG_MOD "events"
+#include "events.h"
+#include "xlog.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Longer strings are cut, so that an event fits one atomic pipe write. */
+#define EVENT_MAX 1024
+
+static struct {
+    int fd;
+    uint64_t started_ms;
+    const char *progress_step;
+    uint64_t progress_ms;
+} g_events = {
+    .fd = -1,
+};
+
+static uint64_t now_ms(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+typedef struct {
+    char buf[EVENT_MAX];
+    size_t len;
+    xbool_t truncated;
+} event_buf_t;
+
+static void put(event_buf_t *e, const char *fmt, ...) {
+    if (e->truncated)
+        return;
+
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(e->buf + e->len, sizeof(e->buf) - e->len, fmt, ap);
+    va_end(ap);
+
+    if (n < 0 || (size_t)n >= sizeof(e->buf) - e->len) {
+        e->truncated = xTRUE;
+        return;
+    }
+    e->len += n;
+}
+
+/* Appends "key":"value" with JSON escaping, leaving room for the closing brace. */
+static void put_string(event_buf_t *e, const char *key, const char *value) {
+    static const char hex[] = "0123456789abcdef";
+
+    put(e, ",\"%s\":\"", key);
+    if (e->truncated)
+        return;
+    for (const unsigned char *p = (const unsigned char *)(value ? value : ""); *p && !e->truncated; p++) {
+        // Worst case an escape sequence, a quote and "}\n"
+        if (e->len + 6 + 4 > sizeof(e->buf)) {
+            e->truncated = xTRUE;
+            break;
+        }
+
+        char *out = e->buf + e->len;
+        if (*p == '"' || *p == '\\') {
+            out[0] = '\\';
+            out[1] = *p;
+            e->len += 2;
+        } else if (*p == '\n') {
+            memcpy(out, "\\n", 2);
+            e->len += 2;
+        } else if (*p < 0x20) {
+            memcpy(out, "\\u00", 4);
+            out[4] = hex[*p >> 4];
+            out[5] = hex[*p & 0xf];
+            e->len += 6;
+        } else {
+            out[0] = *p;
+            e->len += 1;
+        }
+    }
+
+    // A cut string is still closed, the event stays valid JSON
+    e->truncated = xFALSE;
+    put(e, "\"");
+}
+
+static void event_begin(event_buf_t *e, const char *event) {
+    e->len = 0;
+    e->truncated = xFALSE;
+    put(e, "{\"ts\":%ju,\"event\":\"%s\"", (uintmax_t)now_ms(CLOCK_REALTIME), event);
+}
+
+static err_t event_send(event_buf_t *e) {
+    if (g_events.fd < 0)
+        return X_RET_OK;
+
+    if (e->len + 2 >= sizeof(e->buf))
+        e->len = sizeof(e->buf) - 3;
+    e->buf[e->len++] = '}';
+    e->buf[e->len++] = '\n';
+
+    // A consumer that went away must not take the upgrade down with SIGPIPE
+    sigset_t pipe_set, old;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, &old);
+
+    err_t err = X_RET_OK;
+    xbool_t closed = xFALSE;
+    const char *p = e->buf;
+    size_t left = e->len;
+    while (left > 0) {
+        ssize_t n = write(g_events.fd, p, left);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            closed = errno == EPIPE;
+            err = X_RET_ERROR;
+            break;
+        }
+        p += n;
+        left -= n;
+    }
+
+    if (closed) {
+        // Drop the signal raised for this write before unblocking it
+        struct timespec zero = {0, 0};
+        sigtimedwait(&pipe_set, NULL, &zero);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (closed) {
+        // Disabled first, the warning goes through the notify transports too
+        g_events.fd = -1;
+        XLOG_W("Event stream consumer went away, no more events are sent");
+    }
+    return err;
+}
+
+static err_t events_progress_changed(const char *step, int percent, uint64_t total, uint64_t current) {
+    // Like the progress bar, but also bounded in time for fast stages
+    uint64_t now = now_ms(CLOCK_MONOTONIC);
+    if (step == g_events.progress_step && current < total &&
+        now - g_events.progress_ms < EVENTS_PROGRESS_INTERVAL_MS)
+        return X_RET_OK;
+    g_events.progress_step = step;
+    g_events.progress_ms = now;
+
+    event_buf_t e;
+    event_begin(&e, "progress");
+    put_string(&e, "stage", step);
+    put(&e, ",\"percent\":%d,\"current\":%ju,\"total\":%ju", percent, (uintmax_t)current, (uintmax_t)total);
+    return event_send(&e);
+}
+
+static err_t events_message_logged(const char *msg) {
+    event_buf_t e;
+    event_begin(&e, "message");
+    put_string(&e, "message", msg);
+    return event_send(&e);
+}
+
+static err_t events_error_occurred(int err_code, const char *err_msg) {
+    event_buf_t e;
+    event_begin(&e, "error");
+    put(&e, ",\"code\":%d", err_code);
+    put_string(&e, "message", err_msg);
+    return event_send(&e);
+}
+
+err_t register_events_notify_operators(int fd) {
+    static notify_operators_t events_notify_ops = {
+        .progress_changed = events_progress_changed,
+        .message_logged = events_message_logged,
+        .error_occurred = events_error_occurred,
+    };
+
+    if (fd < 0 || fcntl(fd, F_GETFD) < 0) {
+        XLOG_E("Invalid events file descriptor %d", fd);
+        return X_RET_INVAL;
+    }
+
+    g_events.fd = fd;
+    g_events.started_ms = now_ms(CLOCK_MONOTONIC);
+    return register_notify_operators(&events_notify_ops);
+}
+
+xbool_t events_enabled(void) {
+    return g_events.fd >= 0;
+}
+
+events_stage_t events_stage_begin(const char *stage) {
+    if (!events_enabled())
+        return 0;
+
+    event_buf_t e;
+    event_begin(&e, "stage");
+    put_string(&e, "stage", stage);
+    put(&e, ",\"state\":\"begin\"");
+    event_send(&e);
+
+    return now_ms(CLOCK_MONOTONIC);
+}
+
+void events_stage_end(const char *stage, events_stage_t begun, err_t code) {
+    if (!events_enabled())
+        return;
+
+    event_buf_t e;
+    event_begin(&e, "stage");
+    put_string(&e, "stage", stage);
+    put(&e, ",\"state\":\"end\",\"code\":%d,\"elapsed_ms\":%ju",
+        code, (uintmax_t)(now_ms(CLOCK_MONOTONIC) - begun));
+    event_send(&e);
+}
+
+void events_result(const char *command, err_t code) {
+    if (!events_enabled())
+        return;
+
+    event_buf_t e;
+    event_begin(&e, "result");
+    put_string(&e, "command", command);
+    put(&e, ",\"code\":%d", code);
+    put_string(&e, "status", err_str(code));
+    put(&e, ",\"elapsed_ms\":%ju", (uintmax_t)(now_ms(CLOCK_MONOTONIC) - g_events.started_ms));
+    event_send(&e);
+}
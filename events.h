@@ -0,0 +1,59 @@
+/**
+ * @brief Machine-readable event stream.
+ *  Writes one JSON object per line to a file descriptor handed in by a
+ *  supervisor, e.g. `iota-cli upgrade --events-fd 3 ... 3>events.ndjson`.
+ *  Each event is formatted on the stack and written with a single write(2),
+ *  so lines from a pipe never interleave. Progress is rate limited. If the
+ *  reader closes its end the stream is switched off and the command carries on.
+ *
+ *  {"ts":1769990400123,"event":"stage","stage":"verify","state":"begin"}
+ *  {"ts":...,"event":"progress","stage":"Verifying","percent":42,"current":4200,"total":10000}
+ *  {"ts":...,"event":"stage","stage":"verify","state":"end","code":0,"elapsed_ms":812}
+ *  {"ts":...,"event":"message","message":"Calculating"}
+ *  {"ts":...,"event":"error","code":500,"message":"Decryption failed"}
+ *  {"ts":...,"event":"result","command":"upgrade","code":0,"status":"OK","elapsed_ms":9120}
+ *
+ *  Progress, messages and errors arrive through notify_operators_t.
+ *
+ * @file events.h
+ * @author Oswin
+ * @date 2026-02-03
+ * @details
+ */
+#ifndef EVENTS_H_
+#define EVENTS_H_
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "notify.h"
+
+/* Minimum gap between two progress events of one stage, the last one always goes out. */
+#define EVENTS_PROGRESS_INTERVAL_MS 200
+
+/**
+ * @brief Starts writing events to `fd` and registers the notify transport.
+ * @return X_RET_OK, X_RET_INVAL if fd is not open.
+ */
+err_t register_events_notify_operators(int fd);
+
+/**
+ * @brief Whether an event stream is open.
+ */
+xbool_t events_enabled(void);
+
+/** @brief When a stage began, stages may overlap. */
+typedef uint64_t events_stage_t;
+
+events_stage_t events_stage_begin(const char *stage);
+void events_stage_end(const char *stage, events_stage_t begun, err_t code);
+
+/**
+ * @brief The final event of a command, with its total run time.
+ */
+void events_result(const char *command, err_t code);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* EVENTS_H_ */
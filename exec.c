@@ -1,13 +1,26 @@
 #define XLOG_MOD "exec"
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 #include "exec.h"
 #include "xlog.h"
 
+extern char **environ;
+
 #ifdef __APPLE__
-#include <string.h>
 exec_t exec_command(const char *command) {
-    exec_t result = {X_RET_OK, xstring_init_empty()};
+    exec_t result = {X_RET_OK, xstring_init_empty(), xstring_init_empty()};
     if (command == NULL) {
         return result;
     }
@@ -19,7 +32,10 @@ exec_t exec_command(const char *command) {
         XLOG_T("Simulating %s command on macOS.", command);
     } else if (!strcmp(command, "fw_printenv -n rootfs_part")) {
         XLOG_T("Simulating fw_printenv command on macOS.");
-        return (exec_t){0, xstring_init_format("a\n")};
+        return (exec_t){0, xstring_init_format("a\n"), xstring_init_empty()};
+    } else if (!strcmp(command, "fw_printenv")) {
+        XLOG_T("Simulating fw_printenv command on macOS.");
+        return (exec_t){0, xstring_init_format("rootfs_part=a\n"), xstring_init_empty()};
     } else {
         XLOG_T("Simulating Run `%s`", command);
     }
@@ -31,43 +47,390 @@ exec_t exec_command(const char *command) {
 
 exec_t exec_command(const char *command) {
     if (command == NULL) {
-        return (exec_t){X_RET_INVAL, xstring_init_empty()};
+        return (exec_t){X_RET_INVAL, xstring_init_empty(), xstring_init_empty()};
+    }
+
+    char *const argv[] = {"/bin/sh", "-c", (char *)command, NULL};
+    return exec_run(argv, 0);
+}
+
+#endif /* __APPLE__ */
+
+#define EXEC_CAPTURE_INITIAL (16 * 1024)
+#define EXEC_READ_CHUNK (64 * 1024)
+
+typedef struct {
+    int fd;             // read end of the pipe, -1 once closed
+    char *buf;
+    size_t len;
+    size_t cap;
+} exec_stream_t;
+
+struct exec_proc_priv {
+    pid_t pid;
+    exec_stream_t streams[2];   // stdout, stderr
+    int in_fd;                  // write end of stdin, -1 once all is fed
+    const char *in;             // what is left to feed, owned by the caller
+    size_t in_len;
+};
+
+static int64_t exec_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void exec_stream_close(exec_stream_t *st) {
+    if (st->fd >= 0) {
+        close(st->fd);
+        st->fd = -1;
+    }
+}
+
+/* Reads what is available, keeping at most EXEC_CAPTURE_LIMIT bytes. */
+static void exec_stream_read(exec_stream_t *st) {
+    for (;;) {
+        if (st->cap - st->len < EXEC_READ_CHUNK / 4 && st->cap < EXEC_CAPTURE_LIMIT + 1) {
+            size_t cap = st->cap ? st->cap * 2 : EXEC_CAPTURE_INITIAL;
+            if (cap > EXEC_CAPTURE_LIMIT + 1)
+                cap = EXEC_CAPTURE_LIMIT + 1;
+            char *buf = xbox_realloc(st->buf, cap);
+            if (buf != NULL) {
+                st->buf = buf;
+                st->cap = cap;
+            }
+        }
+
+        char discard[4096];
+        size_t room = st->cap > st->len ? st->cap - st->len - 1 : 0;
+        ssize_t n = room > 0 ? read(st->fd, st->buf + st->len, room)
+                             : read(st->fd, discard, sizeof(discard));
+        if (n > 0) {
+            if (room > 0)
+                st->len += (size_t)n;
+            continue;
+        }
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+
+        exec_stream_close(st);
+        return;
+    }
+}
+
+/* Hands the captured bytes to an xstring without copying large outputs. */
+static xstring exec_stream_take(exec_stream_t *st) {
+    if (st->buf == NULL)
+        return xstring_init_empty();
+
+    st->buf[st->len] = '\0';
+    if (st->len < X_STRING_DEFAULT_CAP) {
+        xstring s = xstring_init_iter(st->buf);
+        xbox_free(st->buf);
+        st->buf = NULL;
+        return s;
+    }
+
+    xstring s = xstring_init_take(st->buf, (int)st->len, (int)st->cap);
+    st->buf = NULL;
+    return s;
+}
+
+/* Feeds what the pipe takes, SIGPIPE is held back if the command quit reading. */
+static void exec_stdin_write(exec_proc proc) {
+    sigset_t pipe_set, old;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, &old);
+
+    while (proc->in_len > 0) {
+        ssize_t n = write(proc->in_fd, proc->in, proc->in_len);
+        if (n > 0) {
+            proc->in += n;
+            proc->in_len -= (size_t)n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+
+        if (n < 0 && errno == EPIPE) {
+            // Drop the signal raised for this write before unblocking it
+            struct timespec zero = {0, 0};
+            sigtimedwait(&pipe_set, NULL, &zero);
+        }
+        proc->in_len = 0;
+    }
+
+    if (proc->in_len == 0) {
+        close(proc->in_fd);
+        proc->in_fd = -1;
     }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+static void exec_proc_free(exec_proc proc) {
+    if (proc->in_fd >= 0)
+        close(proc->in_fd);
+    for (int i = 0; i < 2; i++) {
+        exec_stream_close(&proc->streams[i]);
+        if (proc->streams[i].buf)
+            xbox_free(proc->streams[i].buf);
+    }
+    free(proc);
+}
+
+static int exec_pipe(int fds[2]) {
+    // Close-on-exec from the start, another thread may be spawning meanwhile
+    if (pipe2(fds, O_CLOEXEC) != 0)
+        return -1;
 
-    exec_t result = {0};
-    FILE *fp = NULL;
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    return 0;
+}
 
-    fp = popen(command, "r");
-    if (fp == NULL) {
-        XLOG_D("Failed to run command: %s", command);
-        return (exec_t){X_RET_ERROR, xstring_init_empty()};
+static exec_proc exec_spawn_input(char *const argv[], const char *input, size_t len) {
+    if (argv == NULL || argv[0] == NULL)
+        return NULL;
+
+    int out[2] = {-1, -1};
+    int err[2] = {-1, -1};
+    int in[2] = {-1, -1};
+    if (exec_pipe(out) != 0 || exec_pipe(err) != 0) {
+        XLOG_D("Failed to create pipes for %s: %s", argv[0], strerror(errno));
+        goto fail;
+    }
+    if (input != NULL) {
+        if (exec_pipe(in) != 0) {
+            XLOG_D("Failed to create pipes for %s: %s", argv[0], strerror(errno));
+            goto fail;
+        }
+        // exec_pipe() makes the read end non-blocking, here it is ours to write
+        fcntl(in[0], F_SETFL, fcntl(in[0], F_GETFL) & ~O_NONBLOCK);
+        fcntl(in[1], F_SETFL, fcntl(in[1], F_GETFL) | O_NONBLOCK);
     }
 
-    char buf[32];
-    while (fgets(buf, sizeof(buf), fp) != NULL) {
-        xstring_cat(&result.output, buf);
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, err[1], STDERR_FILENO);
+    if (input != NULL)
+        posix_spawn_file_actions_adddup2(&actions, in[0], STDIN_FILENO);
+
+    // Own process group, so a timeout also takes down whatever it started.
+    // Nothing of the caller's signal state is passed on: no blocked signals
+    // (e.g. SIGPIPE held back around a write), no ignored ones.
+    sigset_t defaults, mask;
+    sigfillset(&defaults);
+    sigdelset(&defaults, SIGKILL);
+    sigdelset(&defaults, SIGSTOP);
+    sigemptyset(&mask);
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setsigmask(&attr, &mask);
+
+    pid_t pid = -1;
+    int rc = posix_spawnp(&pid, argv[0], &actions, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (rc != 0) {
+        errno = rc;
+        XLOG_D("Failed to run %s: %s", argv[0], strerror(rc));
+        goto fail;
     }
 
-    result.code = pclose(fp);
+    close(out[1]);
+    close(err[1]);
+    if (in[0] >= 0)
+        close(in[0]);
+
+    exec_proc proc = calloc(1, sizeof(*proc));
+    if (proc == NULL) {
+        // Nobody could reap it otherwise
+        kill(-pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        close(out[0]);
+        close(err[0]);
+        if (in[1] >= 0)
+            close(in[1]);
+        return NULL;
+    }
+
+    proc->pid = pid;
+    proc->streams[0].fd = out[0];
+    proc->streams[1].fd = err[0];
+    proc->in_fd = in[1];
+    proc->in = input;
+    proc->in_len = len;
+    if (proc->in_fd >= 0)
+        exec_stdin_write(proc);
+    return proc;
+
+fail:
+    for (int i = 0; i < 2; i++) {
+        if (out[i] >= 0) close(out[i]);
+        if (err[i] >= 0) close(err[i]);
+        if (in[i] >= 0) close(in[i]);
+    }
+    return NULL;
+}
+
+exec_proc exec_spawn(char *const argv[]) {
+    return exec_spawn_input(argv, NULL, 0);
+}
+
+err_t exec_wait(exec_proc proc, int timeout_ms, exec_t *result) {
+    if (proc == NULL)
+        return X_RET_INVAL;
+
+    int64_t deadline = timeout_ms > 0 ? exec_now_ms() + timeout_ms : -1;
+    int status = 0;
+
+    for (;;) {
+        struct pollfd fds[3];
+        exec_stream_t *streams[3];
+        nfds_t nfds = 0;
+        for (int i = 0; i < 2; i++) {
+            if (proc->streams[i].fd >= 0) {
+                fds[nfds] = (struct pollfd){.fd = proc->streams[i].fd, .events = POLLIN};
+                streams[nfds++] = &proc->streams[i];
+            }
+        }
+        if (proc->in_fd >= 0) {
+            fds[nfds] = (struct pollfd){.fd = proc->in_fd, .events = POLLOUT};
+            streams[nfds++] = NULL;
+        }
+
+        int64_t left = deadline < 0 ? -1 : deadline - exec_now_ms();
+        if (deadline >= 0 && left <= 0)
+            return X_RET_TIMEOUT;
+
+        if (nfds > 0) {
+            int n = poll(fds, nfds, (int)left);
+            if (n < 0 && errno != EINTR)
+                return X_RET_ERROR;
+            if (n == 0)
+                return X_RET_TIMEOUT;
+
+            for (nfds_t i = 0; n > 0 && i < nfds; i++) {
+                if (fds[i].revents == 0)
+                    continue;
+                if (streams[i] != NULL)
+                    exec_stream_read(streams[i]);
+                else
+                    exec_stdin_write(proc);
+            }
+            continue;
+        }
+
+        // Both streams hit EOF, the command is exiting or detached them
+        pid_t r = waitpid(proc->pid, &status, deadline < 0 ? 0 : WNOHANG);
+        if (r == proc->pid)
+            break;
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0) {
+            status = -1;
+            break;
+        }
+
+        struct timespec pause = {.tv_sec = 0, .tv_nsec = 2 * 1000 * 1000};
+        nanosleep(&pause, NULL);
+    }
+
+    if (result) {
+        if (status < 0)
+            result->code = X_RET_ERROR;
+        else if (WIFEXITED(status))
+            result->code = WEXITSTATUS(status);
+        else if (WIFSIGNALED(status))
+            result->code = 128 + WTERMSIG(status);
+        else
+            result->code = X_RET_ERROR;
+        result->output = exec_stream_take(&proc->streams[0]);
+        result->error = exec_stream_take(&proc->streams[1]);
+    }
+
+    exec_proc_free(proc);
+    return X_RET_OK;
+}
+
+void exec_kill(exec_proc proc) {
+    if (proc == NULL)
+        return;
+
+    kill(-proc->pid, SIGKILL);
+    exec_wait(proc, 0, NULL);
+}
+
+exec_t exec_run(char *const argv[], int timeout_ms) {
+    return exec_run_input(argv, NULL, 0, timeout_ms);
+}
+
+exec_t exec_run_input(char *const argv[], const char *input, size_t len, int timeout_ms) {
+    exec_t result = {X_RET_ERROR, xstring_init_empty(), xstring_init_empty()};
+
+    exec_proc proc = exec_spawn_input(argv, input, len);
+    if (proc == NULL) {
+        result.code = errno == ENOENT ? X_RET_NOTENT : X_RET_ERROR;
+        return result;
+    }
+
+    if (exec_wait(proc, timeout_ms, &result) == X_RET_TIMEOUT) {
+        XLOG_W("Command %s timed out after %d ms, killing it", argv[0], timeout_ms);
+        kill(-proc->pid, SIGKILL);
+        exec_wait(proc, 0, &result);
+        result.code = X_RET_TIMEOUT;
+    }
 
     return result;
 }
 
-#endif /* __APPLE__ */
+xbool_t exec_find_program(const char *name) {
+    if (name == NULL || name[0] == '\0')
+        return xFALSE;
+
+    if (strchr(name, '/'))
+        return access(name, X_OK) == 0;
+
+    const char *path = getenv("PATH");
+    if (path == NULL)
+        path = "/usr/bin:/bin";
+
+    char candidate[PATH_MAX];
+    while (*path) {
+        const char *end = strchr(path, ':');
+        size_t len = end ? (size_t)(end - path) : strlen(path);
+
+        // An empty PATH entry means the current directory
+        if (len == 0)
+            snprintf(candidate, sizeof(candidate), "./%s", name);
+        else
+            snprintf(candidate, sizeof(candidate), "%.*s/%s", (int)len, path, name);
+        if (access(candidate, X_OK) == 0)
+            return xTRUE;
+
+        if (end == NULL)
+            break;
+        path = end + 1;
+    }
+
+    return xFALSE;
+}
 
 void assert_command(const char *cmd) {
 #ifdef __APPLE__
 #else
-    xstring c = xstring_init_format("which %s", cmd);
-    exec_t r = exec_command(xstring_to_string(&c));
-    if (!exec_success(r)) {
-        XLOG_E("fw_printenv not found in PATH");
+    if (!exec_find_program(cmd)) {
+        XLOG_E("%s not found in PATH", cmd);
         exit(-1);
     }
-
-    exec_free(r);
-    xstring_free(&c);
 #endif /* __APPLE__ */
 }
-
-
@@ -1,5 +1,17 @@
 /**
  * @brief exec header
+ *  Commands are started with posix_spawn, stdout and stderr are captured
+ *  separately through pipes, exec_run_input() also feeds stdin through one. Runs can be bounded by a timeout, and
+ *  exec_spawn()/exec_wait() let a caller keep working while a command runs.
+ *
+ * e.g.
+ *  char *const argv[] = {"fw_setenv", "rootfs_part", "b", NULL};
+ *  exec_t r = exec_run(argv, 5000);
+ *
+ *  exec_proc p = exec_spawn(argv);
+ *  ... other work ...
+ *  exec_wait(p, 5000, &r);
+ *
  * @file exec.h
  * @author Oswin
  * @date 2025-12-26
@@ -13,17 +25,74 @@ extern "C" {
 
 #include "xstring.h"
 
+/* Bytes kept per stream, anything beyond is read and discarded. */
+#ifndef EXEC_CAPTURE_LIMIT
+#define EXEC_CAPTURE_LIMIT (1024 * 1024)
+#endif /* EXEC_CAPTURE_LIMIT */
+
 typedef struct {
-    int code;
-    xstring output;
+    int code;           /**< Exit status, 128 + signal if killed, or a negative X_RET_* */
+    xstring output;     /**< Captured stdout */
+    xstring error;      /**< Captured stderr */
 } exec_t;
 
+/** @brief A command started by exec_spawn() and not yet waited for. */
+typedef struct exec_proc_priv *exec_proc;
+
+/**
+ * @brief Runs a shell command line through /bin/sh -c, without timeout.
+ */
 exec_t exec_command(const char *command);
+
+/**
+ * @brief Runs argv[0] (searched in PATH) with no shell involved.
+ * @param argv NULL terminated argument vector.
+ * @param timeout_ms Kill the command after this long, <= 0 waits forever.
+ * @return The result, code is X_RET_TIMEOUT if the command was killed.
+ */
+exec_t exec_run(char *const argv[], int timeout_ms);
+
+/**
+ * @brief Like exec_run(), with `input` fed to the command's stdin.
+ * @param input Bytes to write, stdin is closed once they are all taken.
+ * @param len Length of input.
+ */
+exec_t exec_run_input(char *const argv[], const char *input, size_t len, int timeout_ms);
+
+/**
+ * @brief Starts argv[0] (searched in PATH) and returns immediately.
+ * @return The process handle, or NULL if it could not be started.
+ */
+exec_proc exec_spawn(char *const argv[]);
+
+/**
+ * @brief Waits for a spawned command, capturing its output meanwhile.
+ * @param proc The process handle, released unless X_RET_TIMEOUT is returned.
+ * @param timeout_ms Give up after this long, <= 0 waits forever.
+ * @param result Receives the result when the command finished.
+ * @return X_RET_OK once finished, X_RET_TIMEOUT if still running.
+ */
+err_t exec_wait(exec_proc proc, int timeout_ms, exec_t *result);
+
+/**
+ * @brief Kills a spawned command with its process group and releases it.
+ */
+void exec_kill(exec_proc proc);
+
+/**
+ * @brief Whether `name` is an executable in PATH, like `which`.
+ */
+xbool_t exec_find_program(const char *name);
+
 #define exec_code(exe) ((exe).code)
 #define exec_output(exe) xstring_to_string(&(exe).output)
+#define exec_error(exe) xstring_to_string(&(exe).error)
+#define exec_output_view(exe) xstring_view(&(exe).output)
+#define exec_error_view(exe) xstring_view(&(exe).error)
 #define exec_success(exe) ((exe).code == 0)
 #define exec_free(exe) do { \
     xstring_free(&(exe).output); \
+    xstring_free(&(exe).error); \
 } while (0)
 
 
@@ -0,0 +1,213 @@
+#define XLOG_MOD "kexec"
+#include "kexec.h"
+#include "exec.h"
+#include "os_file.h"
+#include "xlog.h"
+#include "xstring.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifndef __APPLE__
+#include <linux/reboot.h>
+#include <sys/reboot.h>
+#include <sys/syscall.h>
+#endif /* __APPLE__ */
+
+#define KEXEC_CMDLINE_PATH "/proc/cmdline"
+
+#ifndef KEXEC_FILE_NO_INITRAMFS
+#define KEXEC_FILE_NO_INITRAMFS 0x00000004
+#endif /* KEXEC_FILE_NO_INITRAMFS */
+
+static err_t native_load(const char *kernel, const char *cmdline) {
+#if defined(__APPLE__) || !defined(SYS_kexec_file_load)
+    XLOG_W("kexec_file_load is not available on this platform");
+    return X_RET_NOTSUP;
+#else
+    int fd = open(kernel, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        XLOG_E("Failed to open kernel %s: %s", kernel, strerror(errno));
+        return X_RET_ERROR;
+    }
+
+    // The length covers the terminating NUL
+    long rc = syscall(SYS_kexec_file_load, fd, -1, strlen(cmdline) + 1, cmdline,
+                      (unsigned long)KEXEC_FILE_NO_INITRAMFS);
+    int saved = errno;
+    close(fd);
+
+    if (rc != 0) {
+        XLOG_E("kexec_file_load of %s failed: %s", kernel, strerror(saved));
+        return saved == ENOSYS ? X_RET_NOTSUP : X_RET_ERROR;
+    }
+
+    return X_RET_OK;
+#endif /* __APPLE__ */
+}
+
+static err_t native_exec(void) {
+#ifdef __APPLE__
+    return X_RET_NOTSUP;
+#else
+    // systemd stops the services and unmounts everything, then boots the
+    // loaded kernel. Without it the caller reboots normally instead.
+    if (!os_file_exist("/run/systemd/system") || !exec_find_program("systemctl")) {
+        XLOG_W("No systemd to shut down through for kexec");
+        return X_RET_NOTSUP;
+    }
+
+    char *const argv[] = {"systemctl", "kexec", NULL};
+    exec_t r = exec_run(argv, 30000);
+    err_t err = exec_success(r) ? X_RET_OK : X_RET_ERROR;
+    if (err != X_RET_OK)
+        XLOG_E("systemctl kexec failed (%d): " XSTR_VIEW_FMT, r.code,
+               XSTR_VIEW_ARG(xstr_view_trim(exec_error_view(r))));
+    exec_free(r);
+    return err;
+#endif /* __APPLE__ */
+}
+
+err_t kexec_exec_immediately(void) {
+#ifdef __APPLE__
+    return X_RET_NOTSUP;
+#else
+    XLOG_W("Jumping into the loaded kernel without shutting down");
+    sync();
+    reboot(LINUX_REBOOT_CMD_KEXEC);
+
+    // Only reached when the kernel refused
+    XLOG_E("kexec reboot failed: %s", strerror(errno));
+    return X_RET_ERROR;
+#endif /* __APPLE__ */
+}
+
+static const kexec_ops_t g_native_ops = {
+    .name = "native",
+    .load = native_load,
+    .exec = native_exec,
+};
+
+const kexec_ops_t *kexec_native_ops(void) {
+    return &g_native_ops;
+}
+
+static char g_record_path[PATH_MAX];
+
+static err_t record_append(const char *line) {
+    return os_file_write_append(g_record_path, (const uint8_t *)line, strlen(line));
+}
+
+static err_t record_load(const char *kernel, const char *cmdline) {
+    if (!os_file_exist(kernel)) {
+        XLOG_E("Kernel %s does not exist", kernel);
+        return X_RET_NOTENT;
+    }
+
+    char line[PATH_MAX + 4096];
+    snprintf(line, sizeof(line), "load kernel=%s cmdline=%s\n", kernel, cmdline);
+    return record_append(line);
+}
+
+static err_t record_exec(void) {
+    XLOG_I("Recorded kexec request to %s instead of executing it", g_record_path);
+    return record_append("exec\n");
+}
+
+static const kexec_ops_t g_record_ops = {
+    .name = "record",
+    .load = record_load,
+    .exec = record_exec,
+};
+
+const kexec_ops_t *kexec_record_ops(const char *path) {
+    if (path == NULL)
+        return NULL;
+
+    snprintf(g_record_path, sizeof(g_record_path), "%s", path);
+    return &g_record_ops;
+}
+
+err_t kexec_build_cmdline(const char *root_source, char *buf, size_t len) {
+    if (root_source == NULL || buf == NULL || len == 0)
+        return X_RET_INVAL;
+
+    // procfs reports a size of 0, so it can not go through os_file_readall()
+    char current[4096] = {0};
+    FILE *fp = fopen(KEXEC_CMDLINE_PATH, "r");
+    if (fp == NULL || fgets(current, sizeof(current), fp) == NULL) {
+        XLOG_E("Failed to read %s", KEXEC_CMDLINE_PATH);
+        if (fp)
+            fclose(fp);
+        return X_RET_ERROR;
+    }
+    fclose(fp);
+
+    // Keep every parameter but root=, which is pointed at the slot. Anything
+    // after "--" belongs to init, so a missing root= goes in before it.
+    size_t pos = 0;
+    xbool_t has_root = xFALSE;
+    xbool_t init_args = xFALSE;
+    xstr_view rest = xstr_view_of(current), tok;
+    buf[0] = '\0';
+    while (xstr_view_next_token(&rest, " \t\n", &tok)) {
+        int n;
+        if (!init_args && xstr_view_equal(tok, XSTR_VIEW_LIT("--"), X_CASE)) {
+            init_args = xTRUE;
+            n = has_root ? snprintf(buf + pos, len - pos, "%s--", pos ? " " : "")
+                         : snprintf(buf + pos, len - pos, "%sroot=%s --", pos ? " " : "", root_source);
+            has_root = xTRUE;
+        } else if (!init_args && xstr_view_has_prefix(tok, XSTR_VIEW_LIT("root="), X_CASE)) {
+            if (has_root)
+                continue;
+            n = snprintf(buf + pos, len - pos, "%sroot=%s", pos ? " " : "", root_source);
+            has_root = xTRUE;
+        } else {
+            n = snprintf(buf + pos, len - pos, "%s" XSTR_VIEW_FMT, pos ? " " : "", XSTR_VIEW_ARG(tok));
+        }
+
+        if (n < 0 || (size_t)n >= len - pos)
+            return X_RET_OVERFLOW;
+        pos += n;
+    }
+
+    if (!has_root) {
+        int n = snprintf(buf + pos, len - pos, "%sroot=%s", pos ? " " : "", root_source);
+        if (n < 0 || (size_t)n >= len - pos)
+            return X_RET_OVERFLOW;
+    }
+
+    return X_RET_OK;
+}
+
+err_t kexec_load_slot(const kexec_ops_t *ops, const char *slot_root, const char *root_source) {
+    if (ops == NULL || slot_root == NULL || root_source == NULL)
+        return X_RET_INVAL;
+
+    static const char *candidates[] = KEXEC_KERNEL_CANDIDATES;
+    char kernel[PATH_MAX];
+    const char *found = NULL;
+    for (int i = 0; candidates[i] != NULL && found == NULL; i++) {
+        snprintf(kernel, sizeof(kernel), "%s%s", strcmp(slot_root, "/") ? slot_root : "", candidates[i]);
+        if (os_file_exist(kernel))
+            found = kernel;
+    }
+
+    if (found == NULL) {
+        XLOG_W("No kernel image found under %s", slot_root);
+        return X_RET_NOTENT;
+    }
+
+    char cmdline[4096];
+    err_t err = kexec_build_cmdline(root_source, cmdline, sizeof(cmdline));
+    if (err != X_RET_OK) {
+        XLOG_E("Failed to build kernel command line: %s", err_str(err));
+        return err;
+    }
+
+    XLOG_D("Loading %s with '%s' (%s backend)", found, cmdline, ops->name);
+    return ops->load(found, cmdline);
+}
@@ -0,0 +1,78 @@
+/**
+ * @brief Fast reboot into another slot via kexec.
+ *  Loads the kernel found in a slot's root filesystem with the running
+ *  command line, root= pointing at the slot, and jumps into it without
+ *  going through firmware and bootloader again.
+ *
+ *  The syscalls sit behind kexec_ops_t so that a dev machine can use the
+ *  record backend, which writes the request to a file instead.
+ *
+ * e.g.
+ *  const kexec_ops_t *ops = kexec_native_ops();
+ *  if (kexec_load_slot(ops, "/mnt/inactive_partition", "ubi0:b") == X_RET_OK)
+ *      ops->exec();
+ *
+ * @file kexec.h
+ * @author Oswin
+ * @date 2026-01-20
+ * @details
+ */
+#ifndef KEXEC_H_
+#define KEXEC_H_
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "xdef.h"
+
+/* Kernel images looked up in the slot, first match wins. */
+#define KEXEC_KERNEL_CANDIDATES {"/boot/zImage", "/boot/Image", "/boot/vmlinuz", NULL}
+
+typedef struct {
+    const char *name;
+    /** Loads `kernel` with `cmdline` as the image to boot next. */
+    err_t (*load)(const char *kernel, const char *cmdline);
+    /** Hands the loaded image to an orderly shutdown, X_RET_OK once it is under way. */
+    err_t (*exec)(void);
+} kexec_ops_t;
+
+/**
+ * @brief The backend using kexec_file_load(2) and `systemctl kexec`.
+ */
+const kexec_ops_t *kexec_native_ops(void);
+
+/**
+ * @brief Boots the loaded image right away with reboot(2), after sync(2).
+ *  Services are not stopped and filesystems stay mounted, so this is only a
+ *  last resort when neither the init system nor `reboot` could be used.
+ * @return Only returns, with an error code, when the kernel refused.
+ */
+err_t kexec_exec_immediately(void);
+
+/**
+ * @brief A stand-in backend that appends each request to `path`.
+ */
+const kexec_ops_t *kexec_record_ops(const char *path);
+
+/**
+ * @brief Builds the command line for the slot from /proc/cmdline.
+ * @param root_source The root device of the slot, e.g. "ubi0:b".
+ * @param buf Receives the command line.
+ * @param len The size of buf.
+ * @return X_RET_OK on success, X_RET_OVERFLOW if buf is too small.
+ */
+err_t kexec_build_cmdline(const char *root_source, char *buf, size_t len);
+
+/**
+ * @brief Loads the kernel of the slot mounted at `slot_root`.
+ * @param ops The backend.
+ * @param slot_root Where the slot's root filesystem is mounted.
+ * @param root_source The root device of the slot, e.g. "ubi0:b".
+ * @return X_RET_OK on success, X_RET_NOTENT without kernel, or an error code.
+ */
+err_t kexec_load_slot(const kexec_ops_t *ops, const char *slot_root, const char *root_source);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* KEXEC_H_ */
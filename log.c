@@ -0,0 +1,76 @@
+#define XLOG_MOD "log"
+#include "log.h"
+#include "version.h"
+#include "xlog.h"
+#include "xlog_recorder.h"
+#include <stdio.h>
+
+/* Formats resolve only in the build that recorded them */
+#define LOG_IMAGE_ID GIT_DESCRIBE " " BUILD_TIME
+
+typedef struct {
+    xoption this_option;
+    struct {
+        char *file;
+        int sessions;
+        char *level;
+    } flags;
+} log_context_t;
+
+static log_context_t g_log_ctx = {
+    .this_option = NULL,
+    .flags = {
+        .file = FLIGHT_RECORDER_PATH,
+        .sessions = 0,
+        .level = NULL,
+    },
+};
+
+static err_t log_decode_run(xoption self);
+
+err_t log_recorder_start(void) {
+    return xlog_recorder_open(FLIGHT_RECORDER_PATH, XLOG_RECORDER_DEFAULT_SIZE, LOG_IMAGE_ID);
+}
+
+err_t log_usage_init(xoption root) {
+    if (!root)
+        return X_RET_INVAL;
+
+    if (g_log_ctx.this_option)
+        return X_RET_OK;
+
+    xoption log = xoption_create_subcommand(root, "log", "Inspect the flight recorder.");
+    xoption decode = xoption_create_subcommand(log, "decode", "Render the flight recorder as text, oldest first.");
+    xoption_set_context(decode, &g_log_ctx);
+    xoption_set_post_parse_callback(decode, log_decode_run);
+    xoption_add_string(decode, 'f', "file", "<flight.rec>",
+                       "Path to the record file (default " FLIGHT_RECORDER_PATH ")",
+                       &g_log_ctx.flags.file, xFALSE);
+    xoption_add_number(decode, 'n', "sessions", "<count>",
+                       "Only show what was recorded since the last <count> iota-cli runs started",
+                       &g_log_ctx.flags.sessions, xFALSE);
+    xoption_add_string(decode, 'l', "level", "<level>",
+                       "Skip records below trace, debug, info, warn, error or fatal",
+                       &g_log_ctx.flags.level, xFALSE);
+
+    g_log_ctx.this_option = log;
+
+    return X_RET_OK;
+}
+
+static err_t log_decode_run(xoption self) {
+    xlog_lvl_e lvl = XLOG_LVL_TRACE;
+    if (g_log_ctx.flags.level && xlog_lvl_parse(g_log_ctx.flags.level, &lvl) != X_RET_OK) {
+        XLOG_E("Unknown level '%s'", g_log_ctx.flags.level);
+        return X_RET_INVAL;
+    }
+
+    err_t err = xlog_recorder_decode(g_log_ctx.flags.file, stdout, LOG_IMAGE_ID,
+                                     g_log_ctx.flags.sessions, lvl);
+    if (err == X_RET_NOTENT)
+        XLOG_E("No flight recorder at %s", g_log_ctx.flags.file);
+    else if (err != X_RET_OK)
+        XLOG_E("%s is not a flight recorder file: %s", g_log_ctx.flags.file, err_str(err));
+
+    return err;
+}
@@ -0,0 +1,39 @@
+/**
+ * @brief iota log command implementation.
+ *  Every iota-cli run keeps its full log history, trace level included, in
+ *  a binary flight recorder under /var/ota (see xlog_recorder.h). Nothing is
+ *  formatted while recording; "iota-cli log decode" renders the records,
+ *  e.g. after an upgrade failed in the field. It has to be the same build
+ *  that wrote them.
+ *
+ * e.g.
+ *  - iota-cli log decode
+ *  - iota-cli log decode --sessions 2 --level debug
+ *  - iota-cli log decode -f /tmp/flight.rec
+ *
+ * @file log.h
+ * @author Oswin
+ * @date 2026-02-04
+ * @details
+ */
+#ifndef LOG_H_
+#define LOG_H_
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "xoption.h"
+
+#define FLIGHT_RECORDER_PATH "/var/ota/flight.rec"
+
+/**
+ * @brief Starts the flight recorder for this process.
+ */
+err_t log_recorder_start(void);
+
+err_t log_usage_init(xoption root);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* LOG_H_ */
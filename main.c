@@ -2,11 +2,14 @@
 #include <stdio.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <string.h>
 #include "main.h"
 #include "xoption.h"
 #include "version.h"
 #include "checkout.h"
 #include "upgrade.h"
+#include "serve.h"
+#include "log.h"
 
 static void sigint_handler(int sig);
 static void show_version(xoption context, void* user_data);
@@ -14,6 +17,9 @@ static void show_full_version(xoption context, void* user_data);
 
 int main(int argc, char** argv){
     signal(SIGINT, sigint_handler);
+    // `log` reads the recorder, its own run must not become the newest session
+    if (argc < 2 || strcmp(argv[1], "log"))
+        log_recorder_start();
 
     xoption root = xoption_create_root();
     xoption_set_prefix_prompt(root, CLI_PROMPT);
@@ -25,6 +31,8 @@ int main(int argc, char** argv){
     // Add subcommand
     checkout_usage_init(root);
     upgrade_usage_init(root);
+    serve_usage_init(root);
+    log_usage_init(root);
 
     err_t err = xoption_parse(root, argc, argv);
     xoption_destroy(root);
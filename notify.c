@@ -1,15 +1,127 @@
+#define XLOG_MOD "notify"
 #include "notify.h"
+#include "dbus_interfaces.h"
+#include "notify_shm.h"
+#include "notify_socket.h"
+#include "xlog.h"
+#include <stdio.h>
+#include <string.h>
 
-static notify_operators_t *notify_ops = NULL;
+static notify_operators_t *notify_ops[NOTIFY_MAX_OPERATORS];
+static int notify_ops_count = 0;
+
+static err_t fanout_progress_changed(const char *step, int percent, uint64_t total, uint64_t current) {
+    err_t err = X_RET_OK;
+    for (int i = 0; i < notify_ops_count; i++) {
+        if (notify_ops[i]->progress_changed &&
+            notify_ops[i]->progress_changed(step, percent, total, current) != X_RET_OK)
+            err = X_RET_ERROR;
+    }
+    return err;
+}
+
+static err_t fanout_message_logged(const char *msg) {
+    err_t err = X_RET_OK;
+    for (int i = 0; i < notify_ops_count; i++) {
+        if (notify_ops[i]->message_logged && notify_ops[i]->message_logged(msg) != X_RET_OK)
+            err = X_RET_ERROR;
+    }
+    return err;
+}
+
+static err_t fanout_error_occurred(int err_code, const char *err_msg) {
+    err_t err = X_RET_OK;
+    for (int i = 0; i < notify_ops_count; i++) {
+        if (notify_ops[i]->error_occurred && notify_ops[i]->error_occurred(err_code, err_msg) != X_RET_OK)
+            err = X_RET_ERROR;
+    }
+    return err;
+}
+
+static err_t fanout_job_started(void) {
+    err_t err = X_RET_OK;
+    for (int i = 0; i < notify_ops_count; i++) {
+        if (notify_ops[i]->job_started && notify_ops[i]->job_started() != X_RET_OK)
+            err = X_RET_ERROR;
+    }
+    return err;
+}
+
+static err_t fanout_job_finished(int err_code) {
+    err_t err = X_RET_OK;
+    for (int i = 0; i < notify_ops_count; i++) {
+        if (notify_ops[i]->job_finished && notify_ops[i]->job_finished(err_code) != X_RET_OK)
+            err = X_RET_ERROR;
+    }
+    return err;
+}
+
+static notify_operators_t fanout_ops = {
+    .progress_changed = fanout_progress_changed,
+    .message_logged = fanout_message_logged,
+    .error_occurred = fanout_error_occurred,
+    .job_started = fanout_job_started,
+    .job_finished = fanout_job_finished,
+};
 
 err_t register_notify_operators(notify_operators_t *ops) {
     if (ops == NULL) {
         return X_RET_INVAL;
     }
-    notify_ops = ops;
+
+    for (int i = 0; i < notify_ops_count; i++) {
+        if (notify_ops[i] == ops)
+            return X_RET_OK;
+    }
+
+    if (notify_ops_count == NOTIFY_MAX_OPERATORS) {
+        return X_RET_FULL;
+    }
+
+    notify_ops[notify_ops_count++] = ops;
     return X_RET_OK;
 }
 
 notify_operators_t *get_notify_operators() {
-    return notify_ops;
+    // A single transport is called directly
+    if (notify_ops_count == 0)
+        return NULL;
+    return notify_ops_count == 1 ? notify_ops[0] : &fanout_ops;
+}
+
+err_t notify_setup(const char *spec) {
+    if (spec == NULL) {
+        return X_RET_INVAL;
+    }
+
+    char buf[512];
+    snprintf(buf, sizeof(buf), "%s", spec);
+
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+        char *arg = strchr(tok, ':');
+        if (arg)
+            *arg++ = '\0';
+
+        err_t err;
+        if (!strcmp(tok, "dbus")) {
+            register_dbus_notify_operators();
+            err = X_RET_OK;
+        } else if (!strcmp(tok, "socket")) {
+            err = register_socket_notify_operators(arg);
+        } else if (!strcmp(tok, "shm")) {
+            err = register_shm_notify_operators(arg);
+        } else {
+            XLOG_E("Unknown notify transport '%s'", tok);
+            return X_RET_INVAL;
+        }
+
+        if (err != X_RET_OK) {
+            XLOG_E("Failed to set up notify transport '%s': %s", tok, err_str(err));
+            return err;
+        }
+        XLOG_D("Notify transport '%s' registered", tok);
+    }
+
+    return X_RET_OK;
 }
@@ -1,3 +1,22 @@
+/**
+ * @brief Notification operators.
+ *  Upgrade progress, messages and errors are reported through
+ *  notify_operators_t. Several transports can be registered at once, the
+ *  operators returned by get_notify_operators() forward to all of them.
+ *
+ *  Transports, selected with notify_setup():
+ *   - dbus                     signals on the system bus, see dbus_interfaces.h
+ *   - socket[:<path>]          datagrams to a unix socket, see notify_socket.h
+ *   - shm[:<path>]             a status page in /run, see notify_shm.h
+ *
+ * e.g.
+ *  notify_setup("shm,socket:/run/iota/monitor.sock");
+ *
+ * @file notify.h
+ * @author Oswin
+ * @date 2025-12-26
+ * @details
+ */
 #ifndef NOTIFY_H_
 #define NOTIFY_H_
 #ifdef __cplusplus
@@ -6,10 +25,15 @@ extern "C" {
 
 #include "xdef.h"
 
+/* Transports that can be registered at the same time. */
+#define NOTIFY_MAX_OPERATORS 4
+
 typedef struct {
-    err_t (*progress_changed)(const char *step, int precent, int total, int current);
+    err_t (*progress_changed)(const char *step, int precent, uint64_t total, uint64_t current);
     err_t (*message_logged)(const char *msg);
     err_t (*error_occurred)(int err_code, const char *err_msg);
+    err_t (*job_started)(void);                 // optional, before the first event of a job
+    err_t (*job_finished)(int err_code);        // optional, X_RET_OK when the job succeeded
 
     // Additional notification operators can be added here
     // void (*firmware_info)(const char *version, const char *date);
@@ -17,9 +41,26 @@ typedef struct {
     // void (*reboot_event)(const char *reason, int delay_seconds);
 } notify_operators_t;
 
+/**
+ * @brief Adds a transport, registering the same one twice is a no-op.
+ *  Register before any thread reports through the operators.
+ * @return X_RET_OK, or X_RET_FULL after NOTIFY_MAX_OPERATORS.
+ */
 err_t register_notify_operators(notify_operators_t *ops);
+
+/**
+ * @brief The operators to report through, NULL if none is registered.
+ */
 notify_operators_t *get_notify_operators();
 
+/**
+ * @brief Registers the transports in a comma separated list.
+ * @param spec e.g. "dbus,shm" or "socket:/run/iota/monitor.sock".
+ * @return X_RET_OK, X_RET_INVAL for an unknown transport, or the error of
+ *  the transport that failed to start.
+ */
+err_t notify_setup(const char *spec);
+
 
 #ifdef __cplusplus
 }
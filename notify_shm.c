@@ -0,0 +1,150 @@
+#define XLOG_MOD "notify"
+#include "notify_shm.h"
+#include "os_file.h"
+#include "xlog.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+static notify_shm_page_t *g_page = NULL;
+
+static void page_begin(void) {
+    atomic_fetch_add_explicit(&g_page->seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void page_end(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    g_page->updated_ms = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    g_page->events++;
+
+    atomic_fetch_add_explicit(&g_page->seq, 1, memory_order_release);
+}
+
+static void page_copy(char *dst, size_t len, const char *src) {
+    size_t n = src ? strnlen(src, len - 1) : 0;
+    if (n > 0)
+        memcpy(dst, src, n);
+    dst[n] = '\0';
+}
+
+static err_t shm_progress_changed(const char *step, int percent, uint64_t total, uint64_t current) {
+    page_begin();
+    g_page->state = NOTIFY_SHM_RUNNING;
+    g_page->percent = percent;
+    g_page->total = total;
+    g_page->current = current;
+    // Most updates stay within one step
+    if (strncmp(g_page->step, step ? step : "", sizeof(g_page->step)) != 0)
+        page_copy(g_page->step, sizeof(g_page->step), step);
+    page_end();
+    return X_RET_OK;
+}
+
+static err_t shm_message_logged(const char *msg) {
+    page_begin();
+    if (g_page->state == NOTIFY_SHM_IDLE)
+        g_page->state = NOTIFY_SHM_RUNNING;
+    page_copy(g_page->message, sizeof(g_page->message), msg);
+    page_end();
+    return X_RET_OK;
+}
+
+static err_t shm_error_occurred(int err_code, const char *err_msg) {
+    page_begin();
+    g_page->state = NOTIFY_SHM_FAILED;
+    g_page->error_code = err_code;
+    page_copy(g_page->message, sizeof(g_page->message), err_msg);
+    page_end();
+    return X_RET_OK;
+}
+
+static err_t shm_job_started(void) {
+    // Nothing of the previous job's outcome may carry over
+    page_begin();
+    g_page->state = NOTIFY_SHM_RUNNING;
+    g_page->percent = 0;
+    g_page->error_code = 0;
+    g_page->total = 0;
+    g_page->current = 0;
+    g_page->step[0] = '\0';
+    g_page->message[0] = '\0';
+    page_end();
+    return X_RET_OK;
+}
+
+static err_t shm_job_finished(int err_code) {
+    page_begin();
+    g_page->state = err_code == X_RET_OK ? NOTIFY_SHM_SUCCEEDED : NOTIFY_SHM_FAILED;
+    g_page->error_code = err_code;
+    if (err_code == X_RET_OK)
+        g_page->percent = 100;
+    page_end();
+    return X_RET_OK;
+}
+
+err_t register_shm_notify_operators(const char *path) {
+    static notify_operators_t shm_notify_ops = {
+        .progress_changed = shm_progress_changed,
+        .message_logged = shm_message_logged,
+        .error_occurred = shm_error_occurred,
+        .job_started = shm_job_started,
+        .job_finished = shm_job_finished,
+    };
+
+    if (g_page != NULL)
+        return register_notify_operators(&shm_notify_ops);
+
+    if (path == NULL || *path == '\0')
+        path = NOTIFY_SHM_DEFAULT_PATH;
+
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    if (os_mkdir_p(dirname(dir), 0755) != X_RET_OK) {
+        XLOG_E("Failed to create directory for %s: %s", path, strerror(errno));
+        return X_RET_ERROR;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        XLOG_E("Failed to open status page %s: %s", path, strerror(errno));
+        return X_RET_ERROR;
+    }
+
+    if (ftruncate(fd, sizeof(notify_shm_page_t)) != 0) {
+        XLOG_E("Failed to size status page %s: %s", path, strerror(errno));
+        close(fd);
+        return X_RET_ERROR;
+    }
+
+    void *page = mmap(NULL, sizeof(notify_shm_page_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) {
+        XLOG_E("Failed to map status page %s: %s", path, strerror(errno));
+        return X_RET_ERROR;
+    }
+
+    // Start over from a clean page, readers see it as one update. A writer
+    // that died halfway left the sequence odd.
+    g_page = page;
+    unsigned seq = atomic_load_explicit(&g_page->seq, memory_order_relaxed);
+    if (seq & 1)
+        atomic_store_explicit(&g_page->seq, seq + 1, memory_order_relaxed);
+    page_begin();
+    memset((char *)g_page + offsetof(notify_shm_page_t, pid), 0,
+           sizeof(*g_page) - offsetof(notify_shm_page_t, pid));
+    g_page->magic = NOTIFY_SHM_MAGIC;
+    g_page->version = NOTIFY_SHM_VERSION;
+    g_page->pid = (uint32_t)getpid();
+    g_page->state = NOTIFY_SHM_IDLE;
+    page_end();
+
+    return register_notify_operators(&shm_notify_ops);
+}
@@ -0,0 +1,86 @@
+/**
+ * @brief Shared memory notify transport.
+ *  The latest state is kept in a fixed-layout page in /run, guarded by a
+ *  sequence lock. The reporting thread pays a few stores per event, and a
+ *  local monitor maps the page read-only and polls it without any syscall.
+ *
+ *  Events must come from one thread at a time, like the upgrade thread.
+ *
+ * e.g.
+ *  int fd = open(NOTIFY_SHM_DEFAULT_PATH, O_RDONLY);
+ *  const notify_shm_page_t *page = mmap(NULL, sizeof(*page), PROT_READ, MAP_SHARED, fd, 0);
+ *  notify_shm_page_t snap;
+ *  if (notify_shm_snapshot(page, &snap))
+ *      printf("%s %d%%\n", snap.step, snap.percent);
+ *
+ * @file notify_shm.h
+ * @author Oswin
+ * @date 2026-02-02
+ * @details
+ */
+#ifndef NOTIFY_SHM_H_
+#define NOTIFY_SHM_H_
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "notify.h"
+#include <stdatomic.h>
+#include <string.h>
+
+#define NOTIFY_SHM_DEFAULT_PATH "/run/iota/status"
+#define NOTIFY_SHM_MAGIC        0x41544f49  /* "IOTA" */
+#define NOTIFY_SHM_VERSION      2
+
+typedef enum {
+    NOTIFY_SHM_IDLE,
+    NOTIFY_SHM_RUNNING,
+    NOTIFY_SHM_FAILED,          /**< The last job failed, until the next one starts */
+    NOTIFY_SHM_SUCCEEDED,       /**< The last job succeeded, until the next one starts */
+} notify_shm_state_e;
+
+typedef struct {
+    uint32_t magic;             /**< NOTIFY_SHM_MAGIC once initialized */
+    uint32_t version;           /**< NOTIFY_SHM_VERSION */
+    atomic_uint seq;            /**< Odd while the writer is updating */
+    uint32_t pid;               /**< The writing process */
+    uint32_t state;             /**< notify_shm_state_e */
+    int32_t percent;
+    int32_t error_code;         /**< Last error, 0 if none */
+    uint32_t events;            /**< Events written so far */
+    uint64_t total;
+    uint64_t current;
+    uint64_t updated_ms;        /**< CLOCK_MONOTONIC of the last event */
+    char step[64];
+    char message[256];          /**< Last message or error text */
+} notify_shm_page_t;
+
+/**
+ * @brief Copies a consistent state out of a mapped page.
+ * @return xFALSE if the page is not initialized or kept changing.
+ */
+static inline xbool_t notify_shm_snapshot(const notify_shm_page_t *page, notify_shm_page_t *snap) {
+    for (int tries = 0; tries < 100; tries++) {
+        unsigned begin = atomic_load_explicit(&page->seq, memory_order_acquire);
+        if (begin & 1)
+            continue;
+
+        memcpy(snap, (const void *)page, sizeof(*snap));
+        atomic_thread_fence(memory_order_acquire);
+
+        if (atomic_load_explicit(&page->seq, memory_order_relaxed) == begin)
+            return snap->magic == NOTIFY_SHM_MAGIC;
+    }
+    return xFALSE;
+}
+
+/**
+ * @brief Registers the transport writing the page at `path`.
+ * @param path The page, NULL for NOTIFY_SHM_DEFAULT_PATH.
+ */
+err_t register_shm_notify_operators(const char *path);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* NOTIFY_SHM_H_ */
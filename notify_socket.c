@@ -0,0 +1,84 @@
+#define XLOG_MOD "notify"
+#include "notify_socket.h"
+#include "xlog.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* Longer events are truncated */
+#define DATAGRAM_MAX 1024
+
+static int g_socket_fd = -1;
+static struct sockaddr_un g_socket_addr;
+static socklen_t g_socket_addr_len;
+
+static err_t socket_send(const char *buf, int len) {
+    if (len < 0)
+        return X_RET_ERROR;
+    // snprintf reports the untruncated length
+    if (len >= DATAGRAM_MAX)
+        len = DATAGRAM_MAX - 1;
+
+    if (sendto(g_socket_fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL,
+               (const struct sockaddr *)&g_socket_addr, g_socket_addr_len) < 0) {
+        // Nobody listening or a slow monitor, neither may stall the upgrade
+        if (errno == ENOENT || errno == ECONNREFUSED || errno == EAGAIN || errno == ENOBUFS)
+            return X_RET_OK;
+        return X_RET_ERROR;
+    }
+
+    return X_RET_OK;
+}
+
+static err_t socket_progress_changed(const char *step, int percent, uint64_t total, uint64_t current) {
+    char buf[DATAGRAM_MAX];
+    int len = snprintf(buf, sizeof(buf), "progress\t%s\t%d\t%ju\t%ju",
+                       step ? step : "", percent, (uintmax_t)current, (uintmax_t)total);
+    return socket_send(buf, len);
+}
+
+static err_t socket_message_logged(const char *msg) {
+    char buf[DATAGRAM_MAX];
+    int len = snprintf(buf, sizeof(buf), "message\t%s", msg ? msg : "");
+    return socket_send(buf, len);
+}
+
+static err_t socket_error_occurred(int err_code, const char *err_msg) {
+    char buf[DATAGRAM_MAX];
+    int len = snprintf(buf, sizeof(buf), "error\t%d\t%s", err_code, err_msg ? err_msg : "");
+    return socket_send(buf, len);
+}
+
+err_t register_socket_notify_operators(const char *path) {
+    static notify_operators_t socket_notify_ops = {
+        .progress_changed = socket_progress_changed,
+        .message_logged = socket_message_logged,
+        .error_occurred = socket_error_occurred,
+    };
+
+    if (path == NULL || *path == '\0')
+        path = NOTIFY_SOCKET_DEFAULT_PATH;
+
+    if (strlen(path) >= sizeof(g_socket_addr.sun_path)) {
+        XLOG_E("Notify socket path too long: %s", path);
+        return X_RET_INVAL;
+    }
+
+    if (g_socket_fd < 0) {
+        g_socket_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (g_socket_fd < 0) {
+            XLOG_E("Failed to create notify socket: %s", strerror(errno));
+            return X_RET_ERROR;
+        }
+    }
+
+    memset(&g_socket_addr, 0, sizeof(g_socket_addr));
+    g_socket_addr.sun_family = AF_UNIX;
+    strcpy(g_socket_addr.sun_path, path);
+    g_socket_addr_len = sizeof(g_socket_addr);
+
+    return register_notify_operators(&socket_notify_ops);
+}
@@ -0,0 +1,38 @@
+/**
+ * @brief Unix datagram notify transport.
+ *  Every event is one datagram of tab separated fields, sent without
+ *  blocking to a socket bound by a local monitor. Events are dropped while
+ *  no monitor listens or its queue is full.
+ *
+ *   progress <TAB> step <TAB> percent <TAB> current <TAB> total
+ *   message  <TAB> text
+ *   error    <TAB> code <TAB> text
+ *
+ * e.g.
+ *  socat UNIX-RECV:/run/iota/notify.sock -
+ *
+ * @file notify_socket.h
+ * @author Oswin
+ * @date 2026-02-02
+ * @details
+ */
+#ifndef NOTIFY_SOCKET_H_
+#define NOTIFY_SOCKET_H_
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "notify.h"
+
+#define NOTIFY_SOCKET_DEFAULT_PATH "/run/iota/notify.sock"
+
+/**
+ * @brief Registers the transport sending to `path`.
+ * @param path The monitor's socket, NULL for NOTIFY_SOCKET_DEFAULT_PATH.
+ */
+err_t register_socket_notify_operators(const char *path);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* NOTIFY_SOCKET_H_ */
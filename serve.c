@@ -0,0 +1,473 @@
+#define XLOG_MOD "serve"
+#include "serve.h"
+#include "checkout.h"
+#include "dbus_interfaces.h"
+#include "ubootenv.h"
+#include "upgrade.h"
+#include "xlist.h"
+#include "xlog.h"
+#include "xlog_journal.h"
+#include <dbus/dbus.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SERVE_ERROR_QUEUE_FULL "com.iota.status.Error.QueueFull"
+
+typedef enum {
+    JOB_UPGRADE,
+    JOB_CHECKOUT,
+} serve_job_kind_e;
+
+typedef struct {
+    uint32_t id;
+    int priority;               // higher runs first, FIFO among equals
+    serve_job_kind_e kind;
+    upgrade_request_t upgrade;
+    checkout_request_t checkout;
+    char *firmware_path;        // owned strings referenced by upgrade
+    char *key_path;
+    char *hexkey;
+} serve_job_t;
+
+typedef struct {
+    xoption this_option;
+    struct {
+        xbool_t session_bus;
+        int max_queue;
+        char *notify;
+        xbool_t journal;
+        int allow_uid;          // besides root, -1 for nobody else
+        xbool_t allow_skip_verify;
+    } flags;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t worker;
+    xlist queue;                // serve_job_t *, ordered by priority
+    serve_job_t *current;       // job the worker is running
+    uint32_t next_id;
+    xbool_t stopping;
+} serve_context_t;
+
+static serve_context_t g_serve_ctx = {
+    .this_option = NULL,
+    .flags = {
+        .session_bus = xFALSE,
+        .max_queue = 16,
+        .notify = NULL,
+        .journal = xFALSE,
+        .allow_uid = -1,
+        .allow_skip_verify = xFALSE,
+    },
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .queue = NULL,
+    .current = NULL,
+    .next_id = 1,
+    .stopping = xFALSE,
+};
+
+static volatile sig_atomic_t g_serve_stop = 0;
+
+static err_t serve_run(xoption self);
+
+err_t serve_usage_init(xoption root) {
+    if (!root)
+        return X_RET_INVAL;
+
+    if (g_serve_ctx.this_option)
+        return X_RET_OK;
+
+    xoption serve = xoption_create_subcommand(root, "serve", "Run as a daemon taking upgrade and checkout jobs over D-Bus.");
+    xoption_set_context(serve, &g_serve_ctx);
+    xoption_set_post_parse_callback(serve, serve_run);
+    xoption_add_boolean(serve, '\0', "session",
+                        "Use the session bus instead of the system bus (for testing)",
+                        &g_serve_ctx.flags.session_bus);
+    xoption_add_number(serve, '\0', "max-queue", "<count>",
+                       "Maximum number of jobs waiting to run",
+                       &g_serve_ctx.flags.max_queue, xFALSE);
+    xoption_add_string(serve, '\0', "notify", "<transports>",
+                       "Also notify job events through socket[:<path>] and shm[:<path>]",
+                       &g_serve_ctx.flags.notify, xFALSE);
+    xoption_add_boolean(serve, '\0', "journal",
+                        "Also log to the systemd journal, with module, stage and throughput fields",
+                        &g_serve_ctx.flags.journal);
+    xoption_add_number(serve, '\0', "allow-uid", "<uid>",
+                       "Also accept jobs from this user, besides root",
+                       &g_serve_ctx.flags.allow_uid, xFALSE);
+    xoption_add_boolean(serve, '\0', "allow-skip-verify",
+                        "Let callers queue upgrades with 'skip-verify', i.e. unsigned firmware",
+                        &g_serve_ctx.flags.allow_skip_verify);
+
+    g_serve_ctx.this_option = serve;
+
+    return X_RET_OK;
+}
+
+static void job_free(void *p) {
+    serve_job_t *job = p;
+    if (job == NULL)
+        return;
+
+    free(job->firmware_path);
+    free(job->key_path);
+    free(job->hexkey);
+    free(job);
+}
+
+static int job_compare(const void *first, const void *second) {
+    const serve_job_t *a = first;
+    const serve_job_t *b = second;
+
+    if (a->priority != b->priority)
+        return a->priority > b->priority ? -1 : 1;
+    return a->id < b->id ? -1 : (a->id > b->id);
+}
+
+static const char *job_kind_str(serve_job_kind_e kind) {
+    return kind == JOB_UPGRADE ? "upgrade" : "checkout";
+}
+
+static void *serve_worker(void *arg) {
+    serve_context_t *ctx = arg;
+
+    pthread_mutex_lock(&ctx->lock);
+    for (;;) {
+        while (!ctx->stopping && xlist_length(ctx->queue) == 0)
+            pthread_cond_wait(&ctx->cond, &ctx->lock);
+        if (ctx->stopping)
+            break;
+
+        serve_job_t *job = xlist_pop_front(ctx->queue);
+        // Cleared before the job becomes current, so a Cancel for it can not be lost
+        upgrade_cancel_clear();
+        ctx->current = job;
+        pthread_mutex_unlock(&ctx->lock);
+
+        XLOG_I("Running %s job #%u", job_kind_str(job->kind), job->id);
+        // The slot state may have changed since the last job, read it afresh
+        ubootenv_free();
+        err_t err = job->kind == JOB_UPGRADE ? upgrade_perform(&job->upgrade)
+                                             : checkout_perform(&job->checkout);
+        XLOG_I("Job #%u finished: %s (%d)", job->id, err_str(err), err);
+        dbus_emit_job_finished(job->id, err, err_str(err));
+
+        pthread_mutex_lock(&ctx->lock);
+        ctx->current = NULL;
+        job_free(job);
+    }
+    pthread_mutex_unlock(&ctx->lock);
+
+    return NULL;
+}
+
+/* Reads an a{sv} options dictionary into the job. */
+static err_t parse_job_options(serve_context_t *ctx, DBusMessageIter *iter, serve_job_t *job, const char **bad_key) {
+    job->upgrade.firmware_path = job->firmware_path;
+
+    // The options may be left out altogether
+    if (dbus_message_iter_get_arg_type(iter) == DBUS_TYPE_INVALID)
+        return X_RET_OK;
+
+    if (dbus_message_iter_get_arg_type(iter) != DBUS_TYPE_ARRAY ||
+        dbus_message_iter_get_element_type(iter) != DBUS_TYPE_DICT_ENTRY) {
+        *bad_key = "options";
+        return X_RET_INVAL;
+    }
+
+    DBusMessageIter dict;
+    dbus_message_iter_recurse(iter, &dict);
+    for (; dbus_message_iter_get_arg_type(&dict) == DBUS_TYPE_DICT_ENTRY; dbus_message_iter_next(&dict)) {
+        DBusMessageIter entry, variant;
+        const char *key = NULL;
+        dbus_message_iter_recurse(&dict, &entry);
+        dbus_message_iter_get_basic(&entry, &key);
+        dbus_message_iter_next(&entry);
+        dbus_message_iter_recurse(&entry, &variant);
+
+        int type = dbus_message_iter_get_arg_type(&variant);
+        dbus_bool_t b = FALSE;
+        dbus_int32_t i = 0;
+        const char *str = NULL;
+        if (type == DBUS_TYPE_BOOLEAN)
+            dbus_message_iter_get_basic(&variant, &b);
+        else if (type == DBUS_TYPE_INT32)
+            dbus_message_iter_get_basic(&variant, &i);
+        else if (type == DBUS_TYPE_STRING)
+            dbus_message_iter_get_basic(&variant, &str);
+
+        *bad_key = key;
+        if (!strcmp(key, "priority") && type == DBUS_TYPE_INT32) {
+            job->priority = i;
+        } else if (!strcmp(key, "force") && type == DBUS_TYPE_BOOLEAN) {
+            job->upgrade.force = b;
+            job->checkout.force = b;
+        } else if (job->kind == JOB_UPGRADE && !strcmp(key, "in-place") && type == DBUS_TYPE_BOOLEAN) {
+            job->upgrade.in_place = b;
+        } else if (job->kind == JOB_UPGRADE && !strcmp(key, "skip-verify") && type == DBUS_TYPE_BOOLEAN &&
+                   (!b || ctx->flags.allow_skip_verify)) {
+            job->upgrade.skip_verify = b;
+        } else if (job->kind == JOB_UPGRADE && !strcmp(key, "verify") && type == DBUS_TYPE_STRING) {
+            free(job->key_path);
+            job->key_path = strdup(str);
+        } else if (job->kind == JOB_UPGRADE && !strcmp(key, "key") && type == DBUS_TYPE_STRING) {
+            free(job->hexkey);
+            job->hexkey = strdup(str);
+        } else if (job->kind == JOB_CHECKOUT && !strcmp(key, "reboot") && type == DBUS_TYPE_BOOLEAN) {
+            job->checkout.reboot = b;
+        } else if (job->kind == JOB_CHECKOUT && !strcmp(key, "delay") && type == DBUS_TYPE_INT32) {
+            job->checkout.delay_second = i;
+        } else if (job->kind == JOB_CHECKOUT && !strcmp(key, "kexec") && type == DBUS_TYPE_BOOLEAN) {
+            job->checkout.kexec = b;
+        } else {
+            return X_RET_INVAL;
+        }
+    }
+
+    job->upgrade.key_path = job->key_path;
+    job->upgrade.hexkey = job->hexkey;
+    return X_RET_OK;
+}
+
+static DBusMessage *handle_submit(serve_context_t *ctx, DBusMessage *msg, serve_job_kind_e kind) {
+    DBusMessageIter iter;
+    serve_job_t *job = calloc(1, sizeof(*job));
+    if (job == NULL)
+        return dbus_message_new_error(msg, DBUS_ERROR_NO_MEMORY, "Out of memory");
+
+    job->kind = kind;
+    job->checkout.delay_second = 3;
+    dbus_message_iter_init(msg, &iter);
+
+    if (kind == JOB_UPGRADE) {
+        const char *firmware = NULL;
+        if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_STRING) {
+            job_free(job);
+            return dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS, "Expected firmware path");
+        }
+        dbus_message_iter_get_basic(&iter, &firmware);
+        job->firmware_path = strdup(firmware);
+        dbus_message_iter_next(&iter);
+    }
+
+    const char *bad_key = NULL;
+    if (parse_job_options(ctx, &iter, job, &bad_key) != X_RET_OK) {
+        DBusMessage *reply = dbus_message_new_error_printf(msg, DBUS_ERROR_INVALID_ARGS,
+                                                           "Invalid option '%s'", bad_key ? bad_key : "");
+        job_free(job);
+        return reply;
+    }
+
+    pthread_mutex_lock(&ctx->lock);
+    if ((int)xlist_length(ctx->queue) >= ctx->flags.max_queue) {
+        pthread_mutex_unlock(&ctx->lock);
+        job_free(job);
+        return dbus_message_new_error(msg, SERVE_ERROR_QUEUE_FULL, "Too many queued jobs");
+    }
+
+    // The worker may run and free the job as soon as the lock is released
+    dbus_uint32_t id = job->id = ctx->next_id++;
+    XLOG_I("Queued %s job #%u (priority %d)", job_kind_str(kind), job->id, job->priority);
+    xlist_push_back(ctx->queue, job);
+    xlist_sort(ctx->queue, job_compare);
+    pthread_cond_signal(&ctx->cond);
+    pthread_mutex_unlock(&ctx->lock);
+
+    DBusMessage *reply = dbus_message_new_method_return(msg);
+    dbus_message_append_args(reply, DBUS_TYPE_UINT32, &id, DBUS_TYPE_INVALID);
+    return reply;
+}
+
+static DBusMessage *handle_status(serve_context_t *ctx, DBusMessage *msg) {
+    pthread_mutex_lock(&ctx->lock);
+    const char *state = ctx->current ? job_kind_str(ctx->current->kind) : "idle";
+    dbus_uint32_t running = ctx->current ? ctx->current->id : 0;
+    dbus_uint32_t queued = (dbus_uint32_t)xlist_length(ctx->queue);
+    pthread_mutex_unlock(&ctx->lock);
+
+    DBusMessage *reply = dbus_message_new_method_return(msg);
+    dbus_message_append_args(reply,
+                             DBUS_TYPE_STRING, &state,
+                             DBUS_TYPE_UINT32, &running,
+                             DBUS_TYPE_UINT32, &queued,
+                             DBUS_TYPE_INVALID);
+    return reply;
+}
+
+static DBusMessage *handle_cancel(serve_context_t *ctx, DBusMessage *msg) {
+    dbus_uint32_t id = 0;
+    if (!dbus_message_get_args(msg, NULL, DBUS_TYPE_UINT32, &id, DBUS_TYPE_INVALID))
+        return dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS, "Expected job id");
+
+    dbus_bool_t canceled = FALSE;
+    serve_job_t *job = NULL;
+
+    pthread_mutex_lock(&ctx->lock);
+    xlist_foreach(ctx->queue, job) {
+        if (job->id == id) {
+            xlist_remove(ctx->queue, job);
+            job_free(job);
+            canceled = TRUE;
+            break;
+        }
+    }
+
+    // Only upgrades stop midway, a checkout is over in moments
+    if (!canceled && ctx->current && ctx->current->id == id && ctx->current->kind == JOB_UPGRADE) {
+        upgrade_cancel();
+        canceled = TRUE;
+    }
+    pthread_mutex_unlock(&ctx->lock);
+
+    if (canceled)
+        XLOG_I("Canceled job #%u", id);
+
+    DBusMessage *reply = dbus_message_new_method_return(msg);
+    dbus_message_append_args(reply, DBUS_TYPE_BOOLEAN, &canceled, DBUS_TYPE_INVALID);
+    return reply;
+}
+
+/* Jobs run as root and install firmware, only root and --allow-uid may queue or cancel them. */
+static xbool_t caller_allowed(serve_context_t *ctx, DBusConnection *conn, DBusMessage *msg) {
+    const char *sender = dbus_message_get_sender(msg);
+    // Peer to peer connections carry no sender, but the daemon only listens on a bus
+    if (sender == NULL)
+        return xFALSE;
+
+    DBusError err;
+    dbus_error_init(&err);
+    unsigned long uid = dbus_bus_get_unix_user(conn, sender, &err);
+    if (dbus_error_is_set(&err)) {
+        XLOG_W("Failed to identify caller %s: %s", sender, err.message);
+        dbus_error_free(&err);
+        return xFALSE;
+    }
+
+    if (uid == 0 || (ctx->flags.allow_uid >= 0 && uid == (unsigned long)ctx->flags.allow_uid))
+        return xTRUE;
+
+    XLOG_W("Rejected %s from %s (uid %lu)", dbus_message_get_member(msg), sender, uid);
+    return xFALSE;
+}
+
+static DBusHandlerResult serve_on_message(DBusConnection *conn, DBusMessage *msg, void *data) {
+    serve_context_t *ctx = data;
+    DBusMessage *reply = NULL;
+
+    // Status is read only, anyone may ask
+    xbool_t manages = dbus_message_is_method_call(msg, DBUS_INTERFACE_NAME, "Upgrade") ||
+                      dbus_message_is_method_call(msg, DBUS_INTERFACE_NAME, "Checkout") ||
+                      dbus_message_is_method_call(msg, DBUS_INTERFACE_NAME, "Cancel");
+
+    if (manages && !caller_allowed(ctx, conn, msg)) {
+        reply = dbus_message_new_error(msg, DBUS_ERROR_ACCESS_DENIED, "Not allowed to manage jobs");
+    } else if (dbus_message_is_method_call(msg, DBUS_INTERFACE_NAME, "Upgrade")) {
+        reply = handle_submit(ctx, msg, JOB_UPGRADE);
+    } else if (dbus_message_is_method_call(msg, DBUS_INTERFACE_NAME, "Checkout")) {
+        reply = handle_submit(ctx, msg, JOB_CHECKOUT);
+    } else if (dbus_message_is_method_call(msg, DBUS_INTERFACE_NAME, "Status")) {
+        reply = handle_status(ctx, msg);
+    } else if (dbus_message_is_method_call(msg, DBUS_INTERFACE_NAME, "Cancel")) {
+        reply = handle_cancel(ctx, msg);
+    } else {
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+
+    if (reply) {
+        dbus_connection_send(conn, reply, NULL);
+        dbus_message_unref(reply);
+    }
+
+    return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+static void serve_on_signal(int sig) {
+    g_serve_stop = sig;
+}
+
+static err_t serve_run(xoption self) {
+    serve_context_t *ctx = xoption_get_context(self);
+
+    if (ctx->flags.max_queue <= 0) {
+        XLOG_E("Invalid queue size: %d", ctx->flags.max_queue);
+        return X_RET_INVAL;
+    }
+
+    if (ctx->flags.journal) {
+        xlog_journal_options_t opt = xlog_journal_options_init("iota-cli");
+        xlog_sink sink = xlog_journal_sink_new(&opt);
+        if (sink == NULL) {
+            XLOG_E("Failed to create the journal sink");
+            return X_RET_ERROR;
+        }
+        xlog_logger_append_sink(xlog_global_instance(), sink);
+        // Batched, entries wait at most a second unless a warning comes
+        xlog_global_set_flush_lvl(XLOG_LVL_WARN);
+    }
+
+    err_t err = dbus_interfaces_connect(ctx->flags.session_bus, xTRUE);
+    if (err != X_RET_OK) {
+        XLOG_E("Failed to own %s on the %s bus", DBUS_SERVICE_NAME, ctx->flags.session_bus ? "session" : "system");
+        return err;
+    }
+
+    DBusConnection *conn = dbus_interfaces_connection();
+    static const DBusObjectPathVTable vtable = {
+        .message_function = serve_on_message,
+    };
+    if (!dbus_connection_register_object_path(conn, DBUS_OBJECT_PATH, &vtable, ctx)) {
+        XLOG_E("Failed to register %s", DBUS_OBJECT_PATH);
+        dbus_interfaces_disconnect();
+        return X_RET_ERROR;
+    }
+
+    register_dbus_notify_operators();
+    if (ctx->flags.notify && (err = notify_setup(ctx->flags.notify)) != X_RET_OK) {
+        dbus_interfaces_disconnect();
+        return err;
+    }
+
+    // Jobs come and go all day, keep their nodes in one slab of queue size
+    ctx->queue = xlist_create_slab((size_t)ctx->flags.max_queue);
+    ctx->stopping = xFALSE;
+    if (ctx->queue == NULL || pthread_create(&ctx->worker, NULL, serve_worker, ctx) != 0) {
+        XLOG_E("Failed to start the job worker");
+        xlist_destroy(ctx->queue);
+        dbus_interfaces_disconnect();
+        return X_RET_ERROR;
+    }
+
+    // No SA_RESTART, a signal has to break out of the dispatch poll
+    struct sigaction sa = {0};
+    sa.sa_handler = serve_on_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    XLOG_I("Serving %s on the %s bus", DBUS_SERVICE_NAME, ctx->flags.session_bus ? "session" : "system");
+
+    while (!g_serve_stop && dbus_connection_read_write_dispatch(conn, 500)) {
+    }
+
+    XLOG_I("Shutting down (%s)", g_serve_stop ? strsignal(g_serve_stop) : "bus disconnected");
+
+    pthread_mutex_lock(&ctx->lock);
+    ctx->stopping = xTRUE;
+    if (ctx->current && ctx->current->kind == JOB_UPGRADE)
+        upgrade_cancel();
+    pthread_cond_broadcast(&ctx->cond);
+    pthread_mutex_unlock(&ctx->lock);
+
+    pthread_join(ctx->worker, NULL);
+
+    xlist_drain(ctx->queue, job_free);
+    xlist_destroy(ctx->queue);
+    ctx->queue = NULL;
+
+    dbus_connection_unregister_object_path(conn, DBUS_OBJECT_PATH);
+    dbus_interfaces_disconnect();
+
+    return X_RET_OK;
+}
@@ -0,0 +1,39 @@
+/**
+ * @brief iota serve command implementation.
+ *  Runs iota-cli as a daemon owning com.iota.status. Upgrades and checkouts
+ *  are requested over D-Bus and executed one at a time from a priority
+ *  queue, so crypto and bus state stay warm between jobs.
+ *
+ *  Methods on com.iota.status.Interface at /com/iota/status:
+ *   - Upgrade(s firmware, a{sv} options) -> u job_id
+ *       options: priority (i), force (b), in-place (b), skip-verify (b),
+ *                verify (s), key (s)
+ *   - Checkout(a{sv} options) -> u job_id
+ *       options: priority (i), force (b), reboot (b), delay (i), kexec (b)
+ *   - Status() -> (s state, u running_job, u queued_jobs)
+ *   - Cancel(u job_id) -> b canceled
+ *  Finished jobs are announced with the JobFinished(u, i, s) signal.
+ *
+ * e.g.
+ *  - iota-cli serve
+ *  - iota-cli serve --session
+ *
+ * @file serve.h
+ * @author Oswin
+ * @date 2026-01-26
+ * @details
+ */
+#ifndef SERVE_H_
+#define SERVE_H_
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "xoption.h"
+
+err_t serve_usage_init(xoption root);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* SERVE_H_ */
@@ -0,0 +1,567 @@
+#define XLOG_MOD "ubootenv"
+#include "ubootenv.h"
+#include "exec.h"
+#include "xlist.h"
+#include "xlog.h"
+#include "xstring.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifndef __APPLE__
+#include <mtd/mtd-user.h>
+#include <mtd/ubi-user.h>
+#endif /* __APPLE__ */
+
+#define ENV_CRC_SIZE sizeof(uint32_t)
+#define ENV_FLAGS_SIZE 1
+#define FALLBACK_ENV_SIZE (128 * 1024)
+#define FW_SETENV_TIMEOUT_MS (30 * 1000)
+
+typedef enum {
+    ENV_DEV_FILE,   // regular file or block device
+    ENV_DEV_MTD,    // MTD character device, needs erase before write
+    ENV_DEV_UBI,    // UBI volume, written through a volume update
+} env_dev_kind_e;
+
+typedef struct {
+    char path[PATH_MAX];
+    uint64_t offset;
+    size_t env_size;
+    size_t sector_size;
+    env_dev_kind_e kind;
+} env_device_t;
+
+static struct {
+    xbool_t loaded;
+    xbool_t native;
+    xbool_t dirty;
+    int device_count;           // 2 for a redundant environment
+    int current;                // device holding the valid copy
+    uint8_t flags;              // update counter of the valid copy
+    env_device_t devices[2];
+    uint8_t *data;              // "name=value\0...\0\0"
+    size_t data_size;
+    xlist staged;               // names changed since load, fallback mode only
+} g_env;
+
+static uint32_t env_crc32(const uint8_t *buf, size_t len) {
+    static uint32_t table[256];
+    static xbool_t table_ready = xFALSE;
+
+    if (!table_ready) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        table_ready = xTRUE;
+    }
+
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < len; i++) {
+        crc = table[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+static size_t env_header_size(void) {
+    return ENV_CRC_SIZE + (g_env.device_count > 1 ? ENV_FLAGS_SIZE : 0);
+}
+
+static env_dev_kind_e env_device_kind(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISCHR(st.st_mode))
+        return ENV_DEV_FILE;
+
+    if (!strncmp(path, "/dev/ubi", strlen("/dev/ubi")) && strchr(path, '_'))
+        return ENV_DEV_UBI;
+
+    return ENV_DEV_MTD;
+}
+
+/**
+ * Parses fw_env.config. Each line reads:
+ *  <device> <offset> <env size> [<sector size> [<sector count>]]
+ */
+static err_t parse_config(const char *config) {
+    FILE *fp = fopen(config, "r");
+    if (fp == NULL)
+        return X_RET_NOTENT;
+
+    char line[PATH_MAX + 128];
+    g_env.device_count = 0;
+    while (g_env.device_count < 2 && fgets(line, sizeof(line), fp) != NULL) {
+        xstr_view rest = xstr_view_of(line);
+        xstr_view device, offset, env_size, sector_size;
+        if (!xstr_view_next_token(&rest, " \t\r\n", &device) || device.p[0] == '#')
+            continue;
+
+        uint64_t off = 0, size = 0, sector = 0;
+        xbool_t ok = xstr_view_next_token(&rest, " \t\r\n", &offset) &&
+                     xstr_view_next_token(&rest, " \t\r\n", &env_size) &&
+                     xstr_view_to_u64(offset, 0, &off) == X_RET_OK &&
+                     xstr_view_to_u64(env_size, 0, &size) == X_RET_OK && size <= SIZE_MAX;
+        if (ok && xstr_view_next_token(&rest, " \t\r\n", &sector_size))
+            ok = xstr_view_to_u64(sector_size, 0, &sector) == X_RET_OK && sector <= SIZE_MAX;
+        if (!ok || device.len >= sizeof(g_env.devices[0].path)) {
+            XLOG_E("Malformed line in %s for device " XSTR_VIEW_FMT, config, XSTR_VIEW_ARG(device));
+            fclose(fp);
+            return X_RET_BADFMT;
+        }
+
+        env_device_t *dev = &g_env.devices[g_env.device_count++];
+        snprintf(dev->path, sizeof(dev->path), XSTR_VIEW_FMT, XSTR_VIEW_ARG(device));
+        dev->offset = off;
+        dev->env_size = size;
+        dev->sector_size = sector;
+        dev->kind = env_device_kind(dev->path);
+    }
+    fclose(fp);
+
+    if (g_env.device_count == 0) {
+        XLOG_E("No environment device configured in %s", config);
+        return X_RET_BADFMT;
+    }
+
+    if (g_env.device_count == 2 && g_env.devices[0].env_size != g_env.devices[1].env_size) {
+        XLOG_E("Redundant environments in %s differ in size", config);
+        return X_RET_BADFMT;
+    }
+
+    if (g_env.devices[0].env_size <= ENV_CRC_SIZE + ENV_FLAGS_SIZE) {
+        XLOG_E("Invalid environment size in %s", config);
+        return X_RET_BADFMT;
+    }
+
+    return X_RET_OK;
+}
+
+static err_t read_device(const env_device_t *dev, uint8_t *buf) {
+    int fd = open(dev->path, O_RDONLY);
+    if (fd < 0) {
+        XLOG_E("Failed to open %s: %s", dev->path, strerror(errno));
+        return X_RET_ERROR;
+    }
+
+    // UBI volumes hold the environment alone, the offset does not apply
+    off_t offset = dev->kind == ENV_DEV_UBI ? 0 : (off_t)dev->offset;
+    ssize_t n = pread(fd, buf, dev->env_size, offset);
+    close(fd);
+
+    if (n != (ssize_t)dev->env_size) {
+        XLOG_E("Failed to read environment from %s: %s", dev->path, n < 0 ? strerror(errno) : "short read");
+        return X_RET_ERROR;
+    }
+
+    return X_RET_OK;
+}
+
+#ifndef __APPLE__
+static err_t write_mtd(int fd, const env_device_t *dev, const uint8_t *image) {
+    struct mtd_info_user info;
+    if (ioctl(fd, MEMGETINFO, &info) != 0) {
+        XLOG_E("Failed to get MTD info of %s: %s", dev->path, strerror(errno));
+        return X_RET_ERROR;
+    }
+
+    if (info.flags & MTD_NO_ERASE) {
+        return pwrite(fd, image, dev->env_size, (off_t)dev->offset) == (ssize_t)dev->env_size
+                   ? X_RET_OK
+                   : X_RET_ERROR;
+    }
+
+    // Erase whole sectors, keeping whatever shares them with the environment
+    size_t sector = dev->sector_size ? dev->sector_size : info.erasesize;
+    uint64_t start = dev->offset / sector * sector;
+    size_t length = (dev->offset + dev->env_size - start + sector - 1) / sector * sector;
+
+    uint8_t *block = malloc(length);
+    if (block == NULL)
+        return X_RET_NOMEM;
+
+    err_t err = X_RET_ERROR;
+    if (pread(fd, block, length, (off_t)start) != (ssize_t)length) {
+        XLOG_E("Failed to read back %s: %s", dev->path, strerror(errno));
+        goto end;
+    }
+    memcpy(block + (dev->offset - start), image, dev->env_size);
+
+    struct erase_info_user erase = {
+        .start = (uint32_t)start,
+        .length = (uint32_t)length,
+    };
+    ioctl(fd, MEMUNLOCK, &erase);
+    if (ioctl(fd, MEMERASE, &erase) != 0) {
+        XLOG_E("Failed to erase %s: %s", dev->path, strerror(errno));
+        goto end;
+    }
+
+    if (pwrite(fd, block, length, (off_t)start) != (ssize_t)length) {
+        XLOG_E("Failed to write %s: %s", dev->path, strerror(errno));
+        goto end;
+    }
+    err = X_RET_OK;
+
+end:
+    free(block);
+    return err;
+}
+
+static err_t write_ubi(int fd, const env_device_t *dev, const uint8_t *image) {
+    int64_t bytes = (int64_t)dev->env_size;
+    if (ioctl(fd, UBI_IOCVOLUP, &bytes) != 0) {
+        XLOG_E("Failed to start volume update of %s: %s", dev->path, strerror(errno));
+        return X_RET_ERROR;
+    }
+
+    if (write(fd, image, dev->env_size) != (ssize_t)dev->env_size) {
+        XLOG_E("Failed to write %s: %s", dev->path, strerror(errno));
+        return X_RET_ERROR;
+    }
+
+    return X_RET_OK;
+}
+#endif /* __APPLE__ */
+
+static err_t write_device(const env_device_t *dev, const uint8_t *image) {
+    int fd = open(dev->path, O_RDWR);
+    if (fd < 0) {
+        XLOG_E("Failed to open %s: %s", dev->path, strerror(errno));
+        return X_RET_ERROR;
+    }
+
+    err_t err = X_RET_ERROR;
+    switch (dev->kind) {
+#ifndef __APPLE__
+    case ENV_DEV_MTD:
+        err = write_mtd(fd, dev, image);
+        break;
+    case ENV_DEV_UBI:
+        err = write_ubi(fd, dev, image);
+        break;
+#endif /* __APPLE__ */
+    default:
+        if (pwrite(fd, image, dev->env_size, (off_t)dev->offset) == (ssize_t)dev->env_size) {
+            err = X_RET_OK;
+        } else {
+            XLOG_E("Failed to write %s: %s", dev->path, strerror(errno));
+        }
+        break;
+    }
+
+    if (err == X_RET_OK && fsync(fd) != 0) {
+        XLOG_E("Failed to sync %s: %s", dev->path, strerror(errno));
+        err = X_RET_ERROR;
+    }
+
+    close(fd);
+    return err;
+}
+
+static err_t load_native(const char *config) {
+    err_t err = parse_config(config);
+    if (err != X_RET_OK)
+        return err;
+
+    size_t env_size = g_env.devices[0].env_size;
+    size_t header = env_header_size();
+    uint8_t *images[2] = {NULL, NULL};
+    xbool_t valid[2] = {xFALSE, xFALSE};
+
+    for (int i = 0; i < g_env.device_count; i++) {
+        images[i] = malloc(env_size);
+        if (images[i] == NULL) {
+            err = X_RET_NOMEM;
+            goto end;
+        }
+
+        if (read_device(&g_env.devices[i], images[i]) != X_RET_OK)
+            continue;
+
+        uint32_t crc;
+        memcpy(&crc, images[i], ENV_CRC_SIZE);
+        valid[i] = crc == env_crc32(images[i] + header, env_size - header);
+        if (!valid[i])
+            XLOG_W("Bad CRC of environment on %s", g_env.devices[i].path);
+    }
+
+    // Same rules as U-Boot: the flags byte counts updates and wraps around
+    int current = -1;
+    if (valid[0] && valid[1]) {
+        uint8_t f0 = images[0][ENV_CRC_SIZE];
+        uint8_t f1 = images[1][ENV_CRC_SIZE];
+        if (f0 == 0xFF && f1 == 0)
+            current = 1;
+        else if (f1 == 0xFF && f0 == 0)
+            current = 0;
+        else
+            current = f1 > f0 ? 1 : 0;
+    } else if (valid[0]) {
+        current = 0;
+    } else if (valid[1]) {
+        current = 1;
+    }
+
+    if (current < 0) {
+        // fw_printenv knows the built-in default environment, we do not
+        XLOG_W("No valid environment found through %s", config);
+        err = X_RET_BADFMT;
+        goto end;
+    }
+
+    g_env.current = current;
+    g_env.flags = g_env.device_count > 1 ? images[current][ENV_CRC_SIZE] : 0;
+    g_env.data_size = env_size - header;
+    g_env.data = malloc(g_env.data_size);
+    if (g_env.data == NULL) {
+        err = X_RET_NOMEM;
+        goto end;
+    }
+    memcpy(g_env.data, images[current] + header, g_env.data_size);
+
+    XLOG_D("Loaded environment from %s (copy %d of %d)", g_env.devices[current].path, current + 1, g_env.device_count);
+    err = X_RET_OK;
+
+end:
+    free(images[0]);
+    free(images[1]);
+    return err;
+}
+
+static err_t load_fallback(void) {
+    exec_t r = exec_command("fw_printenv");
+    if (!exec_success(r)) {
+        XLOG_E("Failed to read environment with fw_printenv. output: %s", exec_output(r));
+        exec_free(r);
+        return X_RET_ERROR;
+    }
+
+    g_env.data_size = xstring_length(&r.output) + FALLBACK_ENV_SIZE;
+    g_env.data = calloc(1, g_env.data_size);
+    if (g_env.data == NULL) {
+        exec_free(r);
+        return X_RET_NOMEM;
+    }
+
+    // One "name=value" per line becomes one "name=value\0" entry
+    size_t pos = 0;
+    xstr_view rest = exec_output_view(r), line;
+    while (xstr_view_next_token(&rest, "\n", &line)) {
+        if (!xstr_view_cut(line, '=', NULL, NULL))
+            continue;
+
+        memcpy(g_env.data + pos, line.p, line.len);
+        g_env.data[pos + line.len] = '\0';
+        pos += line.len + 1;
+    }
+
+    exec_free(r);
+    g_env.staged = xlist_create();
+    return X_RET_OK;
+}
+
+err_t ubootenv_load(void) {
+    if (g_env.loaded)
+        return X_RET_OK;
+
+    const char *config = getenv(UBOOTENV_CONFIG_ENV);
+    if (config == NULL || config[0] == '\0')
+        config = UBOOTENV_DEFAULT_CONFIG;
+
+    err_t err = load_native(config);
+    if (err == X_RET_OK) {
+        g_env.native = xTRUE;
+    } else {
+        XLOG_D("Native environment access unavailable (%s), using fw_printenv", err_str(err));
+        ubootenv_free();
+        err = load_fallback();
+        if (err != X_RET_OK) {
+            ubootenv_free();
+            return err;
+        }
+        g_env.native = xFALSE;
+    }
+
+    g_env.loaded = xTRUE;
+    return X_RET_OK;
+}
+
+xbool_t ubootenv_is_native(void) {
+    return g_env.loaded && g_env.native;
+}
+
+/* Returns the entry "name=value" or NULL, `end` receives the data end. */
+static uint8_t *find_entry(const char *name, size_t *end) {
+    size_t name_len = strlen(name);
+    uint8_t *found = NULL;
+    size_t pos = 0;
+
+    while (pos < g_env.data_size && g_env.data[pos] != '\0') {
+        char *entry = (char *)g_env.data + pos;
+        size_t len = strnlen(entry, g_env.data_size - pos);
+        if (found == NULL && len > name_len && !strncmp(entry, name, name_len) && entry[name_len] == '=')
+            found = (uint8_t *)entry;
+        pos += len + 1;
+    }
+
+    if (end)
+        *end = pos;
+    return found;
+}
+
+const char *ubootenv_get(const char *name) {
+    if (name == NULL || ubootenv_load() != X_RET_OK)
+        return NULL;
+
+    uint8_t *entry = find_entry(name, NULL);
+    return entry ? (const char *)entry + strlen(name) + 1 : NULL;
+}
+
+err_t ubootenv_set(const char *name, const char *value) {
+    if (name == NULL || name[0] == '\0' || strchr(name, '='))
+        return X_RET_INVAL;
+
+    err_t err = ubootenv_load();
+    if (err != X_RET_OK)
+        return err;
+
+    size_t end = 0;
+    uint8_t *entry = find_entry(name, &end);
+    size_t old_len = entry ? strlen((char *)entry) + 1 : 0;
+    size_t new_len = value ? strlen(name) + 1 + strlen(value) + 1 : 0;
+
+    // The data must still end with an empty entry
+    if (end - old_len + new_len + 1 > g_env.data_size) {
+        XLOG_E("No space left in environment for %s", name);
+        return X_RET_FULL;
+    }
+
+    if (entry) {
+        memmove(entry, entry + old_len, end - (entry + old_len - g_env.data));
+        end -= old_len;
+    }
+
+    if (value) {
+        sprintf((char *)g_env.data + end, "%s=%s", name, value);
+        end += new_len;
+    }
+    memset(g_env.data + end, 0, g_env.data_size - end);
+
+    if (!g_env.native) {
+        xbool_t known = xFALSE;
+        char *staged = NULL;
+        xlist_foreach(g_env.staged, staged) {
+            known = known || !strcmp(staged, name);
+        }
+        if (!known)
+            xlist_push_back(g_env.staged, strdup(name));
+    }
+
+    g_env.dirty = xTRUE;
+    return X_RET_OK;
+}
+
+/*
+ * Hands every staged variable to one `fw_setenv -s -`, so the tool writes a
+ * single new environment and an interruption never leaves half of them set.
+ * The script goes through stdin, values never meet a shell.
+ */
+static err_t commit_fallback(void) {
+    err_t err = X_RET_OK;
+    xstring script = xstring_init_empty();
+    char *name = NULL;
+
+    while ((name = xlist_pop_front(g_env.staged)) != NULL) {
+        const char *value = ubootenv_get(name);
+        if (value && strchr(value, '\n')) {
+            // One line per variable in the script, there is no escaping
+            XLOG_E("Cannot set %s through fw_setenv, the value contains a newline", name);
+            err = X_RET_INVAL;
+        } else {
+            // "name value" sets it, a bare name deletes it
+            xstring_cat(&script, name);
+            if (value) {
+                xstring_cat(&script, " ");
+                xstring_cat(&script, value);
+            }
+            xstring_cat(&script, "\n");
+        }
+        free(name);
+    }
+
+    if (err == X_RET_OK && xstring_length(&script) > 0) {
+        char *const argv[] = {"fw_setenv", "-s", "-", NULL};
+        exec_t r = exec_run_input(argv, xstring_to_string(&script), (size_t)xstring_length(&script),
+                                  FW_SETENV_TIMEOUT_MS);
+        if (!exec_success(r)) {
+            XLOG_E("Failed to run `fw_setenv -s -`. return code: %d, " XSTR_VIEW_FMT,
+                   exec_code(r), XSTR_VIEW_ARG(xstr_view_trim(exec_error_view(r))));
+            err = X_RET_ERROR;
+        }
+        exec_free(r);
+    }
+
+    xstring_free(&script);
+    return err;
+}
+
+err_t ubootenv_commit(void) {
+    if (!g_env.loaded || !g_env.dirty)
+        return X_RET_OK;
+
+    if (!g_env.native) {
+        err_t err = commit_fallback();
+        g_env.dirty = xFALSE;
+        return err;
+    }
+
+    size_t header = env_header_size();
+    size_t env_size = g_env.devices[0].env_size;
+    uint8_t *image = malloc(env_size);
+    if (image == NULL)
+        return X_RET_NOMEM;
+
+    // Write the copy that is not in use, the valid one survives a power cut
+    int target = g_env.device_count > 1 ? !g_env.current : 0;
+    uint8_t flags = g_env.flags + 1;
+
+    memcpy(image + header, g_env.data, g_env.data_size);
+    uint32_t crc = env_crc32(image + header, g_env.data_size);
+    memcpy(image, &crc, ENV_CRC_SIZE);
+    if (g_env.device_count > 1)
+        image[ENV_CRC_SIZE] = flags;
+
+    err_t err = write_device(&g_env.devices[target], image);
+    free(image);
+
+    if (err != X_RET_OK)
+        return err;
+
+    XLOG_D("Committed environment to %s", g_env.devices[target].path);
+    g_env.current = target;
+    g_env.flags = flags;
+    g_env.dirty = xFALSE;
+    return X_RET_OK;
+}
+
+static void free_staged(void *name) {
+    free(name);
+}
+
+void ubootenv_free(void) {
+    if (g_env.staged) {
+        xlist_drain(g_env.staged, free_staged);
+        xlist_destroy(g_env.staged);
+    }
+    free(g_env.data);
+    memset(&g_env, 0, sizeof(g_env));
+}
@@ -0,0 +1,82 @@
+/**
+ * @brief U-Boot environment access.
+ *  Reads and writes the U-Boot environment in-process, using the same
+ *  /etc/fw_env.config as fw_printenv/fw_setenv. Redundant environments and
+ *  their CRCs are handled natively.
+ *
+ *  The environment is read once per process and cached, so repeated lookups
+ *  of the A/B slot state are free. Changes are staged with ubootenv_set()
+ *  and written to flash by a single ubootenv_commit().
+ *
+ *  When no config file is available the module falls back to the
+ *  fw_printenv/fw_setenv tools, committing through one `fw_setenv -s -`.
+ *
+ * e.g.
+ *  const char *part = ubootenv_get("rootfs_part");
+ *  ubootenv_set("rootfs_part", "b");
+ *  ubootenv_set("upgrade_available", "1");
+ *  ubootenv_commit();
+ *
+ * @file ubootenv.h
+ * @author Oswin
+ * @date 2026-01-12
+ * @details
+ */
+#ifndef UBOOTENV_H_
+#define UBOOTENV_H_
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "xdef.h"
+
+#define UBOOTENV_DEFAULT_CONFIG "/etc/fw_env.config"
+/* Environment variable overriding the config path, e.g. for a file-backed env. */
+#define UBOOTENV_CONFIG_ENV "IOTA_FW_ENV_CONFIG"
+
+/**
+ * @brief Loads the environment into the process cache.
+ *  Only the first call touches the storage, later calls are no-ops.
+ * @return X_RET_OK on success, or an error code on failure.
+ */
+err_t ubootenv_load(void);
+
+/**
+ * @brief Whether the environment is accessed natively rather than through
+ *  the fw_printenv/fw_setenv tools.
+ */
+xbool_t ubootenv_is_native(void);
+
+/**
+ * @brief Looks up a variable, loading the environment on first use.
+ * @param name The variable name.
+ * @return The value owned by the cache, or NULL if it is not set.
+ *  The pointer is invalidated by the next ubootenv_set().
+ */
+const char *ubootenv_get(const char *name);
+
+/**
+ * @brief Stages a variable change in the cache.
+ * @param name The variable name.
+ * @param value The new value, or NULL to delete the variable.
+ * @return X_RET_OK on success, X_RET_FULL if the environment is out of space.
+ */
+err_t ubootenv_set(const char *name, const char *value);
+
+/**
+ * @brief Writes all staged changes in one environment update.
+ *  With a redundant environment the inactive copy is written, so an
+ *  interrupted update leaves the previous environment intact.
+ * @return X_RET_OK on success (or nothing to write), or an error code on failure.
+ */
+err_t ubootenv_commit(void);
+
+/**
+ * @brief Drops the cache and any uncommitted changes.
+ */
+void ubootenv_free(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* UBOOTENV_H_ */
@@ -4,19 +4,39 @@
 #include "os_file.h"
 #include "checkout.h"
 #include "xlog.h"
+#include "xlog_file.h"
+#include "xlog_journal.h"
+#include "xarena.h"
 #include "xstring.h"
 #include "notify.h"
 #include "dbus_interfaces.h"
+#include "events.h"
 #include <time.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
 #include <openssl/evp.h>
 #include <openssl/pem.h>
 #include <openssl/err.h>
+#include <openssl/sha.h>
 #include <archive.h>
 #include <archive_entry.h>
 
 #define TEMPORARY_TARGZ_PATH "/tmp/upgrade_firmware.tar.gz"
+#define TEMPORARY_TARGZ_DIR "/tmp"
 #define FIRMWARE_EXTRACTED_DIR "/tmp/firmware_extracted"
+#define FIRMWARE_RECORD_DIR "/var/ota"
+#define FIRMWARE_CHECKSUM_FILE "current.sha256"
+#define SHA256_MAP_WINDOW (4 * 1024 * 1024)
+#define FIRMWARE_IDENTITY_FILE "current.id"
 
 #define AES_GCM_KEY_LEN  ( 16 )
 #define AES_GCM_IV_LEN  ( 12 )
@@ -31,6 +51,8 @@ typedef struct {
     FILE *firmware_fp;
     FILE *temp_fp;
     struct archive *ar, *disk;
+    xarena arena;               // temporaries of the run, rewound after every stage
+    xbool_t notifying;          // some notify transport is registered
     struct {
         char *firmware_path;
         char *hexkey;
@@ -38,6 +60,11 @@ typedef struct {
         xbool_t upgrade_in_place;
         xbool_t dont_print_progress;
         xbool_t enable_dbus;
+        char *notify;
+        int events_fd;
+        char *log_file;
+        xbool_t journal;
+        xbool_t force;
         char *key_path;
         int stream_count;
      } flags;
@@ -48,6 +75,8 @@ static upgrade_context_t g_upgrade_ctx = {
     .temp_fp = NULL,
     .ar = NULL,
     .disk = NULL,
+    .arena = NULL,
+    .notifying = xFALSE,
     .flags = {
         .firmware_path = NULL,
         .hexkey = NULL,
@@ -55,57 +84,115 @@ static upgrade_context_t g_upgrade_ctx = {
         .upgrade_in_place = xFALSE,
         .dont_print_progress = xFALSE,
         .enable_dbus = xFALSE,
+        .notify = NULL,
+        .events_fd = -1,
+        .log_file = NULL,
+        .journal = xFALSE,
+        .force = xFALSE,
         .key_path = NULL,
         .stream_count = 10240,
      }
 };
 
+/* Header version with 64-bit sizes in firmware_header_ext_t, v1 images carry 0 */
+#define FIRMWARE_HEADER_V2 2
+
 #pragma pack(push, 1)
 typedef struct {
     uint8_t magic[4];
     char datetime[20];
-    uint32_t size;
+    uint32_t size;          // Encrypted payload with tag, unused by v2
     uint8_t iv[AES_GCM_IV_LEN];
-    uint8_t reserved[12];
+    uint32_t unpacked_kib;  // Total unpacked size in KiB, 0 if unknown, unused by v2
+    uint32_t file_count;    // Number of archive entries, 0 if unknown, unused by v2
+    uint8_t version;        // 0 for v1, FIRMWARE_HEADER_V2, the first of the four bytes v1 reserved
+    uint8_t reserved[3];
 } firmware_header_t;
+
+/* Follows firmware_header_t in a v2 image, the payload starts after it. */
+typedef struct {
+    uint64_t size;          // Encrypted payload with tag
+    uint64_t unpacked_size; // Total unpacked size in bytes, 0 if unknown
+    uint64_t file_count;    // Number of archive entries, 0 if unknown
+    uint8_t reserved[8];
+} firmware_header_ext_t;
 #pragma pack(pop)
 
+/* Where things are in an image, whichever header version it uses. */
+typedef struct {
+    uint8_t version;
+    uint64_t payload_offset;
+    uint64_t size;
+    uint64_t unpacked_size;
+    uint64_t file_count;
+} firmware_layout_t;
+
+/* A step of upgrade_execute(), reported to the event stream and the journal. */
+typedef struct {
+    const char *name;
+    struct timespec started;
+    events_stage_t events;
+    xarena_mark_t mark;         // what the stage allocates goes at stage_end()
+    size_t live;                // xbox heap in use at stage_begin(), with XBOX_ENABLE_MEMSTAT
+} upgrade_stage_t;
+
 static err_t upgrade_run(xoption self);
+static err_t upgrade_execute(upgrade_context_t *ctx);
+static void upgrade_release_resources(upgrade_context_t *ctx);
+static atomic_bool g_upgrade_canceled = xFALSE;
+#define upgrade_canceled() atomic_load(&g_upgrade_canceled)
 static int hexchar_to_int(char c);
 static err_t parse_hex_key(const char *hex, uint8_t *key, size_t key_len);
-static void XLOG_P(const char *prefix, const char *postfix, size_t current, size_t total);
+static void XLOG_P(const char *prefix, const char *postfix, uint64_t current, uint64_t total);
 static void XLOG_WAITING(const char *message);
 #define notify_progress(step, percent, total, current) do { \
-    if (!g_upgrade_ctx.flags.enable_dbus) break; \
+    if (!g_upgrade_ctx.notifying) break; \
     notify_operators_t *ops = get_notify_operators(); \
     if (ops && ops->progress_changed) { \
         ops->progress_changed(step, percent, total, current); \
     } \
 } while(0)
 #define notify_message(message) do { \
-    if (!g_upgrade_ctx.flags.enable_dbus) break; \
+    if (!g_upgrade_ctx.notifying) break; \
     notify_operators_t *ops = get_notify_operators(); \
     if (ops && ops->message_logged) { \
         ops->message_logged(message); \
     } \
 } while(0)
 #define notify_message_fmt(fmt, ...) do { \
-    if (!g_upgrade_ctx.flags.enable_dbus) break; \
-    xstring message = xstring_init_format(fmt, __VA_ARGS__); \
+    if (!g_upgrade_ctx.notifying) break; \
+    xarena_mark_t mark = xarena_mark(g_upgrade_ctx.arena); \
+    xstrbuf message = xstrbuf_init_arena(g_upgrade_ctx.arena, 128); \
+    xstrbuf_format(&message, fmt, __VA_ARGS__); \
     notify_operators_t *ops = get_notify_operators(); \
-    if (ops && ops->message_logged) { \
-        ops->message_logged(xstring_to_string(&message)); \
+    if (ops && ops->message_logged && xstrbuf_str(&message)) { \
+        ops->message_logged(xstrbuf_str(&message)); \
     } \
-    xstring_free(&message); \
+    xarena_rewind(g_upgrade_ctx.arena, mark); \
 } while(0)
 #define notify_error(code, message) do { \
-    if (!g_upgrade_ctx.flags.enable_dbus) break; \
+    if (!g_upgrade_ctx.notifying) break; \
     notify_operators_t *ops = get_notify_operators(); \
     if (ops && ops->error_occurred) { \
         ops->error_occurred(code, message); \
     } \
 } while(0)
 
+#define notify_job_started() do { \
+    if (!g_upgrade_ctx.notifying) break; \
+    notify_operators_t *ops = get_notify_operators(); \
+    if (ops && ops->job_started) { \
+        ops->job_started(); \
+    } \
+} while(0)
+#define notify_job_finished(code) do { \
+    if (!g_upgrade_ctx.notifying) break; \
+    notify_operators_t *ops = get_notify_operators(); \
+    if (ops && ops->job_finished) { \
+        ops->job_finished(code); \
+    } \
+} while(0)
+
 err_t upgrade_usage_init(xoption root) {
     if (!root)
         return X_RET_INVAL;
@@ -137,6 +224,21 @@ err_t upgrade_usage_init(xoption root) {
     xoption_add_boolean(upgrade, '\0', "enable-dbus",
                         "Use D-Bus to notify event",
                         &g_upgrade_ctx.flags.enable_dbus);
+    xoption_add_string(upgrade, '\0', "notify", "<transports>",
+                       "Notify events through a comma separated list of dbus, socket[:<path>] and shm[:<path>]",
+                       &g_upgrade_ctx.flags.notify, xFALSE);
+    xoption_add_number(upgrade, '\0', "events-fd", "<fd>",
+                       "Write newline-delimited JSON events to this open file descriptor",
+                       &g_upgrade_ctx.flags.events_fd, xFALSE);
+    xoption_add_string(upgrade, '\0', "log-file", "<path>",
+                       "Also log to this file, rotated at 1 MiB with 5 old files kept",
+                       &g_upgrade_ctx.flags.log_file, xFALSE);
+    xoption_add_boolean(upgrade, '\0', "journal",
+                        "Also log to the systemd journal, with module, stage and throughput fields",
+                        &g_upgrade_ctx.flags.journal);
+    xoption_add_boolean(upgrade, '\0', "force",
+                        "Reinstall even if a partition already carries this firmware",
+                        &g_upgrade_ctx.flags.force);
 
     g_upgrade_ctx.this_option = upgrade;
 
@@ -147,18 +249,31 @@ static err_t stream_decrypt_gcm(FILE *in_fp,
                                 FILE *out_fp,
                                 const uint8_t key[AES_GCM_KEY_LEN],
                                 const uint8_t iv[AES_GCM_IV_LEN],
-                                size_t data_size,
+                                uint64_t data_size,
                                 const uint8_t tag[AES_GCM_TAG_LEN],
                                 int stream_count,
                                 xbool_t skip_auth_tag);
 
 static err_t verify_rsa_signature(FILE *in,
-                                  size_t length,
+                                  uint64_t length,
                                   int stream_count,
                                   const uint8_t *signature,
                                   size_t signature_size,
                                   const char *public_key_pem_path);
 
+static err_t read_firmware_layout(FILE *in, const firmware_header_t *header, firmware_layout_t *layout);
+static err_t preflight_check(FILE *in, const firmware_layout_t *layout, const char *target_dir);
+static err_t check_free_space(const char *dir, uint64_t need_bytes, uint64_t need_inodes, const char *what);
+typedef enum {
+    IMAGE_NOT_INSTALLED,
+    IMAGE_ON_ACTIVE,
+    IMAGE_ON_TARGET,
+} image_install_state_e;
+
+static void format_image_identity(const firmware_header_t *header, const firmware_layout_t *layout,
+                                  const uint8_t tag[AES_GCM_TAG_LEN], char *buf, size_t len);
+static image_install_state_e detect_installed_image(FILE *in, const char *identity, xbool_t upgrade_in_place);
+static void record_firmware_checksum(FILE *in, const char *firmware_path, const char *record_dir);
 static err_t unpack_with_install(upgrade_context_t *ctx, const char *tar_gz_path, const char *output_dir);
 static err_t install_firmware(const char *firmware_dir);
 static err_t cleanup_temporary_resources();
@@ -174,9 +289,29 @@ err_t upgrade_run(xoption self) {
 
     upgrade_context_t *ctx = xoption_get_context(self);
 
-    if (!ctx->flags.firmware_path) {
-        XLOG_E("No update image specified.");
-        return X_RET_INVAL;
+    if (ctx->flags.log_file) {
+        xlog_file_options_t opt = xlog_file_options_init(ctx->flags.log_file);
+        opt.compress = xTRUE;
+        opt.sync = xTRUE;
+        xlog_sink sink = xlog_file_sink_new(&opt);
+        if (sink == NULL) {
+            XLOG_E("Failed to open log file %s: %s", ctx->flags.log_file, strerror(errno));
+            return X_RET_ERROR;
+        }
+        xlog_logger_append_sink(xlog_global_instance(), sink);
+        // Buffer the chatter, warnings and errors reach the disk right away
+        xlog_global_set_flush_lvl(XLOG_LVL_WARN);
+    }
+
+    if (ctx->flags.journal) {
+        xlog_journal_options_t opt = xlog_journal_options_init("iota-cli");
+        xlog_sink sink = xlog_journal_sink_new(&opt);
+        if (sink == NULL) {
+            XLOG_E("Failed to create the journal sink");
+            return X_RET_ERROR;
+        }
+        xlog_logger_append_sink(xlog_global_instance(), sink);
+        xlog_global_set_flush_lvl(XLOG_LVL_WARN);
     }
 
     if (ctx->flags.enable_dbus) {
@@ -184,6 +319,130 @@ err_t upgrade_run(xoption self) {
         register_dbus_notify_operators();
     }
 
+    if (ctx->flags.notify) {
+        err_t err = notify_setup(ctx->flags.notify);
+        if (err != X_RET_OK) {
+            return err;
+        }
+    }
+
+    if (ctx->flags.events_fd >= 0) {
+        err_t err = register_events_notify_operators(ctx->flags.events_fd);
+        if (err != X_RET_OK) {
+            return err;
+        }
+    }
+    ctx->notifying = get_notify_operators() != NULL;
+
+    notify_job_started();
+    err_t err = upgrade_execute(ctx);
+    notify_job_finished(err);
+    events_result("upgrade", err);
+    return err;
+}
+
+err_t upgrade_perform(const upgrade_request_t *req) {
+    if (req == NULL || req->firmware_path == NULL)
+        return X_RET_INVAL;
+
+    // The daemon reports through the registered notify operators only
+    upgrade_context_t *ctx = &g_upgrade_ctx;
+    ctx->flags.firmware_path = (char *)req->firmware_path;
+    ctx->flags.hexkey = (char *)req->hexkey;
+    ctx->flags.key_path = (char *)req->key_path;
+    ctx->flags.skip_firmware_verify = req->skip_verify;
+    ctx->flags.upgrade_in_place = req->in_place;
+    ctx->flags.force = req->force;
+    ctx->flags.dont_print_progress = xTRUE;
+    ctx->notifying = get_notify_operators() != NULL;
+
+    notify_job_started();
+    err_t err = upgrade_execute(ctx);
+    notify_job_finished(err);
+    upgrade_release_resources(ctx);
+
+    ctx->flags.firmware_path = NULL;
+    ctx->flags.hexkey = NULL;
+    ctx->flags.key_path = NULL;
+    return err;
+}
+
+void upgrade_cancel(void) {
+    atomic_store(&g_upgrade_canceled, xTRUE);
+}
+
+void upgrade_cancel_clear(void) {
+    atomic_store(&g_upgrade_canceled, xFALSE);
+}
+
+static upgrade_stage_t stage_begin(const char *name) {
+    upgrade_stage_t stage = {.name = name, .events = events_stage_begin(name)};
+    clock_gettime(CLOCK_MONOTONIC, &stage.started);
+    stage.mark = xarena_mark(g_upgrade_ctx.arena);
+
+    xbox_memstat_t mem;
+    if (xbox_memstat_get(&mem)) {
+        stage.live = mem.live_bytes;
+        xbox_memstat_reset_peak();
+    }
+
+    // Everything logged until stage_end() is tagged with the stage
+    xlog_journal_set_field("IOTA_STAGE", name);
+    return stage;
+}
+
+static void stage_end(const upgrade_stage_t *stage, uint64_t bytes, err_t err) {
+    events_stage_end(stage->name, stage->events, err);
+    xarena_rewind(g_upgrade_ctx.arena, stage->mark);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t elapsed_ms = (uint64_t)(now.tv_sec - stage->started.tv_sec) * 1000 +
+                          (now.tv_nsec - stage->started.tv_nsec) / 1000000;
+
+    if (err == X_RET_OK && bytes > 0) {
+        uint64_t kibps = bytes * 1000 / 1024 / (elapsed_ms ? elapsed_ms : 1);
+        char value[24];
+
+        // Only the summary carries the numbers, e.g. journalctl IOTA_STAGE=install -o verbose
+        snprintf(value, sizeof(value), "%ju", (uintmax_t)bytes);
+        xlog_journal_set_field("IOTA_STAGE_BYTES", value);
+        snprintf(value, sizeof(value), "%ju", (uintmax_t)elapsed_ms);
+        xlog_journal_set_field("IOTA_STAGE_MS", value);
+        snprintf(value, sizeof(value), "%ju", (uintmax_t)kibps);
+        xlog_journal_set_field("IOTA_STAGE_KIBPS", value);
+
+        XLOG_I("Stage %s: %ju bytes in %ju ms (%ju KiB/s)", stage->name,
+               (uintmax_t)bytes, (uintmax_t)elapsed_ms, (uintmax_t)kibps);
+
+        xlog_journal_set_field("IOTA_STAGE_BYTES", NULL);
+        xlog_journal_set_field("IOTA_STAGE_MS", NULL);
+        xlog_journal_set_field("IOTA_STAGE_KIBPS", NULL);
+    }
+
+    // The peak is what the stage needs on top of what was live before it
+    xbox_memstat_t mem;
+    if (xbox_memstat_get(&mem)) {
+        XLOG_I("Stage %s: heap peak %zu KiB, %zu KiB live (%+ld KiB), %zu blocks",
+               stage->name, mem.peak_bytes / 1024, mem.live_bytes / 1024,
+               ((long)mem.live_bytes - (long)stage->live) / 1024, mem.live_blocks);
+
+        xbox_memsite_t sites[3];
+        size_t n = xbox_memstat_sites(sites, xARRAY_SIZE(sites));
+        for (size_t i = 0; i < n; ++i)
+            XLOG_D("  %zu bytes in %zu blocks from %s:%d", sites[i].live_bytes,
+                   sites[i].live_blocks, sites[i].file, sites[i].line);
+    }
+
+    xlog_journal_set_field("IOTA_STAGE", NULL);
+}
+
+static err_t upgrade_execute(upgrade_context_t *ctx) {
+    if (!ctx->flags.firmware_path) {
+        XLOG_E("No update image specified.");
+        return X_RET_INVAL;
+    }
+
     const char *firmware_path = ctx->flags.firmware_path;
     const char *hexkey = ctx->flags.hexkey;
     const char *key_path = ctx->flags.key_path;
@@ -196,6 +455,14 @@ err_t upgrade_run(xoption self) {
 
     XLOG_I("Stream decryption signature verification, single stream %d bytes", stream_count);
 
+    // Sized for the stream buffers, so a stage needs one chunk at most
+    if (!ctx->arena)
+        ctx->arena = xarena_create((size_t)xMAX(stream_count, 0) * 2 + 4096);
+    if (!ctx->arena) {
+        XLOG_E("Failed to allocate upgrade work memory.");
+        return X_RET_NOMEM;
+    }
+
     ctx->firmware_fp = os_file_open(firmware_path, "rb");
     FILE *in = ctx->firmware_fp;
     if (!in) {
@@ -205,6 +472,7 @@ err_t upgrade_run(xoption self) {
 
     err_t err = X_RET_OK;
     firmware_header_t header = {0};
+    firmware_layout_t layout = {0};
     uint8_t tag[AES_GCM_TAG_LEN] = {0};
     uint8_t signature[RSA_SIGNATURE_LEN] = {0};
     time_t start_time = time(NULL);
@@ -234,14 +502,48 @@ err_t upgrade_run(xoption self) {
     XLOG_D("Firmware header:");
     XLOG_D(" Magic: %c%c%c%c", header.magic[0], header.magic[1], header.magic[2], header.magic[3]);
     XLOG_D(" Datetime: %.*s", (int)sizeof(header.datetime), header.datetime);
-    XLOG_D(" Size: %u", header.size);
+    XLOG_D(" Version: %u", header.version ? header.version : 1);
     XLOG_D(" IV: %x%x%x%x%x%x%x%x%x%x%x%x", 
            header.iv[0], header.iv[1], header.iv[2], header.iv[3],
            header.iv[4], header.iv[5], header.iv[6], header.iv[7],
            header.iv[8], header.iv[9], header.iv[10], header.iv[11]);
 
+    XLOG_I("Checking firmware magic");
+    // Validate magic
+    if (memcmp(header.magic, magic, sizeof(magic)) != 0) {
+        XLOG_E("Invalid firmware magic.");
+        return X_RET_BADFMT;
+    }
+
+    err = read_firmware_layout(in, &header, &layout);
+    if (err != X_RET_OK) {
+        return err;
+    }
+
+    XLOG_D(" Size: %ju", (uintmax_t)layout.size);
+    XLOG_D(" Unpacked: %ju KiB, Files: %ju", (uintmax_t)(layout.unpacked_size / 1024), (uintmax_t)layout.file_count);
+
+    if (upgrade_in_place) {
+        XLOG_I("Performing In-Place update mode");
+        XLOG_I("Skip mounting inactive partition");
+    } else {
+        XLOG_I("Performing Standard update mode");
+        err = mount_inactive_partition();
+        if (err != X_RET_OK) {
+            XLOG_E("Failed to mount inactive partition");
+            return err;
+        }
+    }
+
+    // Reject images that cannot be installed before any heavy work
+    err = preflight_check(in, &layout, upgrade_in_place ? "/" : INACTIVE_PARTITION_MOUNT_POINT);
+    if (err != X_RET_OK) {
+        notify_error(500, "Preflight check failed");
+        return err;
+    }
+
     // Read IOTA AES-GCM tag
-    fseek(in, sizeof(firmware_header_t) + header.size - AES_GCM_TAG_LEN, SEEK_SET);
+    fseeko(in, (off_t)(layout.payload_offset + layout.size - AES_GCM_TAG_LEN), SEEK_SET);
     size_t tag_read_size = fread(tag, 1, sizeof(tag), in);
     if (tag_read_size != sizeof(tag)) {
         XLOG_E("Failed to read firmware tag.");
@@ -250,7 +552,7 @@ err_t upgrade_run(xoption self) {
     // XLOG_HEX_DUMP("Image tag:", tag, sizeof(tag));
 
     // Read Signature
-    fseek(in, -RSA_SIGNATURE_LEN, SEEK_END);
+    fseeko(in, -RSA_SIGNATURE_LEN, SEEK_END);
     size_t sig_read_size = fread(signature, 1, sizeof(signature), in);
     if (sig_read_size != sizeof(signature)) {
         XLOG_E("Failed to read firmware signature.");
@@ -258,11 +560,25 @@ err_t upgrade_run(xoption self) {
     }
     // XLOG_HEX_DUMP("Image signature:", signature, sizeof(signature));
 
-    XLOG_I("Checking firmware magic");
-    // Validate magic
-    if (memcmp(header.magic, magic, sizeof(magic)) != 0) {
-        XLOG_E("Invalid firmware magic.");
-        return X_RET_BADFMT;
+    // Skip reinstalling an image that is already recorded on a partition
+    char identity[128];
+    format_image_identity(&header, &layout, tag, identity, sizeof(identity));
+    XLOG_D("Firmware identity: %s", identity);
+
+    if (ctx->flags.force) {
+        XLOG_I("Forced upgrade, skipping installed image detection");
+    } else {
+        image_install_state_e state = detect_installed_image(in, identity, upgrade_in_place);
+        if (state == IMAGE_ON_ACTIVE) {
+            XLOG_W("This firmware is already installed on the active partition, nothing to do. Use --force to reinstall.");
+            notify_message("Already installed");
+            // Nothing left to do is a success, scripts and the daemon must not see a failure
+            return X_RET_OK;
+        } else if (state == IMAGE_ON_TARGET) {
+            XLOG_W("This firmware is already installed on the inactive partition, run `iota-cli checkout` to switch. Use --force to reinstall.");
+            notify_message("Already installed, checkout required");
+            return X_RET_OK;
+        }
     }
 
     // Verify signature
@@ -274,13 +590,15 @@ err_t upgrade_run(xoption self) {
 
         XLOG_I("Verifying firmware signature");
 
-        fseek(in, 0, SEEK_SET); // Seek back to the beginning for signature verification
+        fseeko(in, 0, SEEK_SET); // Seek back to the beginning for signature verification
+        upgrade_stage_t stage = stage_begin("verify");
         err = verify_rsa_signature(in,
-                                   sizeof(firmware_header_t) + header.size,
+                                   layout.payload_offset + layout.size,
                                    stream_count,
                                    signature,
                                    sizeof(signature),
                                    key_path);
+        stage_end(&stage, layout.payload_offset + layout.size, err);
 
         if (err != X_RET_OK) {
             notify_error(500, "Firmware signature verification failed");
@@ -295,7 +613,7 @@ err_t upgrade_run(xoption self) {
 
     XLOG_I("Decrypting firmware package");
     // Seek to the start of encrypted data
-    fseek(in, sizeof(firmware_header_t), SEEK_SET);
+    fseeko(in, (off_t)layout.payload_offset, SEEK_SET);
     ctx->temp_fp = os_file_open(TEMPORARY_TARGZ_PATH, "wb");
     FILE *out = ctx->temp_fp;
     if (!out) {
@@ -303,50 +621,59 @@ err_t upgrade_run(xoption self) {
         return X_RET_ERROR;
     }
 
+    upgrade_stage_t stage = stage_begin("decrypt");
     err = stream_decrypt_gcm(in,
                              out,
                              key,
                              header.iv,
-                             (size_t)header.size,
+                             layout.size,
                              tag,
                              stream_count,
                              xFALSE);
+    stage_end(&stage, layout.size, err);
     if (err != X_RET_OK) {
         return err;
     }
 
+    // The archive is read back by name, nothing may stay in the stdio buffer
+    if (fflush(out) != 0) {
+        XLOG_E("Failed to write decrypted firmware: %s", strerror(errno));
+        return X_RET_ERROR;
+    }
+
     XLOG_I("Firmware package decrypted successfully");
 
-    if (upgrade_in_place) {
-        XLOG_I("Performing In-Place update mode");
-        XLOG_I("Skip mounting inactive partition");
-    } else {
-        XLOG_I("Performing Standard update mode");
-        err = mount_inactive_partition();
-        if (err != X_RET_OK) {
-            XLOG_E("Failed to mount inactive partition");
-            goto exit;
-        }
-    }
+    // The target stops carrying its recorded image as soon as it is written to
+    unlink(upgrade_in_place ? FIRMWARE_RECORD_DIR "/" FIRMWARE_IDENTITY_FILE
+                            : INACTIVE_PARTITION_MOUNT_POINT FIRMWARE_RECORD_DIR "/" FIRMWARE_IDENTITY_FILE);
+    unlink(upgrade_in_place ? FIRMWARE_RECORD_DIR "/" FIRMWARE_CHECKSUM_FILE
+                            : INACTIVE_PARTITION_MOUNT_POINT FIRMWARE_RECORD_DIR "/" FIRMWARE_CHECKSUM_FILE);
 
     XLOG_I("Unpacking and installing firmware package");
+    stage = stage_begin("install");
     err = unpack_with_install(ctx, TEMPORARY_TARGZ_PATH, upgrade_in_place ? "/" : INACTIVE_PARTITION_MOUNT_POINT);
+    stage_end(&stage, layout.unpacked_size, err);
     if (err != X_RET_OK) {
         XLOG_E("Failed to unpack firmware package");
         goto exit;
     }
 
     // Record IOTA package checksum 
-    xstring cmd = xstring_init_format("mkdir -p %s;sha256sum %s > %s/current.sha256",
-                                      upgrade_in_place ? "/var/ota" : INACTIVE_PARTITION_MOUNT_POINT "/var/ota",
-                                      firmware_path,
-                                      upgrade_in_place ? "/var/ota" : INACTIVE_PARTITION_MOUNT_POINT "/var/ota");
-    exec_t checksum = exec_command(xstring_to_string(&cmd));
-
-    XLOG_I("Recorded firmware package checksum to %s/current.sha256",
-           upgrade_in_place ? "/var/ota" : INACTIVE_PARTITION_MOUNT_POINT "/var/ota");
-    xstring_free(&cmd);
-    exec_free(checksum);
+    record_firmware_checksum(in, firmware_path,
+                             upgrade_in_place ? FIRMWARE_RECORD_DIR : INACTIVE_PARTITION_MOUNT_POINT FIRMWARE_RECORD_DIR);
+
+    // Record the cheap identity used to detect re-sent images
+    xarena_mark_t mark = xarena_mark(ctx->arena);
+    xstrbuf id_path = xstrbuf_init_arena(ctx->arena, PATH_MAX);
+    xstrbuf id_line = xstrbuf_init_arena(ctx->arena, sizeof(identity) + 1);
+    xstrbuf_format(&id_path, "%s/" FIRMWARE_IDENTITY_FILE,
+                   upgrade_in_place ? FIRMWARE_RECORD_DIR : INACTIVE_PARTITION_MOUNT_POINT FIRMWARE_RECORD_DIR);
+    xstrbuf_format(&id_line, "%s\n", identity);
+    if (xstrbuf_truncated(&id_path) || xstrbuf_truncated(&id_line) ||
+        os_file_write(xstrbuf_str(&id_path), (const uint8_t *)xstrbuf_str(&id_line), xstrbuf_len(&id_line)) != X_RET_OK) {
+        XLOG_W("Failed to record firmware identity to %s", xstrbuf_str(&id_path) ? xstrbuf_str(&id_path) : "(none)");
+    }
+    xarena_rewind(ctx->arena, mark);
 
     time_t end_time = time(NULL);
     XLOG_I("Firmware upgrade completed successfully. Total time: %jd (s).", end_time - start_time);
@@ -359,7 +686,7 @@ static err_t stream_decrypt_gcm(FILE *in_fp,
                                 FILE *out_fp,
                                 const uint8_t key[AES_GCM_KEY_LEN],
                                 const uint8_t iv[AES_GCM_IV_LEN],
-                                size_t data_size,
+                                uint64_t data_size,
                                 const uint8_t tag[AES_GCM_TAG_LEN],
                                 int stream_count, 
                                 xbool_t skip_auth_tag) {
@@ -369,8 +696,8 @@ static err_t stream_decrypt_gcm(FILE *in_fp,
 
     err_t err = X_RET_OK;
     EVP_CIPHER_CTX *ctx = NULL;
-    size_t processed_size = 0;
-    size_t total_size = data_size - AES_GCM_TAG_LEN;
+    uint64_t processed_size = 0;
+    uint64_t total_size = data_size - AES_GCM_TAG_LEN;
     time_t start_time = time(NULL);
 
     if(!(ctx = EVP_CIPHER_CTX_new())) {
@@ -393,18 +720,25 @@ static err_t stream_decrypt_gcm(FILE *in_fp,
         return X_RET_ERROR;
     }
 
+    // Both go when the decrypt stage ends, whichever way this returns
     int len = 0;
-    uint8_t *inbuf = malloc(stream_count);
-    uint8_t *outbuf = malloc(stream_count);
-    if (!inbuf) {
-        XLOG_E("Failed to allocate input buffer.");
+    uint8_t *inbuf = xarena_alloc(g_upgrade_ctx.arena, stream_count);
+    uint8_t *outbuf = xarena_alloc(g_upgrade_ctx.arena, stream_count);
+    if (!inbuf || !outbuf) {
+        XLOG_E("Failed to allocate stream buffers.");
         EVP_CIPHER_CTX_free(ctx);
         return X_RET_NOMEM;
     }
 
     while (processed_size < total_size) {
-        size_t remaining_size = total_size - processed_size;
-        size_t to_read = xMIN(remaining_size, stream_count);
+        if (upgrade_canceled()) {
+            XLOG_W("Decryption canceled.");
+            EVP_CIPHER_CTX_free(ctx);
+            return X_RET_CANCELED;
+        }
+
+        uint64_t remaining_size = total_size - processed_size;
+        size_t to_read = (size_t)xMIN(remaining_size, (uint64_t)stream_count);
         size_t read_bytes = fread(inbuf, 1, to_read, in_fp);
         time_t current_time = time(NULL);
 
@@ -415,20 +749,19 @@ static err_t stream_decrypt_gcm(FILE *in_fp,
                total_size,
                ((double)(processed_size + read_bytes) / total_size) * 100.0);
 #else
-        xstring postfix = xstring_init_format(" Elapsed: %jd (s)", current_time - start_time);
-        XLOG_P("Decrypting", xstring_to_string(&postfix), processed_size + read_bytes, total_size);
+        char postfix[32];
+        xstrbuf sb = xstrbuf_init(postfix, sizeof(postfix));
+        xstrbuf_format(&sb, " Elapsed: %jd (s)", (intmax_t)(current_time - start_time));
+        XLOG_P("Decrypting", postfix, processed_size + read_bytes, total_size);
 #endif
         if (read_bytes != to_read) {
             XLOG_E("Failed to read encrypted data. Expected %zu bytes, got %zu bytes.", to_read, read_bytes);
-            free(inbuf);
             EVP_CIPHER_CTX_free(ctx);
             return X_RET_ERROR;
         }
 
         if(1 != EVP_DecryptUpdate(ctx, outbuf, &len, inbuf, read_bytes)) {
             XLOG_E("EVP_DecryptUpdate failed. error: %s", ERR_reason_error_string(ERR_get_error()));
-            free(inbuf);
-            free(outbuf);
             EVP_CIPHER_CTX_free(ctx);
             return X_RET_ERROR;
         }
@@ -436,8 +769,6 @@ static err_t stream_decrypt_gcm(FILE *in_fp,
         if (len > 0) {
             if (fwrite(outbuf, 1, len, out_fp) != (size_t)len) {
                 XLOG_E("Failed to write decrypted data.");
-                free(inbuf);
-                free(outbuf);
                 EVP_CIPHER_CTX_free(ctx);
                 return X_RET_ERROR;
             }
@@ -454,8 +785,6 @@ static err_t stream_decrypt_gcm(FILE *in_fp,
         /* Set expected tag value. */
         if(1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, AES_GCM_TAG_LEN, (void *)tag)) {
             XLOG_E("EVP_CIPHER_CTX_ctrl failed. error: %s", ERR_reason_error_string(ERR_get_error()));
-            free(inbuf);
-            free(outbuf);
             EVP_CIPHER_CTX_free(ctx);
             return X_RET_ERROR;
         }
@@ -472,7 +801,7 @@ static err_t stream_decrypt_gcm(FILE *in_fp,
             }
 
             time_t end_time = time(NULL);
-            XLOG_I("Decrypted %ld bytes successfully. Total time: %jd (s).", processed_size, end_time - start_time);
+            XLOG_I("Decrypted %ju bytes successfully. Total time: %jd (s).", (uintmax_t)processed_size, end_time - start_time);
             err = X_RET_OK; // Success for main return
         } else {
             /* Verify failed */
@@ -483,8 +812,6 @@ static err_t stream_decrypt_gcm(FILE *in_fp,
 
     }
 
-    free(inbuf);
-    free(outbuf);
     EVP_CIPHER_CTX_free(ctx);
 
     return err;
@@ -492,7 +819,7 @@ static err_t stream_decrypt_gcm(FILE *in_fp,
 
 
 static err_t verify_rsa_signature(FILE *in,
-                                  size_t size,
+                                  uint64_t size,
                                   int stream_count,
                                   const uint8_t *signature,
                                   size_t signature_size,
@@ -503,7 +830,7 @@ static err_t verify_rsa_signature(FILE *in,
     FILE *fp = NULL;
     unsigned char buf[stream_count];
     size_t n = 0;
-    size_t read_bytes = 0;
+    uint64_t read_bytes = 0;
     err_t err = X_RET_OK;
     time_t start_time = time(NULL);
 
@@ -524,9 +851,15 @@ static err_t verify_rsa_signature(FILE *in,
         goto end;
 
     while (read_bytes < size) {
+        if (upgrade_canceled()) {
+            XLOG_W("Verification canceled.");
+            err = X_RET_CANCELED;
+            goto end;
+        }
+
         time_t current_time = time(NULL);
-        size_t remaining_size = size - read_bytes;
-        n = fread(buf, 1, xMIN(remaining_size, sizeof(buf)), in);
+        uint64_t remaining_size = size - read_bytes;
+        n = fread(buf, 1, (size_t)xMIN(remaining_size, (uint64_t)sizeof(buf)), in);
         if (n == 0) break;
         if (EVP_DigestVerifyUpdate(ctx, buf, n) != 1)
             goto end;
@@ -535,8 +868,10 @@ static err_t verify_rsa_signature(FILE *in,
         XLOG_T("Verifying..., Elapsed: %jd (s), %zu/%zu bytes processed (%.1f %%).",
                current_time - start_time, read_bytes + n, size, ((double)(read_bytes + n) / size) * 100.0);
 #else
-        xstring postfix = xstring_init_format(" Elapsed: %jd (s)", current_time - start_time);
-        XLOG_P("Verifying", xstring_to_string(&postfix), read_bytes + n, size);
+        char postfix[32];
+        xstrbuf sb = xstrbuf_init(postfix, sizeof(postfix));
+        xstrbuf_format(&sb, " Elapsed: %jd (s)", (intmax_t)(current_time - start_time));
+        XLOG_P("Verifying", postfix, read_bytes + n, size);
 #endif
 
         read_bytes += n;
@@ -565,6 +900,305 @@ end:
     return err;
 }
 
+/* Fills `layout` from a v1 header, or from the v2 extension that follows it in `in`. */
+static err_t read_firmware_layout(FILE *in, const firmware_header_t *header, firmware_layout_t *layout) {
+    memset(layout, 0, sizeof(*layout));
+
+    if (header->version == 0 || header->version == 1) {
+        layout->version = 1;
+        layout->payload_offset = sizeof(firmware_header_t);
+        layout->size = header->size;
+        layout->unpacked_size = (uint64_t)header->unpacked_kib * 1024;
+        layout->file_count = header->file_count;
+        return X_RET_OK;
+    }
+
+    if (header->version != FIRMWARE_HEADER_V2) {
+        XLOG_E("Unsupported firmware header version %u", header->version);
+        return X_RET_NOTSUP;
+    }
+
+    // The extension directly follows the header, which was just read
+    firmware_header_ext_t ext;
+    if (fread(&ext, 1, sizeof(ext), in) != sizeof(ext)) {
+        XLOG_E("Failed to read image header extension.");
+        return X_RET_BADFMT;
+    }
+
+    layout->version = FIRMWARE_HEADER_V2;
+    layout->payload_offset = sizeof(firmware_header_t) + sizeof(firmware_header_ext_t);
+    layout->size = ext.size;
+    layout->unpacked_size = ext.unpacked_size;
+    layout->file_count = ext.file_count;
+    return X_RET_OK;
+}
+
+/**
+ * Predict whether the image can be installed at all, using only the header
+ * and statvfs. Everything here is O(1) so a hopeless upgrade is rejected
+ * before the verify/decrypt/extract pipeline starts.
+ */
+static err_t preflight_check(FILE *in, const firmware_layout_t *layout, const char *target_dir) {
+    struct stat st;
+    if (fstat(fileno(in), &st) != 0) {
+        XLOG_E("Preflight: cannot stat firmware image: %s", strerror(errno));
+        return X_RET_ERROR;
+    }
+
+    // Compatibility: header, payload (with tag) and signature must all be present
+    uint64_t expected = layout->payload_offset + layout->size + RSA_SIGNATURE_LEN;
+    if (layout->size <= AES_GCM_TAG_LEN || expected < layout->size || (uint64_t)st.st_size < expected) {
+        XLOG_E("Preflight: firmware image is truncated or incompatible (size %jd, expected at least %ju bytes)",
+               (intmax_t)st.st_size, (uintmax_t)expected);
+        return X_RET_BADFMT;
+    }
+
+    // The decrypted package is staged in /tmp
+    err_t err = check_free_space(TEMPORARY_TARGZ_DIR, layout->size - AES_GCM_TAG_LEN, 1, "staging");
+    if (err != X_RET_OK) return err;
+
+    if (layout->unpacked_size == 0 && layout->file_count == 0) {
+        XLOG_D("Preflight: image header carries no install totals, deferring target check to archive scan");
+        return X_RET_OK;
+    }
+
+    // Files replaced on the target give their space back, so only reject
+    // here when the image cannot fit even into an empty filesystem.
+    struct statvfs vfs;
+    if (statvfs(target_dir, &vfs) != 0) {
+        XLOG_W("Preflight: statvfs '%s' failed: %s, skipping target check", target_dir, strerror(errno));
+        return X_RET_OK;
+    }
+
+    uint64_t need_bytes = layout->unpacked_size;
+    uint64_t capacity = (uint64_t)vfs.f_blocks * vfs.f_frsize;
+    if (need_bytes > capacity) {
+        XLOG_E("Preflight: image needs %ju KiB but '%s' holds only %ju KiB",
+               (uintmax_t)(need_bytes / 1024), target_dir, (uintmax_t)(capacity / 1024));
+        return X_RET_FULL;
+    }
+
+    if (vfs.f_files > 0 && layout->file_count > (uint64_t)vfs.f_files) {
+        XLOG_E("Preflight: image has %ju files but '%s' has only %ju inodes",
+               (uintmax_t)layout->file_count, target_dir, (uintmax_t)vfs.f_files);
+        return X_RET_FULL;
+    }
+
+    XLOG_I("Preflight OK: %ju KiB, %ju files on '%s' (%ju KiB free)",
+           (uintmax_t)(need_bytes / 1024), (uintmax_t)layout->file_count, target_dir,
+           (uintmax_t)((uint64_t)vfs.f_bavail * vfs.f_frsize / 1024));
+
+    return X_RET_OK;
+}
+
+static err_t check_free_space(const char *dir, uint64_t need_bytes, uint64_t need_inodes, const char *what) {
+    struct statvfs vfs;
+    if (statvfs(dir, &vfs) != 0) {
+        XLOG_W("Cannot statvfs '%s': %s, skipping %s space check", dir, strerror(errno), what);
+        return X_RET_OK;
+    }
+
+    uint64_t avail_bytes = (uint64_t)vfs.f_bavail * vfs.f_frsize;
+    if (need_bytes > avail_bytes) {
+        XLOG_E("Not enough %s space on '%s': need %ju KiB, available %ju KiB",
+               what, dir, (uintmax_t)(need_bytes / 1024), (uintmax_t)(avail_bytes / 1024));
+        return X_RET_FULL;
+    }
+
+    // Some filesystems (e.g. UBIFS) report no inode limit at all
+    if (vfs.f_files > 0 && need_inodes > (uint64_t)vfs.f_favail) {
+        XLOG_E("Not enough %s inodes on '%s': need %ju, available %ju",
+               what, dir, (uintmax_t)need_inodes, (uintmax_t)vfs.f_favail);
+        return X_RET_FULL;
+    }
+
+    XLOG_D("%s space on '%s': need %ju KiB / %ju inodes, available %ju KiB / %ju inodes",
+           what, dir, (uintmax_t)(need_bytes / 1024), (uintmax_t)need_inodes,
+           (uintmax_t)(avail_bytes / 1024), (uintmax_t)vfs.f_favail);
+
+    return X_RET_OK;
+}
+
+/**
+ * The GCM tag authenticates the whole encrypted payload, so together with
+ * the header fields it identifies an image without hashing it.
+ */
+static void format_image_identity(const firmware_header_t *header, const firmware_layout_t *layout,
+                                  const uint8_t tag[AES_GCM_TAG_LEN], char *buf, size_t len) {
+    size_t off = 0;
+    for (int i = 0; i < AES_GCM_TAG_LEN && off + 2 < len; i++) {
+        off += snprintf(buf + off, len - off, "%02x", tag[i]);
+    }
+    snprintf(buf + off, len - off, " %ju %.*s",
+             (uintmax_t)layout->size, (int)strnlen(header->datetime, sizeof(header->datetime)), header->datetime);
+}
+
+/* Reads a one-line record file, trailing whitespace removed. Caller frees. */
+static char *read_record(const char *dir, const char *name) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    char *content = (char *)os_file_readall(path);
+    if (!content) return NULL;
+
+    size_t len = strlen(content);
+    while (len > 0 && isspace((unsigned char)content[len - 1])) content[--len] = '\0';
+    return content;
+}
+
+/* Where a SIGBUS in digest_mapped() returns to, NULL outside of it. */
+static __thread sigjmp_buf *t_sigbus_jmp;
+
+static void on_sigbus(int sig) {
+    if (t_sigbus_jmp)
+        siglongjmp(*t_sigbus_jmp, 1);
+
+    // Not ours, die the way it would have without the handler
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+/*
+ * Digests a mapped image, dropping each window once it is digested. An image
+ * on removable or network media can shrink or vanish underneath the mapping,
+ * which faults with SIGBUS instead of a short read, so that is caught here and
+ * turned into an error.
+ */
+static err_t digest_mapped(EVP_MD_CTX *md, os_file_map_t *map) {
+    struct sigaction sa = {0}, old;
+    sa.sa_handler = on_sigbus;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGBUS, &sa, &old) != 0)
+        return X_RET_ERROR;
+
+    sigjmp_buf jmp;
+    volatile err_t err = X_RET_OK;
+    if (sigsetjmp(jmp, 1) == 0) {
+        t_sigbus_jmp = &jmp;
+        for (size_t off = 0, n = 0; off < map->len && err == X_RET_OK; off += n) {
+            n = xMIN(map->len - off, (size_t)SHA256_MAP_WINDOW);
+            if (EVP_DigestUpdate(md, map->data + off, n) != 1)
+                err = X_RET_ERROR;
+            os_file_map_drop(map, off, n);
+        }
+    } else {
+        XLOG_E("Firmware image was truncated or removed while hashing");
+        err = X_RET_ERROR;
+    }
+
+    t_sigbus_jmp = NULL;
+    sigaction(SIGBUS, &old, NULL);
+    return err;
+}
+
+static err_t compute_file_sha256(FILE *in, char hex[SHA256_DIGEST_LENGTH * 2 + 1]) {
+    uint8_t digest[SHA256_DIGEST_LENGTH];
+    unsigned int digest_len = 0;
+    size_t n = 0;
+    err_t err = X_RET_ERROR;
+
+    xarena_mark_t mark = xarena_mark(g_upgrade_ctx.arena);
+    os_file_map_t map = {0};
+    struct stat st;
+    EVP_MD_CTX *md = EVP_MD_CTX_new();
+    if (!md || EVP_DigestInit_ex(md, EVP_sha256(), NULL) != 1) goto end;
+
+    // Hash straight from the page cache so a large image never piles up in
+    // our resident set
+    if (fstat(fileno(in), &st) == 0 && S_ISREG(st.st_mode) &&
+        os_file_map_fd(fileno(in), 0, (size_t)st.st_size, OS_FILE_ADVICE_SEQUENTIAL, &map) == X_RET_OK) {
+        if (digest_mapped(md, &map) != X_RET_OK) goto end;
+    } else {
+        uint8_t *buf = xarena_alloc(g_upgrade_ctx.arena, 64 * 1024);
+        if (!buf) goto end;
+
+        fseeko(in, 0, SEEK_SET);
+        while ((n = fread(buf, 1, 64 * 1024, in)) > 0) {
+            if (EVP_DigestUpdate(md, buf, n) != 1) goto end;
+        }
+    }
+
+    if (EVP_DigestFinal_ex(md, digest, &digest_len) != 1) goto end;
+    for (unsigned int i = 0; i < digest_len; i++) {
+        sprintf(hex + i * 2, "%02x", digest[i]);
+    }
+    err = X_RET_OK;
+
+end:
+    EVP_MD_CTX_free(md);
+    os_file_unmap(&map);
+    xarena_rewind(g_upgrade_ctx.arena, mark);
+    return err;
+}
+
+/* Writes `record_dir`/current.sha256 in the same format as sha256sum(1). */
+static void record_firmware_checksum(FILE *in, const char *firmware_path, const char *record_dir) {
+    char hex[SHA256_DIGEST_LENGTH * 2 + 1];
+
+    if (os_mkdir_p(record_dir, 0755) != X_RET_OK) {
+        XLOG_W("Failed to create record directory %s: %s", record_dir, strerror(errno));
+        return;
+    }
+
+    if (compute_file_sha256(in, hex) != X_RET_OK) {
+        XLOG_W("Failed to compute firmware package checksum");
+        return;
+    }
+
+    xarena_mark_t mark = xarena_mark(g_upgrade_ctx.arena);
+    xstrbuf path = xstrbuf_init_arena(g_upgrade_ctx.arena, PATH_MAX);
+    xstrbuf line = xstrbuf_init_arena(g_upgrade_ctx.arena, PATH_MAX);
+    xstrbuf_format(&path, "%s/" FIRMWARE_CHECKSUM_FILE, record_dir);
+    xstrbuf_format(&line, "%s  %s\n", hex, firmware_path);
+    if (!xstrbuf_truncated(&path) && !xstrbuf_truncated(&line) &&
+        os_file_write(xstrbuf_str(&path), (const uint8_t *)xstrbuf_str(&line), xstrbuf_len(&line)) == X_RET_OK) {
+        XLOG_I("Recorded firmware package checksum to %s", xstrbuf_str(&path));
+    } else {
+        XLOG_W("Failed to record firmware package checksum to %s", xstrbuf_str(&path) ? xstrbuf_str(&path) : record_dir);
+    }
+    xarena_rewind(g_upgrade_ctx.arena, mark);
+}
+
+/* Whether the records in `dir` describe the incoming image. */
+static xbool_t slot_carries_image(const char *dir, FILE *in, const char *identity,
+                                  char *sha256_hex, xbool_t *sha256_ready) {
+    char *record = read_record(dir, FIRMWARE_IDENTITY_FILE);
+    if (record) {
+        xbool_t same = strcmp(record, identity) == 0;
+        free(record);
+        return same;
+    }
+
+    // Slots installed before identities were recorded only carry a checksum,
+    // hashing the image once is still far cheaper than reinstalling it.
+    record = read_record(dir, FIRMWARE_CHECKSUM_FILE);
+    if (!record) return xFALSE;
+
+    if (!*sha256_ready) {
+        XLOG_D("Computing firmware checksum to compare with %s/" FIRMWARE_CHECKSUM_FILE, dir);
+        *sha256_ready = compute_file_sha256(in, sha256_hex) == X_RET_OK;
+    }
+
+    xbool_t same = *sha256_ready && strncmp(record, sha256_hex, SHA256_DIGEST_LENGTH * 2) == 0;
+    free(record);
+    return same;
+}
+
+static image_install_state_e detect_installed_image(FILE *in, const char *identity, xbool_t upgrade_in_place) {
+    char sha256_hex[SHA256_DIGEST_LENGTH * 2 + 1] = {0};
+    xbool_t sha256_ready = xFALSE;
+    image_install_state_e state = IMAGE_NOT_INSTALLED;
+
+    if (slot_carries_image(FIRMWARE_RECORD_DIR, in, identity, sha256_hex, &sha256_ready)) {
+        state = IMAGE_ON_ACTIVE;
+    } else if (!upgrade_in_place &&
+               slot_carries_image(INACTIVE_PARTITION_MOUNT_POINT FIRMWARE_RECORD_DIR, in, identity, sha256_hex, &sha256_ready)) {
+        state = IMAGE_ON_TARGET;
+    }
+
+    return state;
+}
+
 static int is_excluded(const char *path) {
     const char *exclude[] = {
         "proc/", "sys/", "dev/", "run/", "tmp/", "mnt/", "media/", NULL
@@ -586,7 +1220,10 @@ static err_t unpack_with_install(upgrade_context_t *ctx, const char *tar_gz_path
     struct archive *a, *disk;
     struct archive_entry *entry;
     la_int64_t total_size = 0, processed_size = 0;
-    size_t file_count = 0;
+    la_int64_t install_size = 0, reclaimable_size = 0;
+    size_t file_count = 0, new_file_count = 0;
+    char target_path[PATH_MAX];
+    struct stat st;
 
     ctx->ar = archive_read_new();
     a = ctx->ar;
@@ -602,14 +1239,36 @@ static err_t unpack_with_install(upgrade_context_t *ctx, const char *tar_gz_path
     notify_message("Calculating");
     // First pass: calculate total size for progress reporting
     while (archive_read_next_header(a, &entry) == ARCHIVE_OK) {
+        const char *path = archive_entry_pathname(entry);
         total_size += archive_entry_size(entry);
+
+        // Net space the install needs: new bytes minus files it will replace
+        if (!is_excluded(path)) {
+            install_size += archive_entry_size(entry);
+            snprintf(target_path, sizeof(target_path), "%s/%s", output_dir, path);
+            if (lstat(target_path, &st) == 0) {
+                if (S_ISREG(st.st_mode)) reclaimable_size += st.st_size;
+            } else {
+                new_file_count++;
+            }
+        }
         archive_read_data_skip(a);
 
         XLOG_WAITING("Calculating");
-        XLOG_T("#%zu Archive entry: %s, size: %jd bytes", ++file_count, archive_entry_pathname(entry), archive_entry_size(entry));
+        XLOG_T("#%zu Archive entry: %s, size: %jd bytes", ++file_count, path, archive_entry_size(entry));
     }
     archive_read_close(a);
     archive_read_free(a);
+    ctx->ar = NULL;
+
+    err_t err = check_free_space(output_dir,
+                                 install_size > reclaimable_size ? install_size - reclaimable_size : 0,
+                                 new_file_count,
+                                 "install");
+    if (err != X_RET_OK) {
+        notify_error(500, "Not enough space on target");
+        return err;
+    }
 
     // Reopen for unpacking
     ctx->ar = archive_read_new();
@@ -633,6 +1292,13 @@ static err_t unpack_with_install(upgrade_context_t *ctx, const char *tar_gz_path
     while (archive_read_next_header(a, &entry) == ARCHIVE_OK) {
         const char *path = archive_entry_pathname(entry);
 
+        // A half-written inactive slot is harmless, a half-written root is not
+        if (upgrade_canceled() && !ctx->flags.upgrade_in_place) {
+            XLOG_W("Installation canceled, the inactive partition is incomplete.");
+            err = X_RET_CANCELED;
+            break;
+        }
+
         if (is_excluded(path)) {
             archive_read_data_skip(a);
             continue;
@@ -644,11 +1310,13 @@ static err_t unpack_with_install(upgrade_context_t *ctx, const char *tar_gz_path
             la_int64_t offset;
             while (archive_read_data_block(a, &buff, &size, &offset) == ARCHIVE_OK) {
                 time_t current_time = time(NULL);
-                xstring postfix = xstring_init_format(" Elapsed: %jd (s)", current_time - start_time);
+                char postfix[32];
+                xstrbuf sb = xstrbuf_init(postfix, sizeof(postfix));
+                xstrbuf_format(&sb, " Elapsed: %jd (s)", (intmax_t)(current_time - start_time));
                 archive_write_data_block(disk, buff, size, offset);
                 processed_size += size;
 
-                XLOG_P("Unpacking&Installing", xstring_to_string(&postfix), processed_size, total_size);
+                XLOG_P("Unpacking&Installing", postfix, processed_size, total_size);
 
                 usleep(1000);
             }
@@ -657,8 +1325,6 @@ static err_t unpack_with_install(upgrade_context_t *ctx, const char *tar_gz_path
 
     time_t end_time = time(NULL);
 
-    XLOG_I("Firmware package unpacked and installed successfully. Total time: %jd (s).", end_time - start_time);
-
     archive_read_close(a);
     archive_read_free(a);
     archive_write_close(disk);
@@ -667,6 +1333,11 @@ static err_t unpack_with_install(upgrade_context_t *ctx, const char *tar_gz_path
     ctx->ar = NULL;
     ctx->disk = NULL;
 
+    if (err != X_RET_OK)
+        return err;
+
+    XLOG_I("Firmware package unpacked and installed successfully. Total time: %jd (s).", end_time - start_time);
+
 #else
     xstring cmd = xstring_init_format("tar --warning=none "
                                       "--exclude=proc "
@@ -695,34 +1366,42 @@ static err_t unpack_with_install(upgrade_context_t *ctx, const char *tar_gz_path
 static err_t cleanup_temporary_resources() {
     XLOG_D("Cleaning up temporary resources");
 
-    xstring cmd = xstring_init_format("rm -rf %s %s", FIRMWARE_EXTRACTED_DIR, TEMPORARY_TARGZ_PATH);
-    exec_t output = exec_command(xstring_to_string(&cmd));
-    xstring_free(&cmd);
-    exec_free(output);
+    err_t err = os_remove_tree(FIRMWARE_EXTRACTED_DIR);
+    if (err != X_RET_OK) {
+        XLOG_W("Failed to remove %s: %s", FIRMWARE_EXTRACTED_DIR, strerror(errno));
+    }
 
-    return X_RET_OK;
+    if (unlink(TEMPORARY_TARGZ_PATH) != 0 && errno != ENOENT) {
+        XLOG_W("Failed to remove %s: %s", TEMPORARY_TARGZ_PATH, strerror(errno));
+        err = X_RET_ERROR;
+    }
+
+    return err;
 }
 
-static void XLOG_P(const char *prefix, const char *postfix, size_t current, size_t total) {
+static void XLOG_P(const char *prefix, const char *postfix, uint64_t current, uint64_t total) {
 
-    if (g_upgrade_ctx.flags.enable_dbus) {
+    if (g_upgrade_ctx.notifying) {
         static int last_precent = -1;
+        static const char *last_prefix = NULL;
         int current_percent = 0;
 
         if (total > 0) {
-            current_percent = (int)((uint64_t)current * 100 / total);
+            current_percent = (int)(current * 100 / total);
         }
 
-        if (current_percent != last_precent) {
-            notify_progress(prefix, current_percent, (int)total, (int)current);
+        // A new step starts reporting again from its first value
+        if (current_percent != last_precent || prefix != last_prefix) {
+            notify_progress(prefix, current_percent, total, current);
             last_precent = current_percent;
+            last_prefix = prefix;
         }
     }
 
     if (g_upgrade_ctx.flags.dont_print_progress) return;
 
     const int bar_width = 50;
-    float progress = (float)current / total;
+    float progress = total > 0 ? (float)((double)current / total) : 1.0f;
     int pos = (int)(bar_width * progress);
     char bar[bar_width + 1];
 
@@ -786,37 +1465,45 @@ err_t parse_hex_key(const char *hex, uint8_t *key, size_t key_len) {
     return X_RET_OK;
 }
 
-__attribute__((destructor))
-static void global_upgrade_destructor(void) {
-    // show cursor
-    fprintf(stderr, "\n\033[?25h");
-
+/* Releases what an upgrade run left behind, the run may have failed anywhere. */
+static void upgrade_release_resources(upgrade_context_t *ctx) {
     chdir("/");
 
-    if (g_upgrade_ctx.firmware_fp) {
-        fclose(g_upgrade_ctx.firmware_fp);
-        g_upgrade_ctx.firmware_fp = NULL;
+    if (ctx->firmware_fp) {
+        fclose(ctx->firmware_fp);
+        ctx->firmware_fp = NULL;
     }
 
-    if (g_upgrade_ctx.temp_fp) {
-        fclose(g_upgrade_ctx.temp_fp);
-        g_upgrade_ctx.temp_fp = NULL;
+    if (ctx->temp_fp) {
+        fclose(ctx->temp_fp);
+        ctx->temp_fp = NULL;
     }
 
-    if (g_upgrade_ctx.ar) {
-        archive_read_close(g_upgrade_ctx.ar);
-        archive_read_free(g_upgrade_ctx.ar);
-        g_upgrade_ctx.ar = NULL;
+    if (ctx->ar) {
+        archive_read_close(ctx->ar);
+        archive_read_free(ctx->ar);
+        ctx->ar = NULL;
     }
 
-    if (g_upgrade_ctx.disk) {
-        archive_write_close(g_upgrade_ctx.disk);
-        archive_write_free(g_upgrade_ctx.disk);
-        g_upgrade_ctx.disk = NULL;
+    if (ctx->disk) {
+        archive_write_close(ctx->disk);
+        archive_write_free(ctx->disk);
+        ctx->disk = NULL;
     }
 
-    if (!g_upgrade_ctx.flags.upgrade_in_place)
+    if (!ctx->flags.upgrade_in_place)
         unmount_inactive_partition();
 
+    xarena_destroy(ctx->arena);
+    ctx->arena = NULL;
+
     cleanup_temporary_resources();
 }
+
+__attribute__((destructor))
+static void global_upgrade_destructor(void) {
+    // show cursor
+    fprintf(stderr, "\n\033[?25h");
+
+    upgrade_release_resources(&g_upgrade_ctx);
+}
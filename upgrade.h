@@ -20,8 +20,38 @@ extern "C" {
 
 #include "xoption.h"
 
+typedef struct {
+    const char *firmware_path;
+    const char *hexkey;         // NULL selects the default key
+    const char *key_path;       // public key PEM, required unless skip_verify
+    xbool_t skip_verify;
+    xbool_t in_place;
+    xbool_t force;
+} upgrade_request_t;
+
 err_t upgrade_usage_init(xoption root);
 
+/**
+ * @brief Runs one upgrade in a long-lived process and releases everything it
+ *  used afterwards. Progress goes to the registered notify operators.
+ * @return X_RET_OK on success, X_RET_CANCELED after upgrade_cancel().
+ */
+err_t upgrade_perform(const upgrade_request_t *req);
+
+/**
+ * @brief Asks a running upgrade_perform() to stop at the next safe point.
+ *  An in-place upgrade is not interrupted once installation started.
+ */
+void upgrade_cancel(void);
+
+/**
+ * @brief Withdraws an earlier upgrade_cancel(), before the next job starts.
+ *  upgrade_perform() leaves the flag alone, so a cancel that arrives between
+ *  taking a job and running it still stops that job; call this while the job
+ *  is not yet visible to whoever cancels.
+ */
+void upgrade_cancel_clear(void);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -7,13 +7,27 @@
  *
  * @copyright (c) 2025 Intretech Software Development Department. All Rights Reserved.
  */
+#define _GNU_SOURCE
 #include "os_file.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "xvec.h"
+
+/* chunk of the read/write fallback and of a single in-kernel copy call */
+#define OS_FILE_COPY_CHUNK (1024 * 1024)
+
 FILE* os_file_open(const char* path, const char* mode) {
   if (path == NULL || mode == NULL) return NULL;
 
@@ -118,6 +132,364 @@ err_t os_remove(const char* path) {
   return remove(path) == 0 ? X_RET_OK : X_RET_ERROR;
 }
 
+err_t os_mkdir_p(const char* path, unsigned int mode) {
+  if (path == NULL || path[0] == '\0') return X_RET_INVAL;
+
+  char buf[PATH_MAX];
+  size_t len = strlen(path);
+  if (len >= sizeof(buf)) return X_RET_OVERFLOW;
+  memcpy(buf, path, len + 1);
+
+  /* create every parent, skipping the leading '/' */
+  for (char* p = buf + 1; *p; p++) {
+    if (*p != '/') continue;
+
+    *p = '\0';
+    if (mkdir(buf, mode) != 0 && errno != EEXIST) return X_RET_ERROR;
+    *p = '/';
+  }
+
+  if (mkdir(buf, mode) != 0 && errno != EEXIST) return X_RET_ERROR;
+
+  return X_RET_OK;
+}
+
+static int remove_tree_entry(const char* path,
+                             const struct stat* sb,
+                             int flag,
+                             struct FTW* ftw) {
+  xUNUSED(sb);
+  xUNUSED(ftw);
+
+  int ret = (flag == FTW_DP) ? rmdir(path) : unlink(path);
+  return (ret == 0 || errno == ENOENT) ? 0 : -1;
+}
+
+err_t os_remove_tree(const char* path) {
+  if (path == NULL) return X_RET_INVAL;
+
+  struct stat st;
+  if (lstat(path, &st) != 0) return errno == ENOENT ? X_RET_OK : X_RET_ERROR;
+
+  if (!S_ISDIR(st.st_mode)) return unlink(path) == 0 ? X_RET_OK : X_RET_ERROR;
+
+  /* depth-first so directories are emptied before they are removed */
+  return nftw(path, remove_tree_entry, 16, FTW_DEPTH | FTW_PHYS) == 0
+             ? X_RET_OK
+             : X_RET_ERROR;
+}
+
+static int advice_flag(os_file_advice_e advice) {
+  switch (advice) {
+    case OS_FILE_ADVICE_SEQUENTIAL:
+      return MADV_SEQUENTIAL;
+    case OS_FILE_ADVICE_RANDOM:
+      return MADV_RANDOM;
+    case OS_FILE_ADVICE_WILLNEED:
+      return MADV_WILLNEED;
+    default:
+      return MADV_NORMAL;
+  }
+}
+
+err_t os_file_map_fd(int fd, off_t offset, size_t len, os_file_advice_e advice, os_file_map_t* map) {
+  if (fd < 0 || offset < 0 || map == NULL) return X_RET_INVAL;
+
+  memset(map, 0, sizeof(*map));
+  if (len == 0) return X_RET_OK;
+
+  /* mmap wants a page aligned offset, map from the page it falls in */
+  off_t page = (off_t)sysconf(_SC_PAGESIZE);
+  off_t start = offset - offset % page;
+  size_t lead = (size_t)(offset - start);
+  if (len > SIZE_MAX - lead) return X_RET_OVERFLOW;
+
+  void* addr = mmap(NULL, lead + len, PROT_READ, MAP_PRIVATE, fd, start);
+  if (addr == MAP_FAILED) return X_RET_ERROR;
+
+  /* only a hint, the mapping works without it */
+  madvise(addr, lead + len, advice_flag(advice));
+
+  map->addr_ = addr;
+  map->map_len_ = lead + len;
+  map->data = (const uint8_t*)addr + lead;
+  map->len = len;
+  return X_RET_OK;
+}
+
+err_t os_file_map(const char* path, os_file_advice_e advice, os_file_map_t* map) {
+  if (path == NULL || map == NULL) return X_RET_INVAL;
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return X_RET_ERROR;
+
+  struct stat st;
+  err_t err = X_RET_ERROR;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+    err = os_file_map_fd(fd, 0, (size_t)st.st_size, advice, map);
+
+  close(fd);
+  return err;
+}
+
+void os_file_map_drop(os_file_map_t* map, size_t offset, size_t len) {
+  if (map == NULL || map->addr_ == NULL || offset >= map->len) return;
+
+  len = xMIN(len, map->len - offset);
+
+  /* whole pages only, a partial one at either end stays */
+  uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+  uintptr_t begin = ((uintptr_t)map->data + offset + page - 1) & ~(page - 1);
+  uintptr_t end = ((uintptr_t)map->data + offset + len) & ~(page - 1);
+  if (end > begin) madvise((void*)begin, end - begin, MADV_DONTNEED);
+}
+
+void os_file_unmap(os_file_map_t* map) {
+  if (map == NULL) return;
+
+  if (map->addr_) munmap(map->addr_, map->map_len_);
+  memset(map, 0, sizeof(*map));
+}
+
+/* the fallback, through a buffer of ours */
+static ssize_t copy_fd_rw(int in, int out, size_t want) {
+  char buf[64 * 1024];
+
+  ssize_t n = read(in, buf, xMIN(want, sizeof(buf)));
+  for (ssize_t off = 0; off < n;) {
+    ssize_t w = write(out, buf + off, (size_t)(n - off));
+    if (w < 0 && errno == EINTR) continue;
+    if (w < 0) return -1;
+    off += w;
+  }
+  return n;
+}
+
+/* copies up to `len` bytes, the cheapest way the two files allow */
+static err_t copy_fd(int in, int out, off_t len) {
+  off_t done = 0;
+  xbool_t try_range = xTRUE, try_sendfile = xTRUE;
+
+  while (done < len) {
+    size_t want = (size_t)xMIN(len - done, (off_t)OS_FILE_COPY_CHUNK);
+    ssize_t n;
+
+    if (try_range) {
+      n = copy_file_range(in, NULL, out, NULL, want, 0);
+      /* across file systems on older kernels, or not implemented at all */
+      if (n < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) {
+        try_range = xFALSE;
+        continue;
+      }
+    } else if (try_sendfile) {
+      n = sendfile(out, in, NULL, want);
+      if (n < 0 && (errno == ENOSYS || errno == EINVAL)) {
+        try_sendfile = xFALSE;
+        continue;
+      }
+    } else {
+      n = copy_fd_rw(in, out, want);
+    }
+
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) return X_RET_ERROR;
+    if (n == 0) return X_RET_ERROR; /* the file shrank underneath us */
+    done += n;
+  }
+
+  return X_RET_OK;
+}
+
+err_t os_file_copy(const char* src, const char* dst) {
+  if (src == NULL || dst == NULL) return X_RET_INVAL;
+
+  int in = open(src, O_RDONLY | O_CLOEXEC);
+  if (in < 0) return X_RET_ERROR;
+
+  struct stat st;
+  if (fstat(in, &st) != 0 || !S_ISREG(st.st_mode)) {
+    close(in);
+    return X_RET_INVAL;
+  }
+
+  int out = open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 07777);
+  if (out < 0) {
+    close(in);
+    return X_RET_ERROR;
+  }
+
+  err_t err = copy_fd(in, out, st.st_size);
+  /* an existing destination keeps its mode through O_CREAT, set it anyway */
+  if (err == X_RET_OK && fchmod(out, st.st_mode & 07777) != 0) err = X_RET_ERROR;
+
+  close(in);
+  if (close(out) != 0 && err == X_RET_OK) err = X_RET_ERROR;
+  return err;
+}
+
+struct copy_tree {
+  char src[PATH_MAX]; /* no trailing '/', unless it is the root */
+  size_t src_len;
+  char dst[PATH_MAX];
+  struct xvec_priv files; /* char*, paths relative to src */
+  struct xvec_priv dirs;  /* struct copy_tree_dir, parents first */
+  atomic_size_t next;     /* next file a worker takes */
+  atomic_int err;
+};
+
+struct copy_tree_dir {
+  char* rel;
+  mode_t mode;
+};
+
+/* `base`/`rel` with exactly one '/' in between, `base` alone for the top */
+static xbool_t copy_tree_join(char* buf, size_t len, const char* base, const char* rel) {
+  const char* sep = *rel == '\0' || base[strlen(base) - 1] == '/' ? "" : "/";
+  return snprintf(buf, len, "%s%s%s", base, sep, rel) < (int)len;
+}
+
+/* Copies `path` into `buf` without trailing '/', "/" stays itself */
+static xbool_t copy_tree_normalize(char* buf, size_t len, const char* path) {
+  size_t n = strlen(path);
+  while (n > 1 && path[n - 1] == '/') --n;
+  if (n == 0 || n >= len) return xFALSE;
+
+  memcpy(buf, path, n);
+  buf[n] = '\0';
+  return xTRUE;
+}
+
+/* nftw() takes no user pointer */
+static __thread struct copy_tree* t_copy_tree;
+
+static int copy_tree_entry(const char* path,
+                           const struct stat* sb,
+                           int flag,
+                           struct FTW* ftw) {
+  xUNUSED(ftw);
+  struct copy_tree* tree = t_copy_tree;
+  const char* rel = path + tree->src_len;
+  while (*rel == '/') ++rel;
+
+  char target[PATH_MAX];
+  if (!copy_tree_join(target, sizeof(target), tree->dst, rel)) return -1;
+
+  switch (flag) {
+    case FTW_D: {
+      /* writable until everything is in, a read-only source mode comes last */
+      if (mkdir(target, 0700) != 0 && errno != EEXIST) return -1;
+
+      struct copy_tree_dir dir = {.rel = xbox_strdup(rel), .mode = sb->st_mode & 07777};
+      if (!dir.rel || xvec_push_back(&tree->dirs, &dir) != X_RET_OK) {
+        xbox_free(dir.rel);
+        return -1;
+      }
+      return 0;
+    }
+    case FTW_SL: {
+      char link[PATH_MAX];
+      ssize_t n = readlink(path, link, sizeof(link) - 1);
+      if (n < 0) return -1;
+      link[n] = '\0';
+      unlink(target);
+      return symlink(link, target) == 0 ? 0 : -1;
+    }
+    case FTW_F:
+      if (S_ISREG(sb->st_mode)) {
+        char* dup = xbox_strdup(rel);
+        if (!dup || xvec_push_back(&tree->files, &dup) != X_RET_OK) {
+          xbox_free(dup);
+          return -1;
+        }
+        return 0;
+      }
+      /* fifos and device nodes */
+      unlink(target);
+      return mknod(target, sb->st_mode, sb->st_rdev) == 0 ? 0 : -1;
+    default:
+      /* unreadable directory or a stat failure */
+      return -1;
+  }
+}
+
+static void* copy_tree_worker(void* arg) {
+  struct copy_tree* tree = arg;
+  char from[PATH_MAX], to[PATH_MAX];
+
+  for (;;) {
+    size_t i = atomic_fetch_add(&tree->next, 1);
+    if (i >= xvec_length(&tree->files) || atomic_load(&tree->err) != X_RET_OK) break;
+
+    const char* rel = *(char**)xvec_at(&tree->files, i);
+    err_t err = X_RET_ERROR;
+    if (copy_tree_join(from, sizeof(from), tree->src, rel) &&
+        copy_tree_join(to, sizeof(to), tree->dst, rel))
+      err = os_file_copy(from, to);
+    if (err != X_RET_OK) {
+      int ok = X_RET_OK;
+      atomic_compare_exchange_strong(&tree->err, &ok, err);
+    }
+  }
+
+  return NULL;
+}
+
+err_t os_file_copy_tree(const char* src, const char* dst, int jobs) {
+  if (src == NULL || dst == NULL) return X_RET_INVAL;
+
+  struct stat st;
+  if (stat(src, &st) != 0) return X_RET_ERROR;
+  if (!S_ISDIR(st.st_mode)) return os_file_copy(src, dst);
+  if (os_mkdir_p(dst, 0755) != X_RET_OK) return X_RET_ERROR;
+
+  struct copy_tree tree;
+  if (!copy_tree_normalize(tree.src, sizeof(tree.src), src) ||
+      !copy_tree_normalize(tree.dst, sizeof(tree.dst), dst))
+    return X_RET_INVAL;
+  tree.src_len = strlen(tree.src);
+  xvec_init(&tree.files, sizeof(char*));
+  xvec_init(&tree.dirs, sizeof(struct copy_tree_dir));
+  atomic_init(&tree.next, 0);
+  atomic_init(&tree.err, X_RET_OK);
+
+  /* the tree is laid out single threaded, parents come before children */
+  t_copy_tree = &tree;
+  err_t err = nftw(tree.src, copy_tree_entry, 16, FTW_PHYS) == 0 ? X_RET_OK : X_RET_ERROR;
+  t_copy_tree = NULL;
+
+  if (err == X_RET_OK && xvec_length(&tree.files) > 0) {
+    if (jobs <= 0) jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    jobs = (int)xMIN((size_t)xMAX(jobs, 1), xvec_length(&tree.files));
+
+    pthread_t threads[16];
+    int started = 0;
+    for (; started < xMIN(jobs, (int)xARRAY_SIZE(threads)) - 1; ++started) {
+      if (pthread_create(&threads[started], NULL, copy_tree_worker, &tree) != 0) break;
+    }
+
+    /* this thread is a worker too, so a failed pthread_create only slows it down */
+    copy_tree_worker(&tree);
+    for (int i = 0; i < started; ++i) pthread_join(threads[i], NULL);
+    err = atomic_load(&tree.err);
+  }
+
+  /* children before their parents, so a read-only parent does not get in the way */
+  for (size_t i = xvec_length(&tree.dirs); i-- > 0;) {
+    struct copy_tree_dir* dir = xvec_at(&tree.dirs, i);
+    char target[PATH_MAX];
+    if (err == X_RET_OK &&
+        (!copy_tree_join(target, sizeof(target), tree.dst, dir->rel) || chmod(target, dir->mode) != 0))
+      err = X_RET_ERROR;
+    xbox_free(dir->rel);
+  }
+  xvec_deinit(&tree.dirs);
+
+  char** file;
+  xvec_foreach(&tree.files, file) xbox_free(*file);
+  xvec_deinit(&tree.files);
+  return err;
+}
+
 const char* os_file_basename(const char* path) {
   if (path == NULL) return "";
 
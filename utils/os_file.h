@@ -14,9 +14,26 @@ extern "C" {
 #endif
 
 #include <stdio.h>
+#include <sys/types.h>
 
 #include "xdef.h"
 
+/** @brief How a mapping will be read, passed on to madvise(2). */
+typedef enum {
+  OS_FILE_ADVICE_NORMAL,     /**< No particular order. */
+  OS_FILE_ADVICE_SEQUENTIAL, /**< Front to back once, read ahead aggressively. */
+  OS_FILE_ADVICE_RANDOM,     /**< Scattered reads, do not read ahead. */
+  OS_FILE_ADVICE_WILLNEED,   /**< Fault the whole range in now. */
+} os_file_advice_e;
+
+/** @brief A read-only file mapping, see os_file_map(). */
+typedef struct {
+  const uint8_t* data; /**< The file content, NULL for an empty range. */
+  size_t len;          /**< Bytes at `data`. */
+  void* addr_;         /**< Page aligned start of the mapping. */
+  size_t map_len_;     /**< Length of the mapping from `addr_`. */
+} os_file_map_t;
+
 /**
  * @brief Opens a file.
  * @param path The path to the file.
@@ -102,6 +119,81 @@ err_t os_rename(const char* o, const char* n);
  */
 err_t os_remove(const char* path);
 
+/**
+ * @brief Creates a directory and any missing parents, like `mkdir -p`.
+ * @param path The directory path.
+ * @param mode The permission bits for newly created directories.
+ * @return XBOX_OK on success or if the directory already exists, or an error code on failure.
+ */
+err_t os_mkdir_p(const char* path, unsigned int mode);
+
+/**
+ * @brief Removes a file or a directory tree, like `rm -rf`.
+ *  Symbolic links are removed, never followed. A missing path is not an error.
+ * @param path The path to remove.
+ * @return XBOX_OK on success, or an error code on failure.
+ */
+err_t os_remove_tree(const char* path);
+
+/**
+ * @brief Maps a whole file read-only.
+ *  The pages come straight from the page cache, nothing is copied into a
+ *  buffer of ours, and the kernel can drop them again under memory pressure.
+ * @param path The path to the file.
+ * @param advice How the mapping will be read.
+ * @param map Receives the mapping, release it with os_file_unmap().
+ * @return XBOX_OK on success, an empty file maps to NULL data and 0 length.
+ */
+err_t os_file_map(const char* path, os_file_advice_e advice, os_file_map_t* map);
+
+/**
+ * @brief Maps part of an open file read-only, the offset needs no alignment.
+ * @param fd The file descriptor, it can be closed once mapped.
+ * @param offset Where the range starts.
+ * @param len Bytes to map, they must lie within the file.
+ * @param advice How the mapping will be read.
+ * @param map Receives the mapping, release it with os_file_unmap().
+ * @return XBOX_OK on success, or an error code on failure.
+ */
+err_t os_file_map_fd(int fd, off_t offset, size_t len, os_file_advice_e advice, os_file_map_t* map);
+
+/**
+ * @brief Tells the kernel a part of a mapping is not needed any more.
+ *  Its pages leave our resident set, reading them again refaults from the file.
+ * @param map The mapping.
+ * @param offset Start of the part, relative to `data`.
+ * @param len Length of the part.
+ */
+void os_file_map_drop(os_file_map_t* map, size_t offset, size_t len);
+
+/**
+ * @brief Releases a mapping, a zeroed or already released one is fine.
+ * @param map The mapping.
+ */
+void os_file_unmap(os_file_map_t* map);
+
+/**
+ * @brief Copies a regular file, keeping its permission bits.
+ *  The data moves inside the kernel with copy_file_range(2), or sendfile(2)
+ *  where that is not supported, and only falls back to read/write last.
+ * @param src The file to copy.
+ * @param dst The copy, replaced if it exists.
+ * @return XBOX_OK on success, or an error code on failure.
+ */
+err_t os_file_copy(const char* src, const char* dst);
+
+/**
+ * @brief Copies a directory tree, like `cp -a` without owners and times.
+ *  Directories and symbolic links are created first, then the regular files
+ *  are copied with os_file_copy() by `jobs` threads. Directories stay
+ *  writable until then and get the source's modes last.
+ * @param src The directory to copy.
+ * @param dst Where to put it, created if missing.
+ * @param jobs Number of copying threads, 0 for one per online CPU.
+ * @return XBOX_OK on success, or the error of the first failed entry.
+ */
+err_t os_file_copy_tree(const char* src, const char* dst, int jobs);
+
 /**
  * @brief Checks if a path is a directory.
  * @param path The path to check.
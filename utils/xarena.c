@@ -0,0 +1,332 @@
+/**
+ * @brief 内存池
+ * @file xarena.c
+ * @author Oswin
+ * @date 2026-02-07
+ * @details
+ *
+ * @copyright (c) 2026 Intretech Software Development Department. All Rights Reserved.
+ */
+#include "xarena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct xarena_chunk {
+  struct xarena_chunk* next;
+  uint64_t serial; /* creation order, marks compare against it */
+  size_t size;     /* usable bytes after the header */
+  size_t used;
+  /* aligned, the data follows */
+} __attribute__((aligned(XARENA_ALIGN)));
+
+struct xarena_private {
+  size_t chunk_size;
+  struct xarena_chunk* head; /* the chunk allocations come from */
+  size_t used;               /* bytes handed out since the last reset */
+  void* last;                /* last allocation, xarena_realloc() grows it in place */
+  uint64_t serial;           /* serial of the next chunk */
+};
+
+#define CHUNK_DATA(c) ((char*)((c) + 1))
+#define ALIGN_UP(n) (((n) + XARENA_ALIGN - 1) & ~(size_t)(XARENA_ALIGN - 1))
+
+static struct xarena_chunk* new_chunk(xarena self, size_t size) {
+  struct xarena_chunk* chunk = xbox_malloc(sizeof(struct xarena_chunk) + size);
+  if (!chunk) return NULL;
+
+  chunk->next = NULL;
+  chunk->serial = self->serial++;
+  chunk->size = size;
+  chunk->used = 0;
+  return chunk;
+}
+
+xarena xarena_create(size_t chunk_size) {
+  xarena self = xbox_calloc(1, sizeof(struct xarena_private));
+  if (!self) return NULL;
+
+  self->chunk_size = ALIGN_UP(chunk_size ? chunk_size : XARENA_DEFAULT_CHUNK);
+  self->head = new_chunk(self, self->chunk_size);
+  if (!self->head) {
+    xbox_free(self);
+    return NULL;
+  }
+
+  return self;
+}
+
+void xarena_destroy(xarena self) {
+  if (!self) return;
+
+  struct xarena_chunk* chunk = self->head;
+  while (chunk) {
+    struct xarena_chunk* next = chunk->next;
+    xbox_free(chunk);
+    chunk = next;
+  }
+
+  xbox_free(self);
+}
+
+void* xarena_alloc(xarena self, size_t size) {
+  if (!self) return NULL;
+  if (size == 0) size = 1;
+  if (size > SIZE_MAX - XARENA_ALIGN) return NULL;
+
+  size = ALIGN_UP(size);
+  struct xarena_chunk* chunk = self->head;
+
+  if (!chunk || chunk->size - chunk->used < size) {
+    /* an oversized allocation gets a chunk of its own, behind the current
+     * one, so the space left in the current chunk is not wasted */
+    if (chunk && size > self->chunk_size / 4 && chunk->used > 0) {
+      struct xarena_chunk* big = new_chunk(self, size);
+      if (!big) return NULL;
+
+      big->used = size;
+      big->next = chunk->next;
+      chunk->next = big;
+      self->used += size;
+      self->last = NULL;
+      return CHUNK_DATA(big);
+    }
+
+    chunk = new_chunk(self, xMAX(size, self->chunk_size));
+    if (!chunk) return NULL;
+
+    chunk->next = self->head;
+    self->head = chunk;
+  }
+
+  void* p = CHUNK_DATA(chunk) + chunk->used;
+  chunk->used += size;
+  self->used += size;
+  self->last = p;
+  return p;
+}
+
+void* xarena_calloc(xarena self, size_t count, size_t size) {
+  if (size && count > SIZE_MAX / size) return NULL;
+
+  void* p = xarena_alloc(self, count * size);
+  if (p) memset(p, 0, count * size);
+  return p;
+}
+
+void* xarena_realloc(xarena self, void* ptr, size_t old_size, size_t new_size) {
+  if (!self) return NULL;
+  if (!ptr) return xarena_alloc(self, new_size);
+  if (new_size <= old_size) return ptr;
+
+  /* the last allocation of the current chunk can grow where it is */
+  struct xarena_chunk* chunk = self->head;
+  if (ptr == self->last) {
+    size_t start = (size_t)((char*)ptr - CHUNK_DATA(chunk));
+    size_t need = ALIGN_UP(new_size);
+    if (new_size <= SIZE_MAX - XARENA_ALIGN && start + need <= chunk->size) {
+      self->used += start + need - chunk->used;
+      chunk->used = start + need;
+      return ptr;
+    }
+  }
+
+  void* p = xarena_alloc(self, new_size);
+  if (p) memcpy(p, ptr, old_size);
+  return p;
+}
+
+char* xarena_strndup(xarena self, const char* str, size_t len) {
+  if (!str) return NULL;
+
+  char* p = xarena_alloc(self, len + 1);
+  if (!p) return NULL;
+
+  memcpy(p, str, len);
+  p[len] = '\0';
+  return p;
+}
+
+char* xarena_strdup(xarena self, const char* str) {
+  if (!str) return NULL;
+  return xarena_strndup(self, str, strlen(str));
+}
+
+void xarena_reset(xarena self) {
+  if (!self) return;
+
+  /* keep one chunk of the regular size, the steady state needs no malloc */
+  struct xarena_chunk* keep = NULL;
+  struct xarena_chunk* chunk = self->head;
+  while (chunk) {
+    struct xarena_chunk* next = chunk->next;
+    if (!keep && chunk->size == self->chunk_size) {
+      keep = chunk;
+    } else {
+      xbox_free(chunk);
+    }
+    chunk = next;
+  }
+
+  if (!keep) keep = new_chunk(self, self->chunk_size);
+  /* without one, the next xarena_alloc() tries again */
+  if (keep) {
+    keep->next = NULL;
+    keep->used = 0;
+  }
+
+  self->head = keep;
+  self->used = 0;
+  self->last = NULL;
+}
+
+size_t xarena_used(xarena self) {
+  return self ? self->used : 0;
+}
+
+xarena_mark_t xarena_mark(xarena self) {
+  xarena_mark_t mark = {0, 0, 0};
+  if (!self) return mark;
+
+  mark.serial_ = self->serial;
+  mark.offset_ = self->head ? self->head->used : 0;
+  mark.used_ = self->used;
+  return mark;
+}
+
+void xarena_rewind(xarena self, xarena_mark_t mark) {
+  if (!self) return;
+
+  /* newer chunks sit in front of the marked one, or right behind it for
+   * oversized allocations; either way their serial gives them away */
+  struct xarena_chunk** link = &self->head;
+  while (*link) {
+    struct xarena_chunk* chunk = *link;
+    if (chunk->serial >= mark.serial_) {
+      *link = chunk->next;
+      xbox_free(chunk);
+    } else {
+      link = &chunk->next;
+    }
+  }
+
+  if (self->head) self->head->used = mark.offset_;
+  self->used = mark.used_;
+  self->last = NULL;
+}
+
+/* Hooked allocations carry their size, for realloc, and a tag that tells
+ * them from malloc() blocks whichever arena the thread uses by then */
+struct hooked_header {
+  size_t size;
+  uintptr_t tag;
+} __attribute__((aligned(XARENA_ALIGN)));
+
+/* mixed with the header address, so a stale or foreign word can hardly match */
+#define HOOKED_TAG(h) ((uintptr_t)(h) ^ (uintptr_t)0x78617265686f6f6bull /* "xarehook" */)
+
+static __thread xarena g_hooked;
+
+/* Also called on malloc() blocks, whose word before the pointer is the
+ * allocator's own chunk header: readable, and never equal to a tag */
+__attribute__((no_sanitize_address)) static struct hooked_header* hooked_header_of(void* ptr) {
+  struct hooked_header* h = (struct hooked_header*)ptr - 1;
+  return h->tag == HOOKED_TAG(h) ? h : NULL;
+}
+
+static void* hooked_alloc(xarena self, size_t size) {
+  if (size > SIZE_MAX - sizeof(struct hooked_header)) return NULL;
+
+  struct hooked_header* h = xarena_alloc(self, sizeof(*h) + size);
+  if (!h) return NULL;
+
+  h->size = size;
+  h->tag = HOOKED_TAG(h);
+  return h + 1;
+}
+
+static xbool_t owns(xarena self, const void* ptr) {
+  for (struct xarena_chunk* chunk = self->head; chunk; chunk = chunk->next) {
+    if ((const char*)ptr >= CHUNK_DATA(chunk) && (const char*)ptr < CHUNK_DATA(chunk) + chunk->size)
+      return xTRUE;
+  }
+  return xFALSE;
+}
+
+/* The arena takes its own chunks from xbox_malloc() too, so the thread is
+ * detached while inside it */
+static void* hook_malloc(size_t size) {
+  xarena arena = g_hooked;
+  if (!arena) return malloc(size);
+
+  g_hooked = NULL;
+  void* p = hooked_alloc(arena, size);
+  g_hooked = arena;
+  return p;
+}
+
+static void* hook_calloc(size_t count, size_t size) {
+  xarena arena = g_hooked;
+  if (!arena) return calloc(count, size);
+  if (size && count > SIZE_MAX / size) return NULL;
+
+  g_hooked = NULL;
+  void* p = hooked_alloc(arena, count * size);
+  g_hooked = arena;
+  if (p) memset(p, 0, count * size);
+  return p;
+}
+
+static void* hook_realloc(void* ptr, size_t size) {
+  if (!ptr) return hook_malloc(size);
+
+  struct hooked_header* h = hooked_header_of(ptr);
+  if (!h) return realloc(ptr, size);
+
+  xarena arena = g_hooked;
+  if (!arena || !owns(arena, ptr)) {
+    /* from an arena this thread is not using now: move it, the old block
+     * goes with that arena */
+    void* p = hook_malloc(size);
+    if (p) memcpy(p, ptr, xMIN(size, h->size));
+    return p;
+  }
+  if (size > SIZE_MAX - sizeof(struct hooked_header)) return NULL;
+
+  size_t old = h->size;
+
+  g_hooked = NULL;
+  /* the last allocation grows in place, anything else is copied */
+  struct hooked_header* n = xarena_realloc(arena, h, sizeof(*h) + old, sizeof(*h) + size);
+  g_hooked = arena;
+  if (!n) return NULL;
+
+  n->size = size;
+  n->tag = HOOKED_TAG(n);
+  return n + 1;
+}
+
+static void hook_free(void* ptr) {
+  /* arena blocks go with their arena, from whichever thread */
+  if (ptr && hooked_header_of(ptr)) return;
+
+  free(ptr);
+}
+
+const xbox_hook_t* xarena_hooks(void) {
+  static const xbox_hook_t hooks = {
+      .malloc = hook_malloc,
+      .calloc = hook_calloc,
+      .realloc = hook_realloc,
+      .free = hook_free,
+      .exit = NULL,
+  };
+
+  return &hooks;
+}
+
+xarena xarena_hook_use(xarena self) {
+  xarena prev = g_hooked;
+  g_hooked = self;
+  return prev;
+}
@@ -0,0 +1,190 @@
+/**
+ * @brief 内存池
+ * @file xarena.h
+ * @author Oswin
+ * @date 2026-02-07
+ * @details A bump allocator for short-lived allocations. Memory comes from
+ *          chunks carved front to back, nothing is freed one at a time: the
+ *          whole arena is rewound with xarena_reset() or released with
+ *          xarena_destroy(). Meant for per-chunk and per-entry work on hot
+ *          paths, which then does no malloc/free at all once the arena has
+ *          grown to its working size.
+ *
+ *          e.g.
+ *          xarena arena = xarena_create(0);
+ *          while (next_entry()) {
+ *            char* path = xarena_strdup(arena, entry_path);
+ *            ...
+ *            xarena_reset(arena);
+ *          }
+ *          xarena_destroy(arena);
+ *
+ *          Scopes nest: xarena_mark() remembers where the arena stands and
+ *          xarena_rewind() drops everything allocated since, in O(1) per
+ *          chunk, leaving older allocations alone.
+ *
+ *          e.g.
+ *          xarena_mark_t stage = xarena_mark(arena);
+ *          for (each entry) {
+ *            xarena_mark_t entry = xarena_mark(arena);
+ *            ...
+ *            xarena_rewind(arena, entry);
+ *          }
+ *          xarena_rewind(arena, stage);
+ *
+ *          Code that allocates through xbox_malloc() and friends can be
+ *          pointed at an arena without changing it, see xarena_hooks().
+ *
+ * @copyright (c) 2026 Intretech Software Development Department. All Rights Reserved.
+ */
+#ifndef XTOOL_XARENA__H_
+#define XTOOL_XARENA__H_
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "xdef.h"
+
+/**< Default chunk size, larger allocations get a chunk of their own. */
+#define XARENA_DEFAULT_CHUNK (4096)
+
+/**< Alignment of every allocation. */
+#define XARENA_ALIGN (16)
+
+/** @brief Opaque handle to an arena. */
+typedef struct xarena_private* xarena;
+
+/**
+ * @brief A position in an arena, see xarena_mark().
+ */
+typedef struct {
+  uint64_t serial_; /**< Chunks created from here on are released. */
+  size_t offset_;   /**< Bytes used in the current chunk. */
+  size_t used_;     /**< Bytes handed out. */
+} xarena_mark_t;
+
+/**
+ * @brief Creates an arena.
+ * @param chunk_size Size of the chunks it grows by, 0 for XARENA_DEFAULT_CHUNK.
+ * @return The arena, or NULL if memory allocation fails.
+ */
+xarena xarena_create(size_t chunk_size);
+
+/**
+ * @brief Frees an arena and everything allocated from it.
+ * @param self The arena, can be NULL.
+ */
+void xarena_destroy(xarena self);
+
+/**
+ * @brief Allocates from an arena, aligned to XARENA_ALIGN.
+ * @param self The arena.
+ * @param size Bytes to allocate.
+ * @return The memory, or NULL if memory allocation fails.
+ */
+void* xarena_alloc(xarena self, size_t size);
+
+/**
+ * @brief Allocates zeroed memory from an arena.
+ * @param self The arena.
+ * @param count Number of elements.
+ * @param size Size of one element.
+ * @return The memory, or NULL on overflow or if memory allocation fails.
+ */
+void* xarena_calloc(xarena self, size_t count, size_t size);
+
+/**
+ * @brief Grows the last allocation in place when it can, else moves it.
+ * @param self The arena.
+ * @param ptr An allocation from this arena, or NULL.
+ * @param old_size Its size.
+ * @param new_size The size wanted.
+ * @return The memory, or NULL if memory allocation fails (ptr is kept).
+ */
+void* xarena_realloc(xarena self, void* ptr, size_t old_size, size_t new_size);
+
+/**
+ * @brief Copies a string into an arena.
+ * @param self The arena.
+ * @param str The string.
+ * @return The copy, or NULL if memory allocation fails.
+ */
+char* xarena_strdup(xarena self, const char* str);
+
+/**
+ * @brief Copies `len` bytes into an arena and terminates them.
+ * @param self The arena.
+ * @param str The bytes.
+ * @param len Number of bytes.
+ * @return The copy, or NULL if memory allocation fails.
+ */
+char* xarena_strndup(xarena self, const char* str, size_t len);
+
+/**
+ * @brief Releases everything allocated, keeping the first chunk.
+ * @param self The arena.
+ */
+void xarena_reset(xarena self);
+
+/**
+ * @brief Remembers the current position, to come back to with xarena_rewind().
+ * @param self The arena.
+ * @return The mark, valid until the arena is reset or rewound past it.
+ */
+xarena_mark_t xarena_mark(xarena self);
+
+/**
+ * @brief Releases everything allocated since a mark.
+ * @details Chunks taken since the mark are freed, the chunk current at the
+ *          mark is cut back. Allocations made before the mark stay valid.
+ * @param self The arena.
+ * @param mark A mark of this arena.
+ */
+void xarena_rewind(xarena self, xarena_mark_t mark);
+
+/**
+ * @brief Gets the bytes handed out since the last reset.
+ * @param self The arena.
+ * @return The bytes, alignment padding included.
+ */
+size_t xarena_used(xarena self);
+
+/**
+ * @brief Gets allocation hooks that serve xbox_malloc() from an arena.
+ * @details Install them once with xbox_init_hooks(); they do nothing on
+ *          their own, memory keeps coming from libc until a thread picks an
+ *          arena with xarena_hook_use(). From then on that thread's
+ *          xbox_malloc(), xbox_calloc() and xbox_realloc() are carved from
+ *          the arena, while memory from before keeps going through libc.
+ *          Other threads are not affected. Arena blocks are tagged, so
+ *          xbox_free() of one does nothing and xbox_realloc() moves it out,
+ *          from any thread and whichever arena is in use by then.
+ *
+ *          Everything allocated while an arena is in use is gone once it is
+ *          rewound or reset, so only hand it code whose allocations die
+ *          within the scope; a block must not be freed after that.
+ *
+ *          e.g.
+ *          xbox_init_hooks(xarena_hooks());
+ *          ...
+ *          xarena prev = xarena_hook_use(arena);
+ *          xstring s = xstring_init_format("%s/%s", dir, name);
+ *          ...
+ *          xarena_hook_use(prev);
+ *          xarena_reset(arena);
+ *
+ * @return The hooks, the exit hook is left alone.
+ */
+const xbox_hook_t* xarena_hooks(void);
+
+/**
+ * @brief Routes the calling thread's xbox allocations to an arena.
+ * @param self The arena, NULL to go back to libc.
+ * @return The arena used before, to restore when the scope ends.
+ */
+xarena xarena_hook_use(xarena self);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* XTOOL_XARENA__H_ */
@@ -14,6 +14,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef XBOX_ENABLE_MEMSTAT
+#include <pthread.h>
+#endif
+
 #define STB_SPRINTF_NOUNALIGNED
 #define STB_SPRINTF_IMPLEMENTATION
 #include "stb_sprintf.h"
@@ -30,6 +34,20 @@ static xbox_hook_t g_xbox_hook = {
     .exit = exit,
 };
 
+#ifdef XBOX_ENABLE_XJSON
+#ifdef XBOX_ENABLE_MEMSTAT
+/* xjson memory may be handed to xbox_free(), so it is accounted the same way */
+static void* xjson_malloc(size_t size) { return xbox_malloc(size); }
+static void xjson_free(void* ptr) { xbox_free(ptr); }
+
+__attribute__((constructor)) static void xbox_xjson_hooks(void) {
+  xjson_init_hooks(xjson_malloc, xjson_free);
+}
+#else
+static void xbox_xjson_hooks(void) { xjson_init_hooks(g_xbox_hook.malloc, g_xbox_hook.free); }
+#endif /* XBOX_ENABLE_MEMSTAT */
+#endif /* XBOX_ENABLE_XJSON */
+
 const char* xbool_str(xbool_t b) {
   if (b == xFALSE)
     return "false";
@@ -67,6 +85,8 @@ const char* err_str(err_t err) {
       return "FormatError";
     case X_RET_OVERFLOW:
       return "Overflow";
+    case X_RET_CANCELED:
+      return "Canceled";
     default:
       return "UnknownError";
   }
@@ -86,7 +106,7 @@ void xbox_init_hooks(const xbox_hook_t* hook) {
   if (hook->exit) g_xbox_hook.exit = hook->exit;
 
 #ifdef XBOX_ENABLE_XJSON
-  xjson_init_hooks(g_xbox_hook.malloc, g_xbox_hook.free);
+  xbox_xjson_hooks();
 #endif
 }
 
@@ -94,7 +114,7 @@ char* xbox_strdup(const char* str) {
   if (str == NULL) str = "";
 
   size_t len = strlen(str);
-  char* dup = g_xbox_hook.malloc(len + 1);
+  char* dup = xbox_malloc(len + 1);
   if (dup != NULL) memcpy(dup, str, len + 1);
   return dup;
 }
@@ -210,3 +230,221 @@ void __xbox_exit_backtrace(const char* __f, int __l, int __c) {
   printf("[EXIT] %s:%d\n", __f, __l);
   g_xbox_hook.exit(__c);
 }
+
+#ifdef XBOX_ENABLE_MEMSTAT
+/* Call sites are few and fixed, a full table lumps the rest into slot 0 */
+#define MEMSTAT_SITES (512)
+#define MEMSTAT_MAGIC (0x78626d73u) /* "xbms" */
+/* mixed with the header address, a stale copy or a stray word can hardly match */
+#define MEMSTAT_TAG(hdr) (MEMSTAT_MAGIC ^ (uint32_t)((uintptr_t)(hdr) >> 4))
+
+/* Keeps the user block at the alignment malloc gave the header */
+typedef union {
+  struct {
+    uint32_t magic;
+    uint32_t site;
+    size_t size;
+  } h;
+  char align[16];
+} memstat_hdr_t;
+
+static pthread_mutex_t g_memstat_lock = PTHREAD_MUTEX_INITIALIZER;
+static xbox_memstat_t g_memstat;
+static xbox_memsite_t g_memsites[MEMSTAT_SITES] = {{.file = "(other)"}};
+
+static uint32_t memstat_site(const char* file, int line) {
+  uintptr_t h = ((uintptr_t)file >> 3) * 31 + (uintptr_t)line;
+  for (uint32_t i = 0; i < MEMSTAT_SITES - 1; ++i) {
+    uint32_t at = 1 + (uint32_t)((h + i) % (MEMSTAT_SITES - 1));
+    xbox_memsite_t* site = &g_memsites[at];
+    if (site->file == file && site->line == line) return at;
+    if (site->file == NULL) {
+      site->file = file;
+      site->line = line;
+      return at;
+    }
+  }
+  return 0;
+}
+
+/* called with the lock held */
+static void memstat_add(memstat_hdr_t* hdr, const char* file, int line, size_t size) {
+  hdr->h.magic = MEMSTAT_TAG(hdr);
+  hdr->h.site = memstat_site(file, line);
+  hdr->h.size = size;
+
+  xbox_memsite_t* site = &g_memsites[hdr->h.site];
+  site->allocs++;
+  site->live_blocks++;
+  site->live_bytes += size;
+  if (site->live_bytes > site->peak_bytes) site->peak_bytes = site->live_bytes;
+
+  g_memstat.allocs++;
+  g_memstat.live_blocks++;
+  g_memstat.live_bytes += size;
+  if (g_memstat.live_bytes > g_memstat.peak_bytes) g_memstat.peak_bytes = g_memstat.live_bytes;
+}
+
+/* called with the lock held */
+static void memstat_sub(memstat_hdr_t* hdr) {
+  xbox_memsite_t* site = &g_memsites[hdr->h.site];
+  site->live_blocks--;
+  site->live_bytes -= hdr->h.size;
+
+  g_memstat.live_blocks--;
+  g_memstat.live_bytes -= hdr->h.size;
+  hdr->h.magic = 0;
+}
+
+/*
+ * NULL for blocks that did not come from the accounted wrappers. Every
+ * allocator whose blocks reach xbox_free() goes through them (xbox_strdup(),
+ * xbox_vasprintf(), xjson), so this is a safety net: a miss is reported and
+ * the block is passed on untouched rather than trusted.
+ */
+__attribute__((no_sanitize_address)) static memstat_hdr_t* memstat_hdr(void* p) {
+  memstat_hdr_t* hdr = (memstat_hdr_t*)p - 1;
+  if (hdr->h.magic != MEMSTAT_TAG(hdr) || hdr->h.site >= MEMSTAT_SITES) {
+    fprintf(stderr, "xbox: %p was not allocated by xbox_malloc()\n", p);
+    return NULL;
+  }
+  return hdr;
+}
+
+void* __xbox_malloc_memstat(const char* __f, int __l, size_t __s) {
+  if (__s > SIZE_MAX - sizeof(memstat_hdr_t)) return NULL;
+
+  memstat_hdr_t* hdr = g_xbox_hook.malloc(sizeof(memstat_hdr_t) + __s);
+  if (!hdr) return NULL;
+
+  pthread_mutex_lock(&g_memstat_lock);
+  memstat_add(hdr, __f, __l, __s);
+  pthread_mutex_unlock(&g_memstat_lock);
+  return hdr + 1;
+}
+
+void* __xbox_calloc_memstat(const char* __f, int __l, size_t __c, size_t __s) {
+  if (__s && __c > (SIZE_MAX - sizeof(memstat_hdr_t)) / __s) return NULL;
+
+  void* ptr = __xbox_malloc_memstat(__f, __l, __c * __s);
+  if (ptr) memset(ptr, 0, __c * __s);
+  return ptr;
+}
+
+void* __xbox_realloc_memstat(const char* __f, int __l, void* __p, size_t __s) {
+  if (!__p) return __xbox_malloc_memstat(__f, __l, __s);
+
+  memstat_hdr_t* hdr = memstat_hdr(__p);
+  if (!hdr) return g_xbox_hook.realloc(__p, __s);
+  if (__s > SIZE_MAX - sizeof(memstat_hdr_t)) return NULL;
+
+  memstat_hdr_t* moved = g_xbox_hook.realloc(hdr, sizeof(memstat_hdr_t) + __s);
+  if (!moved) return NULL;
+
+  /* the header moved along, the block now belongs to this call site */
+  pthread_mutex_lock(&g_memstat_lock);
+  memstat_sub(moved);
+  memstat_add(moved, __f, __l, __s);
+  pthread_mutex_unlock(&g_memstat_lock);
+  return moved + 1;
+}
+
+void __xbox_free_memstat(void* __p) {
+  if (!__p) return;
+
+  memstat_hdr_t* hdr = memstat_hdr(__p);
+  if (!hdr) {
+    g_xbox_hook.free(__p);
+    return;
+  }
+
+  pthread_mutex_lock(&g_memstat_lock);
+  memstat_sub(hdr);
+  g_memstat.frees++;
+  pthread_mutex_unlock(&g_memstat_lock);
+  g_xbox_hook.free(hdr);
+}
+
+/* lists what is still allocated, after the other destructors had their go */
+__attribute__((destructor(101))) static void memstat_leaks(void) {
+  if (g_memstat.live_blocks == 0) return;
+
+  fprintf(stderr, "xbox: %zu blocks not freed at exit\n", g_memstat.live_blocks);
+  xbox_memstat_report(stderr, 16);
+}
+#endif /* XBOX_ENABLE_MEMSTAT */
+
+xbool_t xbox_memstat_get(xbox_memstat_t* st) {
+  if (!st) return xFALSE;
+
+#ifdef XBOX_ENABLE_MEMSTAT
+  pthread_mutex_lock(&g_memstat_lock);
+  *st = g_memstat;
+  pthread_mutex_unlock(&g_memstat_lock);
+  return xTRUE;
+#else
+  memset(st, 0, sizeof(*st));
+  return xFALSE;
+#endif
+}
+
+size_t xbox_memstat_reset_peak(void) {
+#ifdef XBOX_ENABLE_MEMSTAT
+  pthread_mutex_lock(&g_memstat_lock);
+  size_t peak = g_memstat.peak_bytes;
+  g_memstat.peak_bytes = g_memstat.live_bytes;
+  pthread_mutex_unlock(&g_memstat_lock);
+  return peak;
+#else
+  return 0;
+#endif
+}
+
+size_t xbox_memstat_sites(xbox_memsite_t* sites, size_t n) {
+  size_t count = 0;
+  if (!sites) return 0;
+
+#ifdef XBOX_ENABLE_MEMSTAT
+  pthread_mutex_lock(&g_memstat_lock);
+  for (size_t i = 0; i < MEMSTAT_SITES; ++i) {
+    const xbox_memsite_t* site = &g_memsites[i];
+    if (site->live_bytes == 0 && site->live_blocks == 0) continue;
+
+    /* insertion into the top n, largest first */
+    size_t at = count;
+    while (at > 0 && sites[at - 1].live_bytes < site->live_bytes) {
+      if (at < n) sites[at] = sites[at - 1];
+      at--;
+    }
+    if (at < n) {
+      sites[at] = *site;
+      if (count < n) count++;
+    }
+  }
+  pthread_mutex_unlock(&g_memstat_lock);
+#else
+  xUNUSED(n);
+#endif
+  return count;
+}
+
+void xbox_memstat_report(FILE* fp, size_t top) {
+  xbox_memstat_t st;
+  if (!fp) return;
+
+  if (!xbox_memstat_get(&st)) {
+    fprintf(fp, "xbox: allocation accounting is not built in (XBOX_ENABLE_MEMSTAT)\n");
+    return;
+  }
+
+  fprintf(fp, "xbox: %zu bytes live in %zu blocks, peak %zu, %ju allocs, %ju frees\n",
+          st.live_bytes, st.live_blocks, st.peak_bytes, (uintmax_t)st.allocs,
+          (uintmax_t)st.frees);
+
+  xbox_memsite_t sites[16];
+  size_t n = xbox_memstat_sites(sites, xMIN(top, xARRAY_SIZE(sites)));
+  for (size_t i = 0; i < n; ++i)
+    fprintf(fp, "  %8zu bytes %6zu blocks (peak %zu, %ju allocs) %s:%d\n",
+            sites[i].live_bytes, sites[i].live_blocks, sites[i].peak_bytes,
+            (uintmax_t)sites[i].allocs, sites[i].file, sites[i].line);
+}
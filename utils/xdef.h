@@ -14,6 +14,7 @@
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -90,6 +91,7 @@ enum {
   X_RET_MISMATCH = -10, /**< Mismatch */
   X_RET_BADFMT = -11,   /**< Bad format */
   X_RET_OVERFLOW = -12, /**< Overflow */
+  X_RET_CANCELED = -13, /**< Canceled */
 };
 
 /**
@@ -129,7 +131,21 @@ const char* err_str(err_t err);
 #endif
 
 // #define XBOX_ENABLE_BACKTRACE
-#if defined(XBOX_ENABLE_BACKTRACE)
+// #define XBOX_ENABLE_MEMSTAT
+#if defined(XBOX_ENABLE_MEMSTAT)
+/** @brief Wrapper for malloc, accounted to the call site. */
+#define xbox_malloc(size) __xbox_malloc_memstat(__FILE__, __LINE__, size)
+/** @brief Wrapper for calloc, accounted to the call site. */
+#define xbox_calloc(count, size) \
+  __xbox_calloc_memstat(__FILE__, __LINE__, count, size)
+/** @brief Wrapper for realloc, accounted to the call site. */
+#define xbox_realloc(ptr, size) \
+  __xbox_realloc_memstat(__FILE__, __LINE__, ptr, size)
+/** @brief Wrapper for free, the block leaves the site that allocated it. */
+#define xbox_free(ptr) __xbox_free_memstat(ptr)
+/** @brief Standard exit wrapper. */
+#define xbox_exit(code) __xbox_exit(code)
+#elif defined(XBOX_ENABLE_BACKTRACE)
 /** @brief Wrapper for malloc with backtrace. */
 #define xbox_malloc(size) __xbox_malloc_backtrace(__FILE__, __LINE__, size)
 /** @brief Wrapper for calloc with backtrace. */
@@ -153,7 +169,7 @@ const char* err_str(err_t err);
 #define xbox_free(ptr) __xbox_free(ptr)
 /** @brief Standard exit wrapper. */
 #define xbox_exit(code) __xbox_exit(code)
-#endif /* XBOX_ENABLE_BACKTRACE */
+#endif /* XBOX_ENABLE_MEMSTAT */
 
 /**
  * @brief Duplicates a string.
@@ -264,6 +280,110 @@ void __xbox_free_backtrace(const char* __f, int __l, void* __p);
 void __xbox_exit_backtrace(const char* __f, int __l, int __c);
 #endif /* XBOX_ENABLE_BACKTRACE */
 
+/** @struct xbox_memstat_t
+ *  @brief Allocation totals of the xbox_* wrappers, see xbox_memstat_get().
+ */
+typedef struct {
+  /**< Bytes allocated and not freed yet. */
+  size_t live_bytes;
+  /**< Highest live_bytes since start or the last xbox_memstat_reset_peak(). */
+  size_t peak_bytes;
+  /**< Blocks allocated and not freed yet. */
+  size_t live_blocks;
+  /**< Allocations made, a realloc counts as one. */
+  uint64_t allocs;
+  /**< Blocks freed. */
+  uint64_t frees;
+} xbox_memstat_t;
+
+/** @struct xbox_memsite_t
+ *  @brief The share of one xbox_malloc() call site, see xbox_memstat_sites().
+ */
+typedef struct {
+  /**< __FILE__ of the call. */
+  const char* file;
+  /**< __LINE__ of the call. */
+  int line;
+  /**< Bytes still allocated from here. */
+  size_t live_bytes;
+  /**< Blocks still allocated from here. */
+  size_t live_blocks;
+  /**< Highest live_bytes of this site. */
+  size_t peak_bytes;
+  /**< Allocations made here. */
+  uint64_t allocs;
+} xbox_memsite_t;
+
+/**
+ * @brief Reads the allocation totals.
+ * @details Only counted when built with XBOX_ENABLE_MEMSTAT, each block then
+ *          carries a small header with its size and call site.
+ * @param st Receives the totals, zeroed when accounting is not built in.
+ * @return xTRUE if accounting is built in.
+ */
+xbool_t xbox_memstat_get(xbox_memstat_t* st);
+
+/**
+ * @brief Starts a new peak window, e.g. at the beginning of a stage.
+ * @return The peak of the window that ends, 0 without accounting.
+ */
+size_t xbox_memstat_reset_peak(void);
+
+/**
+ * @brief Lists the call sites holding the most live memory.
+ * @param sites Receives up to `n` sites, largest live_bytes first.
+ * @param n Capacity of `sites`.
+ * @return The number of sites written, sites holding nothing are skipped.
+ */
+size_t xbox_memstat_sites(xbox_memsite_t* sites, size_t n);
+
+/**
+ * @brief Prints the totals and the `top` largest live sites.
+ * @details With accounting built in, the same report goes to stderr at exit
+ *          when blocks are still live, as a leak list.
+ * @param fp Where to print.
+ * @param top How many sites to list.
+ */
+void xbox_memstat_report(FILE* fp, size_t top);
+
+#if defined(XBOX_ENABLE_MEMSTAT)
+/**
+ * @internal
+ * @brief Internal memory allocation function with accounting.
+ * @param __f File name where allocation occurred.
+ * @param __l Line number where allocation occurred.
+ * @param __s Size of memory to allocate.
+ * @return Pointer to allocated memory, or NULL on failure.
+ */
+void* __xbox_malloc_memstat(const char* __f, int __l, size_t __s);
+/**
+ * @internal
+ * @brief Internal memory allocation function for an array with accounting.
+ * @param __f File name where allocation occurred.
+ * @param __l Line number where allocation occurred.
+ * @param __c Number of elements.
+ * @param __s Size of each element.
+ * @return Pointer to allocated memory, or NULL on failure.
+ */
+void* __xbox_calloc_memstat(const char* __f, int __l, size_t __c, size_t __s);
+/**
+ * @internal
+ * @brief Internal memory reallocation function with accounting.
+ * @param __f File name where reallocation occurred.
+ * @param __l Line number where reallocation occurred.
+ * @param __p Pointer to memory to reallocate.
+ * @param __s New size of memory.
+ * @return Pointer to reallocated memory, or NULL on failure.
+ */
+void* __xbox_realloc_memstat(const char* __f, int __l, void* __p, size_t __s);
+/**
+ * @internal
+ * @brief Internal memory free function with accounting.
+ * @param __p Pointer to memory to free.
+ */
+void __xbox_free_memstat(void* __p);
+#endif /* XBOX_ENABLE_MEMSTAT */
+
 #ifdef __cplusplus
 }
 #endif
@@ -12,8 +12,8 @@
 static const int8_t dummy = 0xff;
 
 // Forward declarations for the static helper functions.
-static struct xlist_node* new_node(void* data);
-static void* delete_node(struct xlist_node* node);
+static struct xlist_node* new_node(xlist self, void* data);
+static void* delete_node(xlist self, struct xlist_node* node);
 static struct xlist_node* merge_sort_recursive(struct xlist_node* head,
                                                int (*cmp)(const void*,
                                                           const void*));
@@ -30,14 +30,34 @@ xlist xlist_create(void) {
   return self;
 }
 
+xlist xlist_create_slab(size_t nodes_per_slab) {
+  xlist self = xlist_create();
+  if (!self) return NULL;
+
+  self->slab_ = xslab_create(sizeof(struct xlist_node), nodes_per_slab);
+  if (!self->slab_) {
+    xbox_free(self);
+    return NULL;
+  }
+
+  return self;
+}
+
 err_t xlist_destroy(xlist self) {
   if (!self) return X_RET_INVAL;
 
+  if (self->slab_) {
+    /* the nodes go with their slabs */
+    xslab_destroy(self->slab_);
+    xbox_free(self);
+    return X_RET_OK;
+  }
+
   struct xlist_node* node = self->head_.next_;
 
   while (node != &self->head_) {
     struct xlist_node* next = node->next_;
-    delete_node(node);
+    delete_node(self, node);
     node = next;
   }
 
@@ -51,13 +71,20 @@ err_t xlist_drain(xlist self, void (*free_func)(void*)) {
 
   struct xlist_node* node = self->head_.next_;
 
+  if (self->slab_) {
+    /* only the data needs a walk, the nodes are released in bulk */
+    for (; free_func && node != &self->head_; node = node->next_) free_func(node->data_);
+    xslab_reset(self->slab_);
+    node = &self->head_;
+  }
+
   while (node != &self->head_) {
     struct xlist_node* next = node->next_;
 
     if (free_func)
-      free_func(delete_node(node));
+      free_func(delete_node(self, node));
     else
-      delete_node(node);
+      delete_node(self, node);
 
     node = next;
   }
@@ -73,6 +100,7 @@ err_t xlist_init(xlist self) {
   if (!self) return X_RET_INVAL;
 
   self->length_ = 0;
+  self->slab_ = NULL;
   self->head_.data_ = (void*)&dummy;
   self->head_.prev_ = &self->head_;
   self->head_.next_ = &self->head_;
@@ -83,7 +111,7 @@ err_t xlist_init(xlist self) {
 err_t xlist_push_back(xlist self, void* data) {
   if (!self) return X_RET_INVAL;
 
-  struct xlist_node* node = new_node(data);
+  struct xlist_node* node = new_node(self, data);
   if (!node) return X_RET_NOMEM;
 
   self->head_.prev_->next_ = node;
@@ -99,7 +127,7 @@ err_t xlist_push_back(xlist self, void* data) {
 err_t xlist_push_front(xlist self, void* data) {
   if (!self) return X_RET_INVAL;
 
-  struct xlist_node* node = new_node(data);
+  struct xlist_node* node = new_node(self, data);
   if (!node) return X_RET_NOMEM;
 
   self->head_.next_->prev_ = node;
@@ -122,7 +150,7 @@ void* xlist_pop_back(xlist self) {
   self->head_.prev_ = node->prev_;
   self->length_--;
 
-  return delete_node(node);
+  return delete_node(self, node);
 }
 
 void* xlist_pop_front(xlist self) {
@@ -135,7 +163,7 @@ void* xlist_pop_front(xlist self) {
   self->head_.next_ = node->next_;
   self->length_--;
 
-  return delete_node(node);
+  return delete_node(self, node);
 }
 
 void* xlist_at(xlist self, size_t index) {
@@ -164,7 +192,7 @@ void* xlist_remove(xlist self, const void* data) {
       node->prev_->next_ = node->next_;
       node->next_->prev_ = node->prev_;
       self->length_--;
-      return delete_node(node);
+      return delete_node(self, node);
     }
     node = node->next_;
   }
@@ -264,8 +292,9 @@ static struct xlist_node* merge_sort_recursive(struct xlist_node* head,
   return merge(left_sorted, right_sorted, cmp);
 }
 
-static struct xlist_node* new_node(void* data) {
-  struct xlist_node* node = xbox_malloc(sizeof(struct xlist_node));
+static struct xlist_node* new_node(xlist self, void* data) {
+  struct xlist_node* node =
+      self->slab_ ? xslab_alloc(self->slab_) : xbox_malloc(sizeof(struct xlist_node));
   if (node) {
     node->data_ = data;
     node->prev_ = NULL;
@@ -274,9 +303,12 @@ static struct xlist_node* new_node(void* data) {
   return node;
 }
 
-static void* delete_node(struct xlist_node* node) {
+static void* delete_node(xlist self, struct xlist_node* node) {
   void* ret = node->data_;
-  xbox_free(node);
+  if (self->slab_)
+    xslab_free(self->slab_, node);
+  else
+    xbox_free(node);
   return ret;
 }
 
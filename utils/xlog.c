@@ -11,9 +11,13 @@
 #include "xlog.h"
 
 #include <assert.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "stb_sprintf.h"
 
@@ -25,6 +29,8 @@ struct xlog_sink_private {
   xbool_t auto_destory; /* true: destroy context when sink deleted */
 };
 
+struct xlog_async_private;
+
 struct xlogger_private {
   void* ctx;              /* logger context */
   xlog_sink* sink;        /* sink array */
@@ -33,10 +39,14 @@ struct xlogger_private {
   xlog_lvl_e lvl;         /* logger level */
   xlog_lvl_e which_flush; /* flush level */
   xlog_output_func pipe;  /* pipe func */
+  struct xlog_async_private* _Atomic async; /* background writer, NULL if sync */
+  atomic_int async_users;      /* producers currently using `async` */
+  atomic_size_t async_dropped; /* messages dropped on a full ring */
 };
 
 /* /path/to/file.txt -> file.txt */
 static err_t xlog_sink_del_advance(xlog_sink sink, xbool_t force);
+static void xlog_dedup_forget(xlogger self);
 const char* xlog_get_basename(const char* file);
 char* xlog_dup_basename(const char* file);
 void xlog_default_output(xlogger logger,
@@ -88,6 +98,9 @@ xlogger xlog_create_logger_with_options(xlog_options_t* opt) {
   new_logger->sink_capacity = 0;
   new_logger->ctx = opt->ctx;
   new_logger->pipe = opt->redirect ? opt->redirect : xlog_output;
+  new_logger->async = NULL;
+  atomic_init(&new_logger->async_users, 0);
+  atomic_init(&new_logger->async_dropped, 0);
 
   return new_logger;
 }
@@ -127,11 +140,14 @@ xlogger xlog_create_logger_with_sink_array(xlog_options_t* opt,
 err_t xlog_logger_append_sink(xlogger self, xlog_sink sink) {
   if (self == NULL || sink == NULL) return X_RET_INVAL;
 
-  if (self->sink == NULL) {
-    self->sink = (xlog_sink*)xbox_calloc(3, sizeof(xlog_sink));
-    if (self->sink == NULL) return X_RET_NOMEM;
+  if (self->sink == NULL || self->sink_capacity == 0) {
+    /* the default instance starts on a static array */
+    xlog_sink* new_sink = (xlog_sink*)xbox_calloc(self->sink_used + 3, sizeof(xlog_sink));
+    if (new_sink == NULL) return X_RET_NOMEM;
 
-    self->sink_capacity = 3;
+    for (size_t idx = 0; idx < self->sink_used; ++idx) new_sink[idx] = self->sink[idx];
+    self->sink = new_sink;
+    self->sink_capacity = self->sink_used + 3;
   }
 
   if (self->sink_used >= self->sink_capacity) {
@@ -150,6 +166,15 @@ err_t xlog_logger_append_sink(xlogger self, xlog_sink sink) {
   return X_RET_OK;
 }
 
+void xlog_logger_flush(xlogger self) {
+  if (self == NULL) return;
+
+  for (size_t idx = 0; idx < self->sink_used; ++idx) {
+    xlog_sink sink = self->sink[idx];
+    if (sink->flush) sink->flush(self, sink);
+  }
+}
+
 xlog_lvl_e xlog_logger_lvl(xlogger self) {
   assert(self != NULL);
 
@@ -165,6 +190,9 @@ void* xlog_logger_ctx(xlogger self) {
 err_t xlog_logger_destroy(xlogger self) {
   if (self == NULL || self == &xlog_logger_default_instance) return X_RET_INVAL;
 
+  xlog_async_stop(self);
+  xlog_dedup_forget(self);
+
   if (self->sink) {
     for (size_t idx = 0; idx < self->sink_used; ++idx) {
       xlog_sink sinker = self->sink[idx];
@@ -206,6 +234,14 @@ err_t xlog_global_set_lvl(xlog_lvl_e lvl) {
   return X_RET_OK;
 }
 
+err_t xlog_global_set_flush_lvl(xlog_lvl_e lvl) {
+  xlogger self = xlog_global_instance();
+
+  if (self) self->which_flush = lvl;
+
+  return X_RET_OK;
+}
+
 err_t xlog_global_set_instance(xlogger new_logger) {
   if (new_logger == NULL) return X_RET_INVAL;
 
@@ -236,17 +272,266 @@ void xlog_output(xlogger self, const xlog_message_t* message) {
   if (message->lvl == XLOG_LVL_FATAL) xbox_exit(1);
 }
 
+static xbool_t xlog_async_push(xlogger self, xlog_message_t* message);
+
+/* set on the async writer thread, whose sinks may log themselves */
+static __thread xbool_t t_async_writer;
+
+static void xlog_pipe_message(xlogger self, xlog_message_t message);
+
 void xlog_pipe(xlogger self, xlog_message_t message) {
   /* check if log level is greater than current logger level */
   if (self == NULL || message.lvl < self->lvl) {
     return;
   }
 
+  xlog_pipe_message(self, message);
+}
+
+/* a module level may let messages below the logger level through */
+static void xlog_pipe_message(xlogger self, xlog_message_t message) {
+  if (atomic_load_explicit(&self->async, memory_order_relaxed)) {
+    /* the ring owns the message once pushed */
+    if (message.lvl != XLOG_LVL_FATAL && xlog_async_push(self, &message))
+      return;
+
+    /* fatal messages must be out before the process exits, the writer
+     * can not join itself and just writes it */
+    if (message.lvl == XLOG_LVL_FATAL && !t_async_writer) xlog_async_stop(self);
+  }
+
   self->pipe(self, &message);
 
   xlog_message_release(&message);
 }
 
+struct xlog_async_cell {
+  atomic_size_t seq;
+  xlog_message_t message;
+};
+
+struct xlog_async_private {
+  xlogger logger;
+  struct xlog_async_cell* cells;
+  size_t mask;
+  atomic_size_t enqueue_pos;
+  size_t dequeue_pos; /* writer thread only */
+  xlog_async_policy_e policy;
+  atomic_bool stop;
+  atomic_bool sleeping;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t thread;
+};
+
+static void xlog_async_wakeup(struct xlog_async_private* a) {
+  pthread_mutex_lock(&a->lock);
+  pthread_cond_signal(&a->cond);
+  pthread_mutex_unlock(&a->lock);
+}
+
+/* Vyukov's bounded MPMC queue, used with a single consumer. */
+static xbool_t xlog_async_try_push(struct xlog_async_private* a,
+                                   xlog_message_t* message) {
+  size_t pos = atomic_load_explicit(&a->enqueue_pos, memory_order_relaxed);
+
+  for (;;) {
+    struct xlog_async_cell* cell = &a->cells[pos & a->mask];
+    size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&a->enqueue_pos,
+                                                &pos,
+                                                pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        cell->message = *message;
+        atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+        return xTRUE;
+      }
+    } else if (diff < 0) {
+      return xFALSE; /* full */
+    } else {
+      pos = atomic_load_explicit(&a->enqueue_pos, memory_order_relaxed);
+    }
+  }
+}
+
+static xbool_t xlog_async_try_pop(struct xlog_async_private* a,
+                                  xlog_message_t* message) {
+  struct xlog_async_cell* cell = &a->cells[a->dequeue_pos & a->mask];
+  size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+
+  if ((intptr_t)seq - (intptr_t)(a->dequeue_pos + 1) < 0) return xFALSE;
+
+  *message = cell->message;
+  atomic_store_explicit(&cell->seq,
+                        a->dequeue_pos + a->mask + 1,
+                        memory_order_release);
+  a->dequeue_pos++;
+  return xTRUE;
+}
+
+static xbool_t xlog_async_push(xlogger self, xlog_message_t* message) {
+  xbool_t taken = xFALSE;
+
+  /* keeps xlog_async_stop() from freeing the ring under us */
+  atomic_fetch_add(&self->async_users, 1);
+
+  struct xlog_async_private* a = atomic_load(&self->async);
+  while (a != NULL) {
+    if (xlog_async_try_push(a, message)) {
+      if (atomic_load(&a->sleeping)) xlog_async_wakeup(a);
+      taken = xTRUE;
+      break;
+    }
+
+    /* the writer would wait for itself to make room, it drops instead */
+    if (a->policy == XLOG_ASYNC_DROP || t_async_writer) {
+      atomic_fetch_add_explicit(&self->async_dropped, 1, memory_order_relaxed);
+      xlog_message_release(message);
+      taken = xTRUE;
+      break;
+    }
+
+    /* XLOG_ASYNC_BLOCK, give the writer time to make room */
+    xlog_async_wakeup(a);
+    struct timespec ts = {.tv_sec = 0, .tv_nsec = 100 * 1000};
+    nanosleep(&ts, NULL);
+  }
+
+  atomic_fetch_sub(&self->async_users, 1);
+  return taken;
+}
+
+static void* xlog_async_writer(void* arg) {
+  struct xlog_async_private* a = (struct xlog_async_private*)arg;
+  xlogger self = a->logger;
+  size_t reported = 0;
+  xlog_message_t message;
+
+  t_async_writer = xTRUE;
+
+  for (;;) {
+    while (xlog_async_try_pop(a, &message)) {
+      self->pipe(self, &message);
+      xlog_message_release(&message);
+    }
+
+    size_t dropped = atomic_load_explicit(&self->async_dropped,
+                                          memory_order_relaxed);
+    if (dropped != reported) {
+      xlog_message_t note = xlog_message_init("xlog",
+                                              __FILE__,
+                                              __func__,
+                                              __LINE__,
+                                              XLOG_LVL_WARN,
+                                              "%zu log messages dropped",
+                                              dropped - reported);
+      self->pipe(self, &note);
+      xlog_message_release(&note);
+      reported = dropped;
+    }
+
+    if (atomic_load(&a->stop)) {
+      /* producers are gone, one last pass empties the ring */
+      if (!xlog_async_try_pop(a, &message)) break;
+      self->pipe(self, &message);
+      xlog_message_release(&message);
+      continue;
+    }
+
+    /* the timeout covers a wakeup racing with going to sleep */
+    pthread_mutex_lock(&a->lock);
+    atomic_store(&a->sleeping, xTRUE);
+    struct xlog_async_cell* next = &a->cells[a->dequeue_pos & a->mask];
+    if (atomic_load(&next->seq) != a->dequeue_pos + 1 && !atomic_load(&a->stop)) {
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_nsec += 50 * 1000 * 1000;
+      if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+      }
+      pthread_cond_timedwait(&a->cond, &a->lock, &deadline);
+    }
+    atomic_store(&a->sleeping, xFALSE);
+    pthread_mutex_unlock(&a->lock);
+  }
+
+  return NULL;
+}
+
+err_t xlog_async_start(xlogger self,
+                       size_t capacity,
+                       xlog_async_policy_e policy) {
+  if (self == NULL || capacity == 0) return X_RET_INVAL;
+  if (atomic_load(&self->async)) return X_RET_EXIST;
+
+  size_t size = 1;
+  while (size < capacity) size <<= 1;
+
+  struct xlog_async_private* a = xbox_malloc(sizeof(*a));
+  if (a == NULL) return X_RET_NOMEM;
+
+  a->cells = xbox_malloc(size * sizeof(struct xlog_async_cell));
+  if (a->cells == NULL) {
+    xbox_free(a);
+    return X_RET_NOMEM;
+  }
+
+  for (size_t i = 0; i < size; ++i) atomic_init(&a->cells[i].seq, i);
+  a->logger = self;
+  a->mask = size - 1;
+  atomic_init(&a->enqueue_pos, 0);
+  a->dequeue_pos = 0;
+  a->policy = policy;
+  atomic_init(&a->stop, xFALSE);
+  atomic_init(&a->sleeping, xFALSE);
+  pthread_mutex_init(&a->lock, NULL);
+  pthread_cond_init(&a->cond, NULL);
+
+  atomic_store(&self->async, a);
+  if (pthread_create(&a->thread, NULL, xlog_async_writer, a) != 0) {
+    atomic_store(&self->async, NULL);
+    pthread_cond_destroy(&a->cond);
+    pthread_mutex_destroy(&a->lock);
+    xbox_free(a->cells);
+    xbox_free(a);
+    return X_RET_ERROR;
+  }
+
+  return X_RET_OK;
+}
+
+err_t xlog_async_stop(xlogger self) {
+  if (self == NULL) return X_RET_INVAL;
+
+  struct xlog_async_private* a = atomic_exchange(&self->async, NULL);
+  if (a == NULL) return X_RET_OK;
+
+  /* new messages go out synchronously now, wait for queued producers */
+  while (atomic_load(&self->async_users) > 0) sched_yield();
+
+  atomic_store(&a->stop, xTRUE);
+  xlog_async_wakeup(a);
+  pthread_join(a->thread, NULL);
+
+  pthread_cond_destroy(&a->cond);
+  pthread_mutex_destroy(&a->lock);
+  xbox_free(a->cells);
+  xbox_free(a);
+
+  return X_RET_OK;
+}
+
+size_t xlog_async_dropped(xlogger self) {
+  if (self == NULL) return 0;
+
+  return atomic_load(&self->async_dropped);
+}
+
 const char* xlog_get_basename(const char* file) {
   if (file == NULL) return "";
 
@@ -419,6 +704,39 @@ err_t xlog_sink_del(xlog_sink self) {
   return xlog_sink_del_advance(self, xFALSE);
 }
 
+static xlog_message_t xlog_message_vinit(const char* module,
+                                         const char* file,
+                                         const char* func,
+                                         int line,
+                                         xlog_lvl_e lvl,
+                                         const char* format,
+                                         va_list ap) {
+  va_list ap_copy;
+  va_copy(ap_copy, ap);
+  /* the inline buffer is not zeroed, the formatter terminates it */
+  xlog_message_t message;
+  message.module = module;
+  message.full_file_name = file;
+  message.file_name = xlog_get_basename(file);
+  message.func = func;
+  message.line = line;
+  message.lvl = lvl;
+  message.data.s = NULL;
+  message.need_free = xFALSE;
+
+  /* most messages fit the inline buffer, format only once for them */
+  int need_len = stbsp_vsnprintf(message.data.b, XLOG_SBO_SIZE, format, ap_copy) + 1;  // reserve '\0'
+  va_end(ap_copy);
+
+  if (need_len > XLOG_SBO_SIZE) {
+    message.data.s = xbox_malloc(need_len);
+    assert(message.data.s != NULL);
+    stbsp_vsnprintf(message.data.s, need_len, format, ap);
+  }
+
+  return message;
+}
+
 xlog_message_t xlog_message_init(const char* module,
                                  const char* file,
                                  const char* func,
@@ -426,38 +744,351 @@ xlog_message_t xlog_message_init(const char* module,
                                  xlog_lvl_e lvl,
                                  const char* format,
                                  ...) {
-  va_list ap, ap_copy;
+  va_list ap;
   va_start(ap, format);
-  va_copy(ap_copy, ap);
-  xlog_message_t message = {
-      .module = module,
-      .full_file_name = file,
-      .file_name = xlog_get_basename(file),
-      .func = func,
-      .line = line,
-      .lvl = lvl,
-      .data =
-          {
-              .b = {0},
-              .s = NULL,
-          },
-      .need_free = xFALSE,
-  };
+  xlog_message_t message = xlog_message_vinit(module, file, func, line, lvl, format, ap);
+  va_end(ap);
 
-  int need_len = stbsp_vsnprintf(NULL, 0, format, ap_copy) + 1;  // reserve '\0'
-  va_end(ap_copy);
+  return message;
+}
 
-  if (need_len > XLOG_SBO_SIZE) {
-    message.data.s = xbox_malloc(need_len);
-    assert(message.data.s != NULL);
-    stbsp_vsnprintf(message.data.s, need_len, format, ap);
+xlog_record_func xlog_record_hook = NULL;
+
+void xlog_set_record_hook(xlog_record_func hook) {
+  __atomic_store_n(&xlog_record_hook, hook, __ATOMIC_RELEASE);
+}
+
+unsigned int xlog_site_generation = 1;
+
+static struct {
+  pthread_mutex_t lock;
+  int count;
+  struct {
+    char module[32];
+    xlog_lvl_e lvl;
+  } entries[XLOG_MAX_MODULE_LVLS];
+} g_module_lvls = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+unsigned int xlog_site_resolve(xlog_site_t* site, const char* module) {
+  pthread_mutex_lock(&g_module_lvls.lock);
+
+  unsigned int cached = __atomic_load_n(&xlog_site_generation, __ATOMIC_RELAXED) << 4;
+  for (int i = 0; module && *module && i < g_module_lvls.count; ++i) {
+    if (!strcmp(g_module_lvls.entries[i].module, module)) {
+      cached |= (unsigned int)g_module_lvls.entries[i].lvl + 1;
+      break;
+    }
+  }
+  __atomic_store_n(&site->cached, cached, __ATOMIC_RELAXED);
+
+  pthread_mutex_unlock(&g_module_lvls.lock);
+  return cached;
+}
+
+/* call with g_module_lvls.lock held */
+static void xlog_sites_invalidate(void) {
+  unsigned int gen = __atomic_load_n(&xlog_site_generation, __ATOMIC_RELAXED) + 1;
+  /* 0 is what a fresh site holds, it must never look current */
+  if ((gen & 0x0fffffff) == 0) gen = 1;
+  __atomic_store_n(&xlog_site_generation, gen & 0x0fffffff, __ATOMIC_RELAXED);
+}
+
+err_t xlog_lvl_parse(const char* name, xlog_lvl_e* lvl) {
+  if (name == NULL || lvl == NULL) return X_RET_INVAL;
+
+  for (int i = XLOG_LVL_TRACE; i <= XLOG_LVL_FATAL; ++i) {
+    if (!strcasecmp(name, xlog_lvl_full_str((xlog_lvl_e)i))) {
+      *lvl = (xlog_lvl_e)i;
+      return X_RET_OK;
+    }
+  }
+
+  return X_RET_INVAL;
+}
+
+err_t xlog_set_module_lvl(const char* module, xlog_lvl_e lvl) {
+  if (module == NULL || *module == '\0' || strlen(module) >= sizeof(g_module_lvls.entries[0].module))
+    return X_RET_INVAL;
+  if (lvl < XLOG_LVL_TRACE || lvl > XLOG_LVL_FATAL) return X_RET_INVAL;
+
+  pthread_mutex_lock(&g_module_lvls.lock);
+
+  int at = 0;
+  while (at < g_module_lvls.count && strcmp(g_module_lvls.entries[at].module, module)) at++;
+
+  err_t err = X_RET_OK;
+  if (at == XLOG_MAX_MODULE_LVLS) {
+    err = X_RET_FULL;
+  } else {
+    if (at == g_module_lvls.count) {
+      strcpy(g_module_lvls.entries[at].module, module);
+      g_module_lvls.count++;
+    }
+    g_module_lvls.entries[at].lvl = lvl;
+    xlog_sites_invalidate();
+  }
+
+  pthread_mutex_unlock(&g_module_lvls.lock);
+  return err;
+}
+
+err_t xlog_clear_module_lvl(const char* module) {
+  pthread_mutex_lock(&g_module_lvls.lock);
+
+  err_t err = X_RET_NOTENT;
+  if (module == NULL) {
+    if (g_module_lvls.count > 0) err = X_RET_OK;
+    g_module_lvls.count = 0;
+  } else {
+    for (int i = 0; i < g_module_lvls.count; ++i) {
+      if (!strcmp(g_module_lvls.entries[i].module, module)) {
+        g_module_lvls.entries[i] = g_module_lvls.entries[--g_module_lvls.count];
+        err = X_RET_OK;
+        break;
+      }
+    }
+  }
+  if (err == X_RET_OK) xlog_sites_invalidate();
+
+  pthread_mutex_unlock(&g_module_lvls.lock);
+  return err;
+}
+
+err_t xlog_global_parse_lvl(const char* spec) {
+  if (spec == NULL) return X_RET_INVAL;
+
+  char buf[512];
+  if (strlen(spec) >= sizeof(buf)) return X_RET_INVAL;
+  strcpy(buf, spec);
+
+  err_t err = X_RET_OK;
+  char* save = NULL;
+  for (char* item = strtok_r(buf, ", ", &save); item; item = strtok_r(NULL, ", ", &save)) {
+    xlog_lvl_e lvl;
+    char* eq = strchr(item, '=');
+    if (eq) *eq = '\0';
+
+    if (xlog_lvl_parse(eq ? eq + 1 : item, &lvl) != X_RET_OK)
+      err = X_RET_INVAL;
+    else if (eq == NULL)
+      xlog_global_set_lvl(lvl);
+    else if (xlog_set_module_lvl(item, lvl) != X_RET_OK)
+      err = X_RET_INVAL;
+  }
+
+  return err;
+}
+
+static uint32_t xlog_now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+/* rate limiting and deduplication, both off the path once disabled */
+static struct {
+  pthread_mutex_t lock;
+  unsigned int burst;     /* 0: no rate limiting */
+  unsigned int interval;
+  xbool_t dedup;
+  /* the last message output */
+  xlogger logger;
+  xlog_site_t* site;
+  uint64_t hash;
+  xlog_message_t last;    /* metadata only, to report repeats under */
+  unsigned int repeats;
+  uint32_t reported;      /* when repeats were last reported */
+} g_filter = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .interval = 1000,
+    .dedup = xFALSE,
+};
+
+void xlog_set_ratelimit(unsigned int burst, int interval_ms) {
+  pthread_mutex_lock(&g_filter.lock);
+  g_filter.burst = burst;
+  g_filter.interval = interval_ms > 0 ? (unsigned int)interval_ms : 1000;
+  pthread_mutex_unlock(&g_filter.lock);
+}
+
+static void xlog_dedup_flush(void);
+
+void xlog_set_dedup(xbool_t enable) {
+  if (!enable) xlog_dedup_flush();
+
+  pthread_mutex_lock(&g_filter.lock);
+  g_filter.dedup = enable;
+  pthread_mutex_unlock(&g_filter.lock);
+}
+
+/* outputs a notice under the metadata of the message it is about */
+static void xlog_notice(xlogger self, const xlog_message_t* about, const char* format, ...) {
+  va_list ap;
+  va_start(ap, format);
+  xlog_message_t message = xlog_message_vinit(about->module, about->full_file_name, about->func,
+                                              about->line, about->lvl, format, ap);
+  va_end(ap);
+
+  xlog_pipe_message(self, message);
+}
+
+/* outputs the repeats of the last message, if any */
+static void xlog_dedup_flush(void) {
+  pthread_mutex_lock(&g_filter.lock);
+  unsigned int repeats = g_filter.repeats;
+  xlogger logger = g_filter.logger;
+  xlog_message_t last = g_filter.last;
+  g_filter.repeats = 0;
+  g_filter.site = NULL;
+  pthread_mutex_unlock(&g_filter.lock);
+
+  if (repeats && logger) xlog_notice(logger, &last, "Last message repeated %u times", repeats);
+}
+
+/* drops the last message of a logger going away */
+static void xlog_dedup_forget(xlogger self) {
+  pthread_mutex_lock(&g_filter.lock);
+  if (g_filter.logger == self) {
+    g_filter.logger = NULL;
+    g_filter.site = NULL;
+    g_filter.repeats = 0;
+  }
+  pthread_mutex_unlock(&g_filter.lock);
+}
+
+/**
+ * @brief Lets a message through the call site's rate limit.
+ * @param suppressed Receives the number of messages dropped in the
+ *        window that just ended, to be reported.
+ */
+static xbool_t xlog_ratelimit_admit(xlog_site_t* site, xlog_lvl_e lvl, unsigned int* suppressed) {
+  *suppressed = 0;
+  if (lvl == XLOG_LVL_FATAL || __atomic_load_n(&g_filter.burst, __ATOMIC_RELAXED) == 0)
+    return xTRUE;
+
+  pthread_mutex_lock(&g_filter.lock);
+
+  uint32_t now = xlog_now_ms();
+  if (site->count == 0 || now - site->window >= g_filter.interval) {
+    *suppressed = site->suppressed;
+    site->suppressed = 0;
+    site->count = 0;
+    site->window = now;
+  }
+
+  xbool_t admit = site->count < g_filter.burst;
+  if (admit)
+    site->count++;
+  else
+    site->suppressed++;
+
+  pthread_mutex_unlock(&g_filter.lock);
+  return admit;
+}
+
+static uint64_t xlog_hash(const char* data) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (const unsigned char* p = (const unsigned char*)data; *p; ++p) h = (h ^ *p) * 0x100000001b3ull;
+  return h;
+}
+
+/**
+ * @brief Decides whether a message repeats the last one.
+ * @param repeats Receives the repeats of the previous message to report
+ *        (before this one), or of this one when they are due.
+ * @param about Receives the message the repeats are about.
+ * @param about_logger Receives the logger to report them to.
+ * @return xTRUE if the message is a repeat, to be dropped.
+ */
+static xbool_t xlog_dedup_check(xlogger self,
+                                xlog_site_t* site,
+                                const xlog_message_t* message,
+                                unsigned int* repeats,
+                                xlog_message_t* about,
+                                xlogger* about_logger) {
+  *repeats = 0;
+  if (message->lvl == XLOG_LVL_FATAL || !__atomic_load_n(&g_filter.dedup, __ATOMIC_RELAXED))
+    return xFALSE;
+
+  uint64_t hash = xlog_hash(xlog_message_data(message));
+
+  pthread_mutex_lock(&g_filter.lock);
+
+  xbool_t repeated = g_filter.dedup && g_filter.site == site && g_filter.logger == self &&
+                     g_filter.hash == hash;
+  uint32_t now = xlog_now_ms();
+  *about = g_filter.last;
+  *about_logger = g_filter.logger;
+
+  if (repeated) {
+    g_filter.repeats++;
+    if (now - g_filter.reported >= XLOG_DEDUP_REPORT_MS) {
+      *repeats = g_filter.repeats;
+      g_filter.repeats = 0;
+      g_filter.reported = now;
+    }
   } else {
-    stbsp_vsnprintf(message.data.b, XLOG_SBO_SIZE, format, ap);
+    *repeats = g_filter.repeats;
+    g_filter.logger = self;
+    g_filter.site = site;
+    g_filter.hash = hash;
+    g_filter.last = *message;
+    g_filter.last.data.s = NULL;
+    g_filter.last.need_free = xFALSE;
+    g_filter.repeats = 0;
+    g_filter.reported = now;
   }
 
+  pthread_mutex_unlock(&g_filter.lock);
+  return repeated;
+}
+
+void xlog_emit(xlogger self,
+               xlog_site_t* site,
+               xbool_t output,
+               const char* module,
+               const char* file,
+               const char* func,
+               int line,
+               xlog_lvl_e lvl,
+               const char* format,
+               ...) {
+  va_list ap;
+  va_start(ap, format);
+
+  xlog_record_func hook = __atomic_load_n(&xlog_record_hook, __ATOMIC_ACQUIRE);
+  if (hook) {
+    va_list ap_copy;
+    va_copy(ap_copy, ap);
+    hook(module, line, lvl, format, ap_copy);
+    va_end(ap_copy);
+  }
+
+  unsigned int dropped = 0;
+  if (self == NULL || !output || !xlog_ratelimit_admit(site, lvl, &dropped)) {
+    va_end(ap);
+    return;
+  }
+
+  xlog_message_t message = xlog_message_vinit(module, file, func, line, lvl, format, ap);
   va_end(ap);
 
-  return message;
+  if (dropped)
+    xlog_notice(self, &message, "%u messages suppressed by rate limiting", dropped);
+
+  unsigned int repeats;
+  xlog_message_t about;
+  xlogger about_logger;
+  xbool_t repeated = xlog_dedup_check(self, site, &message, &repeats, &about, &about_logger);
+  if (repeats && about_logger)
+    xlog_notice(about_logger, &about, "Last message repeated %u times", repeats);
+
+  if (repeated)
+    xlog_message_release(&message);
+  else
+    xlog_pipe_message(self, message);
 }
 
 xlog_message_t* xlog_message_dup(const xlog_message_t* other) {
@@ -480,7 +1111,7 @@ xlog_message_t* xlog_message_dup(const xlog_message_t* other) {
     message->data.s = xbox_strdup(other->data.s);
     assert(message->data.s != NULL);
   } else {
-    memcpy(message->data.b, other->data.b, XLOG_SBO_SIZE);
+    memcpy(message->data.b, other->data.b, strlen(other->data.b) + 1);
   }
 
   return message;
@@ -535,22 +1166,49 @@ xlog_options_t xlog_options_init(xlog_lvl_e lvl, xlog_lvl_e which_flush) {
 }
 
 #if defined(__GNUC__) || defined(__clang__)
+static void xlog_at_exit(void) {
+  /* registered first, so it runs after everybody else's atexit handlers */
+  xlog_dedup_flush();
+  xlog_async_stop(xlog_global_logger_instance);
+  xlog_logger_flush(xlog_global_logger_instance);
+}
+
+/* XLOG_ASYNC=drop|block[:capacity] */
+static void xlog_check_async_env(void) {
+  char* async = getenv("XLOG_ASYNC");
+  if (!async || !*async) return;
+
+  xlog_async_policy_e policy = XLOG_ASYNC_DROP;
+  if (!strncasecmp(async, "block", 5))
+    policy = XLOG_ASYNC_BLOCK;
+  else if (strncasecmp(async, "drop", 4))
+    return;
+
+  size_t capacity = XLOG_ASYNC_DEFAULT_CAPACITY;
+  const char* colon = strchr(async, ':');
+  if (colon && atoi(colon + 1) > 0) capacity = (size_t)atoi(colon + 1);
+
+  xlog_async_start(&xlog_logger_default_instance, capacity, policy);
+}
+
 __attribute__((constructor)) void xlog_check_env() {
+  atexit(xlog_at_exit);
+  xlog_check_async_env();
+
+  /* XLOG_LVL=info,dbus=trace */
   char* lvl = getenv("XLOG_LVL");
-  if (!lvl) return;
-
-  if (!strcasecmp(lvl, "trace"))
-    xlog_logger_default_instance.lvl = XLOG_LVL_TRACE;
-  else if (!strcasecmp(lvl, "debug"))
-    xlog_logger_default_instance.lvl = XLOG_LVL_DEBUG;
-  else if (!strcasecmp(lvl, "info"))
-    xlog_logger_default_instance.lvl = XLOG_LVL_INFO;
-  else if (!strcasecmp(lvl, "warn"))
-    xlog_logger_default_instance.lvl = XLOG_LVL_WARN;
-  else if (!strcasecmp(lvl, "error"))
-    xlog_logger_default_instance.lvl = XLOG_LVL_ERROR;
-  else if (!strcasecmp(lvl, "fatal"))
-    xlog_logger_default_instance.lvl = XLOG_LVL_FATAL;
+  if (lvl) xlog_global_parse_lvl(lvl);
+
+  /* XLOG_RATELIMIT=burst[/interval_ms] */
+  char* ratelimit = getenv("XLOG_RATELIMIT");
+  if (ratelimit && atoi(ratelimit) > 0) {
+    const char* slash = strchr(ratelimit, '/');
+    xlog_set_ratelimit((unsigned int)atoi(ratelimit), slash ? atoi(slash + 1) : 0);
+  }
+
+  /* opt-in, it hashes every message and serializes producers on one lock */
+  char* dedup = getenv("XLOG_DEDUP");
+  if (dedup && (!strcasecmp(dedup, "on") || !strcmp(dedup, "1"))) xlog_set_dedup(xTRUE);
 }
 
 #include <time.h>
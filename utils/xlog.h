@@ -11,6 +11,7 @@
 #ifndef XTOOL_XLOG__H_
 #define XTOOL_XLOG__H_
 
+#include <stdarg.h>
 #include <string.h>
 
 #include "xdef.h"
@@ -18,6 +19,15 @@
 /**< Size of the small buffer optimization for log messages. */
 #define XLOG_SBO_SIZE (128)
 
+/**
+ * @def XLOG_COMPILE_MIN_LVL
+ * @brief Calls below this level (0 trace ... 5 fatal) are compiled out,
+ *        format string and arguments included. Set from CMake.
+ */
+#ifndef XLOG_COMPILE_MIN_LVL
+#define XLOG_COMPILE_MIN_LVL 0
+#endif /* XLOG_COMPILE_MIN_LVL */
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -87,12 +97,26 @@ extern "C" {
  * @def XLOG_OUTPUT_MESSAGE
  * @brief Internal macro to construct and pipe a log message if the level is sufficient.
  */
-#define XLOG_OUTPUT_MESSAGE(logger, lvl, fmt, ...)                         \
-  do {                                                                     \
-    if (xlog_logger_lvl(logger) <= lvl)                                    \
-      xlog_pipe(logger, XLOG_MESSAGE_MACRO_INIT(lvl, fmt, ##__VA_ARGS__)); \
+#define XLOG_OUTPUT_MESSAGE(logger, lvl, fmt, ...)                           \
+  do {                                                                       \
+    static xlog_site_t _xlog_site;                                           \
+    if ((int)(lvl) >= XLOG_COMPILE_MIN_LVL) {                                \
+      xbool_t _xlog_out =                                                    \
+          (int)(lvl) >= xlog_site_lvl(&_xlog_site, logger, XLOG_MOD);        \
+      if (_xlog_out || XLOG_RECORDING())                                     \
+        xlog_emit(logger, &_xlog_site, _xlog_out, XLOG_MOD, __FILE__,        \
+                  __func__, __LINE__, lvl, fmt, ##__VA_ARGS__);              \
+    }                                                                        \
   } while (0)
 
+/**
+ * @internal
+ * @def XLOG_RECORDING
+ * @brief Whether a record hook wants every call, whatever the logger level.
+ */
+#define XLOG_RECORDING() \
+  (__atomic_load_n(&xlog_record_hook, __ATOMIC_RELAXED) != NULL)
+
 /**
  * @brief Defines the various levels of logging.
  */
@@ -407,6 +431,13 @@ xlogger xlog_create_logger_with_sink_array(xlog_options_t* opt, size_t sink_coun
  */
 err_t xlog_logger_append_sink(xlogger logger, xlog_sink sink);
 
+/**
+ * @brief Flushes every sink of a logger.
+ * @details The global logger is also flushed at exit.
+ * @param logger The logger instance.
+ */
+void xlog_logger_flush(xlogger logger);
+
 /**
  * @brief Gets the current log level of a logger.
  * @param logger The logger instance.
@@ -460,6 +491,15 @@ err_t xlog_global_set_ctx(void* ctx);
  */
 err_t xlog_global_set_lvl(xlog_lvl_e lvl);
 
+/**
+ * @brief Sets the level from which messages flush the global logger's sinks.
+ * @details Sinks that buffer, e.g. xlog_file.h, only write out on a flush,
+ *          when their buffer fills or at exit.
+ * @param lvl The new flush level.
+ * @return X_RET_OK  on success.
+ */
+err_t xlog_global_set_flush_lvl(xlog_lvl_e lvl);
+
 /**
  * @brief Replaces the global logger instance with a custom one.
  * @param logger The new logger instance. The global logger takes ownership.
@@ -480,6 +520,196 @@ err_t xlog_global_reset(void);
  */
 void xlog_output(xlogger self, const xlog_message_t* message);
 
+/**
+ * @brief What a producer does when the async ring is full.
+ */
+typedef enum {
+  XLOG_ASYNC_DROP,  /**< Discard the message and count it. */
+  XLOG_ASYNC_BLOCK, /**< Wait until the writer made room; the writer itself drops. */
+} xlog_async_policy_e;
+
+/**< Default number of messages the async ring holds. */
+#define XLOG_ASYNC_DEFAULT_CAPACITY (1024)
+
+/**
+ * @brief Switches a logger to asynchronous output.
+ * @details Producers move their message into a preallocated lock-free ring
+ *          and return; a background thread hands them to the sinks. Fatal
+ *          messages drain the ring and are written synchronously.
+ *          Also enabled for the global logger by `XLOG_ASYNC=drop|block[:capacity]`.
+ * @param logger The logger instance.
+ * @param capacity Ring size in messages, rounded up to a power of 2.
+ * @param policy What to do when the ring is full.
+ * @return X_RET_OK on success, X_RET_EXIST if already asynchronous.
+ */
+err_t xlog_async_start(xlogger logger, size_t capacity, xlog_async_policy_e policy);
+
+/**
+ * @brief Writes out everything queued and returns to synchronous output.
+ * @param logger The logger instance.
+ * @return X_RET_OK on success.
+ */
+err_t xlog_async_stop(xlogger logger);
+
+/**
+ * @brief Gets the number of messages dropped because the ring was full.
+ * @param logger The logger instance.
+ * @return The number of dropped messages.
+ */
+size_t xlog_async_dropped(xlogger logger);
+
+/**
+ * @brief Receives every log call ahead of level filtering and formatting.
+ * @param module The module name.
+ * @param line The line number.
+ * @param lvl The log level.
+ * @param format The printf-style format string, unformatted.
+ * @param ap The arguments for the format string.
+ */
+typedef void (*xlog_record_func)(const char* module,
+                                 int line,
+                                 xlog_lvl_e lvl,
+                                 const char* format,
+                                 va_list ap);
+
+/**< The installed record hook, NULL if none. See xlog_set_record_hook(). */
+extern xlog_record_func xlog_record_hook;
+
+/**
+ * @brief Installs a hook that sees every log call, e.g. xlog_recorder.h.
+ * @details While a hook is installed, calls below the logger level still
+ *          evaluate their arguments so the hook can keep them.
+ * @param hook The hook, NULL to remove it.
+ */
+void xlog_set_record_hook(xlog_record_func hook);
+
+/**
+ * @brief State the logging macros keep per call site.
+ */
+// clang-format off
+typedef struct {
+  unsigned int cached;     /**< generation << 4 | module level + 1 (0: none), see xlog_site_lvl(). */
+  unsigned int window;     /**< Start of the rate limit window, in ms. */
+  unsigned int count;      /**< Messages output in the window. */
+  unsigned int suppressed; /**< Messages dropped in the window. */
+} xlog_site_t;
+// clang-format on
+
+/**< Bumped whenever module levels change, invalidating every site's cache. */
+extern unsigned int xlog_site_generation;
+
+/**
+ * @internal
+ * @brief Looks up the module level for a call site and caches it.
+ * @return The cached word, see xlog_site_t.
+ */
+unsigned int xlog_site_resolve(xlog_site_t* site, const char* module);
+
+/**
+ * @brief Gets the level a call site logs from.
+ * @details The module level, if one is set, else the logger level. The
+ *          module lookup is done once per call site and generation.
+ * @param site The call site.
+ * @param logger The logger instance.
+ * @param module The module name of the call site.
+ * @return The level.
+ */
+static inline int xlog_site_lvl(xlog_site_t* site, xlogger logger, const char* module) {
+  unsigned int cached = __atomic_load_n(&site->cached, __ATOMIC_RELAXED);
+  if ((cached >> 4) != __atomic_load_n(&xlog_site_generation, __ATOMIC_RELAXED))
+    cached = xlog_site_resolve(site, module);
+
+  return (cached & 0xf) ? (int)(cached & 0xf) - 1 : (int)xlog_logger_lvl(logger);
+}
+
+/**
+ * @brief Parses a level name, e.g. "debug", case insensitively.
+ * @param name The level name.
+ * @param lvl Receives the level.
+ * @return X_RET_OK on success, X_RET_INVAL for an unknown name.
+ */
+err_t xlog_lvl_parse(const char* name, xlog_lvl_e* lvl);
+
+/**
+ * @brief Overrides the level for the calls of one module (`XLOG_MOD`).
+ * @param module The module name.
+ * @param lvl The level its calls log from, whatever the logger level.
+ * @return X_RET_OK on success, X_RET_FULL if XLOG_MAX_MODULE_LVLS are set.
+ */
+err_t xlog_set_module_lvl(const char* module, xlog_lvl_e lvl);
+
+/**
+ * @brief Drops a module level override.
+ * @param module The module name, NULL drops all of them.
+ * @return X_RET_OK on success, X_RET_NOTENT if there was none.
+ */
+err_t xlog_clear_module_lvl(const char* module);
+
+/**< Module level overrides held at once. */
+#define XLOG_MAX_MODULE_LVLS (16)
+
+/**
+ * @brief Applies a level spec, e.g. "info,dbus=trace,upgrade=warn".
+ * @details A bare level sets the global logger level, `module=level`
+ *          overrides one module. Also read from `XLOG_LVL` at startup.
+ * @param spec The level spec.
+ * @return X_RET_OK on success, X_RET_INVAL if an entry is invalid (the
+ *         valid ones are applied).
+ */
+err_t xlog_global_parse_lvl(const char* spec);
+
+/**
+ * @brief Limits each call site to `burst` messages per `interval_ms`.
+ * @details Fatal messages are never limited. When a limited site logs
+ *          again in a new window, the number of dropped messages is
+ *          reported first. Also set by `XLOG_RATELIMIT=burst[/interval_ms]`.
+ * @param burst Messages per window, 0 disables rate limiting.
+ * @param interval_ms The window length, 1000 if <= 0.
+ */
+void xlog_set_ratelimit(unsigned int burst, int interval_ms);
+
+/**
+ * @brief Collapses repeats of the last message into a count.
+ * @details Off by default, since every message is then hashed and compared
+ *          under one lock shared by all threads. A message identical to the
+ *          previous one from the same call site is dropped; "Last message
+ *          repeated N times" is output before the next different message,
+ *          every XLOG_DEDUP_REPORT_MS while it keeps repeating, and at exit.
+ *          `XLOG_DEDUP=on` enables it.
+ * @param enable Whether to collapse repeats.
+ */
+void xlog_set_dedup(xbool_t enable);
+
+/**< How often a message that keeps repeating reports its count. */
+#define XLOG_DEDUP_REPORT_MS (10000)
+
+/**
+ * @brief Entry point of the logging macros.
+ * @details Hands the call to the record hook, then formats and pipes it
+ *          if `output` is set and rate limiting and deduplication let
+ *          it through.
+ * @param logger The logger instance.
+ * @param site The call site.
+ * @param output Whether the call site level allows output.
+ * @param module The module name.
+ * @param file The full file path.
+ * @param func The function name.
+ * @param line The line number.
+ * @param lvl The log level.
+ * @param format The printf-style format string.
+ * @param ... The arguments for the format string.
+ */
+void xlog_emit(xlogger logger,
+               xlog_site_t* site,
+               xbool_t output,
+               const char* module,
+               const char* file,
+               const char* func,
+               int line,
+               xlog_lvl_e lvl,
+               const char* format,
+               ...) __attribute__((format(printf, 9, 10)));
+
 /**
  * @brief The core logging pipeline function.
  * @details This function takes a message, checks the logger's level,
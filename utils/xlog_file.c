@@ -0,0 +1,336 @@
+/**
+ * @brief xlog 文件输出
+ * @file xlog_file.c
+ * @author Oswin
+ * @date 2026-02-05
+ * @details
+ *
+ * @copyright (c) 2026 Intretech Software Development Department. All Rights Reserved.
+ */
+#define _GNU_SOURCE
+#include "xlog_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef XLOG_ENABLE_ZLIB
+#include <zlib.h>
+#endif /* XLOG_ENABLE_ZLIB */
+
+#include "os_file.h"
+#include "stb_sprintf.h"
+
+struct xlog_file_private {
+  xlog_file_options_t opt;
+  char path[PATH_MAX];
+  pthread_mutex_t lock;
+  pthread_mutex_t compress_lock; /* serialises gzip of `path.1`, taken after `lock` */
+  xbool_t compress_pending;      /* `path.1` is plain and still to be gzipped */
+  int fd;
+  size_t file_size;    /* bytes in the active file, written or buffered */
+  char* buf;
+  size_t used;
+  uint64_t oldest_ms;  /* when the first buffered line came in */
+  time_t stamp_sec;    /* second the cached stamp is for */
+  char stamp[24];      /* "YYYY-mm-dd HH:MM:SS" */
+};
+
+static uint64_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void write_all(struct xlog_file_private* f, const char* data, size_t len) {
+  while (len > 0 && f->fd >= 0) {
+    ssize_t n = write(f->fd, data, len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      /* nowhere to report it, the log itself is what failed */
+      return;
+    }
+    data += n;
+    len -= (size_t)n;
+  }
+}
+
+static void flush_locked(struct xlog_file_private* f) {
+  if (f->used == 0) return;
+
+  write_all(f, f->buf, f->used);
+  f->used = 0;
+}
+
+static int open_active(const char* path) {
+  char dir[PATH_MAX];
+  snprintf(dir, sizeof(dir), "%s", path);
+  char* slash = strrchr(dir, '/');
+  if (slash && slash != dir) {
+    *slash = '\0';
+    os_mkdir_p(dir, 0755);
+  }
+
+  return open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+}
+
+static void rotated_name(const struct xlog_file_private* f, int index, char* buf, size_t len) {
+  snprintf(buf, len, "%s.%d%s", f->path, index, f->opt.compress ? ".gz" : "");
+}
+
+#ifdef XLOG_ENABLE_ZLIB
+/**
+ * @brief Gzips `src` to `dst` and removes `src`.
+ * @return X_RET_OK on success, `src` is kept otherwise.
+ */
+static err_t compress_file(const char* src, const char* dst) {
+  int in = open(src, O_RDONLY | O_CLOEXEC);
+  if (in < 0) return X_RET_ERROR;
+
+  gzFile out = gzopen(dst, "wb6");
+  if (out == NULL) {
+    close(in);
+    return X_RET_ERROR;
+  }
+
+  char chunk[16 * 1024];
+  ssize_t n;
+  err_t err = X_RET_OK;
+  while ((n = read(in, chunk, sizeof(chunk))) > 0) {
+    if (gzwrite(out, chunk, (unsigned)n) != (int)n) {
+      err = X_RET_ERROR;
+      break;
+    }
+  }
+  if (n < 0) err = X_RET_ERROR;
+
+  close(in);
+  if (gzclose(out) != Z_OK) err = X_RET_ERROR;
+
+  if (err == X_RET_OK)
+    unlink(src);
+  else
+    unlink(dst);
+
+  return err;
+}
+#endif /* XLOG_ENABLE_ZLIB */
+
+/**
+ * @brief Gzips a plain `path.1` left by a rotation into `path.1.gz`.
+ * @note Caller holds `compress_lock`.
+ */
+static void compress_rotated(struct xlog_file_private* f) {
+#ifdef XLOG_ENABLE_ZLIB
+  char plain[PATH_MAX + 16];
+  char gz[PATH_MAX + 16];
+
+  snprintf(plain, sizeof(plain), "%s.1", f->path);
+  rotated_name(f, 1, gz, sizeof(gz));
+  if (access(plain, F_OK) == 0) compress_file(plain, gz);
+#endif /* XLOG_ENABLE_ZLIB */
+  f->compress_pending = xFALSE;
+}
+
+/**
+ * @brief Runs the gzip a rotation deferred, outside `lock` so the other
+ *        logging threads are not stalled behind it.
+ */
+static void compress_deferred(struct xlog_file_private* f) {
+  if (!f->opt.compress) return;
+
+  pthread_mutex_lock(&f->compress_lock);
+  if (f->compress_pending) compress_rotated(f);
+  pthread_mutex_unlock(&f->compress_lock);
+}
+
+/**
+ * @brief Moves the active file to `path.1` and reopens it.
+ * @return xTRUE if `path.1` still needs compress_deferred().
+ */
+static xbool_t rotate_locked(struct xlog_file_private* f) {
+  char from[PATH_MAX + 16];
+  char to[PATH_MAX + 16];
+  xbool_t pending = xFALSE;
+
+  flush_locked(f);
+  if (f->fd >= 0) {
+    fdatasync(f->fd);
+    close(f->fd);
+    f->fd = -1;
+  }
+
+  if (f->opt.max_files > 0) {
+    if (f->opt.compress) {
+      /* a plain `path.1` from the last rotation (or a crash) has to be
+       * gzipped before it is shifted; only waits if rotations outrun gzip */
+      pthread_mutex_lock(&f->compress_lock);
+      snprintf(to, sizeof(to), "%s.1", f->path);
+      if (f->compress_pending || access(to, F_OK) == 0) compress_rotated(f);
+    }
+
+    rotated_name(f, f->opt.max_files, to, sizeof(to));
+    unlink(to);
+    for (int i = f->opt.max_files - 1; i >= 1; --i) {
+      rotated_name(f, i, from, sizeof(from));
+      rotated_name(f, i + 1, to, sizeof(to));
+      rename(from, to);
+    }
+
+    snprintf(to, sizeof(to), "%s.1", f->path);
+    rename(f->path, to);
+    if (f->opt.compress) {
+      f->compress_pending = pending = xTRUE;
+      pthread_mutex_unlock(&f->compress_lock);
+    }
+  } else {
+    unlink(f->path);
+  }
+
+  f->fd = open_active(f->path);
+  f->file_size = 0;
+
+  return pending;
+}
+
+static void file_output(xlogger logger, xlog_sink sink, const xlog_message_t* const msg) {
+  xUNUSED(logger);
+  struct xlog_file_private* f = xlog_sink_ctx(sink);
+
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  const char* data = xlog_message_data(msg);
+  size_t data_len = strlen(data);
+
+  pthread_mutex_lock(&f->lock);
+
+  /* localtime_r() is not cheap, most lines share their second */
+  if (ts.tv_sec != f->stamp_sec) {
+    struct tm tm;
+    localtime_r(&ts.tv_sec, &tm);
+    strftime(f->stamp, sizeof(f->stamp), "%Y-%m-%d %H:%M:%S", &tm);
+    f->stamp_sec = ts.tv_sec;
+  }
+
+  char head[128];
+  int head_len = stbsp_snprintf(head, sizeof(head), "%s.%03ld %c [%s] %s:%d ",
+                                f->stamp, ts.tv_nsec / 1000000, xlog_lvl_char(msg->lvl),
+                                msg->module ? msg->module : "", xlog_message_file(msg),
+                                xlog_message_line(msg));
+  if (head_len >= (int)sizeof(head)) head_len = sizeof(head) - 1;
+  size_t line_len = (size_t)head_len + data_len + 1;
+
+  xbool_t rotated = xFALSE;
+  if (f->opt.max_size && f->file_size > 0 && f->file_size + line_len > f->opt.max_size)
+    rotated = rotate_locked(f);
+
+  if (f->used + line_len > f->opt.buffer_size) flush_locked(f);
+
+  if (line_len > f->opt.buffer_size) {
+    /* does not fit any buffer, straight out */
+    write_all(f, head, (size_t)head_len);
+    write_all(f, data, data_len);
+    write_all(f, "\n", 1);
+  } else {
+    if (f->used == 0) f->oldest_ms = now_ms();
+    memcpy(f->buf + f->used, head, (size_t)head_len);
+    memcpy(f->buf + f->used + head_len, data, data_len);
+    f->buf[f->used + line_len - 1] = '\n';
+    f->used += line_len;
+
+    if (f->opt.max_delay_ms > 0 && now_ms() - f->oldest_ms >= (uint64_t)f->opt.max_delay_ms)
+      flush_locked(f);
+  }
+  f->file_size += line_len;
+
+  pthread_mutex_unlock(&f->lock);
+
+  if (rotated) compress_deferred(f);
+}
+
+static void file_flush(xlogger logger, xlog_sink sink) {
+  xUNUSED(logger);
+  struct xlog_file_private* f = xlog_sink_ctx(sink);
+
+  pthread_mutex_lock(&f->lock);
+  flush_locked(f);
+  if (f->opt.sync && f->fd >= 0) fdatasync(f->fd);
+  pthread_mutex_unlock(&f->lock);
+}
+
+static void file_destroy(xlog_sink sink) {
+  struct xlog_file_private* f = xlog_sink_ctx(sink);
+  if (f == NULL) return;
+
+  flush_locked(f);
+  if (f->fd >= 0) close(f->fd);
+  compress_deferred(f);
+  pthread_mutex_destroy(&f->compress_lock);
+  pthread_mutex_destroy(&f->lock);
+  xbox_free(f->buf);
+  xbox_free(f);
+}
+
+xlog_file_options_t xlog_file_options_init(const char* path) {
+  xlog_file_options_t opt = {
+      .path = path,
+      .buffer_size = XLOG_FILE_DEFAULT_BUFFER,
+      .max_size = XLOG_FILE_DEFAULT_MAX_SIZE,
+      .max_files = XLOG_FILE_DEFAULT_MAX_FILES,
+      .compress = xFALSE,
+      .sync = xFALSE,
+      .max_delay_ms = 0,
+  };
+
+  return opt;
+}
+
+xlog_sink xlog_file_sink_new(const xlog_file_options_t* opt) {
+  if (opt == NULL || opt->path == NULL || *opt->path == '\0') return NULL;
+
+  struct xlog_file_private* f = xbox_calloc(1, sizeof(*f));
+  if (f == NULL) return NULL;
+
+  f->opt = *opt;
+  snprintf(f->path, sizeof(f->path), "%s", opt->path);
+  f->opt.path = f->path;
+#ifndef XLOG_ENABLE_ZLIB
+  /* rotated files stay plain */
+  f->opt.compress = xFALSE;
+#endif /* XLOG_ENABLE_ZLIB */
+  if (f->opt.max_files < 0) f->opt.max_files = 0;
+  f->stamp_sec = (time_t)-1;
+
+  f->buf = f->opt.buffer_size ? xbox_malloc(f->opt.buffer_size) : NULL;
+  f->fd = open_active(f->path);
+  if ((f->opt.buffer_size && f->buf == NULL) || f->fd < 0) goto failed;
+
+  struct stat st;
+  if (fstat(f->fd, &st) == 0) f->file_size = (size_t)st.st_size;
+
+  pthread_mutex_init(&f->lock, NULL);
+  pthread_mutex_init(&f->compress_lock, NULL);
+
+  xlog_sink sink = xlog_sink_new_with_destory(f, file_output, file_flush, file_destroy);
+  if (sink == NULL) {
+    pthread_mutex_destroy(&f->compress_lock);
+    pthread_mutex_destroy(&f->lock);
+    goto failed;
+  }
+
+  return sink;
+
+failed:
+  if (f->fd >= 0) close(f->fd);
+  xbox_free(f->buf);
+  xbox_free(f);
+  return NULL;
+}
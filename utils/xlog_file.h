@@ -0,0 +1,74 @@
+/**
+ * @brief xlog 文件输出
+ * @file xlog_file.h
+ * @author Oswin
+ * @date 2026-02-05
+ * @details A buffered, rotating file sink for xlog. Lines are collected in a
+ *          userspace buffer and written out when it fills, when a message
+ *          at or above the logger's `which_flush` level arrives, when the
+ *          oldest buffered line gets older than `max_delay_ms`, or on
+ *          xlog_logger_flush(). Once the file would grow past `max_size` it
+ *          is rotated to `path.1` (`path.1.gz` when compressed), keeping
+ *          `max_files` of them. The gzip runs after the sink lock is
+ *          released, so only the rotating thread pays for it.
+ *
+ *          e.g.
+ *          xlog_file_options_t opt = xlog_file_options_init("/var/log/iota.log");
+ *          opt.compress = xTRUE;
+ *          xlog_logger_append_sink(xlog_global_instance(), xlog_file_sink_new(&opt));
+ *          xlog_global_set_flush_lvl(XLOG_LVL_WARN);
+ *
+ * @copyright (c) 2026 Intretech Software Development Department. All Rights Reserved.
+ */
+#ifndef XTOOL_XLOG_FILE__H_
+#define XTOOL_XLOG_FILE__H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "xlog.h"
+
+/**< Default size of the userspace write buffer. */
+#define XLOG_FILE_DEFAULT_BUFFER (64 * 1024)
+
+/**< Default size a file is rotated at. */
+#define XLOG_FILE_DEFAULT_MAX_SIZE (1024 * 1024)
+
+/**< Default number of rotated files kept. */
+#define XLOG_FILE_DEFAULT_MAX_FILES (5)
+
+/**
+ * @brief Options of a file sink.
+ */
+// clang-format off
+typedef struct {
+  const char* path;     /**< The active file, its directory is created if needed. */
+  size_t buffer_size;   /**< Bytes buffered before a write, 0 writes every line. */
+  size_t max_size;      /**< Rotate before the file exceeds this, 0 never rotates. */
+  int max_files;        /**< Rotated files kept besides the active one. */
+  xbool_t compress;     /**< Gzip rotated files, needs XLOG_ENABLE_ZLIB. */
+  xbool_t sync;         /**< fdatasync() on level flushes, so they survive power loss. */
+  int max_delay_ms;     /**< Write out lines buffered longer than this, 0 to wait. */
+} xlog_file_options_t;
+// clang-format on
+
+/**
+ * @brief Gets the default options for a file sink.
+ * @param path The active file.
+ * @return The options.
+ */
+xlog_file_options_t xlog_file_options_init(const char* path);
+
+/**
+ * @brief Creates a file sink; the file is opened for appending.
+ * @details The sink owns its context, xlog_sink_del() or destroying the
+ *          logger writes out what is buffered and closes the file.
+ * @param opt The options, copied.
+ * @return The sink, or NULL if the file can not be opened.
+ */
+xlog_sink xlog_file_sink_new(const xlog_file_options_t* opt);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* XTOOL_XLOG_FILE__H_ */
@@ -0,0 +1,370 @@
+/**
+ * @brief xlog systemd-journald 输出
+ * @file xlog_journal.c
+ * @author Oswin
+ * @date 2026-02-06
+ * @details Native protocol: one datagram per entry, each field is either
+ *          "NAME=value\n", or "NAME\n" + 64-bit little endian length +
+ *          value + "\n" when the value holds a newline.
+ *
+ * @copyright (c) 2026 Intretech Software Development Department. All Rights Reserved.
+ */
+#define _GNU_SOURCE
+#include "xlog_journal.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FIELD_NAME_MAX 64
+#define FIELD_VALUE_MAX 256
+
+struct journal_entry {
+  size_t used;
+  char data[XLOG_JOURNAL_ENTRY_MAX];
+};
+
+struct xlog_journal_private {
+  xlog_journal_options_t opt;
+  char identifier[64];
+  struct sockaddr_un addr;
+  socklen_t addr_len;
+  pthread_mutex_t lock;
+  pthread_cond_t wakeup;  /* the first entry of a batch came in, or stop */
+  pthread_t flusher;      /* sends a batch `max_delay_ms` old, if set */
+  xbool_t flusher_started;
+  xbool_t stop;
+  int fd;
+  struct journal_entry* entries;
+  int pending;
+  uint64_t oldest_ms;    /* when the first pending entry came in */
+  size_t dropped;        /* entries the journal did not take */
+};
+
+/* Fields attached to every entry, shared by all journal sinks */
+static struct {
+  pthread_mutex_t lock;
+  int count;
+  struct {
+    char name[FIELD_NAME_MAX + 1];
+    char value[FIELD_VALUE_MAX];
+  } fields[XLOG_JOURNAL_MAX_FIELDS];
+} g_journal_fields = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static uint64_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static xbool_t valid_field_name(const char* name) {
+  size_t len = strlen(name);
+  if (len == 0 || len > FIELD_NAME_MAX || name[0] == '_' || (name[0] >= '0' && name[0] <= '9'))
+    return xFALSE;
+
+  for (const char* p = name; *p; ++p) {
+    if (!((*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') || *p == '_')) return xFALSE;
+  }
+
+  return xTRUE;
+}
+
+err_t xlog_journal_set_field(const char* name, const char* value) {
+  if (name == NULL || !valid_field_name(name)) return X_RET_INVAL;
+
+  pthread_mutex_lock(&g_journal_fields.lock);
+
+  int at = 0;
+  while (at < g_journal_fields.count && strcmp(g_journal_fields.fields[at].name, name)) at++;
+
+  err_t err = X_RET_OK;
+  if (value == NULL) {
+    if (at < g_journal_fields.count) {
+      g_journal_fields.fields[at] = g_journal_fields.fields[g_journal_fields.count - 1];
+      g_journal_fields.count--;
+    }
+  } else if (at == g_journal_fields.count && at == XLOG_JOURNAL_MAX_FIELDS) {
+    err = X_RET_FULL;
+  } else {
+    if (at == g_journal_fields.count) g_journal_fields.count++;
+    snprintf(g_journal_fields.fields[at].name, sizeof(g_journal_fields.fields[at].name), "%s", name);
+    snprintf(g_journal_fields.fields[at].value, sizeof(g_journal_fields.fields[at].value), "%s", value);
+  }
+
+  pthread_mutex_unlock(&g_journal_fields.lock);
+  return err;
+}
+
+/**
+ * @brief Appends a field to the entry, cut short if the entry is full.
+ */
+static void put_field(struct journal_entry* e, const char* name, const char* value, size_t len) {
+  size_t name_len = strlen(name);
+  size_t room = sizeof(e->data) - e->used;
+
+  if (memchr(value, '\n', len) == NULL) {
+    if (name_len + 2 > room) return;
+    if (len > room - name_len - 2) len = room - name_len - 2;
+
+    memcpy(e->data + e->used, name, name_len);
+    e->data[e->used + name_len] = '=';
+    memcpy(e->data + e->used + name_len + 1, value, len);
+    e->data[e->used + name_len + 1 + len] = '\n';
+    e->used += name_len + 2 + len;
+    return;
+  }
+
+  if (name_len + 10 > room) return;
+  if (len > room - name_len - 10) len = room - name_len - 10;
+
+  char* p = e->data + e->used;
+  memcpy(p, name, name_len);
+  p[name_len] = '\n';
+  for (int i = 0; i < 8; ++i) p[name_len + 1 + i] = (char)((uint64_t)len >> (i * 8));
+  memcpy(p + name_len + 9, value, len);
+  p[name_len + 9 + len] = '\n';
+  e->used += name_len + 10 + len;
+}
+
+static void put_field_str(struct journal_entry* e, const char* name, const char* value) {
+  put_field(e, name, value, strlen(value));
+}
+
+static void send_locked(struct xlog_journal_private* j) {
+  if (j->pending == 0) return;
+
+  if (j->fd < 0) {
+    /* a stalled journal drops entries rather than blocking the caller */
+    j->fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (j->fd >= 0 && connect(j->fd, (struct sockaddr*)&j->addr, j->addr_len) != 0) {
+      close(j->fd);
+      j->fd = -1;
+    }
+  }
+
+  struct mmsghdr msgs[j->pending];
+  struct iovec iov[j->pending];
+  memset(msgs, 0, sizeof(msgs));
+  for (int i = 0; i < j->pending; ++i) {
+    iov[i].iov_base = j->entries[i].data;
+    iov[i].iov_len = j->entries[i].used;
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  int sent = 0;
+  while (j->fd >= 0 && sent < j->pending) {
+    int n = sendmmsg(j->fd, msgs + sent, (unsigned)(j->pending - sent), MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno != EAGAIN && errno != ENOBUFS) {
+        /* journald restarted, reconnect next time */
+        close(j->fd);
+        j->fd = -1;
+      }
+      break;
+    }
+    sent += n;
+  }
+
+  j->dropped += (size_t)(j->pending - sent);
+  j->pending = 0;
+}
+
+static int syslog_priority(xlog_lvl_e lvl) {
+  switch (lvl) {
+    case XLOG_LVL_FATAL:
+      return 2; /* LOG_CRIT */
+    case XLOG_LVL_ERROR:
+      return 3; /* LOG_ERR */
+    case XLOG_LVL_WARN:
+      return 4; /* LOG_WARNING */
+    case XLOG_LVL_INFO:
+      return 6; /* LOG_INFO */
+    default:
+      return 7; /* LOG_DEBUG */
+  }
+}
+
+static void journal_output(xlogger logger, xlog_sink sink, const xlog_message_t* const msg) {
+  xUNUSED(logger);
+  struct xlog_journal_private* j = xlog_sink_ctx(sink);
+  char number[16];
+
+  pthread_mutex_lock(&j->lock);
+
+  if (j->dropped > 0 && j->pending == 0 && j->fd >= 0) {
+    /* let the journal know about the gap, as an entry of its own */
+    struct journal_entry* e = &j->entries[j->pending++];
+    char text[64];
+    e->used = 0;
+    snprintf(text, sizeof(text), "%zu journal entries dropped", j->dropped);
+    put_field_str(e, "MESSAGE", text);
+    put_field_str(e, "PRIORITY", "4");
+    put_field_str(e, "SYSLOG_IDENTIFIER", j->identifier);
+    j->dropped = 0;
+    if (j->pending >= j->opt.batch) send_locked(j);
+  }
+
+  if (j->pending == 0) {
+    j->oldest_ms = now_ms();
+    if (j->flusher_started) pthread_cond_signal(&j->wakeup);
+  }
+
+  struct journal_entry* e = &j->entries[j->pending++];
+  e->used = 0;
+
+  snprintf(number, sizeof(number), "%d", syslog_priority(msg->lvl));
+  put_field_str(e, "PRIORITY", number);
+  put_field_str(e, "SYSLOG_IDENTIFIER", j->identifier);
+  if (msg->full_file_name) put_field_str(e, "CODE_FILE", msg->full_file_name);
+  snprintf(number, sizeof(number), "%d", msg->line);
+  put_field_str(e, "CODE_LINE", number);
+  if (msg->func) put_field_str(e, "CODE_FUNC", msg->func);
+  if (msg->module && *msg->module) put_field_str(e, "XLOG_MODULE", msg->module);
+  put_field_str(e, "XLOG_LEVEL", xlog_lvl_full_str(msg->lvl));
+
+  pthread_mutex_lock(&g_journal_fields.lock);
+  for (int i = 0; i < g_journal_fields.count; ++i)
+    put_field_str(e, g_journal_fields.fields[i].name, g_journal_fields.fields[i].value);
+  pthread_mutex_unlock(&g_journal_fields.lock);
+
+  /* last, a long message is cut rather than the fields */
+  const char* data = xlog_message_data(msg);
+  put_field(e, "MESSAGE", data, strlen(data));
+
+  if (j->pending >= j->opt.batch ||
+      (j->opt.max_delay_ms > 0 && now_ms() - j->oldest_ms >= (uint64_t)j->opt.max_delay_ms))
+    send_locked(j);
+
+  pthread_mutex_unlock(&j->lock);
+}
+
+/**
+ * @brief Sends a batch once its oldest entry waited `max_delay_ms`, so an
+ *        idle process does not hold entries back until the next one.
+ */
+static void* journal_flusher(void* arg) {
+  struct xlog_journal_private* j = arg;
+
+  pthread_mutex_lock(&j->lock);
+  while (!j->stop) {
+    if (j->pending == 0) {
+      pthread_cond_wait(&j->wakeup, &j->lock);
+      continue;
+    }
+
+    uint64_t due = j->oldest_ms + (uint64_t)j->opt.max_delay_ms;
+    if (now_ms() >= due) {
+      send_locked(j);
+      continue;
+    }
+
+    struct timespec ts = {.tv_sec = (time_t)(due / 1000), .tv_nsec = (long)(due % 1000) * 1000000};
+    pthread_cond_timedwait(&j->wakeup, &j->lock, &ts);
+  }
+  pthread_mutex_unlock(&j->lock);
+
+  return NULL;
+}
+
+static void journal_flush(xlogger logger, xlog_sink sink) {
+  xUNUSED(logger);
+  struct xlog_journal_private* j = xlog_sink_ctx(sink);
+
+  pthread_mutex_lock(&j->lock);
+  send_locked(j);
+  pthread_mutex_unlock(&j->lock);
+}
+
+static void journal_destroy(xlog_sink sink) {
+  struct xlog_journal_private* j = xlog_sink_ctx(sink);
+  if (j == NULL) return;
+
+  if (j->flusher_started) {
+    pthread_mutex_lock(&j->lock);
+    j->stop = xTRUE;
+    pthread_cond_signal(&j->wakeup);
+    pthread_mutex_unlock(&j->lock);
+    pthread_join(j->flusher, NULL);
+  }
+
+  send_locked(j);
+  if (j->fd >= 0) close(j->fd);
+  pthread_cond_destroy(&j->wakeup);
+  pthread_mutex_destroy(&j->lock);
+  xbox_free(j->entries);
+  xbox_free(j);
+}
+
+xlog_journal_options_t xlog_journal_options_init(const char* identifier) {
+  xlog_journal_options_t opt = {
+      .socket_path = NULL,
+      .identifier = identifier,
+      .batch = XLOG_JOURNAL_DEFAULT_BATCH,
+      .max_delay_ms = 1000,
+  };
+
+  return opt;
+}
+
+xlog_sink xlog_journal_sink_new(const xlog_journal_options_t* opt) {
+  if (opt == NULL) return NULL;
+
+  const char* path = opt->socket_path;
+  if (path == NULL) path = getenv("XLOG_JOURNAL_SOCKET");
+  if (path == NULL || *path == '\0') path = XLOG_JOURNAL_SOCKET;
+  if (strlen(path) >= sizeof(((struct sockaddr_un*)0)->sun_path)) return NULL;
+
+  struct xlog_journal_private* j = xbox_calloc(1, sizeof(*j));
+  if (j == NULL) return NULL;
+
+  j->opt = *opt;
+  if (j->opt.batch < 1) j->opt.batch = 1;
+  snprintf(j->identifier, sizeof(j->identifier), "%s", opt->identifier ? opt->identifier : "xlog");
+  j->opt.identifier = j->identifier;
+  j->opt.socket_path = NULL;
+
+  j->addr.sun_family = AF_UNIX;
+  snprintf(j->addr.sun_path, sizeof(j->addr.sun_path), "%s", path);
+  j->addr_len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + strlen(path) + 1);
+  j->fd = -1;
+
+  j->entries = xbox_malloc(sizeof(struct journal_entry) * (size_t)j->opt.batch);
+  if (j->entries == NULL) {
+    xbox_free(j);
+    return NULL;
+  }
+
+  pthread_mutex_init(&j->lock, NULL);
+  /* the deadline is CLOCK_MONOTONIC, like oldest_ms */
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&j->wakeup, &attr);
+  pthread_condattr_destroy(&attr);
+
+  xlog_sink sink = xlog_sink_new_with_destory(j, journal_output, journal_flush, journal_destroy);
+  if (sink == NULL) {
+    pthread_cond_destroy(&j->wakeup);
+    pthread_mutex_destroy(&j->lock);
+    xbox_free(j->entries);
+    xbox_free(j);
+    return NULL;
+  }
+
+  /* without it entries still go out with the next one, only later */
+  if (j->opt.max_delay_ms > 0 && j->opt.batch > 1)
+    j->flusher_started = pthread_create(&j->flusher, NULL, journal_flusher, j) == 0;
+
+  return sink;
+}
@@ -0,0 +1,88 @@
+/**
+ * @brief xlog systemd-journald 输出
+ * @file xlog_journal.h
+ * @author Oswin
+ * @date 2026-02-06
+ * @details A sink speaking journald's native protocol on its datagram
+ *          socket, so entries keep their structure instead of going through
+ *          a stderr pipe. Each entry carries MESSAGE, PRIORITY,
+ *          SYSLOG_IDENTIFIER, CODE_FILE, CODE_LINE, CODE_FUNC, XLOG_MODULE,
+ *          XLOG_LEVEL and the fields set with xlog_journal_set_field().
+ *          Entries are batched and sent with one sendmmsg(2), when the
+ *          batch is full, on a flush (the logger's `which_flush` level and
+ *          exit) or, from a thread of the sink's own, once the oldest entry
+ *          waited `max_delay_ms`. The socket is non-blocking, entries a
+ *          stalled journal does not take are dropped and counted.
+ *
+ *          `XLOG_JOURNAL_SOCKET` in the environment replaces the socket
+ *          path, e.g. with a stand-in bound by a test.
+ *
+ *          e.g.
+ *          xlog_journal_options_t opt = xlog_journal_options_init("iota-cli");
+ *          xlog_logger_append_sink(xlog_global_instance(), xlog_journal_sink_new(&opt));
+ *          xlog_journal_set_field("IOTA_STAGE", "install");
+ *          journalctl IOTA_STAGE=install -o verbose
+ *
+ * @copyright (c) 2026 Intretech Software Development Department. All Rights Reserved.
+ */
+#ifndef XTOOL_XLOG_JOURNAL__H_
+#define XTOOL_XLOG_JOURNAL__H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "xlog.h"
+
+/**< journald's native protocol socket. */
+#define XLOG_JOURNAL_SOCKET "/run/systemd/journal/socket"
+
+/**< Default number of entries sent at once. */
+#define XLOG_JOURNAL_DEFAULT_BATCH (16)
+
+/**< Upper bound of one entry, longer messages are cut. */
+#define XLOG_JOURNAL_ENTRY_MAX (4096)
+
+/**< Fields xlog_journal_set_field() can hold at once. */
+#define XLOG_JOURNAL_MAX_FIELDS (8)
+
+/**
+ * @brief Options of a journal sink.
+ */
+// clang-format off
+typedef struct {
+  const char* socket_path; /**< NULL for `XLOG_JOURNAL_SOCKET` or the default. */
+  const char* identifier;  /**< SYSLOG_IDENTIFIER of the entries. */
+  int batch;               /**< Entries sent at once, 1 sends every entry. */
+  int max_delay_ms;        /**< Send entries waiting longer than this, 0 to wait. */
+} xlog_journal_options_t;
+// clang-format on
+
+/**
+ * @brief Gets the default options for a journal sink.
+ * @param identifier The SYSLOG_IDENTIFIER of the entries.
+ * @return The options.
+ */
+xlog_journal_options_t xlog_journal_options_init(const char* identifier);
+
+/**
+ * @brief Creates a journal sink.
+ * @details A missing journal is not an error, entries are dropped until
+ *          the socket can be reached.
+ * @param opt The options, copied.
+ * @return The sink, or NULL on failure.
+ */
+xlog_sink xlog_journal_sink_new(const xlog_journal_options_t* opt);
+
+/**
+ * @brief Attaches a field to every entry logged from now on.
+ * @param name The field name, upper case letters, digits and '_'.
+ * @param value The value, NULL to remove the field.
+ * @return X_RET_OK on success, X_RET_INVAL for a bad name, X_RET_FULL
+ *         when XLOG_JOURNAL_MAX_FIELDS are set.
+ */
+err_t xlog_journal_set_field(const char* name, const char* value);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* XTOOL_XLOG_JOURNAL__H_ */
@@ -0,0 +1,838 @@
+/**
+ * @brief xlog 飞行记录仪
+ * @file xlog_recorder.c
+ * @author Oswin
+ * @date 2026-02-04
+ * @details File layout: a header page, then a ring of blocks. A block holds
+ *          whole records and carries the sequence number it was started
+ *          with, so the decoder orders blocks by sequence and never has to
+ *          find a record boundary in the middle of a block. Writers from any
+ *          process serialize on a robust mutex kept in the header page; it
+ *          is initialized again by the first opener after a reboot, a
+ *          holder lost with the power never comes back to release it.
+ *
+ * @copyright (c) 2026 Intretech Software Development Department. All Rights Reserved.
+ */
+#define _GNU_SOURCE
+#include "xlog_recorder.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "os_file.h"
+
+#define RECORDER_MAGIC 0x43455258u /* "XREC" */
+#define RECORDER_VERSION 1
+#define RECORDER_HEADER_SIZE 4096
+
+#define RECORD_SESSION 0x01    /* process start, args are pid and image id */
+#define RECORD_FMT_INLINE 0x02 /* the format is copied, not referenced */
+#define RECORD_TRUNCATED 0x04  /* some arguments did not fit */
+
+/* argument tags, each followed by 8 bytes or a string */
+#define ARG_INT 'i'
+#define ARG_UINT 'u'
+#define ARG_CHAR 'c'
+#define ARG_DOUBLE 'f'
+#define ARG_STR 's'
+#define ARG_PTR 'p'
+
+#define ARG_STR_MAX 255
+
+struct recorder_header {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t header_size;
+  uint32_t block_size;
+  uint32_t block_count;
+  uint64_t seq;          /* sequence of the newest block */
+  uint32_t current;      /* index of the newest block */
+  uint32_t reserved;
+  pthread_mutex_t lock;  /* process shared and robust */
+  char boot_id[40];      /* boot the lock was initialized in */
+};
+
+struct block_header {
+  uint64_t seq;  /* 0 while unused or being recycled */
+  uint32_t used; /* bytes of complete records after this header */
+  uint32_t reserved;
+};
+
+struct record_header {
+  uint16_t size;  /* whole record */
+  uint8_t lvl;
+  uint8_t flags;
+  uint32_t line;
+  uint64_t ts_ns; /* CLOCK_REALTIME */
+  uint32_t pid;
+  uint32_t tid;
+  uint32_t image; /* hash of the image id, formats resolve only in that image */
+  uint32_t fmt;   /* offset from the image start, unless RECORD_FMT_INLINE */
+};
+
+static struct {
+  pthread_mutex_t open_lock;
+  char path[PATH_MAX];
+  size_t size;
+  char image_id[64];
+  uint32_t image;
+  uint32_t pid;
+  struct recorder_header* _Atomic map;
+} g_recorder = {
+    .open_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static __thread uint32_t t_tid;
+
+#if defined(__linux__)
+/* provided by the linker, the format strings sit in between */
+extern const char __executable_start[];
+extern const char _edata[];
+#define IMAGE_BEGIN ((uintptr_t)__executable_start)
+#define IMAGE_END ((uintptr_t)_edata)
+#else
+#define IMAGE_BEGIN ((uintptr_t)0)
+#define IMAGE_END ((uintptr_t)0)
+#endif /* __linux__ */
+
+static uint32_t image_hash(const char* id) {
+  /* FNV-1a over the id and the image span */
+  uint32_t h = 2166136261u;
+  for (const char* p = id; *p; ++p) h = (h ^ (uint8_t)*p) * 16777619u;
+
+  uint64_t span = IMAGE_END - IMAGE_BEGIN;
+  for (int i = 0; i < 8; ++i) h = (h ^ (uint8_t)(span >> (i * 8))) * 16777619u;
+
+  return h;
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* ---- format parsing, shared by capture and decode ---- */
+
+typedef struct {
+  const char* begin; /* the '%' */
+  const char* end;   /* past the conversion character */
+  char flags[8];
+  int width;         /* -1 none, -2 taken from the arguments */
+  int prec;          /* -1 none, -2 taken from the arguments */
+  char length[3];
+  char conv;
+} conv_spec_t;
+
+/**
+ * @brief Finds the next conversion in `fmt`.
+ * @param fmt Where to start looking.
+ * @param c Receives the conversion.
+ * @return Where to continue, or NULL if there is no conversion left.
+ */
+static const char* next_conv(const char* fmt, conv_spec_t* c) {
+  const char* p = strchr(fmt, '%');
+  if (p == NULL) return NULL;
+
+  memset(c, 0, sizeof(*c));
+  c->begin = p++;
+  c->width = c->prec = -1;
+
+  size_t nflags = 0;
+  while (*p && strchr("-+ #0'", *p)) {
+    if (nflags < sizeof(c->flags) - 1) c->flags[nflags++] = *p;
+    p++;
+  }
+
+  if (*p == '*') {
+    c->width = -2;
+    p++;
+  } else if (*p >= '0' && *p <= '9') {
+    for (c->width = 0; *p >= '0' && *p <= '9'; ++p) c->width = c->width * 10 + (*p - '0');
+  }
+
+  if (*p == '.') {
+    p++;
+    if (*p == '*') {
+      c->prec = -2;
+      p++;
+    } else {
+      for (c->prec = 0; *p >= '0' && *p <= '9'; ++p) c->prec = c->prec * 10 + (*p - '0');
+    }
+  }
+
+  if (*p == 'h' || *p == 'l') {
+    c->length[0] = *p++;
+    if (*p == c->length[0]) c->length[1] = *p++;
+  } else if (*p && strchr("jztLq", *p)) {
+    c->length[0] = *p++;
+  }
+
+  c->conv = *p;
+  c->end = *p ? p + 1 : p;
+  return c->end;
+}
+
+/* The tag an argument of this conversion is stored with, 0 if none */
+static char conv_tag(const conv_spec_t* c) {
+  switch (c->conv) {
+    case 'd': case 'i':
+      return ARG_INT;
+    case 'u': case 'o': case 'x': case 'X':
+      return ARG_UINT;
+    case 'c':
+      return ARG_CHAR;
+    case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+      return ARG_DOUBLE;
+    case 's':
+      return ARG_STR;
+    case 'p':
+      return ARG_PTR;
+    default:
+      return 0;
+  }
+}
+
+/* ---- capture ---- */
+
+typedef struct {
+  uint8_t* buf;
+  size_t used;
+  size_t cap;
+  xbool_t truncated;
+} record_buf_t;
+
+static xbool_t put(record_buf_t* r, const void* data, size_t len) {
+  if (r->truncated || r->used + len > r->cap) {
+    r->truncated = xTRUE;
+    return xFALSE;
+  }
+
+  memcpy(r->buf + r->used, data, len);
+  r->used += len;
+  return xTRUE;
+}
+
+static void put_u64(record_buf_t* r, char tag, uint64_t v) {
+  if (r->used + 1 + sizeof(v) > r->cap) {
+    r->truncated = xTRUE;
+    return;
+  }
+
+  put(r, &tag, 1);
+  put(r, &v, sizeof(v));
+}
+
+static void put_str(record_buf_t* r, char tag, const char* s, size_t max) {
+  size_t len = strnlen(s, max);
+  if (r->truncated || r->used + 2 > r->cap) {
+    r->truncated = xTRUE;
+    return;
+  }
+
+  /* shorten rather than drop a string that almost fits */
+  if (r->used + 2 + len > r->cap) {
+    len = r->cap - r->used - 2;
+    r->truncated = xTRUE;
+  }
+
+  uint8_t n = (uint8_t)len;
+  r->buf[r->used++] = (uint8_t)tag;
+  r->buf[r->used++] = n;
+  memcpy(r->buf + r->used, s, len);
+  r->used += len;
+}
+
+static int64_t take_signed(const char* length, va_list* ap) {
+  if (!strcmp(length, "hh")) return (signed char)va_arg(*ap, int);
+  if (!strcmp(length, "h")) return (short)va_arg(*ap, int);
+  if (!strcmp(length, "l")) return va_arg(*ap, long);
+  if (!strcmp(length, "ll") || !strcmp(length, "q")) return va_arg(*ap, long long);
+  if (!strcmp(length, "j")) return va_arg(*ap, intmax_t);
+  if (!strcmp(length, "z")) return (ssize_t)va_arg(*ap, size_t);
+  if (!strcmp(length, "t")) return va_arg(*ap, ptrdiff_t);
+  return va_arg(*ap, int);
+}
+
+static uint64_t take_unsigned(const char* length, va_list* ap) {
+  if (!strcmp(length, "hh")) return (unsigned char)va_arg(*ap, unsigned int);
+  if (!strcmp(length, "h")) return (unsigned short)va_arg(*ap, unsigned int);
+  if (!strcmp(length, "l")) return va_arg(*ap, unsigned long);
+  if (!strcmp(length, "ll") || !strcmp(length, "q")) return va_arg(*ap, unsigned long long);
+  if (!strcmp(length, "j")) return va_arg(*ap, uintmax_t);
+  if (!strcmp(length, "z")) return va_arg(*ap, size_t);
+  if (!strcmp(length, "t")) return (uint64_t)va_arg(*ap, ptrdiff_t);
+  return va_arg(*ap, unsigned int);
+}
+
+/**
+ * @brief Stores the arguments `fmt` consumes, tagged, without formatting.
+ */
+static void capture_args(record_buf_t* r, const char* fmt, va_list ap) {
+  va_list args;
+  va_copy(args, ap);
+
+  conv_spec_t c;
+  for (const char* p = fmt; !r->truncated && (p = next_conv(p, &c)) != NULL;) {
+    if (c.width == -2) put_u64(r, ARG_INT, (uint64_t)(int64_t)va_arg(args, int));
+    /* a precision bounds how much of a %s is read, the rest may not be ours */
+    int prec = c.prec;
+    if (c.prec == -2) {
+      prec = va_arg(args, int);
+      put_u64(r, ARG_INT, (uint64_t)(int64_t)prec);
+    }
+
+    switch (conv_tag(&c)) {
+      case ARG_INT:
+        put_u64(r, ARG_INT, (uint64_t)take_signed(c.length, &args));
+        break;
+      case ARG_UINT:
+        put_u64(r, ARG_UINT, take_unsigned(c.length, &args));
+        break;
+      case ARG_CHAR:
+        put_u64(r, ARG_CHAR, (uint64_t)va_arg(args, int));
+        break;
+      case ARG_DOUBLE: {
+        double d = c.length[0] == 'L' ? (double)va_arg(args, long double) : va_arg(args, double);
+        uint64_t bits;
+        memcpy(&bits, &d, sizeof(bits));
+        put_u64(r, ARG_DOUBLE, bits);
+        break;
+      }
+      case ARG_STR: {
+        const char* s = va_arg(args, const char*);
+        /* wide strings are not worth the trouble */
+        size_t max = prec >= 0 ? xMIN((size_t)prec, (size_t)ARG_STR_MAX) : ARG_STR_MAX;
+        put_str(r, ARG_STR, c.length[0] == 'l' ? "(wide)" : (s ? s : "(null)"), max);
+        break;
+      }
+      case ARG_PTR:
+        put_u64(r, ARG_PTR, (uint64_t)(uintptr_t)va_arg(args, void*));
+        break;
+      default:
+        if (c.conv == 'n') {
+          (void)va_arg(args, void*);
+        } else if (c.conv != '%' && c.conv != 'm') {
+          /* unknown conversion, the argument layout is lost from here */
+          r->truncated = xTRUE;
+        }
+        break;
+    }
+
+    if (c.conv == '\0') break;
+  }
+
+  va_end(args);
+}
+
+/* ---- file ---- */
+
+static uint8_t* block_at(struct recorder_header* h, uint32_t index) {
+  return (uint8_t*)h + h->header_size + (size_t)index * h->block_size;
+}
+
+static void shared_lock(struct recorder_header* h) {
+  /* the previous owner died mid-record, its record was never committed */
+  if (pthread_mutex_lock(&h->lock) == EOWNERDEAD) pthread_mutex_consistent(&h->lock);
+}
+
+static void append(struct recorder_header* h, const uint8_t* rec, size_t len) {
+  shared_lock(h);
+
+  struct block_header* b = (struct block_header*)block_at(h, h->current);
+  size_t room = h->block_size - sizeof(*b);
+  if (h->seq == 0 || b->used + len > room) {
+    h->current = h->seq == 0 ? 0 : (h->current + 1) % h->block_count;
+    b = (struct block_header*)block_at(h, h->current);
+    b->seq = 0;
+    b->used = 0;
+    __atomic_store_n(&b->seq, ++h->seq, __ATOMIC_RELEASE);
+  }
+
+  memcpy((uint8_t*)(b + 1) + b->used, rec, len);
+  /* committed only once the record is complete */
+  __atomic_store_n(&b->used, b->used + (uint32_t)len, __ATOMIC_RELEASE);
+
+  pthread_mutex_unlock(&h->lock);
+}
+
+/* The kernel's id for this boot, empty where there is none */
+static void read_boot_id(char* buf, size_t len) {
+  buf[0] = '\0';
+  int fd = open("/proc/sys/kernel/random/boot_id", O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return;
+
+  ssize_t n = read(fd, buf, len - 1);
+  close(fd);
+  buf[n > 0 ? n : 0] = '\0';
+  buf[strcspn(buf, "\n")] = '\0';
+}
+
+static void init_lock(struct recorder_header* h, const char* boot_id) {
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&h->lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+
+  snprintf(h->boot_id, sizeof(h->boot_id), "%s", boot_id);
+}
+
+static void init_header(struct recorder_header* h, size_t size, const char* boot_id) {
+  memset(h, 0, RECORDER_HEADER_SIZE);
+  h->version = RECORDER_VERSION;
+  h->header_size = RECORDER_HEADER_SIZE;
+  h->block_size = XLOG_RECORDER_BLOCK_SIZE;
+  h->block_count = (uint32_t)((size - RECORDER_HEADER_SIZE) / XLOG_RECORDER_BLOCK_SIZE);
+
+  for (uint32_t i = 0; i < h->block_count; ++i)
+    memset(block_at(h, i), 0, sizeof(struct block_header));
+
+  init_lock(h, boot_id);
+
+  /* last, a torn initialization is redone by the next opener */
+  __atomic_store_n(&h->magic, RECORDER_MAGIC, __ATOMIC_RELEASE);
+}
+
+static struct recorder_header* map_file(void) {
+  char dir[PATH_MAX];
+  snprintf(dir, sizeof(dir), "%s", g_recorder.path);
+  char* slash = strrchr(dir, '/');
+  if (slash && slash != dir) {
+    *slash = '\0';
+    os_mkdir_p(dir, 0755);
+  }
+
+  int fd = open(g_recorder.path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) return NULL;
+
+  char boot_id[sizeof(((struct recorder_header*)0)->boot_id)];
+  read_boot_id(boot_id, sizeof(boot_id));
+
+  /* the first process to get here initializes the file for everyone */
+  flock(fd, LOCK_EX);
+
+  struct stat st;
+  xbool_t fresh = fstat(fd, &st) != 0 || (size_t)st.st_size != g_recorder.size;
+  if (fresh && (ftruncate(fd, 0) != 0 || ftruncate(fd, (off_t)g_recorder.size) != 0)) {
+    close(fd);
+    return NULL;
+  }
+
+  struct recorder_header* h = mmap(NULL, g_recorder.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (h == MAP_FAILED) {
+    close(fd);
+    return NULL;
+  }
+
+  if (fresh || h->magic != RECORDER_MAGIC || h->version != RECORDER_VERSION ||
+      h->header_size != RECORDER_HEADER_SIZE || h->block_size != XLOG_RECORDER_BLOCK_SIZE ||
+      (size_t)h->header_size + (size_t)h->block_count * h->block_size != g_recorder.size) {
+    init_header(h, g_recorder.size, boot_id);
+  } else if (boot_id[0] && strncmp(h->boot_id, boot_id, sizeof(h->boot_id))) {
+    /* first opener since a reboot: a holder that went down with the power is
+     * never reported dead, robust or not. Records are committed one by one,
+     * so the blocks stay valid. */
+    init_lock(h, boot_id);
+  }
+
+  flock(fd, LOCK_UN);
+  close(fd);
+  return h;
+}
+
+static void record_session(struct recorder_header* h) {
+  uint8_t buf[sizeof(struct record_header) + 2 * (1 + 8) + 2 + sizeof(g_recorder.image_id)];
+  record_buf_t r = {.buf = buf, .used = sizeof(struct record_header), .cap = sizeof(buf)};
+  put_u64(&r, ARG_UINT, g_recorder.pid);
+  put_u64(&r, ARG_UINT, IMAGE_END - IMAGE_BEGIN);
+  put_str(&r, ARG_STR, g_recorder.image_id, sizeof(g_recorder.image_id));
+
+  struct record_header rh = {
+      .size = (uint16_t)r.used,
+      .lvl = XLOG_LVL_INFO,
+      .flags = RECORD_SESSION,
+      .ts_ns = now_ns(),
+      .pid = g_recorder.pid,
+      .tid = t_tid,
+      .image = g_recorder.image,
+  };
+  memcpy(buf, &rh, sizeof(rh));
+  append(h, buf, r.used);
+}
+
+static void recorder_hook(const char* module, int line, xlog_lvl_e lvl, const char* fmt, va_list ap);
+
+static struct recorder_header* recorder_map(void) {
+  struct recorder_header* h = atomic_load_explicit(&g_recorder.map, memory_order_acquire);
+  if (h) return h;
+
+  pthread_mutex_lock(&g_recorder.open_lock);
+  h = atomic_load(&g_recorder.map);
+  if (h == NULL && __atomic_load_n(&xlog_record_hook, __ATOMIC_ACQUIRE) == recorder_hook) {
+    h = map_file();
+    if (h) {
+      record_session(h);
+      atomic_store(&g_recorder.map, h);
+    } else {
+      /* no place to record, e.g. not root on a dev machine */
+      xlog_set_record_hook(NULL);
+    }
+  }
+  pthread_mutex_unlock(&g_recorder.open_lock);
+
+  return h;
+}
+
+static void recorder_hook(const char* module, int line, xlog_lvl_e lvl, const char* fmt, va_list ap) {
+  if (t_tid == 0) t_tid = (uint32_t)syscall(SYS_gettid);
+
+  struct recorder_header* h = recorder_map();
+  if (h == NULL || fmt == NULL) return;
+
+  uint8_t buf[XLOG_RECORDER_RECORD_MAX];
+  record_buf_t r = {.buf = buf, .used = sizeof(struct record_header), .cap = sizeof(buf)};
+
+  struct record_header rh = {
+      .lvl = (uint8_t)lvl,
+      .line = (uint32_t)line,
+      .ts_ns = now_ns(),
+      .pid = g_recorder.pid,
+      .tid = t_tid,
+      .image = g_recorder.image,
+  };
+
+  put_str(&r, ARG_STR, module ? module : "", ARG_STR_MAX);
+
+  uintptr_t at = (uintptr_t)fmt;
+  if (at >= IMAGE_BEGIN && at < IMAGE_END) {
+    rh.fmt = (uint32_t)(at - IMAGE_BEGIN);
+  } else {
+    /* built at runtime, keep a copy */
+    rh.flags |= RECORD_FMT_INLINE;
+    put_str(&r, ARG_STR, fmt, ARG_STR_MAX);
+  }
+
+  capture_args(&r, fmt, ap);
+
+  if (r.truncated) rh.flags |= RECORD_TRUNCATED;
+  rh.size = (uint16_t)r.used;
+  memcpy(buf, &rh, sizeof(rh));
+  append(h, buf, r.used);
+}
+
+err_t xlog_recorder_open(const char* path, size_t size, const char* image_id) {
+  const char* env = getenv("XLOG_RECORDER");
+  if (env && *env) {
+    if (!strcmp(env, "off")) return X_RET_NOTSUP;
+    path = env;
+  }
+
+  if (path == NULL || *path == '\0') return X_RET_INVAL;
+  if (size == 0) size = XLOG_RECORDER_DEFAULT_SIZE;
+  if (size < RECORDER_HEADER_SIZE + 2 * XLOG_RECORDER_BLOCK_SIZE) return X_RET_INVAL;
+
+  pthread_mutex_lock(&g_recorder.open_lock);
+  if (xlog_record_hook == recorder_hook) {
+    pthread_mutex_unlock(&g_recorder.open_lock);
+    return X_RET_EXIST;
+  }
+
+  snprintf(g_recorder.path, sizeof(g_recorder.path), "%s", path);
+  /* whole blocks only */
+  g_recorder.size = RECORDER_HEADER_SIZE +
+                    (size - RECORDER_HEADER_SIZE) / XLOG_RECORDER_BLOCK_SIZE * XLOG_RECORDER_BLOCK_SIZE;
+  snprintf(g_recorder.image_id, sizeof(g_recorder.image_id), "%s", image_id ? image_id : "");
+  g_recorder.image = image_hash(g_recorder.image_id);
+  g_recorder.pid = (uint32_t)getpid();
+  xlog_set_record_hook(recorder_hook);
+  pthread_mutex_unlock(&g_recorder.open_lock);
+
+  return X_RET_OK;
+}
+
+void xlog_recorder_close(void) {
+  pthread_mutex_lock(&g_recorder.open_lock);
+  if (xlog_record_hook == recorder_hook) xlog_set_record_hook(NULL);
+
+  struct recorder_header* h = atomic_exchange(&g_recorder.map, NULL);
+  if (h) {
+    /* callers still inside the hook keep the mapping alive for a moment */
+    msync(h, g_recorder.size, MS_ASYNC);
+  }
+  pthread_mutex_unlock(&g_recorder.open_lock);
+}
+
+/* ---- decode ---- */
+
+typedef struct {
+  const uint8_t* p;
+  size_t left;
+} cursor_t;
+
+static xbool_t get_u64(cursor_t* c, char tag, uint64_t* v) {
+  if (c->left < 1 + sizeof(*v) || (char)c->p[0] != tag) return xFALSE;
+  memcpy(v, c->p + 1, sizeof(*v));
+  c->p += 1 + sizeof(*v);
+  c->left -= 1 + sizeof(*v);
+  return xTRUE;
+}
+
+static xbool_t get_str(cursor_t* c, char* buf, size_t len) {
+  if (c->left < 2 || (char)c->p[0] != ARG_STR || c->left < 2u + c->p[1]) return xFALSE;
+  size_t n = c->p[1] < len - 1 ? c->p[1] : len - 1;
+  memcpy(buf, c->p + 2, n);
+  buf[n] = '\0';
+  c->left -= 2u + c->p[1];
+  c->p += 2u + c->p[1];
+  return xTRUE;
+}
+
+/* Without a format, shows the tagged values as they are */
+static void print_raw_args(FILE* out, cursor_t* c) {
+  char str[ARG_STR_MAX + 1];
+  const char* sep = "";
+  while (c->left > 0) {
+    char tag = (char)c->p[0];
+    uint64_t v;
+    if (tag == ARG_STR) {
+      if (!get_str(c, str, sizeof(str))) break;
+      fprintf(out, "%s\"%s\"", sep, str);
+    } else if (get_u64(c, tag, &v)) {
+      double d;
+      memcpy(&d, &v, sizeof(d));
+      if (tag == ARG_INT)
+        fprintf(out, "%s%lld", sep, (long long)v);
+      else if (tag == ARG_DOUBLE)
+        fprintf(out, "%s%g", sep, d);
+      else
+        fprintf(out, "%s0x%llx", sep, (unsigned long long)v);
+    } else {
+      break;
+    }
+    sep = ", ";
+  }
+}
+
+static void print_formatted(FILE* out, const char* fmt, cursor_t* c) {
+  char str[ARG_STR_MAX + 1];
+  const char* last = fmt;
+  conv_spec_t cs;
+  for (const char* p = fmt; (p = next_conv(p, &cs)) != NULL; last = p) {
+    fwrite(last, 1, cs.begin - last, out);
+
+    char tag = conv_tag(&cs);
+    if (tag == 0) {
+      if (cs.conv == '%') fputc('%', out);
+      else if (cs.conv != 'n') fwrite(cs.begin, 1, cs.end - cs.begin, out);
+      if (cs.conv == '\0') return;
+      continue;
+    }
+
+    uint64_t v = 0;
+    xbool_t ok = xTRUE;
+    if (cs.width == -2 && (ok = get_u64(c, ARG_INT, &v))) cs.width = (int)(int64_t)v;
+    if (ok && cs.prec == -2 && (ok = get_u64(c, ARG_INT, &v))) cs.prec = (int)(int64_t)v;
+    ok = ok && (tag == ARG_STR ? get_str(c, str, sizeof(str)) : get_u64(c, tag, &v));
+    if (!ok) {
+      /* truncated record, show what is missing */
+      fwrite(cs.begin, 1, cs.end - cs.begin, out);
+      continue;
+    }
+
+    /* rebuild the conversion around the stored 64-bit value */
+    char spec[48];
+    int n = snprintf(spec, sizeof(spec), "%%%s", cs.flags);
+    if (cs.width >= 0) n += snprintf(spec + n, sizeof(spec) - n, "%d", cs.width);
+    if (cs.prec >= 0) n += snprintf(spec + n, sizeof(spec) - n, ".%d", cs.prec);
+    snprintf(spec + n, sizeof(spec) - n, "%s%c", tag == ARG_INT || tag == ARG_UINT ? "ll" : "", cs.conv);
+
+    double d;
+    switch (tag) {
+      case ARG_INT:
+        fprintf(out, spec, (long long)v);
+        break;
+      case ARG_UINT:
+        fprintf(out, spec, (unsigned long long)v);
+        break;
+      case ARG_CHAR:
+        fprintf(out, spec, (int)v);
+        break;
+      case ARG_DOUBLE:
+        memcpy(&d, &v, sizeof(d));
+        fprintf(out, spec, d);
+        break;
+      case ARG_STR:
+        fprintf(out, spec, str);
+        break;
+      case ARG_PTR:
+        fprintf(out, spec, (void*)(uintptr_t)v);
+        break;
+    }
+  }
+
+  fputs(last, out);
+}
+
+static void print_time(FILE* out, uint64_t ts_ns) {
+  time_t sec = (time_t)(ts_ns / 1000000000ull);
+  struct tm tm;
+  char buf[32];
+  localtime_r(&sec, &tm);
+  strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+  fprintf(out, "%s.%06u", buf, (unsigned)(ts_ns % 1000000000ull / 1000));
+}
+
+typedef void (*record_visit_func)(const struct record_header* rh, cursor_t* args, void* ctx);
+
+static void for_each_record(const uint8_t* file, const struct recorder_header* h,
+                            record_visit_func visit, void* ctx) {
+  /* blocks in the order they were started */
+  uint32_t* order = xbox_malloc(sizeof(uint32_t) * h->block_count);
+  if (order == NULL) return;
+
+  uint32_t used = 0;
+  for (uint32_t i = 0; i < h->block_count; ++i) {
+    const struct block_header* b = (const void*)(file + h->header_size + (size_t)i * h->block_size);
+    if (b->seq == 0) continue;
+
+    uint32_t at = used++;
+    while (at > 0) {
+      const struct block_header* prev =
+          (const void*)(file + h->header_size + (size_t)order[at - 1] * h->block_size);
+      if (prev->seq < b->seq) break;
+      order[at] = order[at - 1];
+      at--;
+    }
+    order[at] = i;
+  }
+
+  for (uint32_t i = 0; i < used; ++i) {
+    const struct block_header* b = (const void*)(file + h->header_size + (size_t)order[i] * h->block_size);
+    const uint8_t* p = (const uint8_t*)(b + 1);
+    size_t left = b->used < h->block_size - sizeof(*b) ? b->used : h->block_size - sizeof(*b);
+
+    while (left >= sizeof(struct record_header)) {
+      struct record_header rh;
+      memcpy(&rh, p, sizeof(rh));
+      if (rh.size < sizeof(rh) || rh.size > left) break;
+
+      cursor_t args = {.p = p + sizeof(rh), .left = rh.size - sizeof(rh)};
+      visit(&rh, &args, ctx);
+      p += rh.size;
+      left -= rh.size;
+    }
+  }
+
+  xbox_free(order);
+}
+
+typedef struct {
+  FILE* out;
+  xlog_lvl_e lvl;
+  int sessions;    /* sessions seen so far */
+  int skip;        /* sessions to skip before printing */
+  uint32_t image;  /* ours */
+} decode_ctx_t;
+
+static void count_session(const struct record_header* rh, cursor_t* args, void* ctx) {
+  xUNUSED(args);
+  if (rh->flags & RECORD_SESSION) ((decode_ctx_t*)ctx)->sessions++;
+}
+
+static void print_record(const struct record_header* rh, cursor_t* args, void* ctx) {
+  decode_ctx_t* d = ctx;
+  char module[ARG_STR_MAX + 1];
+  char fmt[ARG_STR_MAX + 1];
+
+  if (rh->flags & RECORD_SESSION) {
+    if (d->skip > 0) d->skip--;
+    if (d->skip > 0) return;
+
+    uint64_t pid = 0, span = 0;
+    get_u64(args, ARG_UINT, &pid);
+    get_u64(args, ARG_UINT, &span);
+    if (!get_str(args, module, sizeof(module))) module[0] = '\0';
+
+    fputs("---- ", d->out);
+    print_time(d->out, rh->ts_ns);
+    fprintf(d->out, " process %llu started, image %s%s ----\n", (unsigned long long)pid, module,
+            rh->image == d->image ? "" : " (not this build)");
+    return;
+  }
+
+  if (d->skip > 0 || rh->lvl > XLOG_LVL_FATAL || rh->lvl < d->lvl) return;
+  if (!get_str(args, module, sizeof(module))) return;
+
+  print_time(d->out, rh->ts_ns);
+  fprintf(d->out, " %u/%u %c %s:%u ", rh->pid, rh->tid, xlog_lvl_char(rh->lvl), module, rh->line);
+
+  if (rh->flags & RECORD_FMT_INLINE) {
+    if (get_str(args, fmt, sizeof(fmt))) print_formatted(d->out, fmt, args);
+  } else if (rh->image == d->image && IMAGE_END > IMAGE_BEGIN && rh->fmt < IMAGE_END - IMAGE_BEGIN) {
+    print_formatted(d->out, (const char*)(IMAGE_BEGIN + rh->fmt), args);
+  } else {
+    fprintf(d->out, "<format +0x%x> ", rh->fmt);
+    print_raw_args(d->out, args);
+  }
+
+  fputs(rh->flags & RECORD_TRUNCATED ? " <truncated>\n" : "\n", d->out);
+}
+
+err_t xlog_recorder_decode(const char* path,
+                           FILE* out,
+                           const char* image_id,
+                           int sessions,
+                           xlog_lvl_e lvl) {
+  if (path == NULL || out == NULL) return X_RET_INVAL;
+
+  FILE* fp = fopen(path, "rb");
+  if (fp == NULL) return X_RET_NOTENT;
+
+  struct stat st;
+  uint8_t* file = NULL;
+  if (fstat(fileno(fp), &st) != 0 || st.st_size < RECORDER_HEADER_SIZE ||
+      (file = xbox_malloc(st.st_size)) == NULL ||
+      fread(file, 1, st.st_size, fp) != (size_t)st.st_size) {
+    fclose(fp);
+    xbox_free(file);
+    return X_RET_BADFMT;
+  }
+  fclose(fp);
+
+  const struct recorder_header* h = (const void*)file;
+  if (h->magic != RECORDER_MAGIC || h->version != RECORDER_VERSION ||
+      h->header_size != RECORDER_HEADER_SIZE ||
+      h->block_size < sizeof(struct block_header) + sizeof(struct record_header) ||
+      (uint64_t)h->header_size + (uint64_t)h->block_count * h->block_size > (uint64_t)st.st_size) {
+    xbox_free(file);
+    return X_RET_BADFMT;
+  }
+
+  decode_ctx_t ctx = {.out = out, .lvl = lvl, .image = image_hash(image_id ? image_id : "")};
+
+  if (sessions > 0) {
+    for_each_record(file, h, count_session, &ctx);
+    /* records before the first kept session are skipped too */
+    ctx.skip = ctx.sessions > sessions ? ctx.sessions - sessions + 1 : 0;
+  }
+
+  for_each_record(file, h, print_record, &ctx);
+
+  xbox_free(file);
+  return X_RET_OK;
+}
@@ -0,0 +1,80 @@
+/**
+ * @brief xlog 飞行记录仪
+ * @file xlog_recorder.h
+ * @author Oswin
+ * @date 2026-02-04
+ * @details An always-on binary flight recorder for xlog. Every log call,
+ *          whatever the logger level, is kept in a fixed-size mmap'd file
+ *          without being formatted: the record holds a timestamp, the
+ *          offset of the format string inside the executable and the raw
+ *          arguments (strings are copied). The file is a ring of blocks,
+ *          so it always holds the most recent history, across processes
+ *          and runs. xlog_recorder_decode() renders it later; it has to run
+ *          in the same build that wrote the records to resolve the formats.
+ *
+ *          e.g.
+ *          xlog_recorder_open("/var/ota/flight.rec", 0, "v1.2-2026-02-04");
+ *          ...
+ *          xlog_recorder_decode("/var/ota/flight.rec", stdout, "v1.2-2026-02-04", 0, XLOG_LVL_TRACE);
+ *
+ * @copyright (c) 2026 Intretech Software Development Department. All Rights Reserved.
+ */
+#ifndef XTOOL_XLOG_RECORDER__H_
+#define XTOOL_XLOG_RECORDER__H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+
+#include "xlog.h"
+
+/**< Default size of the record file, about 15k records. */
+#define XLOG_RECORDER_DEFAULT_SIZE (1024 * 1024)
+
+/**< Records never span blocks, the unit the ring advances by. */
+#define XLOG_RECORDER_BLOCK_SIZE (4096)
+
+/**< Upper bound of one record, longer argument lists are truncated. */
+#define XLOG_RECORDER_RECORD_MAX (1024)
+
+/**
+ * @brief Starts recording every log call to `path`.
+ * @details The file is created (with its directory) and mapped on the
+ *          first log call, so commands that never log leave no trace.
+ *          An existing file of the same size is continued. `XLOG_RECORDER`
+ *          in the environment overrides `path`, "off" disables recording.
+ * @param path The record file.
+ * @param size The file size, 0 for XLOG_RECORDER_DEFAULT_SIZE.
+ * @param image_id Identifies the build, e.g. version and build time.
+ * @return X_RET_OK on success, X_RET_NOTSUP if disabled by the environment.
+ */
+err_t xlog_recorder_open(const char* path, size_t size, const char* image_id);
+
+/**
+ * @brief Stops recording and schedules the file to be written back.
+ */
+void xlog_recorder_close(void);
+
+/**
+ * @brief Renders a record file as text, oldest first.
+ * @details Records written by another build show their raw arguments
+ *          instead of the message, since their format can not be resolved.
+ * @param path The record file.
+ * @param out Where the text goes.
+ * @param image_id The id this build passes to xlog_recorder_open().
+ * @param sessions Only what was recorded since the last this many
+ *                 processes started, 0 for everything.
+ * @param lvl Skip records below this level.
+ * @return X_RET_OK on success, X_RET_NOTENT or X_RET_BADFMT if unreadable.
+ */
+err_t xlog_recorder_decode(const char* path,
+                           FILE* out,
+                           const char* image_id,
+                           int sessions,
+                           xlog_lvl_e lvl);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* XTOOL_XLOG_RECORDER__H_ */
@@ -0,0 +1,204 @@
+/**
+ * @brief 哈希表
+ * @file xmap.c
+ * @author Oswin
+ * @date 2026-02-09
+ * @details Slots keep the key hash next to the key, so probing compares
+ *          hashes first and only touches key memory on a likely hit.
+ *          Removed slots become tombstones until the next rehash.
+ *
+ * @copyright (c) 2026 Intretech Software Development Department. All Rights Reserved.
+ */
+#include "xmap.h"
+
+#include <string.h>
+
+#define XMAP_MIN_CAPACITY (16)
+
+/* Marks a removed slot, probing continues past it */
+static const char xmap_tombstone[1];
+
+struct xmap_slot {
+  const char* key; /* NULL when free */
+  uint64_t hash;
+  size_t len;
+  void* value;
+};
+
+struct xmap_private {
+  struct xmap_slot* slots;
+  size_t capacity; /* a power of two */
+  size_t length;
+  size_t tombstones;
+};
+
+static uint64_t hash_key(const char* key, size_t len) {
+  /* FNV-1a */
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; ++i) {
+    h ^= (unsigned char)key[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+static xbool_t slot_live(const struct xmap_slot* slot) {
+  return slot->key != NULL && slot->key != xmap_tombstone;
+}
+
+/**
+ * @brief Finds the slot of a key, or where it would go.
+ * @return The slot holding the key, else the first reusable one on its probe.
+ */
+static struct xmap_slot* probe(xmap self, const char* key, size_t len, uint64_t hash) {
+  size_t mask = self->capacity - 1;
+  struct xmap_slot* reuse = NULL;
+
+  for (size_t i = (size_t)hash & mask;; i = (i + 1) & mask) {
+    struct xmap_slot* slot = &self->slots[i];
+    if (slot->key == NULL) return reuse ? reuse : slot;
+
+    if (slot->key == xmap_tombstone) {
+      if (!reuse) reuse = slot;
+    } else if (slot->hash == hash && slot->len == len && !memcmp(slot->key, key, len)) {
+      return slot;
+    }
+  }
+}
+
+static err_t rehash(xmap self, size_t capacity) {
+  struct xmap_slot* slots = xbox_calloc(capacity, sizeof(struct xmap_slot));
+  if (!slots) return X_RET_NOMEM;
+
+  struct xmap_slot* old = self->slots;
+  size_t old_capacity = self->capacity;
+
+  self->slots = slots;
+  self->capacity = capacity;
+  self->tombstones = 0;
+
+  for (size_t i = 0; i < old_capacity; ++i) {
+    if (!slot_live(&old[i])) continue;
+
+    size_t mask = capacity - 1;
+    size_t at = (size_t)old[i].hash & mask;
+    while (slots[at].key) at = (at + 1) & mask;
+    slots[at] = old[i];
+  }
+
+  xbox_free(old);
+  return X_RET_OK;
+}
+
+/* keeps the load, tombstones included, under 3/4 */
+static size_t capacity_for(size_t entries) {
+  size_t capacity = XMAP_MIN_CAPACITY;
+  while (capacity / 4 * 3 <= entries) capacity *= 2;
+  return capacity;
+}
+
+xmap xmap_create(size_t hint) {
+  xmap self = xbox_calloc(1, sizeof(struct xmap_private));
+  if (!self) return NULL;
+
+  if (rehash(self, capacity_for(hint)) != X_RET_OK) {
+    xbox_free(self);
+    return NULL;
+  }
+
+  return self;
+}
+
+void xmap_destroy(xmap self) {
+  if (!self) return;
+
+  xbox_free(self->slots);
+  xbox_free(self);
+}
+
+err_t xmap_set(xmap self, const char* key, void* value) {
+  if (!self || !key) return X_RET_INVAL;
+
+  size_t len = strlen(key);
+  uint64_t hash = hash_key(key, len);
+  struct xmap_slot* slot = probe(self, key, len, hash);
+
+  if (slot_live(slot)) {
+    slot->value = value;
+    return X_RET_OK;
+  }
+
+  if (slot->key == NULL && (self->length + self->tombstones + 1) > self->capacity / 4 * 3) {
+    /* only grow when live entries need it, otherwise just drop tombstones */
+    size_t capacity = capacity_for(self->length + 1);
+    err_t err = rehash(self, xMAX(capacity, self->capacity));
+    if (err != X_RET_OK) return err;
+    slot = probe(self, key, len, hash);
+  }
+
+  if (slot->key == xmap_tombstone) self->tombstones--;
+  slot->key = key;
+  slot->hash = hash;
+  slot->len = len;
+  slot->value = value;
+  self->length++;
+  return X_RET_OK;
+}
+
+void* xmap_get_n(xmap self, const char* key, size_t len) {
+  if (!self || !key || self->length == 0) return NULL;
+
+  struct xmap_slot* slot = probe(self, key, len, hash_key(key, len));
+  return slot_live(slot) ? slot->value : NULL;
+}
+
+void* xmap_get(xmap self, const char* key) {
+  return key ? xmap_get_n(self, key, strlen(key)) : NULL;
+}
+
+xbool_t xmap_contains(xmap self, const char* key) {
+  if (!self || !key || self->length == 0) return xFALSE;
+
+  size_t len = strlen(key);
+  return slot_live(probe(self, key, len, hash_key(key, len)));
+}
+
+void* xmap_remove(xmap self, const char* key) {
+  if (!self || !key || self->length == 0) return NULL;
+
+  size_t len = strlen(key);
+  struct xmap_slot* slot = probe(self, key, len, hash_key(key, len));
+  if (!slot_live(slot)) return NULL;
+
+  void* value = slot->value;
+  slot->key = xmap_tombstone;
+  slot->value = NULL;
+  self->length--;
+  self->tombstones++;
+  return value;
+}
+
+size_t xmap_length(xmap self) { return self ? self->length : 0; }
+
+void xmap_clear(xmap self) {
+  if (!self) return;
+
+  memset(self->slots, 0, self->capacity * sizeof(struct xmap_slot));
+  self->length = 0;
+  self->tombstones = 0;
+}
+
+xbool_t xmap_iter_next(xmap self, size_t* index, const char** key, void** value) {
+  if (!self) return xFALSE;
+
+  for (; *index < self->capacity; ++*index) {
+    struct xmap_slot* slot = &self->slots[*index];
+    if (!slot_live(slot)) continue;
+
+    *key = slot->key;
+    *value = slot->value;
+    return xTRUE;
+  }
+
+  return xFALSE;
+}
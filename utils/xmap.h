@@ -0,0 +1,123 @@
+/**
+ * @brief 哈希表
+ * @file xmap.h
+ * @author Oswin
+ * @date 2026-02-09
+ * @details A hash map from strings to pointers, open addressing with linear
+ *          probing in one flat slot array, so a lookup is a hash and usually
+ *          a single cache line rather than a list walk. The map does not copy
+ *          its keys: they have to stay valid and unchanged while they are in
+ *          the map (literals, argv, or strings kept in an xarena). Values are
+ *          not owned either.
+ *
+ *          e.g.
+ *          xmap files = xmap_create(entries);
+ *          xmap_set(files, xarena_strdup(arena, path), entry);
+ *          entry_t* e = xmap_get(files, "/usr/bin/iota-cli");
+ *          const char* key;
+ *          entry_t* value;
+ *          xmap_foreach(files, key, value) printf("%s\n", key);
+ *          xmap_destroy(files);
+ *
+ * @copyright (c) 2026 Intretech Software Development Department. All Rights Reserved.
+ */
+#ifndef XTOOL_XMAP__H_
+#define XTOOL_XMAP__H_
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "xdef.h"
+
+/** @brief Opaque handle to a map. */
+typedef struct xmap_private* xmap;
+
+/**
+ * @brief Creates an empty map.
+ * @param hint Expected number of entries, so that many fit without a rehash.
+ * @return The map, or NULL if memory allocation fails.
+ */
+xmap xmap_create(size_t hint);
+
+/**
+ * @brief Frees a map; keys and values are not looked at.
+ * @param self The map, can be NULL.
+ */
+void xmap_destroy(xmap self);
+
+/**
+ * @brief Adds an entry, or replaces the value of an existing key.
+ * @param self The map.
+ * @param key The key, not copied, see the file description.
+ * @param value The value.
+ * @return X_RET_OK on success, X_RET_INVAL or X_RET_NOMEM otherwise.
+ */
+err_t xmap_set(xmap self, const char* key, void* value);
+
+/**
+ * @brief Looks a key up.
+ * @param self The map.
+ * @param key The key.
+ * @return The value, or NULL if the key is not in the map.
+ */
+void* xmap_get(xmap self, const char* key);
+
+/**
+ * @brief Looks a key up by pointer and length, it needs no terminator.
+ * @param self The map.
+ * @param key The key characters.
+ * @param len The key length.
+ * @return The value, or NULL if the key is not in the map.
+ */
+void* xmap_get_n(xmap self, const char* key, size_t len);
+
+/**
+ * @brief Checks if a key is in the map, for maps that store NULL values.
+ * @param self The map.
+ * @param key The key.
+ * @return xTRUE if it is.
+ */
+xbool_t xmap_contains(xmap self, const char* key);
+
+/**
+ * @brief Removes an entry.
+ * @param self The map.
+ * @param key The key.
+ * @return The value it had, or NULL if the key was not in the map.
+ */
+void* xmap_remove(xmap self, const char* key);
+
+/**
+ * @brief Number of entries, 0 for NULL.
+ */
+size_t xmap_length(xmap self);
+
+/**
+ * @brief Removes every entry, the slots are kept.
+ * @param self The map.
+ */
+void xmap_clear(xmap self);
+
+/**
+ * @internal
+ * @brief Moves `*index` to the next entry at or after it, for xmap_foreach().
+ * @return xFALSE once there is none.
+ */
+xbool_t xmap_iter_next(xmap self, size_t* index, const char** key, void** value);
+
+/**
+ * @brief Iterates over the entries, in no particular order.
+ * @details The map must not be changed inside the loop.
+ *
+ * @param __m The map.
+ * @param __k A `const char*` receiving each key.
+ * @param __v A pointer receiving each value.
+ */
+#define xmap_foreach(___m, ___k, ___v)                                            \
+  for (size_t ___i = 0; xmap_iter_next((___m), &___i, &(___k), (void**)&(___v)); \
+       ++___i)
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* XTOOL_XMAP__H_ */
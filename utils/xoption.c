@@ -18,6 +18,8 @@
 #include <string.h>
 
 #include "xlog.h"
+#include "xmap.h"
+#include "xvec.h"
 
 typedef enum {
   /**< short option. e.g. '-a' */
@@ -65,7 +67,9 @@ struct xoption_candidate_priv {
 struct xoption_priv {
   const char* name;                  /**< Subcommand name (root has none) */
   const char* first_argument;        /**< argv[0] */
-  struct xlist_priv candidates;      /**< Candidate options */
+  struct xvec_priv candidates;       /**< Candidate options, in order */
+  xmap long_names;                   /**< Long name -> option candidate */
+  xmap commands;                     /**< Name -> subcommand candidate */
   struct xlist_priv positional_args; /**< Positional arguments */
   xbool_t done;                      /**< Parsing finished */
   xbool_t end_of_options;            /**< After '--' */
@@ -79,6 +83,7 @@ struct xoption_priv {
 
 static xoption_candidate __candidate_new();
 static void __candidate_free(xoption_candidate self);
+static err_t __candidate_append(xoption self, xoption_candidate candidate);
 static void __candidate_print(xoption_candidate self,
                               size_t left_width,
                               const char* front_padding,
@@ -111,8 +116,8 @@ static void __xoption_try_match_candidate(xoption self,
                                           int* curr_index,
                                           int argc,
                                           char** argv);
-static void __print_options(const xlist options);
-static void __print_commands(const xlist commands);
+static void __print_options(const xvec options);
+static void __print_commands(const xvec commands);
 static const char* __basename(const char* path);
 
 /**
@@ -129,7 +134,15 @@ xoption xoption_create_root() {
 
   self->name = "";
   self->first_argument = "";
-  xlist_init(&self->candidates);
+  xvec_init(&self->candidates, sizeof(xoption_candidate));
+  self->long_names = xmap_create(0);
+  self->commands = xmap_create(0);
+  if (!self->long_names || !self->commands) {
+    xmap_destroy(self->long_names);
+    xmap_destroy(self->commands);
+    xbox_free(self);
+    return NULL;
+  }
   xlist_init(&self->positional_args);
   self->done = xFALSE;
   self->end_of_options = xFALSE;
@@ -147,11 +160,12 @@ xoption xoption_create_root() {
 err_t xoption_disable_default_hepler(xoption self) {
   if (!self) return X_RET_INVAL;
 
-  void* item;
-  xlist_foreach(&self->candidates, item) {
-    xoption_candidate candidate = (xoption_candidate)item;
+  for (size_t i = 0; i < xvec_length(&self->candidates); ++i) {
+    xoption_candidate candidate = *(xoption_candidate*)xvec_at(&self->candidates, i);
     if (candidate->sn == 'h' && strcmp(candidate->ln, "help") == 0) {
-      xlist_remove(&self->candidates, candidate);
+      xvec_remove_at(&self->candidates, i);
+      if (xmap_get(self->long_names, candidate->ln) == candidate)
+        xmap_remove(self->long_names, candidate->ln);
       __candidate_free(candidate);
       break;
     }
@@ -205,7 +219,8 @@ xoption xoption_create_subcommand(xoption root,
   candidate->context = root;
   candidate->desc = desc;
 
-  xlist_push_back(&root->candidates, candidate);
+  /* on failure the candidate takes the subcommand with it */
+  if (__candidate_append(root, candidate) != X_RET_OK) return NULL;
 
   return self;
 }
@@ -234,12 +249,15 @@ err_t xoption_set_post_parse_callback(xoption self, xoption_run_fn callback) {
 err_t xoption_destroy(xoption self) {
   if (self == NULL) return X_RET_INVAL;
 
-  void* data_ptr = NULL;
-  for (data_ptr = xlist_pop_back(&self->candidates); data_ptr;
-       data_ptr = xlist_pop_back(&self->candidates)) {
-    __candidate_free((xoption_candidate)data_ptr);
+  xoption_candidate candidate;
+  while (xvec_pop_back(&self->candidates, &candidate) == X_RET_OK) {
+    __candidate_free(candidate);
   }
+  xvec_deinit(&self->candidates);
+  xmap_destroy(self->long_names);
+  xmap_destroy(self->commands);
 
+  void* data_ptr = NULL;
   for (data_ptr = xlist_pop_back(&self->positional_args); data_ptr;
        data_ptr = xlist_pop_back(&self->positional_args)) {
   }
@@ -300,7 +318,7 @@ static void __xoption_try_match_candidate(xoption self,
     strcpy(safe_buf, pos);
   }
 
-  void* item;  // the candidate item
+  xoption_candidate* item;  // the candidate item
 
   char* eq = strchr(curr, '=');
   if (eq) {
@@ -316,15 +334,16 @@ static void __xoption_try_match_candidate(xoption self,
     is_inline_argument = xTRUE;
   }
 
-  /* use current option 'safe_buf' to check all candidates. */
-  xlist_foreach(&self->candidates, item) {
-    xoption_candidate candidate = (xoption_candidate)item;
+  /* use current option 'safe_buf' to check the candidates: short options
+   * are matched letter by letter, long options and subcommands by name. */
+  if (kind == xoption_KIND_SHORT) {
+    xvec_foreach(&self->candidates, item) {
+      xoption_candidate candidate = *item;
 
-    /* Exit early if an error occurred or parsing is already complete,
-   e.g., when encountering an action like '-h' or '--help'. */
-    if (self->done == xTRUE) break;
+      /* Exit early if an error occurred or parsing is already complete,
+     e.g., when encountering an action like '-h' or '--help'. */
+      if (self->done == xTRUE) break;
 
-    if (kind == xoption_KIND_SHORT) {
       const char* tmp_ptr = safe_buf;
 
       /* check combined form, such as '-abc'.
@@ -375,30 +394,29 @@ static void __xoption_try_match_candidate(xoption self,
           __candidate_assignment(candidate, next, curr_index, xFALSE);
         }
       }  // end if found
+    }
 
-    } else if (kind == xoption_KIND_LONG) {
-      if (!strcmp(candidate->ln, safe_buf)) {
-        __candidate_assignment(candidate, next, curr_index, is_inline_argument);
-        option_active = xTRUE;
-        break;
-      }
+  } else if (kind == xoption_KIND_LONG) {
+    xoption_candidate candidate = xmap_get(self->long_names, safe_buf);
+    if (candidate) {
+      __candidate_assignment(candidate, next, curr_index, is_inline_argument);
+      option_active = xTRUE;
+    }
 
-    } else if (kind == xoption_KIND_POSITIONAL_OR_SUBCOMMAND) {
-      if (candidate->subcommand &&
-          !strcmp(candidate->subcommand->name, safe_buf)) {
-        option_active = xTRUE;
+  } else if (kind == xoption_KIND_POSITIONAL_OR_SUBCOMMAND) {
+    xoption_candidate candidate = xmap_get(self->commands, safe_buf);
+    if (candidate) {
+      option_active = xTRUE;
 
-        /* recursively parse subcommand */
-        xoption_parse(candidate->subcommand, argc - index, &argv[index]);
+      /* recursively parse subcommand */
+      xoption_parse(candidate->subcommand, argc - index, &argv[index]);
 
-        /* stop parsing options at the current level, because parsing has
-           entered a subcommand context. */
-        xoption_done(self, xFALSE, NULL);
+      /* stop parsing options at the current level, because parsing has
+         entered a subcommand context. */
+      xoption_done(self, xFALSE, NULL);
 
-        /* inherit error code from subcommand */
-        self->err = candidate->subcommand->err;
-        break;
-      }
+      /* inherit error code from subcommand */
+      self->err = candidate->subcommand->err;
     }
   }
 
@@ -489,14 +507,14 @@ void xoption_done(xoption self,
   }
 }
 
-static void __print_options(const xlist options) {
-  if (!options || xlist_length(options) == 0) return;
+static void __print_options(const xvec options) {
+  if (!options || xvec_length(options) == 0) return;
 
-  void* item = NULL;
+  xoption_candidate* item = NULL;
   size_t max_len = 0;
 
-  xlist_foreach(options, item) {
-    xoption_candidate candidate = (xoption_candidate)item;
+  xvec_foreach(options, item) {
+    xoption_candidate candidate = *item;
     size_t candidate_len = strlen(candidate->ln) +
                            (candidate->sn != '\0' ? 1 : 0) +
                            strlen(candidate->hint);
@@ -504,8 +522,8 @@ static void __print_options(const xlist options) {
   }
 
   printf("Options:\n");
-  xlist_foreach(options, item) {
-    xoption_candidate candidate = (xoption_candidate)item;
+  xvec_foreach(options, item) {
+    xoption_candidate candidate = *item;
 
     __candidate_print(candidate, max_len, "  ", "  ");
   }
@@ -513,14 +531,14 @@ static void __print_options(const xlist options) {
   printf("\n");
 }
 
-static void __print_commands(const xlist commands) {
-  if (!commands || xlist_length(commands) == 0) return;
+static void __print_commands(const xvec commands) {
+  if (!commands || xvec_length(commands) == 0) return;
 
-  void* item = NULL;
+  xoption_candidate* item = NULL;
   size_t max_len = 0;
 
-  xlist_foreach(commands, item) {
-    xoption_candidate candidate = (xoption_candidate)item;
+  xvec_foreach(commands, item) {
+    xoption_candidate candidate = *item;
     if (!candidate->subcommand) continue;
 
     size_t candidate_len = strlen(candidate->subcommand->name);
@@ -528,8 +546,8 @@ static void __print_commands(const xlist commands) {
   }
 
   printf("Commands:\n");
-  xlist_foreach(commands, item) {
-    xoption_candidate candidate = (xoption_candidate)item;
+  xvec_foreach(commands, item) {
+    xoption_candidate candidate = *item;
     if (!candidate->subcommand) continue;
 
     printf("  %s  %s\n", candidate->subcommand->name, candidate->desc);
@@ -552,18 +570,18 @@ void xoption_helper_printf_advance(xoption self,
     va_end(args);
   }
 
-  void* item;
-  xlist options = xlist_create();
-  xlist commands = xlist_create();
+  xoption_candidate* item;
+  xvec options = xvec_create(sizeof(xoption_candidate));
+  xvec commands = xvec_create(sizeof(xoption_candidate));
 
   assert(options && commands);
 
-  xlist_foreach(&self->candidates, item) {
-    xoption_candidate candidate = (xoption_candidate)item;
+  xvec_foreach(&self->candidates, item) {
+    xoption_candidate candidate = *item;
     if (candidate->type == xoption_CANDIDATE_TYPE_SUBCOMMAND) {
-      xlist_push_back(commands, candidate);
+      xvec_push_back(commands, &candidate);
     } else {
-      xlist_push_back(options, candidate);
+      xvec_push_back(options, &candidate);
     }
   }
 
@@ -574,8 +592,8 @@ void xoption_helper_printf_advance(xoption self,
   printf("Usage:\n");
   printf("  %s %s %s [ARGS...]\n\n",
          __basename(self->first_argument),
-         xlist_length(options) > 0 ? "[OPTIONS]" : "\b",
-         xlist_length(commands) > 0 ? "COMMAND [COMMAND OPTIONS]" : "\b");
+         xvec_length(options) > 0 ? "[OPTIONS]" : "\b",
+         xvec_length(commands) > 0 ? "COMMAND [COMMAND OPTIONS]" : "\b");
 
   if (strlen(self->desc) > 0) {
     printf("Description:\n");
@@ -589,8 +607,8 @@ void xoption_helper_printf_advance(xoption self,
     printf("%s\n", self->suffix_prompt);
   }
 
-  xlist_destroy(options);
-  xlist_destroy(commands);
+  xvec_destroy(options);
+  xvec_destroy(commands);
 }
 
 xlist xoption_get_positional(xoption self) {
@@ -615,7 +633,7 @@ xoption_candidate xoption_add_string(xoption self,
   c->storing_ptr = (void*)ptr;
   c->required = required;
   c->context = self;
-  xlist_push_back(&self->candidates, c);
+  if (__candidate_append(self, c) != X_RET_OK) return NULL;
   return c;
 }
 xoption_candidate xoption_add_number(xoption self,
@@ -635,7 +653,7 @@ xoption_candidate xoption_add_number(xoption self,
   c->storing_ptr = (void*)ptr;
   c->required = required;
   c->context = self;
-  xlist_push_back(&self->candidates, c);
+  if (__candidate_append(self, c) != X_RET_OK) return NULL;
   return c;
 }
 xoption_candidate xoption_add_boolean(
@@ -649,7 +667,7 @@ xoption_candidate xoption_add_boolean(
   c->storing_ptr = (void*)ptr;
   c->required = xFALSE;
   c->context = self;
-  xlist_push_back(&self->candidates, c);
+  if (__candidate_append(self, c) != X_RET_OK) return NULL;
   return c;
 }
 xoption_candidate xoption_add_action(xoption self,
@@ -668,7 +686,7 @@ xoption_candidate xoption_add_action(xoption self,
   c->storing_ptr = user_data;
   c->required = xFALSE;
   c->context = self;
-  xlist_push_back(&self->candidates, c);
+  if (__candidate_append(self, c) != X_RET_OK) return NULL;
   return c;
 }
 
@@ -867,6 +885,24 @@ static void __candidate_free(xoption_candidate self) {
   xbox_free(self);
 }
 
+static err_t __candidate_append(xoption self, xoption_candidate candidate) {
+  err_t err = xvec_push_back(&self->candidates, &candidate);
+
+  /* the first candidate registered under a name is the one that matches */
+  if (err == X_RET_OK && candidate->subcommand) {
+    if (!xmap_contains(self->commands, candidate->subcommand->name))
+      err = xmap_set(self->commands, candidate->subcommand->name, candidate);
+    if (err != X_RET_OK) xvec_pop_back(&self->candidates, NULL);
+  } else if (err == X_RET_OK && strlen(candidate->ln) > 0) {
+    if (!xmap_contains(self->long_names, candidate->ln))
+      err = xmap_set(self->long_names, candidate->ln, candidate);
+    if (err != X_RET_OK) xvec_pop_back(&self->candidates, NULL);
+  }
+
+  if (err != X_RET_OK) __candidate_free(candidate);
+  return err;
+}
+
 static void __candidate_print(xoption_candidate self,
                               size_t left_width,
                               const char* front_padding,
@@ -922,9 +958,9 @@ static void __xoption_default_helper_action(xoption self, void* user_data) {
 static void __xoption_check_required(xoption self) {
   if (!self) return;
 
-  void* item;
-  xlist_foreach(&self->candidates, item) {
-    xoption_candidate candidate = (xoption_candidate)item;
+  xoption_candidate* item;
+  xvec_foreach(&self->candidates, item) {
+    xoption_candidate candidate = *item;
     if (candidate->required == xTRUE && candidate->used == xFALSE) {
       if (candidate->sn != '\0' && strlen(candidate->ln) > 0) {
         xoption_done(self,
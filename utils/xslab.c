@@ -0,0 +1,130 @@
+/**
+ * @brief 定长对象池
+ * @file xslab.c
+ * @author Oswin
+ * @date 2026-02-09
+ * @details Objects are handed out from the free list first, then carved
+ *          from the newest slab; a slab is never split up front, so
+ *          creating a pool touches no memory it does not use.
+ *
+ * @copyright (c) 2026 Intretech Software Development Department. All Rights Reserved.
+ */
+#include "xslab.h"
+
+struct xslab_slab {
+  struct xslab_slab* next;
+  void* block; /* what xbox_malloc() returned, the slab sits in it on a line boundary */
+  /* the objects follow, starting on a cache line of their own */
+} __attribute__((aligned(XSLAB_CACHELINE)));
+
+struct xslab_private {
+  size_t obj_size;
+  size_t per_slab;
+  struct xslab_slab* slabs; /* newest first, objects are carved from it */
+  size_t carved;            /* objects taken from the newest slab */
+  void* free_list;          /* returned objects, linked through their first word */
+  size_t in_use;
+};
+
+#define SLAB_OBJS(s) ((char*)((s) + 1))
+
+/* Small objects take the next power of two, which divides a line, so none
+ * straddles two lines; bigger ones take whole lines. */
+static size_t slab_stride(size_t size) {
+  if (size >= XSLAB_CACHELINE) return (size + XSLAB_CACHELINE - 1) & ~(size_t)(XSLAB_CACHELINE - 1);
+
+  size_t stride = XSLAB_ALIGN;
+  while (stride < size) stride <<= 1;
+  return stride;
+}
+
+xslab xslab_create(size_t obj_size, size_t objs_per_slab) {
+  if (obj_size == 0) return NULL;
+
+  xslab self = xbox_calloc(1, sizeof(struct xslab_private));
+  if (!self) return NULL;
+
+  /* a free object holds the next pointer */
+  obj_size = xMAX(obj_size, sizeof(void*));
+  if (obj_size > SIZE_MAX - XSLAB_CACHELINE) {
+    xbox_free(self);
+    return NULL;
+  }
+  self->obj_size = slab_stride(obj_size);
+  self->per_slab = objs_per_slab ? objs_per_slab
+                                 : xMAX((size_t)1, (XSLAB_DEFAULT_SLAB - sizeof(struct xslab_slab)) /
+                                                       self->obj_size);
+  if (self->per_slab > (SIZE_MAX - sizeof(struct xslab_slab) - XSLAB_CACHELINE) / self->obj_size) {
+    xbox_free(self);
+    return NULL;
+  }
+
+  return self;
+}
+
+void xslab_destroy(xslab self) {
+  if (!self) return;
+
+  struct xslab_slab* slab = self->slabs;
+  while (slab) {
+    struct xslab_slab* next = slab->next;
+    xbox_free(slab->block);
+    slab = next;
+  }
+
+  xbox_free(self);
+}
+
+void* xslab_alloc(xslab self) {
+  if (!self) return NULL;
+
+  void* obj = self->free_list;
+  if (obj) {
+    self->free_list = *(void**)obj;
+  } else {
+    if (!self->slabs || self->carved == self->per_slab) {
+      /* malloc only promises 16 bytes, the slack lets the slab start on a line */
+      void* block = xbox_malloc(XSLAB_CACHELINE - 1 + sizeof(struct xslab_slab) + self->per_slab * self->obj_size);
+      if (!block) return NULL;
+
+      struct xslab_slab* slab =
+          (struct xslab_slab*)(((uintptr_t)block + XSLAB_CACHELINE - 1) & ~(uintptr_t)(XSLAB_CACHELINE - 1));
+      slab->block = block;
+      slab->next = self->slabs;
+      self->slabs = slab;
+      self->carved = 0;
+    }
+
+    obj = SLAB_OBJS(self->slabs) + self->carved++ * self->obj_size;
+  }
+
+  self->in_use++;
+  return obj;
+}
+
+void xslab_free(xslab self, void* obj) {
+  if (!self || !obj) return;
+
+  *(void**)obj = self->free_list;
+  self->free_list = obj;
+  self->in_use--;
+}
+
+void xslab_reset(xslab self) {
+  if (!self || !self->slabs) return;
+
+  /* keep the oldest slab, the others go */
+  struct xslab_slab* slab = self->slabs;
+  while (slab->next) {
+    struct xslab_slab* next = slab->next;
+    xbox_free(slab->block);
+    slab = next;
+  }
+
+  self->slabs = slab;
+  self->carved = 0;
+  self->free_list = NULL;
+  self->in_use = 0;
+}
+
+size_t xslab_in_use(xslab self) { return self ? self->in_use : 0; }
@@ -0,0 +1,90 @@
+/**
+ * @brief 定长对象池
+ * @file xslab.h
+ * @author Oswin
+ * @date 2026-02-09
+ * @details A slab allocator for many small objects of one size, such as
+ *          list nodes. Objects are cut back to back from slabs of
+ *          `objs_per_slab`, so neighbours share cache lines, and freed
+ *          objects go on a free list for the next xslab_alloc() instead of
+ *          back to malloc. Slabs start on a cache line and objects are
+ *          strided so that none straddles two lines; objects below a line
+ *          are still packed together, which is what a single-threaded
+ *          list wants. xslab_destroy() releases every slab at once,
+ *          whether or not its objects were freed one by one.
+ *
+ *          A slab is not thread-safe, it is meant to sit behind whatever
+ *          lock protects the structure it allocates for.
+ *
+ *          e.g.
+ *          xslab pool = xslab_create(sizeof(struct job), 0);
+ *          struct job* j = xslab_alloc(pool);
+ *          ...
+ *          xslab_free(pool, j);
+ *          xslab_destroy(pool);
+ *
+ * @copyright (c) 2026 Intretech Software Development Department. All Rights Reserved.
+ */
+#ifndef XTOOL_XSLAB__H_
+#define XTOOL_XSLAB__H_
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "xdef.h"
+
+/**< Smallest object stride, every object is aligned to at least this. */
+#define XSLAB_ALIGN (8)
+
+/**< Cache line size. Slabs start on a line, and no object straddles two. */
+#define XSLAB_CACHELINE (64)
+
+/**< Slab size used when the caller does not give an object count. */
+#define XSLAB_DEFAULT_SLAB (4096)
+
+/** @brief Opaque handle to a slab allocator. */
+typedef struct xslab_private* xslab;
+
+/**
+ * @brief Creates a slab allocator.
+ * @param obj_size Size of every object.
+ * @param objs_per_slab Objects per slab, 0 to fill about XSLAB_DEFAULT_SLAB bytes.
+ * @return The allocator, or NULL on failure. No slab is allocated yet.
+ */
+xslab xslab_create(size_t obj_size, size_t objs_per_slab);
+
+/**
+ * @brief Frees every slab, including objects still in use.
+ * @param self The allocator, can be NULL.
+ */
+void xslab_destroy(xslab self);
+
+/**
+ * @brief Takes an object, uninitialized.
+ * @param self The allocator.
+ * @return The object, or NULL if a new slab can not be allocated.
+ */
+void* xslab_alloc(xslab self);
+
+/**
+ * @brief Returns an object for reuse.
+ * @param self The allocator it came from.
+ * @param obj The object, can be NULL.
+ */
+void xslab_free(xslab self, void* obj);
+
+/**
+ * @brief Returns every object at once, keeping one slab for reuse.
+ * @param self The allocator.
+ */
+void xslab_reset(xslab self);
+
+/**
+ * @brief Number of objects handed out and not returned.
+ */
+size_t xslab_in_use(xslab self);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* XTOOL_XSLAB__H_ */
@@ -11,10 +11,13 @@
 #include "xstring.h"
 
 #include <ctype.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "stb_sprintf.h"
+#include "xstring_simd.h"
 
 static const char* xstring_double_expand_with_minimum(xstring* s, size_t min) {
   const char* h = s->s;
@@ -91,15 +94,29 @@ void xstring_init_from_other_r(xstring* s1, const xstring* s2) {
   xstring_init_iter_r(s1, xstring_to_string(s2));
 }
 
+xstring xstring_init_take(char* buf, int len, int cap) {
+  xstring s = xstring_init_empty();
+  if (!buf) {
+    return s;
+  }
+
+  s.s = buf;
+  s.len = len;
+  s.cap = cap;
+  return s;
+}
+
 xstring xstring_init_format(const char* fmt, ...) {
   if (!fmt) {
     return xstring_init_empty();
   }
 
-  va_list ap, ap_copy;
+  va_list ap;
   va_start(ap, fmt);
+  xstring s = xstring_init_vformat(fmt, ap);
+  va_end(ap);
 
-  return xstring_init_vformat(fmt, ap);
+  return s;
 }
 
 xstring xstring_init_vformat(const char* fmt, va_list ap) {
@@ -128,27 +145,29 @@ void xstring_init_vformat_r(xstring* s, const char* fmt, va_list ap) {
     return;
   }
 
-  char* p = s->b;
+  /* format straight into the current storage, again only if it was short */
+  char* p = s->s ? s->s : s->b;
 
   va_list ap_copy;
   va_copy(ap_copy, ap);
-  int len = stbsp_vsnprintf(NULL, 0, fmt, ap_copy);
+  int len = stbsp_vsnprintf(p, s->cap, fmt, ap_copy);
   va_end(ap_copy);
   if (len < 0) {
     return;
   }
 
   if ((len + 1) > s->cap) {
-    s->s = xbox_malloc(len + 1);
-    if (!s->s) {
+    char* n = xbox_realloc(s->s, len + 1);
+    if (!n) {
       return;
     }
 
-    p = s->s;
+    s->s = n;
     s->cap = len + 1;
+    stbsp_vsnprintf(s->s, s->cap, fmt, ap);
   }
 
-  s->len = stbsp_vsnprintf(p, s->cap, fmt, ap);
+  s->len = len;
 }
 
 void xstring_free(xstring* s) {
@@ -203,29 +222,12 @@ const char* xstring_trim(xstring* s) {
   if (!s || s->len == 0) return xstring_to_string(s);
 
   char* p = s->s ? s->s : s->b;
-  const char* start = p;
+  const char* start = xstr_skip_charset(p, s->len, XSTR_SPACES);
+  const char* end = xstr_rskip_charset(start, s->len - (start - p), XSTR_SPACES);
 
-  // find the first non-whitespace character
-  while (*start && isspace((unsigned char)*start)) {
-    start++;
-  }
-
-  // if the string is all whitespace
-  if (*start == '\0') {
-    s->len = 0;
-    p[0] = '\0';
-    return p;
-  }
-
-  // find the last non-whitespace character
-  char* end = p + s->len - 1;
-  while (end > start && isspace((unsigned char)*end)) {
-    end--;
-  }
-
-  s->len = end - start + 1;
+  s->len = end - start;
   // Use memmove because src and dest may overlap
-  memmove(p, start, s->len);
+  if (start != p) memmove(p, start, s->len);
   p[s->len] = '\0';
 
   return p;
@@ -235,14 +237,10 @@ const char* xstring_trim_left(xstring* s) {
   if (!s || s->len == 0) return xstring_to_string(s);
 
   char* p = s->s ? s->s : s->b;
-  const char* start = p;
-
-  while (*start && isspace((unsigned char)*start)) {
-    start++;
-  }
+  const char* start = xstr_skip_charset(p, s->len, XSTR_SPACES);
 
   s->len = s->len - (start - p);
-  memmove(p, start, s->len);
+  if (start != p) memmove(p, start, s->len);
   p[s->len] = '\0';
 
   return p;
@@ -252,13 +250,8 @@ const char* xstring_trim_right(xstring* s) {
   if (!s || s->len == 0) return xstring_to_string(s);
 
   char* p = s->s ? s->s : s->b;
-  char* end = p + s->len - 1;
 
-  while (end >= p && isspace((unsigned char)*end)) {
-    end--;
-  }
-
-  s->len = end < p ? 0 : end - p + 1;
+  s->len = xstr_rskip_charset(p, s->len, XSTR_SPACES) - p;
   p[s->len] = '\0';
 
   return p;
@@ -309,17 +302,15 @@ const char* xstring_prepend(xstring* s, const char* str) {
 const char* xstring_upper(const xstring* s) {
   if (!s) return "";
   const char* p = s->s ? s->s : s->b;
-  char* q = (char*)p;
-  while (*q) *q = toupper((unsigned char)*q), q++;
+  xstr_upper((char*)p, s->len);
   return p;
 }
 
 const char* xstring_lower(const xstring* s) {
   if (!s) return "";
   const char* p = s->s ? s->s : s->b;
-  char* q = (char*)p;
-  while (*q) *q = tolower((unsigned char)*q), q++;
-  return (const char*)p;
+  xstr_lower((char*)p, s->len);
+  return p;
 }
 
 xbool_t xstring_equal_ex(const xstring* s1, const char* s2, int flag) {
@@ -362,24 +353,8 @@ xbool_t xstring_has_charset_ex(const xstring* s,
                                const char* charset,
                                int flag) {
   if (!s || !charset) return xFALSE;
-  const char* s_str = xstring_to_string(s);
-  if (flag == X_NOCASE) {
-    char* temp_s = xbox_strdup(s_str);
-    char* temp_charset = xbox_strdup(charset);
-    if (!temp_s || !temp_charset) {
-      if (temp_s) xbox_free(temp_s);
-      if (temp_charset) xbox_free(temp_charset);
-      return xFALSE;  // Out of memory
-    }
-    for (char* p = temp_s; *p; ++p) *p = tolower(*p);
-    for (char* p = temp_charset; *p; ++p) *p = tolower(*p);
-    xbool_t found = (strpbrk(temp_s, temp_charset) != NULL);
-    xbox_free(temp_s);
-    xbox_free(temp_charset);
-    return found;
-  } else {
-    return strpbrk(s_str, charset) != NULL;
-  }
+  if (flag == X_NOCASE) return xstr_find_charset(xstring_to_string(s), s->len, charset, xTRUE) != NULL;
+  return xstr_find_charset_z(xstring_to_string(s), s->len, charset) != NULL;
 }
 
 xbool_t xstring_has_substr_ex(const xstring* s, const char* substr, int flag) {
@@ -400,20 +375,21 @@ xbool_t xstring_has_substr_ex(const xstring* s, const char* substr, int flag) {
     return xFALSE;
 #endif
   } else {
-    return strstr(s_str, substr) != NULL;
+    return xstr_find_substr(s_str, s->len, substr, strlen(substr)) != NULL;
   }
 }
 
-static const char* strpbrk_continue(const char* s, const char* set) {
-  const char* p = strpbrk(s, set);
-  for (; p && *p;) {
-    if (strchr(set, *(p + 1)))
-      p++;
-    else
-      break;
-  }
+/* bytes left from `p` to the end of the string, if `p` points into it */
+static size_t remaining(const xstring* s, const char* p) {
+  const char* base = s->s ? s->s : s->b;
+  if (p >= base && p <= base + s->len) return base + s->len - p;
+  return strlen(p);
+}
 
-  return p;
+/* length of the token at `p`, up to the next delimiter or the end */
+static int token_length(const char* p, size_t left, const char* charset) {
+  const char* q = xstr_find_charset_z(p, left, charset);
+  return q ? q - p : (int)left;
 }
 
 int xstring_tokenize_by_charset(const xstring* s,
@@ -426,25 +402,20 @@ int xstring_tokenize_by_charset(const xstring* s,
   if (*token == NULL) {
     // Start from the beginning of the string
     *token = (s->s ? s->s : s->b);
-    const char* p = strpbrk(*token, charset);
-    if (p)
-      return p - *token;
-    else
-      return strlen(*token);
-  } else {
-    const char* p = strpbrk_continue(*token, charset);
-    if (p) {
-      *token = p + 1;
-      p = strpbrk(*token, charset);
-      if (p)
-        return p - *token;
-      else
-        return strlen(*token);
-    } else {
-      *token = NULL;
-      return 0;
-    }
+    return token_length(*token, s->len, charset);
   }
+
+  // Skip the current token and the run of delimiters after it
+  size_t left = remaining(s, *token);
+  const char* p = xstr_find_charset_z(*token, left, charset);
+  if (!p) {
+    *token = NULL;
+    return 0;
+  }
+
+  left -= p - *token;
+  *token = xstr_skip_charset(p, left, charset);
+  return token_length(*token, left - (*token - p), charset);
 }
 
 int xstring_tokenize_by_substr(const xstring* s,
@@ -454,29 +425,29 @@ int xstring_tokenize_by_substr(const xstring* s,
     return 0;
   }
 
+  size_t sub_len = strlen(substr);
+
   if (*token == NULL) {
     // Start from the beginning of the string
     *token = (s->s ? s->s : s->b);
-    const char* p = strstr(*token, substr);
+    size_t left = s->len;
+    const char* p = xstr_find_substr(*token, left, substr, sub_len);
 
-    if (p == *token) {
-      *token += strlen(substr);
-      p = strstr(*token, substr);
+    if (p == *token && sub_len) {
+      *token += sub_len;
+      left -= sub_len;
+      p = xstr_find_substr(*token, left, substr, sub_len);
     }
 
-    if (p)
-      return p - *token;
-    else
-      return strlen(*token);
+    return p ? p - *token : (int)left;
   } else {
-    const char* p = strstr(*token, substr);
+    size_t left = remaining(s, *token);
+    const char* p = xstr_find_substr(*token, left, substr, sub_len);
     if (p) {
-      *token = p + strlen(substr);
-      p = strstr(*token, substr);
-      if (p)
-        return p - *token;
-      else
-        return strlen(*token);
+      left -= p + sub_len - *token;
+      *token = p + sub_len;
+      p = xstr_find_substr(*token, left, substr, sub_len);
+      return p ? p - *token : (int)left;
     } else {
       *token = NULL;
       return 0;
@@ -484,28 +455,6 @@ int xstring_tokenize_by_substr(const xstring* s,
   }
 }
 
-// KMP helper function to compute the Longest Proper Prefix which is also a
-// Suffix
-static void compute_lps_array(const char* pattern, int M, int* lps) {
-  int length = 0;
-  lps[0] = 0;
-  int i = 1;
-  while (i < M) {
-    if (pattern[i] == pattern[length]) {
-      length++;
-      lps[i] = length;
-      i++;
-    } else {
-      if (length != 0) {
-        length = lps[length - 1];
-      } else {
-        lps[i] = 0;
-        i++;
-      }
-    }
-  }
-}
-
 const char* xstring_replace(xstring* s,
                             const char* old_str,
                             const char* new_str) {
@@ -513,87 +462,66 @@ const char* xstring_replace(xstring* s,
     return xstring_to_string(s);
   }
 
-  int old_len = strlen(old_str);
+  size_t old_len = strlen(old_str);
   if (old_len == 0) {
     return xstring_to_string(s);
   }
-  int new_len = strlen(new_str);
-  const char* s_str = xstring_to_string(s);
+  size_t new_len = strlen(new_str);
+  char* s_str = s->s ? s->s : s->b;
+  const char* end = s_str + s->len;
 
-  // Use KMP to find all occurrences of old_str
-  int M = old_len;
-  int N = s->len;
-  int* lps = (int*)xbox_malloc(sizeof(int) * M);
-  if (!lps) return s_str;  // Malloc failed
-  compute_lps_array(old_str, M, lps);
-
-  // Store indices of matches
-  int* matches = (int*)xbox_malloc(sizeof(int) * N);
-  if (!matches) {
-    xbox_free(lps);
-    return s_str;  // Malloc failed
-  }
-
-  int i = 0, j = 0, count = 0;
-  while (i < N) {
-    if (old_str[j] == s_str[i]) {
-      i++;
-      j++;
-    }
-    if (j == M) {
-      if (count < N) {
-        matches[count++] = i - j;
-      }
-      j = lps[j - 1];
-    } else if (i < N && old_str[j] != s_str[i]) {
-      if (j != 0)
-        j = lps[j - 1];
-      else
-        i++;
-    }
-  }
-  xbox_free(lps);
+  // Count the (non-overlapping) occurrences first, nothing is stored
+  size_t count = 0;
+  for (const char* p = s_str; (p = xstr_find_substr(p, end - p, old_str, old_len)); p += old_len)
+    count++;
 
   if (count == 0) {
-    xbox_free(matches);
     return s_str;
   }
 
-  // Calculate new length and allocate a new buffer
-  // Use long long to prevent overflow during calculation
-  long long new_s_len_ll = (long long)s->len +
-                           (long long)count * (new_len - old_len);
-  if (new_s_len_ll < 0) new_s_len_ll = 0;
-  size_t new_s_len = (size_t)new_s_len_ll;
+  size_t new_s_len = s->len - count * old_len + count * new_len;
+
+  // Not growing: rewrite in place, the write position never passes the read one
+  if (new_len <= old_len) {
+    char* w = s_str;
+    const char* r = s_str;
+    const char* m;
+    while ((m = xstr_find_substr(r, end - r, old_str, old_len))) {
+      memmove(w, r, m - r);
+      w += m - r;
+      memcpy(w, new_str, new_len);
+      w += new_len;
+      r = m + old_len;
+    }
+    memmove(w, r, end - r);
+    s_str[new_s_len] = '\0';
+    s->len = new_s_len;
+    return s_str;
+  }
 
-  char* new_buffer = (char*)xbox_malloc(new_s_len + 1);
+  // Growing: build into a new buffer, or a stack one if the result stays inline
+  char sso[X_STRING_DEFAULT_CAP];
+  xbool_t inline_result = !s->s && new_s_len < (size_t)s->cap;
+  char* new_buffer = inline_result ? sso : (char*)xbox_malloc(new_s_len + 1);
   if (!new_buffer) {
-    xbox_free(matches);
     return s_str;
   }
 
-  // Build the new string in the new buffer
-  char* p = new_buffer;
-  int last_pos = 0;
-  for (int k = 0; k < count; k++) {
-    int match_pos = matches[k];
-    // Copy segment before the match
-    memcpy(p, s_str + last_pos, match_pos - last_pos);
-    p += match_pos - last_pos;
-    // Copy the new string
-    memcpy(p, new_str, new_len);
-    p += new_len;
-    last_pos = match_pos + old_len;
-  }
-  // Copy the remaining part of the string after the last match
-  memcpy(p, s_str + last_pos, s->len - last_pos);
+  char* w = new_buffer;
+  const char* r = s_str;
+  const char* m;
+  while ((m = xstr_find_substr(r, end - r, old_str, old_len))) {
+    memcpy(w, r, m - r);
+    w += m - r;
+    memcpy(w, new_str, new_len);
+    w += new_len;
+    r = m + old_len;
+  }
+  memcpy(w, r, end - r);
   new_buffer[new_s_len] = '\0';
 
-  xbox_free(matches);
-
-  if (new_s_len < s->cap) {
-    memcpy(s->s ? s->s : s->b, new_buffer, new_s_len + 1);
-    xbox_free(new_buffer);
+  if (inline_result) {
+    memcpy(s->b, sso, new_s_len + 1);
   } else {
     if (s->s) xbox_free(s->s);
     s->s = new_buffer;
@@ -792,3 +720,276 @@ xstring xstring_dtos(double val) {
 
   return xstring_init_iter(buf);
 }
+
+xstrbuf xstrbuf_init(char* buf, size_t cap) {
+  xstrbuf sb = {.data = buf, .len = 0, .cap = cap, .arena = NULL, .truncated = xFALSE};
+  if (buf && cap) buf[0] = '\0';
+  return sb;
+}
+
+xstrbuf xstrbuf_init_arena(xarena arena, size_t cap) {
+  if (cap == 0) cap = X_STRING_DEFAULT_CAP;
+
+  char* buf = xarena_alloc(arena, cap);
+  xstrbuf sb = xstrbuf_init(buf, buf ? cap : 0);
+  sb.arena = arena;
+  sb.truncated = buf == NULL;
+  return sb;
+}
+
+err_t xstrbuf_reserve(xstrbuf* sb, size_t n) {
+  if (!sb) return X_RET_INVAL;
+  if (sb->cap && sb->cap - sb->len > n) return X_RET_OK;
+  if (!sb->arena) return X_RET_FULL;
+  if (n > SIZE_MAX / 2 - sb->len) return X_RET_NOMEM;
+
+  size_t cap = xMAX(sb->cap * 2, sb->len + n + 1);
+  char* p = xarena_realloc(sb->arena, sb->data, sb->cap, cap);
+  if (!p) return X_RET_NOMEM;
+
+  sb->data = p;
+  sb->cap = cap;
+  return X_RET_OK;
+}
+
+err_t xstrbuf_append_n(xstrbuf* sb, const void* data, size_t n) {
+  if (!sb || (!data && n)) return X_RET_INVAL;
+
+  err_t err = xstrbuf_reserve(sb, n);
+  if (err != X_RET_OK) {
+    sb->truncated = xTRUE;
+    if (sb->cap == 0) return X_RET_FULL;
+    n = sb->cap - sb->len - 1;
+    err = X_RET_FULL;
+  }
+
+  memcpy(sb->data + sb->len, data, n);
+  sb->len += n;
+  sb->data[sb->len] = '\0';
+  return err;
+}
+
+err_t xstrbuf_append(xstrbuf* sb, const char* str) {
+  if (!str) return X_RET_INVAL;
+  return xstrbuf_append_n(sb, str, strlen(str));
+}
+
+err_t xstrbuf_append_char(xstrbuf* sb, char c) {
+  return xstrbuf_append_n(sb, &c, 1);
+}
+
+err_t xstrbuf_format(xstrbuf* sb, const char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  err_t err = xstrbuf_vformat(sb, fmt, ap);
+  va_end(ap);
+
+  return err;
+}
+
+err_t xstrbuf_vformat(xstrbuf* sb, const char* fmt, va_list ap) {
+  if (!sb || !fmt) return X_RET_INVAL;
+  if (sb->cap == 0 && xstrbuf_reserve(sb, X_STRING_DEFAULT_CAP) != X_RET_OK) {
+    sb->truncated = xTRUE;
+    return X_RET_FULL;
+  }
+
+  size_t room = sb->cap - sb->len;
+
+  va_list ap_copy;
+  va_copy(ap_copy, ap);
+  int len = stbsp_vsnprintf(sb->data + sb->len, (int)xMIN(room, (size_t)INT_MAX), fmt, ap_copy);
+  va_end(ap_copy);
+  if (len < 0) return X_RET_INVAL;
+
+  if ((size_t)len < room) {
+    sb->len += (size_t)len;
+    return X_RET_OK;
+  }
+
+  /* did not fit, grow and format again; a fixed buffer keeps what fitted */
+  if (xstrbuf_reserve(sb, (size_t)len) != X_RET_OK) {
+    sb->truncated = xTRUE;
+    sb->len = sb->cap - 1;
+    return X_RET_FULL;
+  }
+
+  stbsp_vsnprintf(sb->data + sb->len, (int)xMIN(sb->cap - sb->len, (size_t)INT_MAX), fmt, ap);
+  sb->len += (size_t)len;
+  return X_RET_OK;
+}
+
+void xstrbuf_clear(xstrbuf* sb) {
+  if (!sb) return;
+
+  sb->len = 0;
+  sb->truncated = xFALSE;
+  if (sb->cap) sb->data[0] = '\0';
+}
+
+xstr_view xstr_view_trim(xstr_view v) { return xstr_view_trim_right(xstr_view_trim_left(v)); }
+
+xstr_view xstr_view_trim_left(xstr_view v) {
+  if (v.len == 0) return v;
+
+  const char* p = xstr_skip_charset(v.p, v.len, XSTR_SPACES);
+  return xstr_view_n(p, v.len - (size_t)(p - v.p));
+}
+
+xstr_view xstr_view_trim_right(xstr_view v) {
+  if (v.len == 0) return v;
+
+  return xstr_view_n(v.p, (size_t)(xstr_rskip_charset(v.p, v.len, XSTR_SPACES) - v.p));
+}
+
+xbool_t xstr_view_next_token(xstr_view* rest, const char* charset, xstr_view* token) {
+  if (!rest || !charset || !token || rest->len == 0) return xFALSE;
+
+  const char* end = rest->p + rest->len;
+  const char* start = xstr_skip_charset(rest->p, rest->len, charset);
+  if (start == end) {
+    *rest = xstr_view_n(end, 0);
+    return xFALSE;
+  }
+
+  const char* stop = xstr_find_charset(start, (size_t)(end - start), charset, xFALSE);
+  if (!stop) stop = end;
+
+  *token = xstr_view_n(start, (size_t)(stop - start));
+  /* the delimiter that ended the token is consumed too */
+  *rest = stop == end ? xstr_view_n(end, 0) : xstr_view_n(stop + 1, (size_t)(end - stop - 1));
+  return xTRUE;
+}
+
+xbool_t xstr_view_cut(xstr_view v, char sep, xstr_view* before, xstr_view* after) {
+  const char* at = v.len ? memchr(v.p, sep, v.len) : NULL;
+
+  if (!at) {
+    if (before) *before = v;
+    if (after) *after = xstr_view_n(v.p ? v.p + v.len : NULL, 0);
+    return xFALSE;
+  }
+
+  if (before) *before = xstr_view_n(v.p, (size_t)(at - v.p));
+  if (after) *after = xstr_view_n(at + 1, v.len - (size_t)(at - v.p) - 1);
+  return xTRUE;
+}
+
+long xstr_view_find(xstr_view v, xstr_view sub) {
+  if (sub.len == 0) return 0;
+  if (sub.len > v.len) return -1;
+
+  const char* at = xstr_find_substr(v.p, v.len, sub.p, sub.len);
+  return at ? (long)(at - v.p) : -1;
+}
+
+static xbool_t same_chars(const char* a, const char* b, size_t len, int flag) {
+  if (flag != X_NOCASE) return memcmp(a, b, len) == 0;
+
+  for (size_t i = 0; i < len; ++i) {
+    if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i])) return xFALSE;
+  }
+  return xTRUE;
+}
+
+xbool_t xstr_view_equal(xstr_view a, xstr_view b, int flag) {
+  return a.len == b.len && (a.len == 0 || same_chars(a.p, b.p, a.len, flag));
+}
+
+int xstr_view_compare(xstr_view a, xstr_view b) {
+  size_t n = xMIN(a.len, b.len);
+  int r = n ? memcmp(a.p, b.p, n) : 0;
+  if (r) return r;
+
+  return a.len < b.len ? -1 : (a.len > b.len ? 1 : 0);
+}
+
+xbool_t xstr_view_has_prefix(xstr_view v, xstr_view prefix, int flag) {
+  return prefix.len <= v.len && (prefix.len == 0 || same_chars(v.p, prefix.p, prefix.len, flag));
+}
+
+xbool_t xstr_view_has_suffix(xstr_view v, xstr_view suffix, int flag) {
+  return suffix.len <= v.len &&
+         (suffix.len == 0 || same_chars(v.p + v.len - suffix.len, suffix.p, suffix.len, flag));
+}
+
+static int digit_value(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'z') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'Z') return c - 'A' + 10;
+  return 36;
+}
+
+err_t xstr_view_to_u64(xstr_view v, int base, uint64_t* out) {
+  if (!out || base < 0 || base == 1 || base > 36) return X_RET_INVAL;
+
+  const char* p = v.p;
+  const char* end = v.p + v.len;
+
+  if (v.len > 0 && *p == '+') p++;
+
+  if (base == 0 || base == 16) {
+    if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+      p += 2;
+      base = 16;
+    } else if (base == 0) {
+      base = (end - p > 1 && p[0] == '0') ? 8 : 10;
+    }
+  }
+
+  if (p == end) return X_RET_BADFMT;
+
+  uint64_t value = 0;
+  for (; p < end; ++p) {
+    int d = digit_value(*p);
+    if (d >= base) return X_RET_BADFMT;
+    if (value > (UINT64_MAX - (uint64_t)d) / (uint64_t)base) return X_RET_OVERFLOW;
+    value = value * (uint64_t)base + (uint64_t)d;
+  }
+
+  *out = value;
+  return X_RET_OK;
+}
+
+err_t xstr_view_to_i64(xstr_view v, int base, int64_t* out) {
+  if (!out) return X_RET_INVAL;
+
+  xbool_t negative = v.len > 0 && v.p[0] == '-';
+  if (negative) v = xstr_view_n(v.p + 1, v.len - 1);
+  if (v.len > 0 && v.p[0] == '+' && negative) return X_RET_BADFMT;
+
+  uint64_t mag;
+  err_t err = xstr_view_to_u64(v, base, &mag);
+  if (err != X_RET_OK) return err;
+
+  if (negative) {
+    if (mag > (uint64_t)INT64_MAX + 1) return X_RET_OVERFLOW;
+    *out = mag == (uint64_t)INT64_MAX + 1 ? INT64_MIN : -(int64_t)mag;
+  } else {
+    if (mag > (uint64_t)INT64_MAX) return X_RET_OVERFLOW;
+    *out = (int64_t)mag;
+  }
+
+  return X_RET_OK;
+}
+
+xstring xstring_init_view(xstr_view v) {
+  xstring s = xstring_init_empty();
+  xstring_cat_view(&s, v);
+  return s;
+}
+
+const char* xstring_cat_view(xstring* s, xstr_view v) {
+  if (!s) return "";
+  if (v.len == 0) return xstring_to_string(s);
+
+  if ((v.len + s->len) >= (size_t)s->cap) {
+    xstring_double_expand_with_minimum(s, s->len + v.len + 1);
+  }
+
+  char* p = s->s ? s->s : s->b;
+  memcpy(p + s->len, v.p, v.len);
+  s->len += (int)v.len;
+  p[s->len] = '\0';
+  return p;
+}
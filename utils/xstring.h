@@ -14,7 +14,9 @@ extern "C" {
 #endif /* __cplusplus */
 
 #include <stdarg.h>
+#include <string.h>
 
+#include "xarena.h"
 #include "xdef.h"
 
 /** @brief Flag for case-sensitive operations. */
@@ -83,6 +85,21 @@ void xstring_init_iter_r(xstring* s, const char* str);
 xstring xstring_init_from_other(const xstring* s);
 void xstring_init_from_other_r(xstring* s1, const xstring* s2);
 
+/**
+ * @brief Initializes an xstring that takes ownership of a heap buffer.
+ *  No copy is made, the buffer is released by xstring_free().
+ * @param buf A NUL-terminated buffer allocated with xbox_malloc().
+ * @param len The length of the string in buf.
+ * @param cap The size of buf in bytes.
+ * @return A new xstring instance owning buf.
+ * @example
+ * char* buf = xbox_malloc(64);
+ * strcpy(buf, "hello");
+ * xstring s = xstring_init_take(buf, 5, 64);
+ * xstring_free(&s); // frees buf
+ */
+xstring xstring_init_take(char* buf, int len, int cap);
+
 /**
  * @brief Initializes an xstring using a printf-style format.
  * @param fmt The format string.
@@ -471,6 +488,261 @@ xstring xstring_itos(int val);
  */
 xstring xstring_dtos(double val);
 
+/**
+ * @brief A string builder appending into storage it does not own.
+ *
+ * The storage is either a caller buffer, which never grows (what does not
+ * fit is cut and the builder marked truncated), or an arena, which it grows
+ * in. Either way nothing is freed: the buffer goes with its scope, the
+ * arena with xarena_reset() or xarena_destroy(). The content is always
+ * NUL-terminated, and may hold NUL bytes of its own.
+ */
+typedef struct {
+  char* data;        /**< The content. */
+  size_t len;        /**< Bytes in `data`, the terminator excluded. */
+  size_t cap;        /**< Size of `data`, the terminator included. */
+  xarena arena;      /**< Where to grow, NULL for a fixed buffer. */
+  xbool_t truncated; /**< Something did not fit a fixed buffer. */
+} xstrbuf;
+
+/**
+ * @brief Initializes a builder over a caller buffer.
+ * @param buf The buffer.
+ * @param cap Its size, at least 1.
+ * @return The builder, empty.
+ * @example
+ * char buf[64];
+ * xstrbuf sb = xstrbuf_init(buf, sizeof(buf));
+ * xstrbuf_format(&sb, " Elapsed: %d (s)", 3);
+ * puts(xstrbuf_str(&sb));
+ */
+xstrbuf xstrbuf_init(char* buf, size_t cap);
+
+/**
+ * @brief Initializes a builder growing in an arena.
+ * @param arena The arena.
+ * @param cap The initial capacity, 0 for X_STRING_DEFAULT_CAP.
+ * @return The builder, empty; truncated if the arena is out of memory.
+ * @example
+ * xstrbuf sb = xstrbuf_init_arena(arena, 0);
+ * xstrbuf_append(&sb, "fw_setenv ");
+ * xstrbuf_append(&sb, name);
+ */
+xstrbuf xstrbuf_init_arena(xarena arena, size_t cap);
+
+/**
+ * @brief Makes room for `n` more bytes.
+ * @param sb The builder.
+ * @param n The bytes about to be appended.
+ * @return X_RET_OK on success, X_RET_FULL if a fixed buffer is too small,
+ *         X_RET_NOMEM if the arena is out of memory.
+ */
+err_t xstrbuf_reserve(xstrbuf* sb, size_t n);
+
+/**
+ * @brief Appends `n` bytes, which may hold NUL bytes.
+ * @param sb The builder.
+ * @param data The bytes.
+ * @param n Number of bytes.
+ * @return X_RET_OK on success, X_RET_FULL if they were cut.
+ */
+err_t xstrbuf_append_n(xstrbuf* sb, const void* data, size_t n);
+
+/**
+ * @brief Appends a C-style string.
+ * @param sb The builder.
+ * @param str The string.
+ * @return X_RET_OK on success, X_RET_FULL if it was cut.
+ */
+err_t xstrbuf_append(xstrbuf* sb, const char* str);
+
+/**
+ * @brief Appends one character.
+ * @param sb The builder.
+ * @param c The character.
+ * @return X_RET_OK on success, X_RET_FULL if it did not fit.
+ */
+err_t xstrbuf_append_char(xstrbuf* sb, char c);
+
+/**
+ * @brief Appends printf-style output, formatted in one pass when it fits.
+ * @param sb The builder.
+ * @param fmt The format string.
+ * @return X_RET_OK on success, X_RET_FULL if it was cut.
+ */
+err_t xstrbuf_format(xstrbuf* sb, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+err_t xstrbuf_vformat(xstrbuf* sb, const char* fmt, va_list ap);
+
+/**
+ * @brief Empties the builder, keeping its storage.
+ * @param sb The builder.
+ */
+void xstrbuf_clear(xstrbuf* sb);
+
+/** @brief Gets the content of a builder, NUL-terminated. */
+static inline const char* xstrbuf_str(const xstrbuf* sb) { return sb->data; }
+/** @brief Gets the length of a builder. */
+static inline size_t xstrbuf_len(const xstrbuf* sb) { return sb->len; }
+/** @brief Whether something was cut off a fixed buffer. */
+static inline xbool_t xstrbuf_truncated(const xstrbuf* sb) { return sb->truncated; }
+
+/**
+ * @brief A read-only window onto characters owned elsewhere.
+ *
+ * A view is a pointer and a length, it is not NUL-terminated and never
+ * owns or allocates anything: it stays valid as long as what it points
+ * into. Print it with XSTR_VIEW_FMT and XSTR_VIEW_ARG().
+ */
+typedef struct {
+  const char* p; /**< First character, may be NULL for an empty view. */
+  size_t len;    /**< Number of characters. */
+} xstr_view;
+
+/** @brief printf() conversion for a view, takes XSTR_VIEW_ARG(v). */
+#define XSTR_VIEW_FMT "%.*s"
+/** @brief printf() arguments for XSTR_VIEW_FMT. */
+#define XSTR_VIEW_ARG(v) (int)(v).len, (v).p
+/** @brief A view of a string literal, without strlen(). */
+#define XSTR_VIEW_LIT(lit) ((xstr_view){(lit), sizeof(lit) - 1})
+
+/** @brief A view of `len` characters at `p`. */
+static inline xstr_view xstr_view_n(const char* p, size_t len) {
+  return (xstr_view){p, p ? len : 0};
+}
+
+/** @brief A view of a C-style string, empty for NULL. */
+static inline xstr_view xstr_view_of(const char* str) {
+  return (xstr_view){str, str ? strlen(str) : 0};
+}
+
+/** @brief A view of the current content of an xstring. */
+static inline xstr_view xstring_view(const xstring* s) {
+  return s ? (xstr_view){xstring_to_string(s), (size_t)s->len} : (xstr_view){NULL, 0};
+}
+
+/** @brief Whether a view holds no characters. */
+static inline xbool_t xstr_view_empty(xstr_view v) { return v.len == 0; }
+
+/**
+ * @brief Drops leading and trailing whitespace.
+ * @param v The view.
+ * @return The narrowed view.
+ * @example
+ * xstr_view v = xstr_view_trim(xstr_view_of("  a b \n")); // "a b"
+ */
+xstr_view xstr_view_trim(xstr_view v);
+/** @brief Drops leading whitespace. */
+xstr_view xstr_view_trim_left(xstr_view v);
+/** @brief Drops trailing whitespace. */
+xstr_view xstr_view_trim_right(xstr_view v);
+
+/**
+ * @brief Takes the next token off the front of a view, like strtok_r().
+ * @details Runs of delimiters are skipped, so tokens are never empty.
+ * @param rest The characters still to split, advanced past the token.
+ * @param charset The delimiter characters.
+ * @param token Receives the token.
+ * @return xTRUE if a token was found, xFALSE once `rest` is exhausted.
+ * @example
+ * xstr_view rest = exec_output_view(r), line;
+ * while (xstr_view_next_token(&rest, "\n", &line))
+ *   printf(XSTR_VIEW_FMT "\n", XSTR_VIEW_ARG(line));
+ */
+xbool_t xstr_view_next_token(xstr_view* rest, const char* charset, xstr_view* token);
+
+/**
+ * @brief Splits a view at the first occurrence of a character.
+ * @param v The view.
+ * @param sep The separator.
+ * @param before Receives what precedes it, or all of `v` if not found. Can be NULL.
+ * @param after Receives what follows it, or an empty view. Can be NULL.
+ * @return xTRUE if the separator was found.
+ * @example
+ * xstr_view name, value;
+ * if (xstr_view_cut(xstr_view_of("rootfs_part=a"), '=', &name, &value)) ...
+ */
+xbool_t xstr_view_cut(xstr_view v, char sep, xstr_view* before, xstr_view* after);
+
+/**
+ * @brief Finds a substring in a view.
+ * @param v The view.
+ * @param sub The substring.
+ * @return The offset of the first occurrence, or -1 if there is none.
+ */
+long xstr_view_find(xstr_view v, xstr_view sub);
+
+/**
+ * @brief Compares two views.
+ * @param a The first view.
+ * @param b The second view.
+ * @param flag `X_CASE` for case-sensitive, `X_NOCASE` for case-insensitive.
+ * @return xTRUE if they hold the same characters.
+ */
+xbool_t xstr_view_equal(xstr_view a, xstr_view b, int flag);
+
+/**
+ * @brief Orders two views like strcmp().
+ * @return < 0, 0 or > 0 as `a` sorts before, equal to or after `b`.
+ */
+int xstr_view_compare(xstr_view a, xstr_view b);
+
+/**
+ * @brief Checks if a view starts with a prefix.
+ * @param v The view.
+ * @param prefix The prefix.
+ * @param flag `X_CASE` for case-sensitive, `X_NOCASE` for case-insensitive.
+ * @return xTRUE if it does.
+ */
+xbool_t xstr_view_has_prefix(xstr_view v, xstr_view prefix, int flag);
+
+/**
+ * @brief Checks if a view ends with a suffix.
+ * @param v The view.
+ * @param suffix The suffix.
+ * @param flag `X_CASE` for case-sensitive, `X_NOCASE` for case-insensitive.
+ * @return xTRUE if it does.
+ */
+xbool_t xstr_view_has_suffix(xstr_view v, xstr_view suffix, int flag);
+
+/**
+ * @brief Parses the whole view as an unsigned integer, like strtoull().
+ * @param v The view, no surrounding whitespace.
+ * @param base 2 to 36, or 0 to accept 0x (hex) and 0 (octal) prefixes.
+ * @param out Receives the value.
+ * @return X_RET_OK on success, X_RET_BADFMT if anything is not a digit,
+ *         X_RET_OVERFLOW if the value does not fit.
+ */
+err_t xstr_view_to_u64(xstr_view v, int base, uint64_t* out);
+
+/**
+ * @brief Parses the whole view as a signed integer, like strtoll().
+ * @param v The view, an optional sign then digits.
+ * @param base 2 to 36, or 0 to accept 0x (hex) and 0 (octal) prefixes.
+ * @param out Receives the value.
+ * @return X_RET_OK on success, X_RET_BADFMT or X_RET_OVERFLOW otherwise.
+ */
+err_t xstr_view_to_i64(xstr_view v, int base, int64_t* out);
+
+/**
+ * @brief Initializes an xstring from a view, the one place a view is copied.
+ * @param v The view.
+ * @return A new xstring holding the characters of v.
+ */
+xstring xstring_init_view(xstr_view v);
+
+/**
+ * @brief Appends a view to an xstring.
+ * @param s The destination xstring.
+ * @param v The view, must not point into `s`.
+ * @return A pointer to the beginning of the modified string data.
+ */
+const char* xstring_cat_view(xstring* s, xstr_view v);
+
+/** @brief Appends a view to a builder, see xstrbuf_append_n(). */
+static inline err_t xstrbuf_append_view(xstrbuf* sb, xstr_view v) {
+  return xstrbuf_append_n(sb, v.p, v.len);
+}
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -0,0 +1,337 @@
+/**
+ * @brief 字符串向量化扫描
+ * @file xstring_simd.c
+ * @author Oswin
+ * @date 2026-02-08
+ * @details Each vector compare is reduced to an integer mask with
+ *          VEC_BITS_PER_BYTE bits per byte: movemask on SSE2, the
+ *          shift-right-narrow trick on NEON, which has no movemask.
+ *
+ * @copyright (c) 2026 Intretech Software Development Department. All Rights Reserved.
+ */
+#include "xstring_simd.h"
+
+#include <string.h>
+
+#if !defined(XSTRING_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#include <emmintrin.h>
+#define XSTR_SIMD "sse2"
+typedef __m128i vec_t;
+#define VEC_BITS_PER_BYTE 1
+#define VEC_FULL 0xffffull
+static inline vec_t vec_load(const char* p) { return _mm_loadu_si128((const __m128i*)p); }
+static inline void vec_store(char* p, vec_t v) { _mm_storeu_si128((__m128i*)p, v); }
+static inline vec_t vec_splat(char c) { return _mm_set1_epi8(c); }
+static inline vec_t vec_eq(vec_t a, vec_t b) { return _mm_cmpeq_epi8(a, b); }
+static inline vec_t vec_or(vec_t a, vec_t b) { return _mm_or_si128(a, b); }
+static inline vec_t vec_and(vec_t a, vec_t b) { return _mm_and_si128(a, b); }
+static inline vec_t vec_xor(vec_t a, vec_t b) { return _mm_xor_si128(a, b); }
+/* no unsigned compare: move `lo` to -128 and compare signed */
+static inline vec_t vec_in_range(vec_t v, char lo, char hi) {
+  vec_t shifted = _mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - (unsigned char)lo)));
+  return _mm_cmplt_epi8(shifted, _mm_set1_epi8((char)(0x80 + (hi - lo) + 1)));
+}
+static inline uint64_t vec_mask(vec_t v) { return (uint64_t)(unsigned)_mm_movemask_epi8(v); }
+#elif !defined(XSTRING_NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+#define XSTR_SIMD "neon"
+typedef uint8x16_t vec_t;
+#define VEC_BITS_PER_BYTE 4
+#define VEC_FULL (~0ull)
+static inline vec_t vec_load(const char* p) { return vld1q_u8((const uint8_t*)p); }
+static inline void vec_store(char* p, vec_t v) { vst1q_u8((uint8_t*)p, v); }
+static inline vec_t vec_splat(char c) { return vdupq_n_u8((uint8_t)c); }
+static inline vec_t vec_eq(vec_t a, vec_t b) { return vceqq_u8(a, b); }
+static inline vec_t vec_or(vec_t a, vec_t b) { return vorrq_u8(a, b); }
+static inline vec_t vec_and(vec_t a, vec_t b) { return vandq_u8(a, b); }
+static inline vec_t vec_xor(vec_t a, vec_t b) { return veorq_u8(a, b); }
+static inline vec_t vec_in_range(vec_t v, char lo, char hi) {
+  return vcleq_u8(vsubq_u8(v, vdupq_n_u8((uint8_t)lo)), vdupq_n_u8((uint8_t)(hi - lo)));
+}
+/* a nibble per byte */
+static inline uint64_t vec_mask(vec_t v) {
+  return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(v), 4)), 0);
+}
+#endif
+
+#define VEC_SIZE 16
+
+/*
+ * Sets of up to VEC_SIZE bytes (duplicates included), the usual case, are
+ * kept as a list the vector loop compares against; the lookup table is only
+ * filled when the bytes are scanned one at a time.
+ */
+struct charset {
+  int n; /* bytes in `chars`, -1 if they do not fit */
+  char chars[VEC_SIZE];
+  xbool_t use_map;
+  uint8_t map[256];
+};
+
+static void charset_init(struct charset* cs, const char* set, xbool_t nocase) {
+  cs->n = 0;
+  for (const unsigned char* p = (const unsigned char*)set; *p && cs->n >= 0; ++p) {
+    xbool_t both = nocase && (*p | 0x20) >= 'a' && (*p | 0x20) <= 'z';
+    if (cs->n + 1 + both > VEC_SIZE) {
+      cs->n = -1;
+      break;
+    }
+    cs->chars[cs->n++] = (char)*p;
+    if (both) cs->chars[cs->n++] = (char)(*p ^ 0x20);
+  }
+
+#ifdef XSTR_SIMD
+  cs->use_map = cs->n < 0;
+#else
+  cs->use_map = xTRUE;
+#endif
+  if (!cs->use_map) return;
+
+  memset(cs->map, 0, sizeof(cs->map));
+  for (const unsigned char* p = (const unsigned char*)set; *p; ++p) {
+    cs->map[*p] = 1;
+    if (nocase && (*p | 0x20) >= 'a' && (*p | 0x20) <= 'z') cs->map[*p ^ 0x20] = 1;
+  }
+}
+
+static inline xbool_t in_set(const struct charset* cs, unsigned char c) {
+  if (cs->use_map) return cs->map[c];
+
+  for (int k = 0; k < cs->n; ++k) {
+    if ((unsigned char)cs->chars[k] == c) return xTRUE;
+  }
+  return xFALSE;
+}
+
+#ifdef XSTR_SIMD
+/*
+ * The set is padded with its first byte to a fixed size, so the compare
+ * loop has a constant trip count and unrolls into registers.
+ */
+#define DEFINE_MATCH_SET(N)                                       \
+  static inline vec_t match_set_##N(vec_t v, const vec_t* sp) {  \
+    vec_t m = vec_eq(v, sp[0]);                                   \
+    for (int k = 1; k < N; ++k) m = vec_or(m, vec_eq(v, sp[k]));  \
+    return m;                                                     \
+  }
+DEFINE_MATCH_SET(4)
+DEFINE_MATCH_SET(8)
+DEFINE_MATCH_SET(16)
+
+static int load_splats(const struct charset* cs, vec_t* splats) {
+  int n = cs->n <= 4 ? 4 : cs->n <= 8 ? 8 : 16;
+  for (int k = 0; k < n; ++k) splats[k] = vec_splat(cs->chars[k < cs->n ? k : 0]);
+  return n;
+}
+
+static inline vec_t match_set(vec_t v, const vec_t* splats, int n) {
+  if (n == 4) return match_set_4(v, splats);
+  if (n == 8) return match_set_8(v, splats);
+  return match_set_16(v, splats);
+}
+
+/*
+ * Returns from scan_set(). A partial last vector is read overlapping the
+ * one before it, with the bytes already seen masked off.
+ */
+#define SCAN_FORWARD(N)                                                              \
+  for (; i + VEC_SIZE <= len; i += VEC_SIZE) {                                       \
+    uint64_t bits = vec_mask(match_set_##N(vec_load(s + i), splats)) ^ flip;         \
+    if (bits) return s + i + __builtin_ctzll(bits) / VEC_BITS_PER_BYTE;              \
+  }                                                                                  \
+  if (i < len) {                                                                     \
+    size_t at = len - VEC_SIZE;                                                      \
+    uint64_t bits = vec_mask(match_set_##N(vec_load(s + at), splats)) ^ flip;        \
+    bits &= VEC_FULL << ((i - at) * VEC_BITS_PER_BYTE);                              \
+    if (bits) return s + at + __builtin_ctzll(bits) / VEC_BITS_PER_BYTE;             \
+  }                                                                                  \
+  return NULL;
+#endif
+
+/* first byte whose membership is `want` */
+static const char* scan_set(const char* s, size_t len, const struct charset* cs, xbool_t want) {
+  size_t i = 0;
+
+#ifdef XSTR_SIMD
+  if (cs->n > 0 && len >= VEC_SIZE) {
+    vec_t splats[VEC_SIZE];
+    uint64_t flip = want ? 0 : VEC_FULL;
+    int n = load_splats(cs, splats);
+    if (n == 4) {
+      SCAN_FORWARD(4)
+    } else if (n == 8) {
+      SCAN_FORWARD(8)
+    } else {
+      SCAN_FORWARD(16)
+    }
+  }
+#endif
+
+  const unsigned char* u = (const unsigned char*)s;
+  if (cs->use_map) {
+    for (; i + 4 <= len; i += 4) {
+      if (cs->map[u[i]] == want) return s + i;
+      if (cs->map[u[i + 1]] == want) return s + i + 1;
+      if (cs->map[u[i + 2]] == want) return s + i + 2;
+      if (cs->map[u[i + 3]] == want) return s + i + 3;
+    }
+  }
+  for (; i < len; ++i) {
+    if (in_set(cs, u[i]) == want) return s + i;
+  }
+
+  return NULL;
+}
+
+const char* xstr_simd_name(void) {
+#ifdef XSTR_SIMD
+  return XSTR_SIMD;
+#else
+  return "scalar";
+#endif
+}
+
+const char* xstr_find_charset(const char* s, size_t len, const char* set, xbool_t nocase) {
+  if (!s || !set || !*set) return NULL;
+
+  struct charset cs;
+  charset_init(&cs, set, nocase);
+  return scan_set(s, len, &cs, xTRUE);
+}
+
+/* isspace() in the "C" locale, the set trimming asks for nearly always */
+static inline xbool_t is_space(unsigned char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+
+/* strcmp(set, XSTR_SPACES) == 0, inlined */
+static inline xbool_t is_spaces(const char* set) {
+  const char* w = XSTR_SPACES;
+  while (*set && *set == *w) set++, w++;
+  return *set == *w;
+}
+
+/*
+ * Spaces are ' ' and the range '\t'..'\r', two compares a vector with no
+ * set to splat first: the generic set setup is what made short trims lose
+ * to the isspace() loop.
+ */
+#ifdef XSTR_SIMD
+static inline uint64_t space_mask(const char* p) {
+  vec_t v = vec_load(p);
+  return vec_mask(vec_or(vec_eq(v, vec_splat(' ')), vec_in_range(v, '\t', '\r')));
+}
+#endif
+
+static const char* skip_spaces(const char* s, size_t len) {
+  size_t i = 0;
+
+#ifdef XSTR_SIMD
+  for (; i + VEC_SIZE <= len; i += VEC_SIZE) {
+    uint64_t bits = ~space_mask(s + i) & VEC_FULL;
+    if (bits) return s + i + __builtin_ctzll(bits) / VEC_BITS_PER_BYTE;
+  }
+#endif
+
+  while (i < len && is_space((unsigned char)s[i])) i++;
+  return s + i;
+}
+
+static const char* rskip_spaces(const char* s, size_t len) {
+#ifdef XSTR_SIMD
+  for (; len >= VEC_SIZE; len -= VEC_SIZE) {
+    uint64_t bits = ~space_mask(s + len - VEC_SIZE) & VEC_FULL;
+    if (bits) return s + len - VEC_SIZE + (63 - __builtin_clzll(bits)) / VEC_BITS_PER_BYTE + 1;
+  }
+#endif
+
+  while (len > 0 && is_space((unsigned char)s[len - 1])) len--;
+  return s + len;
+}
+
+const char* xstr_skip_charset(const char* s, size_t len, const char* set) {
+  if (!s) return NULL;
+  if (!set || !*set) return s;
+
+  if (is_spaces(set)) return skip_spaces(s, len);
+
+  struct charset cs;
+  charset_init(&cs, set, xFALSE);
+  const char* p = scan_set(s, len, &cs, xFALSE);
+  return p ? p : s + len;
+}
+
+const char* xstr_rskip_charset(const char* s, size_t len, const char* set) {
+  if (!s) return NULL;
+  if (!set || !*set) return s + len;
+
+  if (is_spaces(set)) return rskip_spaces(s, len);
+
+  struct charset cs;
+  charset_init(&cs, set, xFALSE);
+  size_t i = len;
+
+#ifdef XSTR_SIMD
+  if (cs.n > 0 && len >= VEC_SIZE) {
+    vec_t splats[VEC_SIZE];
+    int n = load_splats(&cs, splats);
+
+    for (; i >= VEC_SIZE; i -= VEC_SIZE) {
+      uint64_t bits = ~vec_mask(match_set(vec_load(s + i - VEC_SIZE), splats, n)) & VEC_FULL;
+      if (bits) return s + i - VEC_SIZE + (63 - __builtin_clzll(bits)) / VEC_BITS_PER_BYTE + 1;
+    }
+    if (i > 0) {
+      /* the first vector again, only its first `i` bytes are new */
+      uint64_t bits = ~vec_mask(match_set(vec_load(s), splats, n)) & VEC_FULL;
+      bits &= (1ull << (i * VEC_BITS_PER_BYTE)) - 1;
+      return bits ? s + (63 - __builtin_clzll(bits)) / VEC_BITS_PER_BYTE + 1 : s;
+    }
+    return s;
+  }
+#endif
+
+  while (i > 0 && in_set(&cs, (unsigned char)s[i - 1])) i--;
+  return s + i;
+}
+
+const char* xstr_find_substr(const char* s, size_t len, const char* sub, size_t sub_len) {
+  if (!s || !sub) return NULL;
+  if (sub_len == 0) return s;
+  if (sub_len > len) return NULL;
+  if (sub_len == 1) return memchr(s, sub[0], len);
+
+  /* memchr() is vectorized by every libc that matters and beat a vector
+   * first/last byte filter on every length measured (bench/xstring_bench.c) */
+  size_t i = 0;
+  while (i + sub_len <= len) {
+    const char* p = memchr(s + i, sub[0], len - sub_len + 1 - i);
+    if (!p) break;
+    if (!memcmp(p + 1, sub + 1, sub_len - 1)) return p;
+    i = p - s + 1;
+  }
+
+  return NULL;
+}
+
+/* flips the case of the bytes in [lo, hi] */
+static void flip_case(char* s, size_t len, char lo, char hi) {
+  size_t i = 0;
+
+#ifdef XSTR_SIMD
+  vec_t bit = vec_splat(0x20);
+  for (; i + VEC_SIZE <= len; i += VEC_SIZE) {
+    vec_t v = vec_load(s + i);
+    vec_store(s + i, vec_xor(v, vec_and(vec_in_range(v, lo, hi), bit)));
+  }
+#endif
+
+  for (; i < len; ++i) {
+    if (s[i] >= lo && s[i] <= hi) s[i] ^= 0x20;
+  }
+}
+
+void xstr_upper(char* s, size_t len) {
+  if (s) flip_case(s, len, 'a', 'z');
+}
+
+void xstr_lower(char* s, size_t len) {
+  if (s) flip_case(s, len, 'A', 'Z');
+}
@@ -0,0 +1,111 @@
+/**
+ * @brief 字符串向量化扫描
+ * @file xstring_simd.h
+ * @author Oswin
+ * @date 2026-02-08
+ * @details The scanning primitives behind xstring: charset and substring
+ *          search, whitespace skipping and ASCII case conversion over
+ *          explicit lengths. Charset scans and case conversion use SSE2 or
+ *          NEON, whichever the target has, 16 bytes at a time, and plain
+ *          loops otherwise or when built with XSTRING_NO_SIMD. Where libc
+ *          measured faster, substrings through memchr() and charsets on
+ *          terminated strings through strcspn(), it is used instead. Case
+ *          conversion is ASCII only, like the "C" locale the tools run in.
+ *
+ * @copyright (c) 2026 Intretech Software Development Department. All Rights Reserved.
+ */
+#ifndef XLT_XSTRING_SIMD_H_
+#define XLT_XSTRING_SIMD_H_
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <string.h>
+
+#include "xdef.h"
+
+/** @brief The characters isspace() matches in the "C" locale. */
+#define XSTR_SPACES " \t\n\v\f\r"
+
+/**
+ * @brief Gets the name of the implementation in use.
+ * @return "sse2", "neon" or "scalar".
+ */
+const char* xstr_simd_name(void);
+
+/**
+ * @brief Finds the first byte that is in a set.
+ * @param s The bytes.
+ * @param len Number of bytes.
+ * @param set The set, as a C-style string.
+ * @param nocase Match letters of the set in either case.
+ * @return The byte, or NULL if there is none.
+ */
+const char* xstr_find_charset(const char* s, size_t len, const char* set, xbool_t nocase);
+
+/**
+ * @brief xstr_find_charset() for bytes that end in a terminator.
+ * @details strcspn() does the scan: libc vectorizes it with the whole set in
+ *          one compare, which the per-byte-of-set vector loop does not keep
+ *          up with on the short strings xstring mostly holds.
+ * @param s The bytes, `s[len]` must be '\0'.
+ * @param len Number of bytes.
+ * @param set The set, as a C-style string.
+ * @return The byte, or NULL if there is none.
+ */
+static inline const char* xstr_find_charset_z(const char* s, size_t len, const char* set) {
+  if (!s || !set || !*set) return NULL;
+
+  size_t n = strcspn(s, set);
+  if (n >= len) return NULL;
+  /* a NUL of its own before the terminator, strcspn() stops there */
+  if (s[n] == '\0') return xstr_find_charset(s + n, len - n, set, xFALSE);
+  return s + n;
+}
+
+/**
+ * @brief Finds the first byte that is not in a set.
+ * @param s The bytes.
+ * @param len Number of bytes.
+ * @param set The set, as a C-style string.
+ * @return The byte, or `s + len` if all of them are.
+ */
+const char* xstr_skip_charset(const char* s, size_t len, const char* set);
+
+/**
+ * @brief Finds the end of the bytes once a trailing run of a set is dropped.
+ * @param s The bytes.
+ * @param len Number of bytes.
+ * @param set The set, as a C-style string.
+ * @return One past the last byte not in the set, `s` if there is none.
+ */
+const char* xstr_rskip_charset(const char* s, size_t len, const char* set);
+
+/**
+ * @brief Finds the first occurrence of a substring.
+ * @param s The bytes to search.
+ * @param len Number of bytes.
+ * @param sub The substring.
+ * @param sub_len Its length.
+ * @return The occurrence, or NULL if there is none. `s` for an empty `sub`.
+ */
+const char* xstr_find_substr(const char* s, size_t len, const char* sub, size_t sub_len);
+
+/**
+ * @brief Converts ASCII letters to upper case in place.
+ * @param s The bytes.
+ * @param len Number of bytes.
+ */
+void xstr_upper(char* s, size_t len);
+
+/**
+ * @brief Converts ASCII letters to lower case in place.
+ * @param s The bytes.
+ * @param len Number of bytes.
+ */
+void xstr_lower(char* s, size_t len);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* XLT_XSTRING_SIMD_H_ */
@@ -0,0 +1,123 @@
+/**
+ * @brief 动态数组
+ * @file xvec.c
+ * @author Oswin
+ * @date 2026-02-09
+ * @details
+ *
+ * @copyright (c) 2026 Intretech Software Development Department. All Rights Reserved.
+ */
+#include "xvec.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define XVEC_MIN_CAPACITY (8)
+
+xvec xvec_create(size_t elem_size) {
+  xvec self = xbox_malloc(sizeof(struct xvec_priv));
+  if (!self) return NULL;
+
+  if (xvec_init(self, elem_size) != X_RET_OK) {
+    xbox_free(self);
+    return NULL;
+  }
+
+  return self;
+}
+
+err_t xvec_destroy(xvec self) {
+  if (!self) return X_RET_OK;
+
+  xvec_deinit(self);
+  xbox_free(self);
+  return X_RET_OK;
+}
+
+err_t xvec_init(struct xvec_priv* self, size_t elem_size) {
+  if (!self || elem_size == 0) return X_RET_INVAL;
+
+  self->data_ = NULL;
+  self->length_ = 0;
+  self->capacity_ = 0;
+  self->elem_size_ = elem_size;
+  return X_RET_OK;
+}
+
+void xvec_deinit(struct xvec_priv* self) {
+  if (!self) return;
+
+  xbox_free(self->data_);
+  self->data_ = NULL;
+  self->length_ = 0;
+  self->capacity_ = 0;
+}
+
+err_t xvec_reserve(xvec self, size_t n) {
+  if (!self) return X_RET_INVAL;
+  if (n <= self->capacity_) return X_RET_OK;
+  if (n > SIZE_MAX / self->elem_size_) return X_RET_NOMEM;
+
+  char* data = xbox_realloc(self->data_, n * self->elem_size_);
+  if (!data) return X_RET_NOMEM;
+
+  self->data_ = data;
+  self->capacity_ = n;
+  return X_RET_OK;
+}
+
+err_t xvec_push_back(xvec self, const void* elem) {
+  if (!self || !elem) return X_RET_INVAL;
+
+  if (self->length_ == self->capacity_) {
+    size_t cap = self->capacity_ ? self->capacity_ * 2 : XVEC_MIN_CAPACITY;
+    if (cap < self->capacity_) return X_RET_NOMEM;
+
+    err_t err = xvec_reserve(self, cap);
+    if (err != X_RET_OK) return err;
+  }
+
+  memcpy(self->data_ + self->length_ * self->elem_size_, elem, self->elem_size_);
+  self->length_++;
+  return X_RET_OK;
+}
+
+err_t xvec_pop_back(xvec self, void* out) {
+  if (!self) return X_RET_INVAL;
+  if (self->length_ == 0) return X_RET_EMPTY;
+
+  self->length_--;
+  if (out) memcpy(out, self->data_ + self->length_ * self->elem_size_, self->elem_size_);
+  return X_RET_OK;
+}
+
+err_t xvec_remove_at(xvec self, size_t index) {
+  if (!self || index >= self->length_) return X_RET_INVAL;
+
+  char* at = self->data_ + index * self->elem_size_;
+  memmove(at, at + self->elem_size_, (self->length_ - index - 1) * self->elem_size_);
+  self->length_--;
+  return X_RET_OK;
+}
+
+err_t xvec_swap_remove(xvec self, size_t index) {
+  if (!self || index >= self->length_) return X_RET_INVAL;
+
+  self->length_--;
+  if (index != self->length_)
+    memcpy(self->data_ + index * self->elem_size_,
+           self->data_ + self->length_ * self->elem_size_,
+           self->elem_size_);
+  return X_RET_OK;
+}
+
+void xvec_clear(xvec self) {
+  if (self) self->length_ = 0;
+}
+
+err_t xvec_sort(xvec self, int (*cmp)(const void*, const void*)) {
+  if (!self || !cmp) return X_RET_INVAL;
+
+  if (self->length_ > 1) qsort(self->data_, self->length_, self->elem_size_, cmp);
+  return X_RET_OK;
+}
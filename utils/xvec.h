@@ -0,0 +1,160 @@
+/**
+ * @brief 动态数组
+ * @file xvec.h
+ * @author Oswin
+ * @date 2026-02-09
+ * @details A growable array of fixed-size elements kept in one contiguous
+ *          buffer. Unlike xlist there is no allocation per element and
+ *          indexing is O(1); elements are copied in and out by value, so
+ *          pointers returned by xvec_at() move when the vector grows.
+ *
+ *          e.g.
+ *          xvec v = xvec_create(sizeof(int));
+ *          for (int i = 0; i < 10; ++i) xvec_push_back(v, &i);
+ *          int* p;
+ *          xvec_foreach(v, p) printf("%d\n", *p);
+ *          xvec_destroy(v);
+ *
+ * @copyright (c) 2026 Intretech Software Development Department. All Rights Reserved.
+ */
+#ifndef XTOOL_XVEC__H_
+#define XTOOL_XVEC__H_
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "xdef.h"
+
+/** @struct xvec_priv
+ *  @brief The representation of a vector, can be embedded with xvec_init().
+ */
+struct xvec_priv {
+  char* data_;        /**< The elements, back to back. */
+  size_t length_;     /**< Number of elements. */
+  size_t capacity_;   /**< Elements `data_` has room for. */
+  size_t elem_size_;  /**< Size of one element. */
+};
+
+/** @brief Handle to a vector. */
+typedef struct xvec_priv* xvec;
+
+/**
+ * @brief Creates an empty vector.
+ * @param elem_size Size of one element, e.g. sizeof(void*) for pointers.
+ * @return The vector, or NULL on failure.
+ */
+xvec xvec_create(size_t elem_size);
+
+/**
+ * @brief Frees a vector and its storage; the elements are not looked at.
+ * @param self The vector, can be NULL.
+ * @return X_RET_OK.
+ */
+err_t xvec_destroy(xvec self);
+
+/**
+ * @brief Initializes a vector embedded in another structure.
+ * @param self The vector.
+ * @param elem_size Size of one element.
+ * @return X_RET_OK on success, X_RET_INVAL if `self` is NULL or `elem_size` 0.
+ */
+err_t xvec_init(struct xvec_priv* self, size_t elem_size);
+
+/**
+ * @brief Frees the storage of a vector set up with xvec_init().
+ * @param self The vector, left empty and usable.
+ */
+void xvec_deinit(struct xvec_priv* self);
+
+/**
+ * @brief Makes room for at least `n` elements without further allocation.
+ * @param self The vector.
+ * @param n The number of elements.
+ * @return X_RET_OK on success, X_RET_NOMEM otherwise.
+ */
+err_t xvec_reserve(xvec self, size_t n);
+
+/**
+ * @brief Appends a copy of an element, amortized O(1).
+ * @param self The vector.
+ * @param elem Points to `elem_size` bytes to copy.
+ * @return X_RET_OK on success, X_RET_INVAL or X_RET_NOMEM otherwise.
+ */
+err_t xvec_push_back(xvec self, const void* elem);
+
+/**
+ * @brief Removes the last element.
+ * @param self The vector.
+ * @param out Receives a copy of the element, can be NULL.
+ * @return X_RET_OK on success, X_RET_EMPTY if there is none.
+ */
+err_t xvec_pop_back(xvec self, void* out);
+
+/**
+ * @brief Removes an element keeping the order of the others, O(n).
+ * @param self The vector.
+ * @param index The element.
+ * @return X_RET_OK on success, X_RET_INVAL if out of bounds.
+ */
+err_t xvec_remove_at(xvec self, size_t index);
+
+/**
+ * @brief Removes an element by moving the last one into its place, O(1).
+ * @param self The vector.
+ * @param index The element.
+ * @return X_RET_OK on success, X_RET_INVAL if out of bounds.
+ */
+err_t xvec_swap_remove(xvec self, size_t index);
+
+/**
+ * @brief Drops all elements, the storage is kept.
+ * @param self The vector.
+ */
+void xvec_clear(xvec self);
+
+/**
+ * @brief Sorts the elements with qsort(3).
+ * @param self The vector.
+ * @param cmp Compares two elements, given pointers to them.
+ * @return X_RET_OK on success.
+ */
+err_t xvec_sort(xvec self, int (*cmp)(const void*, const void*));
+
+/**
+ * @brief Points at an element, valid until the vector next grows.
+ * @param self The vector.
+ * @param index The element.
+ * @return The element, or NULL if out of bounds.
+ */
+static inline void* xvec_at(xvec self, size_t index) {
+  return self && index < self->length_ ? self->data_ + index * self->elem_size_ : NULL;
+}
+
+/** @brief Number of elements, 0 for NULL. */
+static inline size_t xvec_length(xvec self) { return self ? self->length_ : 0; }
+
+/** @brief The elements as one array, NULL while empty. */
+static inline void* xvec_data(xvec self) { return self && self->length_ ? self->data_ : NULL; }
+
+/**
+ * @brief Iterates over the elements, front to back.
+ * @details `__p` is a pointer to the element type. Elements must not be
+ *          added or removed inside the loop.
+ *
+ * @par Usage Example:
+ * @code
+ *   xoption_candidate* c;
+ *   xvec_foreach(candidates, c) puts((*c)->ln);
+ * @endcode
+ */
+#define xvec_foreach(___v, ___p)                                                     \
+  for (size_t ___i = 0;                                                              \
+       ___i < (___v)->length_                                                        \
+           ? (*(void**)&(___p) = (___v)->data_ + ___i * (___v)->elem_size_, 1)       \
+           : 0;                                                                      \
+       ++___i)
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* XTOOL_XVEC__H_ */
@@ -0,0 +1,25 @@
+// Do not edit this file directly. It is generated from version.h.in by CMake.
+#ifndef IOTA_VERSION_H_
+#define IOTA_VERSION_H_
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define VERSION_MAJOR 0
+#define VERSION_MINOR 1
+#define VERSION_PATCH 50
+
+#define GIT_BRANCH       "master"
+#define GIT_COMMIT_HASH  "f23dcdff5b055da0678f3ad425682feb47ba837c"
+#define GIT_COMMIT_SHORT "f23dcdf"
+#define GIT_COMMIT_DATE  "2026-10-17 16:01:41 +0000"
+#define GIT_DESCRIBE     "f23dcdf-dirty"
+#define GIT_COMMIT_COUNT "50"
+
+#define BUILD_TIME       "2026-10-17 16:01:57"
+#define BUILD_TYPE       ""
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* IOTA_VERSION_H_ */